@@ -2,6 +2,7 @@
 
 #include <sys/queue.h>
 
+#include "changeset.h"
 #include "resource.h"
 #include "str.h"
 #include "thread_var.h"
@@ -11,16 +12,22 @@
 enum defer_node_type {
 	DNT_SEPARATOR,
 	DNT_CERT,
+	DNT_GROUP,
 };
 
+struct defer_group;
+
 struct defer_node {
 	enum defer_node_type type;
 
 	/**
 	 * This field is only relevant if @type == PCT_CERT.
 	 * Do not dereference members otherwise.
+	 * (If @type == DNT_GROUP, only @deferred.retry_at is set.)
 	 */
 	struct deferred_cert deferred;
+	/** Only relevant if @type == DNT_GROUP. */
+	struct defer_group *group;
 
 	/** Used by certstack. Points to the next stacked certificate. */
 	SLIST_ENTRY(defer_node) next;
@@ -28,6 +35,18 @@ struct defer_node {
 
 SLIST_HEAD(defer_stack, defer_node);
 
+/*
+ * The postponed children of a CA, set aside (along with the CA's entries of the
+ * x509 stack) so the validation can continue with the siblings of the CA. See
+ * park().
+ */
+struct defer_group {
+	X509 *x509;
+	struct metadata_node *meta;
+	/* The children, in their original order; no separator */
+	struct defer_stack defers;
+};
+
 struct serial_number {
 	BIGNUM *number;
 	char *file; /* File where this serial number was found. */
@@ -55,6 +74,11 @@ struct metadata_node {
 	 */
 	struct serial_numbers serials;
 	struct subjects subjects;
+	/*
+	 * Version of the latest change of this certificate or any of its
+	 * ancestors. (See changeset.h.)
+	 */
+	unsigned long version;
 
 	/** Used by certstack. Points to the next stacked certificate. */
 	SLIST_ENTRY(metadata_node) next;
@@ -121,9 +145,13 @@ certstack_create(struct cert_stack **result)
 	return 0;
 }
 
+static void meta_destroy(struct metadata_node *);
+
 static void
 defer_destroy(struct defer_node *defer)
 {
+	struct defer_node *child;
+
 	switch (defer->type) {
 	case DNT_SEPARATOR:
 		break;
@@ -131,6 +159,16 @@ defer_destroy(struct defer_node *defer)
 		uri_refput(defer->deferred.uri);
 		rpp_refput(defer->deferred.pp);
 		break;
+	case DNT_GROUP:
+		while (!SLIST_EMPTY(&defer->group->defers)) {
+			child = SLIST_FIRST(&defer->group->defers);
+			SLIST_REMOVE_HEAD(&defer->group->defers, next);
+			defer_destroy(child);
+		}
+		X509_free(defer->group->x509);
+		meta_destroy(defer->group->meta);
+		free(defer->group);
+		break;
 	}
 
 	free(defer);
@@ -208,6 +246,57 @@ deferstack_push(struct cert_stack *stack, struct deferred_cert *deferred)
 	return 0;
 }
 
+/*
+ * Inserts @node after the siblings that can be retried sooner (or at the same
+ * time), but before the separator of their parent.
+ */
+static void
+insert_sorted(struct cert_stack *stack, struct defer_node *node)
+{
+	struct defer_node *cursor;
+	struct defer_node *prev;
+
+	prev = NULL;
+	SLIST_FOREACH(cursor, &stack->defers, next) {
+		if (cursor->type == DNT_SEPARATOR)
+			break;
+		if (cursor->deferred.retry_at > node->deferred.retry_at)
+			break;
+		prev = cursor;
+	}
+
+	if (prev == NULL)
+		SLIST_INSERT_HEAD(&stack->defers, node, next);
+	else
+		SLIST_INSERT_AFTER(prev, node, next);
+}
+
+/*
+ * Same as deferstack_push(), except the certificate is queued after its
+ * remaining siblings (and the postponed siblings that can be retried sooner),
+ * so they are traversed while its repository recovers.
+ *
+ * If its siblings run out before it can be retried, deferstack_pop() sets it
+ * aside (along with its parents) in favor of whatever else is ready.
+ */
+int
+deferstack_postpone(struct cert_stack *stack, struct deferred_cert *deferred)
+{
+	struct defer_node *node;
+
+	node = malloc(sizeof(struct defer_node));
+	if (node == NULL)
+		return pr_enomem();
+
+	node->type = DNT_CERT;
+	node->deferred = *deferred;
+	uri_refget(deferred->uri);
+	rpp_refget(deferred->pp);
+
+	insert_sorted(stack, node);
+	return 0;
+}
+
 static void
 x509stack_pop(struct cert_stack *stack)
 {
@@ -226,8 +315,126 @@ x509stack_pop(struct cert_stack *stack)
 	meta_destroy(meta);
 }
 
+/*
+ * Is there anything, past the siblings of @head (which aren't ready either),
+ * that can be traversed before @head?
+ */
+static bool
+has_earlier_work(struct defer_node *head)
+{
+	struct defer_node *cursor;
+	bool siblings;
+
+	siblings = true;
+	for (cursor = head; cursor != NULL; cursor = SLIST_NEXT(cursor, next)) {
+		if (cursor->type == DNT_SEPARATOR)
+			siblings = false;
+		else if (!siblings &&
+		    cursor->deferred.retry_at < head->deferred.retry_at)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Sets the first group of siblings (which are all waiting for their
+ * repositories) aside, along with their parent, and queues them as a single
+ * node among the parent's siblings. This way, the parent's siblings can be
+ * traversed while the repositories recover.
+ *
+ * Returns false if there's no memory; the caller will just have to wait.
+ */
+static bool
+park(struct cert_stack *stack)
+{
+	struct defer_node *node;
+	struct defer_node *first;
+	struct defer_node *last;
+	struct defer_node *separator;
+	struct metadata_node *meta;
+
+	node = malloc(sizeof(struct defer_node));
+	if (node == NULL)
+		return false;
+	node->group = malloc(sizeof(struct defer_group));
+	if (node->group == NULL) {
+		free(node);
+		return false;
+	}
+
+	first = SLIST_FIRST(&stack->defers);
+	node->type = DNT_GROUP;
+	node->deferred.uri = NULL;
+	node->deferred.pp = NULL;
+	/* The siblings are sorted, so this is the earliest */
+	node->deferred.retry_at = first->deferred.retry_at;
+
+	/* Move the siblings, in order */
+	SLIST_INIT(&node->group->defers);
+	last = NULL;
+	while ((first = SLIST_FIRST(&stack->defers))->type != DNT_SEPARATOR) {
+		SLIST_REMOVE_HEAD(&stack->defers, next);
+		if (last == NULL)
+			SLIST_INSERT_HEAD(&node->group->defers, first, next);
+		else
+			SLIST_INSERT_AFTER(last, first, next);
+		last = first;
+	}
+
+	/* Take their parent off the stacks, without releasing it */
+	separator = first;
+	SLIST_REMOVE_HEAD(&stack->defers, next);
+	defer_destroy(separator);
+	node->group->x509 = sk_X509_pop(stack->x509s);
+	meta = SLIST_FIRST(&stack->metas);
+	SLIST_REMOVE_HEAD(&stack->metas, next);
+	node->group->meta = meta;
+
+	insert_sorted(stack, node);
+	return true;
+}
+
+/* Reverts park(): puts the parent back on the stacks, and its children next. */
+static void
+unpark(struct cert_stack *stack, struct defer_node *node)
+{
+	struct defer_group *group = node->group;
+	struct defer_node *child;
+	struct defer_node *last;
+
+	SLIST_REMOVE_HEAD(&stack->defers, next);
+
+	/* Can't fail; the stack doesn't shrink after a pop */
+	if (sk_X509_push(stack->x509s, group->x509) <= 0)
+		pr_crit("Could not restore a parked certificate.");
+	SLIST_INSERT_HEAD(&stack->metas, group->meta, next);
+
+	/* The node is recycled as the separator */
+	node->type = DNT_SEPARATOR;
+	node->group = NULL;
+	SLIST_INSERT_HEAD(&stack->defers, node, next);
+
+	last = NULL;
+	while (!SLIST_EMPTY(&group->defers)) {
+		child = SLIST_FIRST(&group->defers);
+		SLIST_REMOVE_HEAD(&group->defers, next);
+		if (last == NULL)
+			SLIST_INSERT_HEAD(&stack->defers, child, next);
+		else
+			SLIST_INSERT_AFTER(last, child, next);
+		last = child;
+	}
+
+	free(group);
+}
+
 /**
  * Contract: Returns either 0 or -ENOENT. No other outcomes.
+ *
+ * The result might be a postponed certificate that can't be retried yet
+ * (@result->retry_at is in the future), but only if there's nothing that can be
+ * traversed sooner.
  */
 int
 deferstack_pop(struct cert_stack *stack, struct deferred_cert *result)
@@ -246,6 +453,15 @@ again:	node = SLIST_FIRST(&stack->defers);
 		goto again;
 	}
 
+	if (node->deferred.retry_at > time(NULL) && has_earlier_work(node) &&
+	    park(stack))
+		goto again;
+
+	if (node->type == DNT_GROUP) {
+		unpark(stack, node);
+		goto again;
+	}
+
 	*result = node->deferred;
 	uri_refget(node->deferred.uri);
 	rpp_refget(node->deferred.pp);
@@ -267,6 +483,7 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
     enum rpki_policy policy, enum cert_type type)
 {
 	struct metadata_node *meta;
+	struct metadata_node *parent;
 	struct defer_node *defer_separator;
 	int ok;
 	int error;
@@ -280,6 +497,11 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 	serial_numbers_init(&meta->serials);
 	subjects_init(&meta->subjects);
 
+	meta->version = changeset_get_file(uri_get_global(uri));
+	parent = SLIST_FIRST(&stack->metas);
+	if (parent != NULL && parent->version > meta->version)
+		meta->version = parent->version;
+
 	meta->resources = resources_create(false);
 	if (meta->resources == NULL) {
 		error = pr_enomem();
@@ -371,6 +593,13 @@ x509stack_peek_resources(struct cert_stack *stack)
 	return (meta != NULL) ? meta->resources : NULL;
 }
 
+unsigned long
+x509stack_peek_version(struct cert_stack *stack)
+{
+	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
+	return (meta != NULL) ? meta->version : 0;
+}
+
 static int
 get_current_file_name(char **_result)
 {
@@ -1,6 +1,7 @@
 #ifndef SRC_CERT_STACK_H_
 #define SRC_CERT_STACK_H_
 
+#include <time.h>
 #include <openssl/x509.h>
 #include "resource.h"
 #include "uri.h"
@@ -32,12 +33,18 @@ struct cert_stack;
 struct deferred_cert {
 	struct rpki_uri *uri;
 	struct rpp *pp;
+	/*
+	 * If nonzero, the certificate's repository couldn't be fetched, and
+	 * it shouldn't be traversed again before this moment.
+	 */
+	time_t retry_at;
 };
 
 int certstack_create(struct cert_stack **);
 void certstack_destroy(struct cert_stack *);
 
 int deferstack_push(struct cert_stack *, struct deferred_cert *cert);
+int deferstack_postpone(struct cert_stack *, struct deferred_cert *cert);
 int deferstack_pop(struct cert_stack *, struct deferred_cert *cert);
 bool deferstack_is_empty(struct cert_stack *);
 
@@ -47,6 +54,7 @@ void x509stack_cancel(struct cert_stack *);
 X509 *x509stack_peek(struct cert_stack *);
 struct rpki_uri *x509stack_peek_uri(struct cert_stack *);
 struct resources *x509stack_peek_resources(struct cert_stack *);
+unsigned long x509stack_peek_version(struct cert_stack *);
 int x509stack_store_serial(struct cert_stack *, BIGNUM *);
 typedef int (*subject_pk_check_cb)(bool *, char const *, void *);
 int x509stack_store_subject(struct cert_stack *, struct rfc5280_name *,
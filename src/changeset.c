@@ -0,0 +1,258 @@
+#include "changeset.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "data_structure/uthash_nonfatal.h"
+
+struct change {
+	/* Global URI of the file or directory (without trailing slash) */
+	char *path;
+	/* Version of its latest change */
+	unsigned long version;
+	UT_hash_handle hh;
+};
+
+/* Changed directories and certificates */
+static struct change *paths;
+/* Directories whose whole content might have changed */
+static struct change *trees;
+/* Version of the latest change */
+static unsigned long version;
+
+/** Read/write lock, which protects all of the above. */
+static pthread_rwlock_t lock;
+
+int
+changeset_init(void)
+{
+	int error;
+
+	error = pthread_rwlock_init(&lock, NULL);
+	if (error)
+		return pr_errno(error, "Changeset pthread_rwlock_init() errored");
+
+	paths = NULL;
+	trees = NULL;
+	version = 0;
+	return 0;
+}
+
+static void
+destroy_table(struct change **table)
+{
+	struct change *change, *tmp;
+
+	HASH_ITER(hh, *table, change, tmp) {
+		HASH_DEL(*table, change);
+		free(change->path);
+		free(change);
+	}
+}
+
+void
+changeset_destroy(void)
+{
+	destroy_table(&paths);
+	destroy_table(&trees);
+	pthread_rwlock_destroy(&lock);
+}
+
+unsigned long
+changeset_get_version(void)
+{
+	unsigned long result;
+
+	rwlock_read_lock(&lock);
+	result = version;
+	rwlock_unlock(&lock);
+
+	return result;
+}
+
+static size_t
+strip_slash(char const *path, size_t len)
+{
+	while (len > 0 && path[len - 1] == '/')
+		len--;
+	return len;
+}
+
+/* Call while holding the write lock */
+static int
+set_version(struct change **table, char const *path, size_t len,
+    unsigned long value)
+{
+	struct change *change;
+
+	HASH_FIND(hh, *table, path, len, change);
+	if (change != NULL) {
+		change->version = value;
+		return 0;
+	}
+
+	change = malloc(sizeof(struct change));
+	if (change == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(change, 0, sizeof(struct change));
+
+	change->path = malloc(len + 1);
+	if (change->path == NULL) {
+		free(change);
+		return pr_enomem();
+	}
+	memcpy(change->path, path, len);
+	change->path[len] = '\0';
+	change->version = value;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, *table, change->path, len, change);
+	if (errno) {
+		free(change->path);
+		free(change);
+		return -pr_errno(errno, "Change couldn't be added to hash table");
+	}
+
+	return 0;
+}
+
+static int
+add(struct change **table, char const *path, size_t len)
+{
+	int error;
+
+	len = strip_slash(path, len);
+
+	rwlock_write_lock(&lock);
+	error = set_version(table, path, len, ++version);
+	rwlock_unlock(&lock);
+
+	return error;
+}
+
+/*
+ * Records that the file @uri (global) was added, modified or removed. Its
+ * directory is marked as changed as well.
+ */
+int
+changeset_add_file(char const *uri)
+{
+	char const *slash;
+	size_t len;
+	int error;
+
+	if (!config_get_incremental_validation())
+		return 0;
+
+	slash = strrchr(uri, '/');
+	if (slash == NULL)
+		return pr_err("'%s' lacks a directory.", uri);
+	len = strlen(uri);
+
+	rwlock_write_lock(&lock);
+	version++;
+	error = set_version(&paths, uri, slash - uri, version);
+	if (!error && len > 4 && strcmp(uri + len - 4, ".cer") == 0)
+		error = set_version(&paths, uri, len, version);
+	rwlock_unlock(&lock);
+
+	return error;
+}
+
+/* Records that some file of the directory @uri (global) changed. */
+int
+changeset_add_dir(char const *uri, size_t len)
+{
+	if (!config_get_incremental_validation())
+		return 0;
+	return add(&paths, uri, len);
+}
+
+/* Records that anything below the directory @uri (global) might've changed. */
+int
+changeset_add_tree(char const *uri, size_t len)
+{
+	if (!config_get_incremental_validation())
+		return 0;
+	return add(&trees, uri, len);
+}
+
+/* Call while holding the lock */
+static unsigned long
+find(struct change *table, char const *path, size_t len)
+{
+	struct change *change;
+
+	HASH_FIND(hh, table, path, len, change);
+	return (change != NULL) ? change->version : 0;
+}
+
+/*
+ * Returns the version of the latest change of @path, considering the trees
+ * that contain it. Call while holding the lock.
+ */
+static unsigned long
+get_version(char const *path, size_t len)
+{
+	unsigned long result;
+	unsigned long tree;
+	size_t i;
+
+	result = find(paths, path, len);
+
+	for (i = 1; i <= len; i++) {
+		if (i != len && path[i] != '/')
+			continue;
+		tree = find(trees, path, i);
+		if (tree > result)
+			result = tree;
+	}
+
+	return result;
+}
+
+/*
+ * Returns the version of the latest change of certificate @uri (global), or
+ * zero if it never changed.
+ */
+unsigned long
+changeset_get_file(char const *uri)
+{
+	unsigned long result;
+
+	if (!config_get_incremental_validation())
+		return 0;
+
+	rwlock_read_lock(&lock);
+	result = get_version(uri, strlen(uri));
+	rwlock_unlock(&lock);
+
+	return result;
+}
+
+/*
+ * Returns the version of the latest change of any of the files in directory
+ * @uri (global), or zero if none of them ever changed.
+ */
+unsigned long
+changeset_get_dir(char const *uri, size_t len)
+{
+	unsigned long result;
+
+	if (!config_get_incremental_validation())
+		return 0;
+
+	len = strip_slash(uri, len);
+
+	rwlock_read_lock(&lock);
+	result = get_version(uri, len);
+	rwlock_unlock(&lock);
+
+	return result;
+}
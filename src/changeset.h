@@ -0,0 +1,33 @@
+#ifndef SRC_CHANGESET_H_
+#define SRC_CHANGESET_H_
+
+#include <stddef.h>
+
+/*
+ * Record of the repository files the fetchers (RRDP and rsync) changed, shared
+ * by all the TAL threads and kept across validation cycles.
+ *
+ * Every change gets a version number, taken from a counter that only grows.
+ * Someone who read a file after sampling changeset_get_version() can tell
+ * whether the file changed since by comparing its version with the sample.
+ *
+ * Changes are tracked per directory (one per RPP), except certificates, which
+ * are also tracked individually. A "tree" change means anything below a path
+ * might have changed (ie. rsync ran, but its output couldn't tell what).
+ *
+ * Nothing is recorded unless "incremental-validation" is enabled.
+ */
+
+int changeset_init(void);
+void changeset_destroy(void);
+
+unsigned long changeset_get_version(void);
+
+int changeset_add_file(char const *);
+int changeset_add_dir(char const *, size_t);
+int changeset_add_tree(char const *, size_t);
+
+unsigned long changeset_get_file(char const *);
+unsigned long changeset_get_dir(char const *, size_t);
+
+#endif /* SRC_CHANGESET_H_ */
@@ -10,13 +10,34 @@ struct hashable_client {
 	UT_hash_handle hh;
 };
 
+/* Number of clients that are at a given serial */
+struct serial_count {
+	serial_t serial;
+	unsigned int count;
+	UT_hash_handle hh;
+};
+
 /** Hash table of clients */
 static struct clients_table {
 	struct hashable_client *clients;
+	/* Serials the clients are at; the key is the serial */
+	struct serial_count *serials;
+	/* The smallest of @serials, or NULL if there are none */
+	struct serial_count *min;
 } db;
 
-/** Read/write lock, which protects @table and its inhabitants. */
+/**
+ * Read/write lock, which protects @db.clients and its inhabitants, except for
+ * their serials.
+ */
 static pthread_rwlock_t lock;
+/**
+ * Mutex, which protects @db.serials, @db.min and the serials of the clients.
+ *
+ * Updating a serial only needs the read lock and this. (Always lock in that
+ * order.)
+ */
+static pthread_mutex_t serials_lock;
 
 int
 clients_db_init(void)
@@ -24,15 +45,81 @@ clients_db_init(void)
 	int error;
 
 	db.clients = NULL;
+	db.serials = NULL;
+	db.min = NULL;
 
 	error = pthread_rwlock_init(&lock, NULL);
 	if (error)
 		return pr_errno(error, "pthread_rwlock_init() errored");
+	error = pthread_mutex_init(&serials_lock, NULL);
+	if (error) {
+		pthread_rwlock_destroy(&lock);
+		return pr_errno(error, "pthread_mutex_init() errored");
+	}
+	return 0;
+}
+
+/* Counts one more client at @serial. Call while holding @serials_lock. */
+static int
+serial_ref(serial_t serial)
+{
+	struct serial_count *node;
+
+	HASH_FIND(hh, db.serials, &serial, sizeof(serial), node);
+	if (node != NULL) {
+		node->count++;
+		return 0;
+	}
+
+	node = malloc(sizeof(struct serial_count));
+	if (node == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(node, 0, sizeof(struct serial_count));
+	node->serial = serial;
+	node->count = 1;
+
+	errno = 0;
+	HASH_ADD(hh, db.serials, serial, sizeof(node->serial), node);
+	if (errno) {
+		free(node);
+		return -pr_errno(errno, "Serial couldn't be added to hash table");
+	}
+
+	if (db.min == NULL || serial < db.min->serial)
+		db.min = node;
 	return 0;
 }
 
+/*
+ * Counts one less client at @serial. Call while holding @serials_lock.
+ *
+ * The minimum only needs to be looked for again when its last client moves on.
+ * There are seldom more than a few different serials, since routers converge
+ * on the latest ones.
+ */
+static void
+serial_unref(serial_t serial)
+{
+	struct serial_count *node, *cursor, *tmp;
+
+	HASH_FIND(hh, db.serials, &serial, sizeof(serial), node);
+	if (node == NULL || --node->count > 0)
+		return;
+
+	HASH_DEL(db.serials, node);
+	if (db.min == node) {
+		db.min = NULL;
+		HASH_ITER(hh, db.serials, cursor, tmp)
+			if (db.min == NULL || cursor->serial < db.min->serial)
+				db.min = cursor;
+	}
+	free(node);
+}
+
 static struct hashable_client *
-create_client(int fd, struct sockaddr_storage addr, pthread_t tid)
+create_client(int fd, struct sockaddr_storage addr, pthread_t tid,
+    int notify_fd)
 {
 	struct hashable_client *client;
 
@@ -47,20 +134,22 @@ create_client(int fd, struct sockaddr_storage addr, pthread_t tid)
 	client->meat.rtr_version_set = false;
 	client->meat.addr = addr;
 	client->meat.tid = tid;
+	client->meat.notify_fd = notify_fd;
 
 	return client;
 }
 
 /*
  * If the client whose file descriptor is @fd isn't already stored, store it.
+ * @notify_fd is the write end of its Serial Notify pipe, or -1.
  */
 int
-clients_add(int fd, struct sockaddr_storage addr, pthread_t tid)
+clients_add(int fd, struct sockaddr_storage addr, pthread_t tid, int notify_fd)
 {
 	struct hashable_client *new_client;
 	struct hashable_client *old_client;
 
-	new_client = create_client(fd, addr, tid);
+	new_client = create_client(fd, addr, tid, notify_fd);
 	if (new_client == NULL)
 		return pr_enomem();
 
@@ -74,8 +163,13 @@ clients_add(int fd, struct sockaddr_storage addr, pthread_t tid)
 		free(new_client);
 		return -pr_errno(errno, "Client couldn't be stored");
 	}
-	if (old_client != NULL)
+	if (old_client != NULL) {
+		pthread_mutex_lock(&serials_lock);
+		if (old_client->meat.serial_number_set)
+			serial_unref(old_client->meat.serial_number);
+		pthread_mutex_unlock(&serials_lock);
 		free(old_client);
+	}
 
 	rwlock_unlock(&lock);
 
@@ -106,15 +200,27 @@ void
 clients_update_serial(int fd, serial_t serial)
 {
 	struct hashable_client *cur_client;
+	struct client *client;
 
-	rwlock_write_lock(&lock);
+	rwlock_read_lock(&lock);
 	HASH_FIND_INT(db.clients, &fd, cur_client);
 	if (cur_client == NULL)
 		goto unlock;
-
-	cur_client->meat.serial_number = serial;
-	cur_client->meat.serial_number_set = true;
-
+	client = &cur_client->meat;
+
+	pthread_mutex_lock(&serials_lock);
+	if (client->serial_number_set && client->serial_number == serial)
+		goto unlock_serials; /* Most likely a keepalive */
+	/* On failure, the old serial stays; the deltas can't tell anyway */
+	if (serial_ref(serial) != 0)
+		goto unlock_serials;
+	if (client->serial_number_set)
+		serial_unref(client->serial_number);
+	client->serial_number = serial;
+	client->serial_number_set = true;
+
+unlock_serials:
+	pthread_mutex_unlock(&serials_lock);
 unlock:
 	rwlock_unlock(&lock);
 }
@@ -122,29 +228,47 @@ unlock:
 int
 clients_get_min_serial(serial_t *result)
 {
-	struct hashable_client *current, *tmp;
 	int retval;
 
 	retval = -ENOENT;
-	rwlock_read_lock(&lock);
-	if (HASH_COUNT(db.clients) == 0)
-		goto unlock;
-
-	HASH_ITER(hh, db.clients, current, tmp) {
-		if (!current->meat.serial_number_set)
-			continue;
-		if (retval) {
-			*result = current->meat.serial_number;
-			retval = 0;
-		} else if (current->meat.serial_number < *result)
-			*result = current->meat.serial_number;
+	pthread_mutex_lock(&serials_lock);
+	if (db.min != NULL) {
+		*result = db.min->serial;
+		retval = 0;
 	}
+	pthread_mutex_unlock(&serials_lock);
 
-unlock:
-	rwlock_unlock(&lock);
 	return retval;
 }
 
+/* Returns the number of clients that are at serial @serial. */
+unsigned int
+clients_count_serial(serial_t serial)
+{
+	struct serial_count *node;
+	unsigned int result;
+
+	pthread_mutex_lock(&serials_lock);
+	HASH_FIND(hh, db.serials, &serial, sizeof(serial), node);
+	result = (node != NULL) ? node->count : 0;
+	pthread_mutex_unlock(&serials_lock);
+
+	return result;
+}
+
+/* Returns the number of connected clients. */
+unsigned int
+clients_count(void)
+{
+	unsigned int result;
+
+	rwlock_read_lock(&lock);
+	result = HASH_COUNT(db.clients);
+	rwlock_unlock(&lock);
+
+	return result;
+}
+
 int
 clients_set_rtr_version(int fd, uint8_t rtr_version)
 {
@@ -203,6 +327,10 @@ clients_forget(int fd)
 	HASH_FIND_INT(db.clients, &fd, client);
 	if (client != NULL) {
 		HASH_DEL(db.clients, client);
+		pthread_mutex_lock(&serials_lock);
+		if (client->meat.serial_number_set)
+			serial_unref(client->meat.serial_number);
+		pthread_mutex_unlock(&serials_lock);
 		free(client);
 	}
 
@@ -238,6 +366,7 @@ void
 clients_db_destroy(join_thread_cb cb, void *arg)
 {
 	struct hashable_client *node, *tmp;
+	struct serial_count *serial, *tmp_serial;
 
 	HASH_ITER(hh, db.clients, node, tmp) {
 		/* Not much to do on failure */
@@ -245,6 +374,13 @@ clients_db_destroy(join_thread_cb cb, void *arg)
 		HASH_DEL(db.clients, node);
 		free(node);
 	}
+	HASH_ITER(hh, db.serials, serial, tmp_serial) {
+		HASH_DEL(db.serials, serial);
+		free(serial);
+	}
+	db.min = NULL;
 
-	pthread_rwlock_destroy(&lock); /* Nothing to do with error code */
+	/* Nothing to do with error codes */
+	pthread_mutex_destroy(&serials_lock);
+	pthread_rwlock_destroy(&lock);
 }
@@ -15,7 +15,10 @@ struct client {
 	 * should do it.
 	 */
 	pthread_t tid;
+	/* Wakes up the client's thread to send a Serial Notify; see notify.h */
+	int notify_fd;
 
+	/* Protected by the serials mutex; see clients_update_serial(). */
 	serial_t serial_number;
 	bool serial_number_set;
 
@@ -25,12 +28,14 @@ struct client {
 
 int clients_db_init(void);
 
-int clients_add(int, struct sockaddr_storage, pthread_t);
+int clients_add(int, struct sockaddr_storage, pthread_t, int);
 void clients_update_serial(int, serial_t);
 void clients_forget(int);
 typedef int (*clients_foreach_cb)(struct client *, void *);
 int clients_foreach(clients_foreach_cb, void *);
 int clients_get_min_serial(serial_t *);
+unsigned int clients_count_serial(serial_t);
+unsigned int clients_count(void);
 int clients_get_addr(int, struct sockaddr_storage *);
 
 int clients_set_rtr_version(int, uint8_t);
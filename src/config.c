@@ -20,6 +20,7 @@
 #include "config/uint.h"
 #include "config/uint32.h"
 #include "config/work_offline.h"
+#include "config/xml_validation.h"
 
 /**
  * To add a member to this structure,
@@ -58,6 +59,16 @@ struct rpki_config {
 	 * 'true' uses only local files located at local-repository.
 	 */
 	bool work_offline;
+	/*
+	 * Keep the repository files at a content-addressed store, shared by
+	 * rsync and RRDP. See object_store.h.
+	 */
+	bool object_store;
+	/*
+	 * Reuse the previous cycle's results of the RPPs that didn't change.
+	 * See rpp_cache.h.
+	 */
+	bool incremental_validation;
 
 	struct {
 		/** The bound listening address of the RTR server. */
@@ -70,10 +81,31 @@ struct rpki_config {
 		struct {
 			/** Interval used to look for updates at VRPs location */
 			unsigned int validation;
+			/** Interval between checks for repository changes */
+			unsigned int change_check;
 			unsigned int refresh;
 			unsigned int retry;
 			unsigned int expire;
 		} interval;
+
+		struct {
+			/** Serials whose deltas are kept apart */
+			unsigned int lifetime;
+			/** Memory (in MiB) the delta history may use */
+			unsigned int max_memory;
+		} deltas;
+
+		/** Snapshot of the published VRPs, kept across restarts */
+		char *state_file;
+		/** RTR processes that serve the snapshot; 0 serves in-process */
+		unsigned int frontends;
+
+		struct {
+			/** Listening address of the metrics endpoint */
+			char *address;
+			/** Listening port of the metrics endpoint; NULL disables */
+			char *port;
+		} metrics;
 	} server;
 
 	struct {
@@ -93,6 +125,13 @@ struct rpki_config {
 			/* Interval (in seconds) between each retry */
 			unsigned int interval;
 		} retry;
+		/* Background rsyncs. See rsync_pool.h. */
+		struct {
+			/* Maximum simultaneous rsyncs; 0 disables the pool */
+			unsigned int total;
+			/* Maximum simultaneous rsyncs per server */
+			unsigned int per_host;
+		} parallel;
 		char *program;
 		struct {
 			struct string_array flat;
@@ -115,6 +154,8 @@ struct rpki_config {
 			/* Interval (in seconds) between each retry */
 			unsigned int interval;
 		} retry;
+		/* Validator of the RRDP files grammar */
+		enum xml_validation xml_validation;
 	} rrdp;
 
 	struct {
@@ -146,6 +187,10 @@ struct rpki_config {
 		char *roa;
 		/** File where the validated BGPsec certs will be stored */
 		char *bgpsec;
+		/** File where both will be stored in JSON format */
+		char *json;
+		/** File where both will be stored in snapshot format */
+		char *snapshot;
 	} output;
 
 	/* ASN1 decoder max stack size allowed */
@@ -268,6 +313,18 @@ static const struct option_field options[] = {
 		.type = &gt_work_offline,
 		.offset = offsetof(struct rpki_config, work_offline),
 		.doc = "Disable all outgoing requests (rsync, http (implies RRDP)) and work only with local repository files.",
+	}, {
+		.id = 1006,
+		.name = "object-store",
+		.type = &gt_bool,
+		.offset = offsetof(struct rpki_config, object_store),
+		.doc = "Deduplicate the local repository files at a content-addressed store, and skip rehashing the unchanged ones",
+	}, {
+		.id = 1007,
+		.name = "incremental-validation",
+		.type = &gt_bool,
+		.offset = offsetof(struct rpki_config, incremental_validation),
+		.doc = "Reuse the previous cycle's results of the publication points the fetchers didn't change",
 	},
 
 	/* Server fields */
@@ -307,6 +364,16 @@ static const struct option_field options[] = {
 		 */
 		.min = 60,
 		.max = UINT_MAX,
+	}, {
+		.id = 5007,
+		.name = "server.interval.change-check",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    server.interval.change_check),
+		.doc = "Interval between checks for repository changes, which trigger early validations (0 disables them)",
+		/* Same minimum as the validation interval; see validate_config() */
+		.min = 0,
+		.max = UINT_MAX,
 	}, {
 		.id = 5004,
 		.name = "server.interval.refresh",
@@ -358,6 +425,50 @@ static const struct option_field options[] = {
 		 */
 		.min = 600,
 		.max = 172800,
+	}, {
+		.id = 5008,
+		.name = "server.deltas.lifetime",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, server.deltas.lifetime),
+		.doc = "Number of serials whose deltas are kept apart; older ones are merged into checkpoints",
+		.min = 1,
+		.max = 65535,
+	}, {
+		.id = 5009,
+		.name = "server.deltas.max-memory",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    server.deltas.max_memory),
+		.doc = "Memory (in MiB) the delta history may use before its oldest deltas are merged or dropped",
+		.min = 1,
+		.max = 65535,
+	}, {
+		.id = 5010,
+		.name = "server.state-file",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, server.state_file),
+		.doc = "File where the published VRPs, serial and session IDs are kept, so they can be served right after a restart",
+		.arg_doc = "<file>",
+	}, {
+		.id = 5011,
+		.name = "server.frontends",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, server.frontends),
+		.doc = "Number of separate processes that serve the RTR clients, following the state file. (0 means the validator serves them itself.)",
+		.min = 0,
+		.max = 64,
+	}, {
+		.id = 5012,
+		.name = "server.metrics.address",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, server.metrics.address),
+		.doc = "Address to which the metrics endpoint will bind itself to.",
+	}, {
+		.id = 5013,
+		.name = "server.metrics.port",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, server.metrics.port),
+		.doc = "Port of the HTTP endpoint that exports the metrics, in Prometheus text format. (Disabled if unset.)",
 	},
 
 	/* RSYNC fields */
@@ -394,9 +505,25 @@ static const struct option_field options[] = {
 		.name = "rsync.retry.interval",
 		.type = &gt_uint,
 		.offset = offsetof(struct rpki_config, rsync.retry.interval),
-		.doc = "Period (in seconds) to wait between retries after an RSYNC error ocurred",
+		.doc = "Base period (in seconds) of the backoff after an RSYNC error ocurred",
 		.min = 0,
 		.max = UINT_MAX,
+	}, {
+		.id = 3008,
+		.name = "rsync.parallel.total",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, rsync.parallel.total),
+		.doc = "Maximum number of RSYNCs running at the same time (0 disables background RSYNCs)",
+		.min = 0,
+		.max = 256,
+	}, {
+		.id = 3009,
+		.name = "rsync.parallel.per-host",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, rsync.parallel.per_host),
+		.doc = "Maximum number of RSYNCs running at the same time against the same server",
+		.min = 1,
+		.max = 256,
 	},{
 		.id = 3005,
 		.name = "rsync.program",
@@ -449,9 +576,15 @@ static const struct option_field options[] = {
 		.name = "rrdp.retry.interval",
 		.type = &gt_uint,
 		.offset = offsetof(struct rpki_config, rrdp.retry.interval),
-		.doc = "Period (in seconds) to wait between retries after an error ocurred fetching RRDP files",
+		.doc = "Base period (in seconds) of the backoff after an error ocurred fetching RRDP files",
 		.min = 0,
 		.max = UINT_MAX,
+	}, {
+		.id = 10004,
+		.name = "rrdp.xml-validation",
+		.type = &gt_xml_validation,
+		.offset = offsetof(struct rpki_config, rrdp.xml_validation),
+		.doc = "Validator of the RRDP files grammar: 'relax-ng' (libxml2 schema validation) or 'structural' (faster, streaming validator)",
 	},
 
 	/* HTTP requests parameters */
@@ -549,6 +682,20 @@ static const struct option_field options[] = {
 		.offset = offsetof(struct rpki_config, output.bgpsec),
 		.doc = "File where BGPsec Router Keys will be stored in CSV format, use '-' to print at console",
 		.arg_doc = "<file>",
+	}, {
+		.id = 6002,
+		.name = "output.json",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, output.json),
+		.doc = "File where ROAs and BGPsec Router Keys will be stored in JSON format, use '-' to print at console",
+		.arg_doc = "<file>",
+	}, {
+		.id = 6003,
+		.name = "output.snapshot",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, output.snapshot),
+		.doc = "File where ROAs and BGPsec Router Keys will be stored in binary snapshot format",
+		.arg_doc = "<file>",
 	},
 
 	{
@@ -697,6 +844,7 @@ set_default_values(void)
 		"--times",
 		"--contimeout=20",
 		"--timeout=15",
+		"--itemize-changes",
 		"$REMOTE",
 		"$LOCAL",
 	};
@@ -705,6 +853,7 @@ set_default_values(void)
 		"--times",
 		"--contimeout=20",
 		"--timeout=15",
+		"--itemize-changes",
 		"--dirs",
 		"$REMOTE",
 		"$LOCAL",
@@ -724,9 +873,16 @@ set_default_values(void)
 
 	rpki_config.server.backlog = SOMAXCONN;
 	rpki_config.server.interval.validation = 3600;
+	rpki_config.server.interval.change_check = 0;
 	rpki_config.server.interval.refresh = 3600;
 	rpki_config.server.interval.retry = 600;
 	rpki_config.server.interval.expire = 7200;
+	rpki_config.server.deltas.lifetime = 64;
+	rpki_config.server.deltas.max_memory = 128;
+	rpki_config.server.state_file = NULL;
+	rpki_config.server.frontends = 0;
+	rpki_config.server.metrics.address = NULL;
+	rpki_config.server.metrics.port = NULL;
 
 	rpki_config.tal = NULL;
 	rpki_config.slurm = NULL;
@@ -742,12 +898,16 @@ set_default_values(void)
 	rpki_config.maximum_certificate_depth = 32;
 	rpki_config.mode = SERVER;
 	rpki_config.work_offline = false;
+	rpki_config.object_store = false;
+	rpki_config.incremental_validation = false;
 
 	rpki_config.rsync.enabled = true;
 	rpki_config.rsync.priority = 50;
 	rpki_config.rsync.strategy = RSYNC_ROOT_EXCEPT_TA;
 	rpki_config.rsync.retry.count = 2;
 	rpki_config.rsync.retry.interval = 5;
+	rpki_config.rsync.parallel.total = 8;
+	rpki_config.rsync.parallel.per_host = 2;
 	rpki_config.rsync.program = strdup("rsync");
 	if (rpki_config.rsync.program == NULL) {
 		error = pr_enomem();
@@ -768,6 +928,7 @@ set_default_values(void)
 	rpki_config.rrdp.priority = 50;
 	rpki_config.rrdp.retry.count = 2;
 	rpki_config.rrdp.retry.interval = 5;
+	rpki_config.rrdp.xml_validation = XML_VALIDATION_RELAX_NG;
 
 	rpki_config.http.user_agent = strdup(PACKAGE_NAME "/" PACKAGE_VERSION);
 	if (rpki_config.http.user_agent == NULL) {
@@ -786,6 +947,8 @@ set_default_values(void)
 
 	rpki_config.output.roa = NULL;
 	rpki_config.output.bgpsec = NULL;
+	rpki_config.output.json = NULL;
+	rpki_config.output.snapshot = NULL;
 
 	rpki_config.asn1_decode_max_stack = 4096; /* 4kB */
 
@@ -809,6 +972,24 @@ valid_output_file(char const *path)
 	return strcmp(path, "-") == 0 || file_valid(path);
 }
 
+/*
+ * rsync arguments that write over the existing files, rather than replacing
+ * them. Those files might be links into the object store.
+ */
+static bool
+writes_in_place(struct string_array *args)
+{
+	size_t i;
+
+	for (i = 0; i < args->length; i++)
+		if (strcmp(args->array[i], "--inplace") == 0 ||
+		    strcmp(args->array[i], "--append") == 0 ||
+		    strcmp(args->array[i], "--append-verify") == 0)
+			return true;
+
+	return false;
+}
+
 static int
 validate_config(void)
 {
@@ -824,6 +1005,14 @@ validate_config(void)
 	    rpki_config.server.interval.retry)
 		return pr_err("Expire interval must be greater than refresh and retry intervals");
 
+	if (rpki_config.server.interval.change_check != 0 &&
+	    rpki_config.server.interval.change_check < 60)
+		return pr_err("The change check interval must be either 0 or at least 60 seconds.");
+
+	if (rpki_config.server.frontends > 0 &&
+	    rpki_config.server.state_file == NULL)
+		return pr_err("The RTR frontends (--server.frontends) need a state file (--server.state-file) to serve.");
+
 	if (rpki_config.output.roa != NULL &&
 	    !valid_output_file(rpki_config.output.roa))
 		return pr_err("Invalid output.roa file.");
@@ -832,10 +1021,25 @@ validate_config(void)
 	    !valid_output_file(rpki_config.output.bgpsec))
 		return pr_err("Invalid output.bgpsec file.");
 
+	if (rpki_config.output.json != NULL &&
+	    !valid_output_file(rpki_config.output.json))
+		return pr_err("Invalid output.json file.");
+
+	/* Binary; not for the console */
+	if (rpki_config.output.snapshot != NULL &&
+	    (strcmp(rpki_config.output.snapshot, "-") == 0 ||
+	    !valid_output_file(rpki_config.output.snapshot)))
+		return pr_err("Invalid output.snapshot file.");
+
 	if (rpki_config.slurm != NULL &&
 	    !valid_file_or_dir(rpki_config.slurm, true, true))
 		return pr_err("Invalid slurm location.");
 
+	if (rpki_config.object_store &&
+	    (writes_in_place(&rpki_config.rsync.args.recursive) ||
+	    writes_in_place(&rpki_config.rsync.args.flat)))
+		return pr_err("The object store (--object-store) can't be used with rsync's --inplace, --append or --append-verify.");
+
 	/* FIXME (later) Remove when sync-strategy is fully deprecated */
 	if (!rpki_config.rsync.enabled)
 		config_set_sync_strategy(RSYNC_OFF);
@@ -986,12 +1190,30 @@ config_get_work_offline(void)
 	return rpki_config.work_offline;
 }
 
+bool
+config_get_incremental_validation(void)
+{
+	return rpki_config.incremental_validation;
+}
+
+bool
+config_get_object_store_enabled(void)
+{
+	return rpki_config.object_store;
+}
+
 unsigned int
 config_get_validation_interval(void)
 {
 	return rpki_config.server.interval.validation;
 }
 
+unsigned int
+config_get_interval_change_check(void)
+{
+	return rpki_config.server.interval.change_check;
+}
+
 unsigned int
 config_get_interval_refresh(void)
 {
@@ -1010,6 +1232,42 @@ config_get_interval_expire(void)
 	return rpki_config.server.interval.expire;
 }
 
+unsigned int
+config_get_deltas_lifetime(void)
+{
+	return rpki_config.server.deltas.lifetime;
+}
+
+unsigned int
+config_get_deltas_max_memory(void)
+{
+	return rpki_config.server.deltas.max_memory;
+}
+
+char const *
+config_get_server_state_file(void)
+{
+	return rpki_config.server.state_file;
+}
+
+unsigned int
+config_get_server_frontends(void)
+{
+	return rpki_config.server.frontends;
+}
+
+char const *
+config_get_server_metrics_address(void)
+{
+	return rpki_config.server.metrics.address;
+}
+
+char const *
+config_get_server_metrics_port(void)
+{
+	return rpki_config.server.metrics.port;
+}
+
 char const *
 config_get_slurm(void)
 {
@@ -1094,6 +1352,18 @@ config_get_rsync_retry_interval(void)
 	return rpki_config.rsync.retry.interval;
 }
 
+unsigned int
+config_get_rsync_parallel_total(void)
+{
+	return rpki_config.rsync.parallel.total;
+}
+
+unsigned int
+config_get_rsync_parallel_per_host(void)
+{
+	return rpki_config.rsync.parallel.per_host;
+}
+
 char *
 config_get_rsync_program(void)
 {
@@ -1143,6 +1413,12 @@ config_get_rrdp_retry_interval(void)
 	return rpki_config.rrdp.retry.interval;
 }
 
+enum xml_validation
+config_get_rrdp_xml_validation(void)
+{
+	return rpki_config.rrdp.xml_validation;
+}
+
 char const *
 config_get_http_user_agent(void)
 {
@@ -1185,6 +1461,18 @@ config_get_output_bgpsec(void)
 	return rpki_config.output.bgpsec;
 }
 
+char const *
+config_get_output_json(void)
+{
+	return rpki_config.output.json;
+}
+
+char const *
+config_get_output_snapshot(void)
+{
+	return rpki_config.output.snapshot;
+}
+
 unsigned int
 config_get_asn1_decode_max_stack(void)
 {
@@ -10,6 +10,7 @@
 #include "config/rsync_strategy.h"
 #include "config/string_array.h"
 #include "config/types.h"
+#include "config/xml_validation.h"
 
 /* Init/destroy */
 int handle_flags_config(int , char **);
@@ -20,9 +21,16 @@ char const *config_get_server_address(void);
 char const *config_get_server_port(void);
 int config_get_server_queue(void);
 unsigned int config_get_validation_interval(void);
+unsigned int config_get_interval_change_check(void);
 unsigned int config_get_interval_refresh(void);
 unsigned int config_get_interval_retry(void);
 unsigned int config_get_interval_expire(void);
+unsigned int config_get_deltas_lifetime(void);
+unsigned int config_get_deltas_max_memory(void);
+char const *config_get_server_state_file(void);
+unsigned int config_get_server_frontends(void);
+char const *config_get_server_metrics_address(void);
+char const *config_get_server_metrics_port(void);
 char const *config_get_slurm(void);
 
 char const *config_get_tal(void);
@@ -31,6 +39,8 @@ bool config_get_shuffle_tal_uris(void);
 unsigned int config_get_max_cert_depth(void);
 enum mode config_get_mode(void);
 bool config_get_work_offline(void);
+bool config_get_object_store_enabled(void);
+bool config_get_incremental_validation(void);
 bool config_get_color_output(void);
 enum filename_format config_get_filename_format(void);
 char const *config_get_http_user_agent(void);
@@ -45,14 +55,19 @@ unsigned int config_get_rsync_priority(void);
 enum rsync_strategy config_get_rsync_strategy(void);
 unsigned int config_get_rsync_retry_count(void);
 unsigned int config_get_rsync_retry_interval(void);
+unsigned int config_get_rsync_parallel_total(void);
+unsigned int config_get_rsync_parallel_per_host(void);
 char *config_get_rsync_program(void);
 struct string_array const *config_get_rsync_args(bool);
 bool config_get_rrdp_enabled(void);
 unsigned int config_get_rrdp_priority(void);
 unsigned int config_get_rrdp_retry_count(void);
 unsigned int config_get_rrdp_retry_interval(void);
+enum xml_validation config_get_rrdp_xml_validation(void);
 char const *config_get_output_roa(void);
 char const *config_get_output_bgpsec(void);
+char const *config_get_output_json(void);
+char const *config_get_output_snapshot(void);
 unsigned int config_get_asn1_decode_max_stack(void);
 
 /*
@@ -0,0 +1,64 @@
+#include "config/xml_validation.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "config/str.h"
+
+#define VALUE_RELAX_NG		"relax-ng"
+#define VALUE_STRUCTURAL	"structural"
+
+#define DEREFERENCE(void_value) (*((enum xml_validation *) void_value))
+
+static void
+print_xml_validation(struct option_field const *field, void *value)
+{
+	char const *str = "<unknown>";
+
+	switch (DEREFERENCE(value)) {
+	case XML_VALIDATION_RELAX_NG:
+		str = VALUE_RELAX_NG;
+		break;
+	case XML_VALIDATION_STRUCTURAL:
+		str = VALUE_STRUCTURAL;
+		break;
+	}
+
+	pr_info("%s: %s", field->name, str);
+}
+
+static int
+parse_argv_xml_validation(struct option_field const *field, char const *str,
+    void *result)
+{
+	if (strcmp(str, VALUE_RELAX_NG) == 0)
+		DEREFERENCE(result) = XML_VALIDATION_RELAX_NG;
+	else if (strcmp(str, VALUE_STRUCTURAL) == 0)
+		DEREFERENCE(result) = XML_VALIDATION_STRUCTURAL;
+	else
+		return pr_err("Unknown XML validation: '%s'", str);
+
+	return 0;
+}
+
+static int
+parse_json_xml_validation(struct option_field const *opt, struct json_t *json,
+    void *result)
+{
+	char const *string;
+	int error;
+
+	error = parse_json_string(json, opt->name, &string);
+	return error ? error : parse_argv_xml_validation(opt, string, result);
+}
+
+const struct global_type gt_xml_validation = {
+	.has_arg = required_argument,
+	.size = sizeof(enum xml_validation),
+	.print = print_xml_validation,
+	.parse.argv = parse_argv_xml_validation,
+	.parse.json = parse_json_xml_validation,
+	.arg_doc = VALUE_RELAX_NG "|" VALUE_STRUCTURAL,
+};
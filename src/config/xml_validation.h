@@ -0,0 +1,27 @@
+#ifndef SRC_CONFIG_XML_VALIDATION_H_
+#define SRC_CONFIG_XML_VALIDATION_H_
+
+#include "config/types.h"
+
+/**
+ * Validator used to check the RRDP files against the RFC 8182 grammar.
+ */
+enum xml_validation {
+	/**
+	 * Use libxml2's Relax NG engine along with the schema from RFC 8182.
+	 *
+	 * This is the reference implementation, but its cost is similar to
+	 * the one of the parsing itself, which is noticeable on huge
+	 * snapshots.
+	 */
+	XML_VALIDATION_RELAX_NG,
+	/**
+	 * Use the hand-written streaming validator of the RRDP v1 grammar
+	 * (element order, required attributes, charsets and version).
+	 */
+	XML_VALIDATION_STRUCTURAL,
+};
+
+extern const struct global_type gt_xml_validation;
+
+#endif /* SRC_CONFIG_XML_VALIDATION_H_ */
@@ -33,7 +33,7 @@ hash_matches(unsigned char const *expected, size_t expected_len,
 }
 
 static int
-hash_file(char const *algorithm, struct rpki_uri *uri, unsigned char *result,
+hash_file(char const *algorithm, char const *path, unsigned char *result,
     unsigned int *result_len)
 {
 	EVP_MD const *md;
@@ -49,7 +49,7 @@ hash_file(char const *algorithm, struct rpki_uri *uri, unsigned char *result,
 	if (error)
 		return error;
 
-	error = file_open(uri_get_local(uri), &file, &stat);
+	error = file_open(path, &file, &stat);
 	if (error)
 		return error;
 
@@ -114,7 +114,7 @@ hash_validate_mft_file(char const *algorithm, struct rpki_uri *uri,
 	if (expected->bits_unused != 0)
 		return pr_err("Hash string has unused bits.");
 
-	error = hash_file(algorithm, uri, actual, &actual_len);
+	error = hash_file(algorithm, uri_get_local(uri), actual, &actual_len);
 	if (error)
 		return error;
 
@@ -138,7 +138,7 @@ hash_validate_file(char const *algorithm, struct rpki_uri *uri,
 	unsigned int actual_len;
 	int error;
 
-	error = hash_file(algorithm, uri, actual, &actual_len);
+	error = hash_file(algorithm, uri_get_local(uri), actual, &actual_len);
 	if (error)
 		return error;
 
@@ -150,7 +150,34 @@ hash_validate_file(char const *algorithm, struct rpki_uri *uri,
 	return 0;
 }
 
-static int
+/**
+ * Same as hash_validate_file(), except the file is the local file @path,
+ * which isn't necessarily the one of any URI.
+ */
+int
+hash_validate_local(char const *algorithm, char const *path,
+    unsigned char const *expected, size_t expected_len)
+{
+	unsigned char actual[EVP_MAX_MD_SIZE];
+	unsigned int actual_len;
+	int error;
+
+	error = hash_file(algorithm, path, actual, &actual_len);
+	if (error)
+		return error;
+
+	if (!hash_matches(expected, expected_len, actual, actual_len))
+		return pr_err("File '%s' does not match its expected hash.",
+		    path);
+
+	return 0;
+}
+
+/*
+ * Computes the @algorithm hash of @content, and stores it at @hash (which must
+ * be at least EVP_MAX_MD_SIZE bytes long).
+ */
+int
 hash_buffer(char const *algorithm,
     unsigned char const *content, size_t content_len,
     unsigned char *hash, unsigned int *hash_len)
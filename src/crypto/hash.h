@@ -10,6 +10,10 @@ int hash_validate_mft_file(char const *, struct rpki_uri *uri,
     BIT_STRING_t const *);
 int hash_validate_file(char const *, struct rpki_uri *, unsigned char const *,
     size_t);
+int hash_validate_local(char const *, char const *, unsigned char const *,
+    size_t);
+int hash_buffer(char const *, unsigned char const *, size_t, unsigned char *,
+    unsigned int *);
 int hash_validate(char const *, unsigned char const *, size_t,
     unsigned char const *, size_t);
 int hash_validate_octet_string(char const *, OCTET_STRING_t const*,
@@ -0,0 +1,261 @@
+#include "fetch_scheduler.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "log.h"
+#include "random.h"
+#include "state.h"
+#include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
+
+/* Maximum backoff, in seconds */
+#define MAX_BACKOFF	3600
+/* Maximum doublings of the retry interval */
+#define MAX_BACKOFF_SHIFT	10
+
+struct host_state {
+	/* "<scheme>://<host>"; the key */
+	char *host;
+	/* Consecutive failed fetches */
+	unsigned int failures;
+	/* The host won't be contacted before this moment */
+	time_t retry_at;
+	UT_hash_handle hh;
+};
+
+static struct host_state *hosts;
+
+/** Read/write lock, which protects @hosts. */
+static pthread_rwlock_t lock;
+
+int
+fetch_scheduler_init(void)
+{
+	int error;
+
+	error = pthread_rwlock_init(&lock, NULL);
+	if (error)
+		return pr_errno(error, "Fetch scheduler pthread_rwlock_init() errored");
+
+	random_init();
+	hosts = NULL;
+	return 0;
+}
+
+void
+fetch_scheduler_cleanup(void)
+{
+	struct host_state *host, *tmp;
+
+	HASH_ITER(hh, hosts, host, tmp) {
+		HASH_DEL(hosts, host);
+		free(host->host);
+		free(host);
+	}
+	pthread_rwlock_destroy(&lock);
+}
+
+/* Call while holding the lock */
+static struct host_state *
+find_host(struct rpki_uri *uri)
+{
+	struct host_state *host;
+
+	HASH_FIND(hh, hosts, uri_get_global(uri), uri_get_host_len(uri), host);
+	return host;
+}
+
+/* Call while holding the write lock */
+static int
+add_host(struct rpki_uri *uri, struct host_state **result)
+{
+	struct host_state *host;
+	size_t host_len;
+
+	host = malloc(sizeof(struct host_state));
+	if (host == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(host, 0, sizeof(struct host_state));
+
+	host_len = uri_get_host_len(uri);
+	host->host = malloc(host_len + 1);
+	if (host->host == NULL) {
+		free(host);
+		return pr_enomem();
+	}
+	memcpy(host->host, uri_get_global(uri), host_len);
+	host->host[host_len] = '\0';
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, hosts, host->host, host_len, host);
+	if (errno) {
+		free(host->host);
+		free(host);
+		return -pr_errno(errno, "Host couldn't be added to hash table");
+	}
+
+	*result = host;
+	return 0;
+}
+
+/*
+ * @interval doubled once per previous failure, and then randomized between
+ * half and all of it, so the hosts that failed at the same time aren't retried
+ * in lockstep.
+ */
+static time_t
+get_backoff(unsigned int interval, unsigned int failures)
+{
+	unsigned long backoff;
+	unsigned int shift;
+
+	shift = failures - 1;
+	if (shift > MAX_BACKOFF_SHIFT)
+		shift = MAX_BACKOFF_SHIFT;
+
+	backoff = ((unsigned long) interval) << shift;
+	if (backoff > MAX_BACKOFF)
+		backoff = MAX_BACKOFF;
+
+	return backoff - random_at_most(backoff / 2);
+}
+
+/* Tells the traversal to retry whatever needed @uri at @retry_at */
+static int
+postpone(time_t retry_at)
+{
+	struct validation *state;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return -EINVAL;
+
+	validation_schedule_retry(state, retry_at);
+	return -EAGAIN;
+}
+
+/*
+ * Call before fetching @uri. Returns 0 if it can be fetched right away,
+ * -EAGAIN if it has to be postponed (see validation_pop_retry()), and another
+ * error code if its host is down.
+ */
+int
+fetch_scheduler_request(struct rpki_uri *uri, unsigned int retry_count)
+{
+	struct host_state *host;
+	unsigned int failures;
+	time_t retry_at;
+
+	rwlock_read_lock(&lock);
+	host = find_host(uri);
+	if (host == NULL) {
+		rwlock_unlock(&lock);
+		return 0;
+	}
+	failures = host->failures;
+	retry_at = host->retry_at;
+	rwlock_unlock(&lock);
+
+	if (time(NULL) >= retry_at)
+		return 0;
+
+	if (failures <= retry_count)
+		return postpone(retry_at);
+
+	pr_info("The host of '%s' has failed %u consecutive times; won't try it again for %ld seconds.",
+	    uri_get_global(uri), failures, (long) (retry_at - time(NULL)));
+	return -EHOSTDOWN;
+}
+
+void
+fetch_scheduler_success(struct rpki_uri *uri)
+{
+	struct host_state *host;
+
+	rwlock_write_lock(&lock);
+	host = find_host(uri);
+	if (host != NULL) {
+		HASH_DEL(hosts, host);
+		free(host->host);
+		free(host);
+	}
+	rwlock_unlock(&lock);
+}
+
+/*
+ * Call after @uri's fetch failed. Returns the moment the fetch can be retried,
+ * or 0 if it shouldn't be retried during this cycle (the host has failed more
+ * than @retry_count consecutive times).
+ *
+ * Doesn't postpone anything, so it can be called from threads that aren't
+ * validating (such as the rsync pool's).
+ */
+time_t
+fetch_scheduler_record_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count)
+{
+	struct host_state *host;
+	unsigned int failures;
+	time_t backoff;
+	time_t retry_at;
+
+	rwlock_write_lock(&lock);
+	host = find_host(uri);
+	if (host == NULL && add_host(uri, &host) != 0) {
+		rwlock_unlock(&lock);
+		return 0;
+	}
+	host->failures++;
+	backoff = get_backoff(interval, host->failures);
+	host->retry_at = time(NULL) + backoff;
+	failures = host->failures;
+	retry_at = host->retry_at;
+	rwlock_unlock(&lock);
+
+	if (failures <= retry_count) {
+		pr_info("Couldn't fetch '%s'; retrying in %ld seconds, %u attempts remaining.",
+		    uri_get_global(uri), (long) backoff,
+		    retry_count - failures + 1);
+		return retry_at;
+	}
+
+	pr_info("Max retries (%u) reached fetching '%s'; its host won't be contacted again for %ld seconds.",
+	    retry_count, uri_get_global(uri), (long) backoff);
+	return 0;
+}
+
+/*
+ * Call after @uri's fetch failed with @error. If the host hasn't failed more
+ * than @retry_count consecutive times, the fetch is postponed and -EAGAIN is
+ * returned. Otherwise, returns @error.
+ */
+int
+fetch_scheduler_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count, int error)
+{
+	time_t retry_at;
+
+	retry_at = fetch_scheduler_record_failure(uri, interval, retry_count);
+	return (retry_at != 0) ? postpone(retry_at) : error;
+}
+
+/* Is @uri's host failing, and not supposed to be contacted yet? */
+bool
+fetch_scheduler_is_down(struct rpki_uri *uri)
+{
+	struct host_state *host;
+	bool result;
+
+	rwlock_read_lock(&lock);
+	host = find_host(uri);
+	result = (host != NULL) && (time(NULL) < host->retry_at);
+	rwlock_unlock(&lock);
+
+	return result;
+}
@@ -0,0 +1,34 @@
+#ifndef SRC_FETCH_SCHEDULER_H_
+#define SRC_FETCH_SCHEDULER_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include "uri.h"
+
+/*
+ * Failure state of the repository hosts (rsync and RRDP), shared by all the
+ * TAL threads and kept across validation cycles.
+ *
+ * Whenever a host fails, it's not contacted again until an exponential
+ * backoff (with jitter) expires. Instead of sleeping, the fetch returns
+ * -EAGAIN and the retry moment is handed to the validation state, so the
+ * traversal can postpone the CA and keep validating others meanwhile.
+ *
+ * After more than "retry count" consecutive failures, the host is considered
+ * down: its fetches fail right away (no more postponing) until its backoff
+ * expires.
+ */
+
+int fetch_scheduler_init(void);
+void fetch_scheduler_cleanup(void);
+
+int fetch_scheduler_request(struct rpki_uri *, unsigned int);
+void fetch_scheduler_success(struct rpki_uri *);
+time_t fetch_scheduler_record_failure(struct rpki_uri *, unsigned int,
+    unsigned int);
+int fetch_scheduler_failure(struct rpki_uri *, unsigned int, unsigned int,
+    int);
+
+bool fetch_scheduler_is_down(struct rpki_uri *);
+
+#endif /* SRC_FETCH_SCHEDULER_H_ */
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "log.h"
 
 static int
@@ -44,6 +45,20 @@ file_write(char const *file_name, FILE **result, struct stat *stat)
 	return file_get(file_name, result, stat, "wb");
 }
 
+/*
+ * Like file_write(), except @file_name is unlinked first, so it's written as a
+ * new file. If it was a hard link (see object_store.h), the file's other names
+ * keep the old content.
+ */
+int
+file_replace(char const *file_name, FILE **result, struct stat *stat)
+{
+	if (unlink(file_name) != 0 && errno != ENOENT)
+		return pr_errno(errno, "Couldn't delete '%s'", file_name);
+
+	return file_write(file_name, result, stat);
+}
+
 void
 file_close(FILE *file)
 {
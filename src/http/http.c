@@ -6,6 +6,7 @@
 #include "config.h"
 #include "file.h"
 #include "log.h"
+#include "metrics.h"
 
 /* HTTP Response Code 304 (Not Modified) */
 #define HTTP_NOT_MODIFIED	304
@@ -140,6 +141,7 @@ __http_download_file(struct rpki_uri *uri, http_write_cb cb,
 {
 	struct http_handler handler;
 	struct stat stat;
+	struct timespec start;
 	FILE *out;
 	int error;
 
@@ -152,7 +154,8 @@ __http_download_file(struct rpki_uri *uri, http_write_cb cb,
 	if (error)
 		return ENSURE_NEGATIVE(error);
 
-	error = file_write(uri_get_local(uri), &out, &stat);
+	/* Don't write through a link into the object store */
+	error = file_replace(uri_get_local(uri), &out, &stat);
 	if (error)
 		goto delete_dir;
 
@@ -167,8 +170,10 @@ __http_download_file(struct rpki_uri *uri, http_write_cb cb,
 		    CURL_TIMECOND_IFMODSINCE);
 	}
 
+	metrics_now(&start);
 	error = http_fetch(&handler, uri_get_global(uri), response_code, cb,
 	    out);
+	metrics_fetch(uri, &start, error != 0);
 	http_easy_cleanup(&handler);
 	file_close(out);
 
@@ -1,10 +1,16 @@
+#include "changeset.h"
 #include "clients.h"
 #include "config.h"
 #include "debug.h"
 #include "extension.h"
+#include "fetch_scheduler.h"
+#include "metrics.h"
 #include "nid.h"
+#include "rpp_cache.h"
 #include "thread_var.h"
 #include "http/http.h"
+#include "rsync/rsync.h"
+#include "rtr/frontends.h"
 #include "rtr/rtr.h"
 #include "rtr/db/vrps.h"
 #include "xml/relax_ng.h"
@@ -15,20 +21,63 @@ start_rtr_server(void)
 {
 	int error;
 
+	/* Shared with the frontends */
+	error = metrics_init();
+	if (error)
+		return error;
+
+	/* Before any thread is spawned */
+	error = frontends_start();
+	if (error)
+		goto metrics_cleanup;
+
 	error = vrps_init();
 	if (error)
-		goto just_quit;
+		goto stop_frontends;
 
 	error = db_rrdp_init();
 	if (error)
 		goto vrps_cleanup;
 
+	error = fetch_scheduler_init();
+	if (error)
+		goto db_cleanup;
+
+	error = changeset_init();
+	if (error)
+		goto scheduler_cleanup;
+
+	error = rpp_cache_init();
+	if (error)
+		goto changeset_cleanup;
+
+	error = rsync_init();
+	if (error)
+		goto cache_cleanup;
+
+	error = metrics_start();
+	if (error)
+		goto rsync_cleanup;
+
 	error = rtr_listen();
 
+	metrics_stop();
+rsync_cleanup:
+	rsync_destroy();
+cache_cleanup:
+	rpp_cache_destroy();
+changeset_cleanup:
+	changeset_destroy();
+scheduler_cleanup:
+	fetch_scheduler_cleanup();
+db_cleanup:
 	db_rrdp_cleanup();
 vrps_cleanup:
 	vrps_destroy();
-just_quit:
+stop_frontends:
+	frontends_stop();
+metrics_cleanup:
+	metrics_destroy();
 	return error;
 }
 
@@ -0,0 +1,822 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "rtr/pdu.h"
+#include "rtr/db/vrps.h"
+
+#define MAX_BUCKETS		10
+/* One more than the largest PDU type */
+#define PDU_TYPES		(PDU_TYPE_ERROR_REPORT + 1)
+
+/* Seconds a scraper gets to send its request */
+#define REQUEST_TIMEOUT		5
+#define REQUEST_MAX		1024
+
+struct buckets {
+	/* Upper bounds, increasing, in the unit of the observations */
+	uint64_t bounds[MAX_BUCKETS];
+	unsigned int len;
+	/* Observation units per exported unit */
+	double scale;
+};
+
+/* Observations are in microseconds; exported in seconds */
+static struct buckets const cycle_buckets = {
+	{ 10000, 100000, 1000000, 10000000, 60000000, 300000000, 900000000,
+	    3600000000ULL },
+	8, 1000000
+};
+static struct buckets const fetch_buckets = {
+	{ 100000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000,
+	    60000000, 300000000 },
+	9, 1000000
+};
+static struct buckets const query_buckets = {
+	{ 100, 1000, 10000, 100000, 1000000, 10000000 },
+	6, 1000000
+};
+/* Observations are entries */
+static struct buckets const delta_buckets = {
+	{ 1, 10, 100, 1000, 10000, 100000 },
+	6, 1
+};
+
+struct histogram {
+	/* Observations per bucket (not cumulative); the last one is +Inf */
+	atomic_ullong counts[MAX_BUCKETS + 1];
+	atomic_ullong sum;
+};
+
+/* Lives in memory shared with the RTR frontends */
+struct shared_metrics {
+	struct histogram cycles;
+	atomic_ullong cycle_errors;
+	struct histogram phases[METRICS_PHASE_COUNT];
+	struct histogram deltas;
+
+	atomic_ullong sessions_opened;
+	atomic_ullong sessions_closed;
+	atomic_ullong pdus[PDU_TYPES];
+	atomic_ullong bytes[PDU_TYPES];
+	struct histogram queries[METRICS_QUERY_COUNT];
+};
+
+/* Fetches of a repository host */
+struct host_metrics {
+	/* "<scheme>://<host>"; the key */
+	char *host;
+	struct histogram durations;
+	unsigned long long failures;
+	UT_hash_handle hh;
+};
+
+static char const *const phase_names[] = {
+	[METRICS_PHASE_VALIDATION] = "validation",
+	[METRICS_PHASE_PUBLISH] = "publish",
+	[METRICS_PHASE_EXPORT] = "export",
+};
+
+/* The PDUs a cache sends */
+static char const *const pdu_names[PDU_TYPES] = {
+	[PDU_TYPE_SERIAL_NOTIFY] = "serial_notify",
+	[PDU_TYPE_CACHE_RESPONSE] = "cache_response",
+	[PDU_TYPE_IPV4_PREFIX] = "ipv4_prefix",
+	[PDU_TYPE_IPV6_PREFIX] = "ipv6_prefix",
+	[PDU_TYPE_END_OF_DATA] = "end_of_data",
+	[PDU_TYPE_CACHE_RESET] = "cache_reset",
+	[PDU_TYPE_ROUTER_KEY] = "router_key",
+	[PDU_TYPE_ERROR_REPORT] = "error_report",
+};
+
+static char const *const query_names[] = {
+	[METRICS_QUERY_RESET] = "reset",
+	[METRICS_QUERY_SERIAL] = "serial",
+};
+
+static struct shared_metrics *shared;
+
+static struct host_metrics *hosts;
+static pthread_mutex_t hosts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listener = -1;
+static pthread_t thread;
+static bool running;
+
+/*
+ * Has to be called before the RTR frontends are forked. (See frontends.h.)
+ */
+int
+metrics_init(void)
+{
+	shared = mmap(NULL, sizeof(struct shared_metrics),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		shared = NULL;
+		return -pr_errno(errno, "Could not map the metrics");
+	}
+
+	/* mmap() zeroes it, which is a valid state for the atomics */
+	return 0;
+}
+
+void
+metrics_destroy(void)
+{
+	struct host_metrics *host, *tmp;
+
+	HASH_ITER(hh, hosts, host, tmp) {
+		HASH_DEL(hosts, host);
+		free(host->host);
+		free(host);
+	}
+
+	if (shared != NULL)
+		munmap(shared, sizeof(struct shared_metrics));
+	shared = NULL;
+}
+
+void
+metrics_now(struct timespec *now)
+{
+	clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+/* Microseconds since @start */
+static uint64_t
+elapsed(struct timespec const *start)
+{
+	struct timespec now;
+	int64_t result;
+
+	metrics_now(&now);
+	result = (int64_t) (now.tv_sec - start->tv_sec) * 1000000
+	    + (now.tv_nsec - start->tv_nsec) / 1000;
+	return (result > 0) ? result : 0;
+}
+
+static void
+add(atomic_ullong *counter, unsigned long long value)
+{
+	atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static unsigned long long
+load(atomic_ullong *counter)
+{
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void
+observe(struct histogram *histogram, struct buckets const *buckets,
+    uint64_t value)
+{
+	unsigned int i;
+
+	for (i = 0; i < buckets->len; i++)
+		if (value <= buckets->bounds[i])
+			break;
+
+	add(&histogram->counts[i], 1);
+	add(&histogram->sum, value);
+}
+
+void
+metrics_cycle(struct timespec const *start, bool error)
+{
+	if (shared == NULL)
+		return;
+	observe(&shared->cycles, &cycle_buckets, elapsed(start));
+	if (error)
+		add(&shared->cycle_errors, 1);
+}
+
+void
+metrics_phase(enum metrics_phase phase, struct timespec const *start)
+{
+	if (shared != NULL)
+		observe(&shared->phases[phase], &cycle_buckets, elapsed(start));
+}
+
+/*
+ * Fills @result (METRICS_PHASE_COUNT elements) with the seconds spent in each
+ * phase since startup.
+ */
+void
+metrics_phase_totals(double *result)
+{
+	unsigned int i;
+
+	for (i = 0; i < METRICS_PHASE_COUNT; i++)
+		result[i] = (shared != NULL)
+		    ? (load(&shared->phases[i].sum) / cycle_buckets.scale)
+		    : 0;
+}
+
+/* Records the size of a new serial's deltas */
+void
+metrics_delta(size_t entries)
+{
+	if (shared != NULL)
+		observe(&shared->deltas, &delta_buckets, entries);
+}
+
+static struct host_metrics *
+get_host(struct rpki_uri *uri)
+{
+	struct host_metrics *host;
+	size_t host_len;
+
+	host_len = uri_get_host_len(uri);
+	HASH_FIND(hh, hosts, uri_get_global(uri), host_len, host);
+	if (host != NULL)
+		return host;
+
+	host = calloc(1, sizeof(struct host_metrics));
+	if (host == NULL)
+		return NULL;
+	host->host = malloc(host_len + 1);
+	if (host->host == NULL) {
+		free(host);
+		return NULL;
+	}
+	memcpy(host->host, uri_get_global(uri), host_len);
+	host->host[host_len] = '\0';
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, hosts, host->host, host_len, host);
+	if (errno) {
+		free(host->host);
+		free(host);
+		return NULL;
+	}
+
+	return host;
+}
+
+/* Records an rsync or an RRDP download, which started at @start. */
+void
+metrics_fetch(struct rpki_uri *uri, struct timespec const *start, bool error)
+{
+	struct host_metrics *host;
+	uint64_t duration;
+
+	if (shared == NULL)
+		return;
+
+	duration = elapsed(start);
+
+	pthread_mutex_lock(&hosts_lock);
+	/* Not worth an error message */
+	host = get_host(uri);
+	if (host != NULL) {
+		observe(&host->durations, &fetch_buckets, duration);
+		if (error)
+			host->failures++;
+	}
+	pthread_mutex_unlock(&hosts_lock);
+}
+
+void
+metrics_session_opened(void)
+{
+	if (shared != NULL)
+		add(&shared->sessions_opened, 1);
+}
+
+void
+metrics_session_closed(void)
+{
+	if (shared != NULL)
+		add(&shared->sessions_closed, 1);
+}
+
+void
+metrics_pdu_sent(uint8_t type, size_t bytes)
+{
+	if (shared == NULL || type >= PDU_TYPES)
+		return;
+	add(&shared->pdus[type], 1);
+	add(&shared->bytes[type], bytes);
+}
+
+/* Records the service of a query, which arrived at @start. */
+void
+metrics_query(enum metrics_query type, struct timespec const *start)
+{
+	if (shared != NULL)
+		observe(&shared->queries[type], &query_buckets, elapsed(start));
+}
+
+static void
+print_header(FILE *out, char const *name, char const *type, char const *help)
+{
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Prints @value as a label value; quotes, backslashes and newlines escaped. */
+static void
+print_label(FILE *out, char const *value)
+{
+	for (; *value != '\0'; value++) {
+		switch (*value) {
+		case '"':
+		case '\\':
+			fputc('\\', out);
+			fputc(*value, out);
+			break;
+		case '\n':
+			fputs("\\n", out);
+			break;
+		default:
+			fputc(*value, out);
+		}
+	}
+}
+
+/* @labels is either empty, or a list of labels followed by a comma. */
+static void
+print_histogram(FILE *out, char const *name, char const *labels,
+    struct histogram *histogram, struct buckets const *buckets)
+{
+	unsigned long long count;
+	unsigned int i;
+
+	count = 0;
+	for (i = 0; i <= buckets->len; i++) {
+		count += load(&histogram->counts[i]);
+		fprintf(out, "%s_bucket{%s", name, labels);
+		if (i < buckets->len)
+			fprintf(out, "le=\"%g\"} %llu\n",
+			    buckets->bounds[i] / buckets->scale, count);
+		else
+			fprintf(out, "le=\"+Inf\"} %llu\n", count);
+	}
+
+	/* Strip the trailing comma */
+	if (labels[0] != '\0')
+		fprintf(out, "%s_sum{%.*s} %.6f\n%s_count{%.*s} %llu\n",
+		    name, (int) strlen(labels) - 1, labels,
+		    load(&histogram->sum) / buckets->scale,
+		    name, (int) strlen(labels) - 1, labels, count);
+	else
+		fprintf(out, "%s_sum %.6f\n%s_count %llu\n", name,
+		    load(&histogram->sum) / buckets->scale, name, count);
+}
+
+static void
+print_validation(FILE *out)
+{
+	char labels[32];
+	unsigned int i;
+
+	print_header(out, "fort_validation_cycle_seconds", "histogram",
+	    "Duration of the validation cycles.");
+	print_histogram(out, "fort_validation_cycle_seconds", "",
+	    &shared->cycles, &cycle_buckets);
+
+	print_header(out, "fort_validation_cycle_errors_total", "counter",
+	    "Validation cycles that ended in error.");
+	fprintf(out, "fort_validation_cycle_errors_total %llu\n",
+	    load(&shared->cycle_errors));
+
+	print_header(out, "fort_validation_phase_seconds", "histogram",
+	    "Duration of each phase of the validation cycles.");
+	for (i = 0; i < METRICS_PHASE_COUNT; i++) {
+		snprintf(labels, sizeof(labels), "phase=\"%s\",",
+		    phase_names[i]);
+		print_histogram(out, "fort_validation_phase_seconds", labels,
+		    &shared->phases[i], &cycle_buckets);
+	}
+}
+
+/* Prints the labels of @host. */
+static void
+print_host_labels(FILE *out, char const *host)
+{
+	char const *separator;
+
+	separator = strstr(host, "://");
+	if (separator != NULL) {
+		fprintf(out, "protocol=\"%.*s\",", (int) (separator - host),
+		    host);
+		host = separator + 3;
+	}
+	fputs("host=\"", out);
+	print_label(out, host);
+	fputc('"', out);
+}
+
+static void
+print_fetches(FILE *out)
+{
+	struct host_metrics *host, *tmp;
+	FILE *labels_out;
+	char *labels;
+	size_t size;
+
+	pthread_mutex_lock(&hosts_lock);
+
+	print_header(out, "fort_fetch_seconds", "histogram",
+	    "Duration of the rsync and RRDP downloads, per repository host.");
+	HASH_ITER(hh, hosts, host, tmp) {
+		labels_out = open_memstream(&labels, &size);
+		if (labels_out == NULL)
+			break;
+		print_host_labels(labels_out, host->host);
+		fputc(',', labels_out);
+		if (fclose(labels_out) != 0) {
+			free(labels);
+			break;
+		}
+		print_histogram(out, "fort_fetch_seconds", labels,
+		    &host->durations, &fetch_buckets);
+		free(labels);
+	}
+
+	print_header(out, "fort_fetch_failures_total", "counter",
+	    "Failed rsync and RRDP downloads, per repository host.");
+	HASH_ITER(hh, hosts, host, tmp) {
+		fputs("fort_fetch_failures_total{", out);
+		print_host_labels(out, host->host);
+		fprintf(out, "} %llu\n", host->failures);
+	}
+
+	pthread_mutex_unlock(&hosts_lock);
+}
+
+enum tal_metric {
+	TAL_VRPS,
+	TAL_ROUTER_KEYS,
+	TAL_TABLE_BYTES,
+};
+
+struct print_tal_args {
+	FILE *out;
+	enum tal_metric metric;
+};
+
+static void
+print_tal(char const *tal, unsigned int vrps, unsigned int router_keys,
+    size_t size, void *arg)
+{
+	struct print_tal_args *args = arg;
+
+	switch (args->metric) {
+	case TAL_VRPS:
+		fputs("fort_tal_vrps{tal=\"", args->out);
+		print_label(args->out, tal);
+		fprintf(args->out, "\"} %u\n", vrps);
+		break;
+	case TAL_ROUTER_KEYS:
+		fputs("fort_tal_router_keys{tal=\"", args->out);
+		print_label(args->out, tal);
+		fprintf(args->out, "\"} %u\n", router_keys);
+		break;
+	case TAL_TABLE_BYTES:
+		fputs("fort_tal_table_bytes{tal=\"", args->out);
+		print_label(args->out, tal);
+		fprintf(args->out, "\"} %zu\n", size);
+		break;
+	}
+}
+
+static void
+print_database(FILE *out)
+{
+	struct print_tal_args args;
+	struct vrps_stats stats;
+
+	vrps_get_stats(&stats);
+
+	print_header(out, "fort_serial", "gauge",
+	    "Serial number of the published VRPs. (Absent until there is one.)");
+	if (stats.published)
+		fprintf(out, "fort_serial %u\n", stats.serial);
+	print_header(out, "fort_vrps", "gauge", "Published VRPs.");
+	fprintf(out, "fort_vrps %u\n", stats.vrps);
+	print_header(out, "fort_router_keys", "gauge",
+	    "Published BGPsec Router Keys.");
+	fprintf(out, "fort_router_keys %u\n", stats.router_keys);
+	print_header(out, "fort_table_bytes", "gauge",
+	    "Memory used by the published VRPs and Router Keys.");
+	fprintf(out, "fort_table_bytes %zu\n", stats.base_size);
+	print_header(out, "fort_deltas", "gauge",
+	    "Serials whose deltas are kept.");
+	fprintf(out, "fort_deltas %u\n", stats.deltas);
+	print_header(out, "fort_deltas_bytes", "gauge",
+	    "Memory used by the delta history.");
+	fprintf(out, "fort_deltas_bytes %zu\n", stats.deltas_size);
+
+	print_header(out, "fort_delta_entries", "histogram",
+	    "Announcements and withdrawals of each new serial.");
+	print_histogram(out, "fort_delta_entries", "", &shared->deltas,
+	    &delta_buckets);
+
+	/* The samples of each metric have to be contiguous */
+	args.out = out;
+	print_header(out, "fort_tal_vrps", "gauge",
+	    "VRPs of each TAL, as of its last successful validation, before SLURM.");
+	args.metric = TAL_VRPS;
+	vrps_foreach_tal_stats(print_tal, &args);
+	print_header(out, "fort_tal_router_keys", "gauge",
+	    "Router Keys of each TAL, as of its last successful validation, before SLURM.");
+	args.metric = TAL_ROUTER_KEYS;
+	vrps_foreach_tal_stats(print_tal, &args);
+	print_header(out, "fort_tal_table_bytes", "gauge",
+	    "Memory used by the VRPs and Router Keys of each TAL.");
+	args.metric = TAL_TABLE_BYTES;
+	vrps_foreach_tal_stats(print_tal, &args);
+}
+
+static void
+print_rtr(FILE *out)
+{
+	unsigned long long opened, closed;
+	char labels[32];
+	unsigned int i;
+
+	opened = load(&shared->sessions_opened);
+	closed = load(&shared->sessions_closed);
+
+	print_header(out, "fort_rtr_sessions", "gauge",
+	    "Connected RTR clients.");
+	fprintf(out, "fort_rtr_sessions %llu\n",
+	    (opened > closed) ? (opened - closed) : 0);
+	print_header(out, "fort_rtr_sessions_total", "counter",
+	    "RTR clients accepted.");
+	fprintf(out, "fort_rtr_sessions_total %llu\n", opened);
+
+	print_header(out, "fort_rtr_pdus_sent_total", "counter",
+	    "RTR PDUs sent, per type.");
+	for (i = 0; i < PDU_TYPES; i++)
+		if (pdu_names[i] != NULL)
+			fprintf(out, "fort_rtr_pdus_sent_total{type=\"%s\"} %llu\n",
+			    pdu_names[i], load(&shared->pdus[i]));
+	print_header(out, "fort_rtr_bytes_sent_total", "counter",
+	    "Bytes of the RTR PDUs sent, per type.");
+	for (i = 0; i < PDU_TYPES; i++)
+		if (pdu_names[i] != NULL)
+			fprintf(out, "fort_rtr_bytes_sent_total{type=\"%s\"} %llu\n",
+			    pdu_names[i], load(&shared->bytes[i]));
+
+	print_header(out, "fort_rtr_query_seconds", "histogram",
+	    "Time spent answering the Reset and Serial Queries.");
+	for (i = 0; i < METRICS_QUERY_COUNT; i++) {
+		snprintf(labels, sizeof(labels), "type=\"%s\",",
+		    query_names[i]);
+		print_histogram(out, "fort_rtr_query_seconds", labels,
+		    &shared->queries[i], &query_buckets);
+	}
+}
+
+static int
+print_metrics(char **result, size_t *size)
+{
+	FILE *out;
+
+	*result = NULL;
+	out = open_memstream(result, size);
+	if (out == NULL)
+		return -pr_errno(errno, "Could not open the metrics buffer");
+
+	print_validation(out);
+	print_fetches(out);
+	print_database(out);
+	print_rtr(out);
+
+	if (fclose(out) != 0) {
+		free(*result);
+		return -pr_errno(errno, "Could not print the metrics");
+	}
+
+	return 0;
+}
+
+static int
+send_all(int fd, char const *data, size_t len)
+{
+	ssize_t sent;
+
+	while (len > 0) {
+		sent = send(fd, data, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += sent;
+		len -= sent;
+	}
+
+	return 0;
+}
+
+static void
+send_status(int fd, char const *status)
+{
+	char response[128];
+	int len;
+
+	len = snprintf(response, sizeof(response),
+	    "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+	    status);
+	send_all(fd, response, len);
+}
+
+/* Reads the request line. Returns false if it's not a metrics request. */
+static bool
+read_request(int fd, char const **status)
+{
+	char request[REQUEST_MAX + 1];
+	size_t len;
+	ssize_t got;
+	char *path, *end;
+
+	len = 0;
+	do {
+		got = recv(fd, request + len, REQUEST_MAX - len, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0) {
+			*status = NULL; /* Timeout or gone */
+			return false;
+		}
+		len += got;
+		request[len] = '\0';
+	} while (strstr(request, "\r\n") == NULL && len < REQUEST_MAX);
+
+	if (strncmp(request, "GET ", 4) != 0) {
+		*status = "405 Method Not Allowed";
+		return false;
+	}
+
+	path = request + 4;
+	end = strpbrk(path, " ?\r\n");
+	if (end != NULL)
+		*end = '\0';
+	if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0) {
+		*status = "404 Not Found";
+		return false;
+	}
+
+	return true;
+}
+
+static void
+serve(int fd)
+{
+	static char const header[] = "HTTP/1.0 200 OK\r\n"
+	    "Content-Type: text/plain; version=0.0.4\r\n"
+	    "Content-Length: %zu\r\n"
+	    "Connection: close\r\n\r\n";
+	char head[sizeof(header) + 32];
+	struct timeval timeout;
+	char const *status;
+	char *body;
+	size_t size;
+	int len;
+
+	timeout.tv_sec = REQUEST_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (!read_request(fd, &status)) {
+		if (status != NULL)
+			send_status(fd, status);
+		return;
+	}
+
+	if (print_metrics(&body, &size) != 0) {
+		send_status(fd, "500 Internal Server Error");
+		return;
+	}
+
+	len = snprintf(head, sizeof(head), header, size);
+	if (send_all(fd, head, len) == 0)
+		send_all(fd, body, size);
+	free(body);
+}
+
+static void *
+serve_scrapers(void *arg)
+{
+	int fd;
+
+	do {
+		fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				pr_debug("Metrics connection not accepted: %s",
+				    strerror(errno));
+			continue;
+		}
+
+		/* Don't get cancelled while holding locks or memory */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		serve(fd);
+		close(fd);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	} while (true);
+
+	return NULL;
+}
+
+static int
+create_listener(char const *address, char const *port)
+{
+	struct addrinfo hints;
+	struct addrinfo *addrs, *addr;
+	int reuse;
+	int fd;
+	int error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	error = getaddrinfo(address, port, &hints, &addrs);
+	if (error)
+		return pr_err("Could not infer a bindable address out of metrics address '%s' and port '%s': %s",
+		    (address != NULL) ? address : "any", port,
+		    gai_strerror(error));
+
+	reuse = 1;
+	for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+		fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC,
+		    addr->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+		    sizeof(reuse)) == 0 &&
+		    bind(fd, addr->ai_addr, addr->ai_addrlen) == 0 &&
+		    listen(fd, 8) == 0) {
+			freeaddrinfo(addrs);
+			listener = fd;
+			return 0;
+		}
+		close(fd);
+	}
+
+	freeaddrinfo(addrs);
+	return pr_err("Could not bind the metrics endpoint to address '%s', port '%s'.",
+	    (address != NULL) ? address : "any", port);
+}
+
+/*
+ * Starts serving the metrics, if they're enabled. Validator only.
+ */
+int
+metrics_start(void)
+{
+	char const *port;
+	int error;
+
+	port = config_get_server_metrics_port();
+	if (config_get_mode() != SERVER || port == NULL || shared == NULL)
+		return 0;
+
+	error = create_listener(config_get_server_metrics_address(), port);
+	if (error)
+		return error;
+
+	errno = pthread_create(&thread, NULL, serve_scrapers, NULL);
+	if (errno) {
+		error = -pr_errno(errno, "Could not spawn the metrics thread");
+		close(listener);
+		listener = -1;
+		return error;
+	}
+
+	running = true;
+	pr_info("Serving the metrics at port '%s'.", port);
+	return 0;
+}
+
+void
+metrics_stop(void)
+{
+	if (!running)
+		return;
+
+	close_thread(thread, "Metrics");
+	close(listener);
+	listener = -1;
+	running = false;
+}
@@ -0,0 +1,59 @@
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "uri.h"
+
+/*
+ * Counters and histograms of the validator and the RTR server, exported in the
+ * Prometheus text format by a small HTTP endpoint ("server.metrics.port").
+ *
+ * Updates are relaxed atomic additions, so any thread can do them without
+ * locks. (The fetches are the exception; they're labeled by host, so they're
+ * looked up in a table.) The fixed metrics live in a shared mapping, created
+ * before the RTR frontends are forked, so the traffic the frontends serve is
+ * counted as well. The endpoint itself is served by the validator.
+ *
+ * The gauges (VRP counts, serial, memory) aren't tracked here; they're read
+ * from the VRP database when the metrics are scraped.
+ */
+
+enum metrics_phase {
+	/* Traversal of the TALs, fetches included */
+	METRICS_PHASE_VALIDATION,
+	/* Merge of the TAL tables, SLURM and deltas */
+	METRICS_PHASE_PUBLISH,
+	/* State file and output files */
+	METRICS_PHASE_EXPORT,
+	METRICS_PHASE_COUNT,
+};
+
+enum metrics_query {
+	METRICS_QUERY_RESET,
+	METRICS_QUERY_SERIAL,
+	METRICS_QUERY_COUNT,
+};
+
+int metrics_init(void);
+void metrics_destroy(void);
+
+int metrics_start(void);
+void metrics_stop(void);
+
+void metrics_now(struct timespec *);
+
+void metrics_cycle(struct timespec const *, bool);
+void metrics_phase(enum metrics_phase, struct timespec const *);
+void metrics_phase_totals(double *);
+void metrics_delta(size_t);
+void metrics_fetch(struct rpki_uri *, struct timespec const *, bool);
+
+void metrics_session_opened(void);
+void metrics_session_closed(void);
+void metrics_pdu_sent(uint8_t, size_t);
+void metrics_query(enum metrics_query, struct timespec const *);
+
+#endif /* SRC_METRICS_H_ */
@@ -1,38 +1,284 @@
+#define _GNU_SOURCE
+
 #include "notify.h"
 
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "clients.h"
 #include "log.h"
+#include "metrics.h"
 #include "rtr/pdu_sender.h"
 #include "rtr/db/vrps.h"
 
+/*
+ * RFC 8210: "The cache MUST rate-limit Serial Notifies to no more frequently
+ * than one per minute."
+ */
+#define NOTIFY_INTERVAL		60
+/* Seconds a Serial Notify can wait for a client before it's deemed stuck */
+#define NOTIFY_STALL_THRESHOLD	30
+
+/* When the last Serial Notify was sent */
+static time_t last_notify;
+/* Was a Serial Notify held back by the rate limit? */
+static bool postponed;
+/* When the clients were last told about a new serial (monotonic clock) */
+static struct timespec queued_at;
+static struct notify_stats stats;
+
+/**
+ * Mutex, which protects @last_notify, @postponed, @queued_at and @stats.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Never blocks; the client's thread does the actual sending. */
 static int
-send_notify(struct client *client, void *arg)
+wake_client(struct client *client, void *arg)
 {
-	serial_t *serial = arg;
-	int error;
+	ssize_t written;
 
-	/* Send Serial Notify PDU */
-	error = send_serial_notify_pdu(client->fd, client->rtr_version,
-	    *serial);
+	if (client->notify_fd < 0)
+		return 0;
 
-	/* Error? Log it... */
-	if (error)
-		pr_warn("Error code %d sending notify PDU to client.", error);
+	written = write(client->notify_fd, "", 1);
+	/* A full pipe means there's a wakeup pending already */
+	if (written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		pr_warn("Could not queue Serial Notify for client %d: %s",
+		    client->fd, strerror(errno));
 
-	return 0; /* ...but do not interrupt notify to other clients */
+	return 0; /* Don't interrupt the other clients */
 }
 
+/*
+ * Tells the clients about the latest serial. If the previous notification was
+ * too recent, this one is postponed instead. (See notify_postponed_at().)
+ */
 int
 notify_clients(void)
 {
 	serial_t serial;
+	time_t now;
 	int error;
 
+	now = time(NULL);
+
+	pthread_mutex_lock(&lock);
+	if (last_notify != 0 && now < last_notify + NOTIFY_INTERVAL) {
+		postponed = true;
+		pthread_mutex_unlock(&lock);
+		return 0;
+	}
+	last_notify = now;
+	postponed = false;
+	clock_gettime(CLOCK_MONOTONIC, &queued_at);
+	pthread_mutex_unlock(&lock);
+
+	/* Nothing to tell yet? */
 	error = get_last_serial_number(&serial);
 	if (error)
 		return error;
 
-	return clients_foreach(send_notify, &serial);
+	return clients_foreach(wake_client, NULL);
+}
+
+/*
+ * Returns the moment the postponed notification can be sent, or zero if there
+ * is none.
+ */
+time_t
+notify_postponed_at(void)
+{
+	time_t result;
+
+	pthread_mutex_lock(&lock);
+	result = postponed ? (last_notify + NOTIFY_INTERVAL) : 0;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+void
+notify_get_stats(struct notify_stats *result)
+{
+	pthread_mutex_lock(&lock);
+	*result = stats;
+	pthread_mutex_unlock(&lock);
+}
+
+int
+notify_queue_init(struct notify_queue *queue)
+{
+	/*
+	 * Close-on-exec atomically, or the rsyncs other threads are spawning
+	 * meanwhile could inherit it.
+	 */
+	if (pipe2(queue->pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		return -pr_errno(errno, "Could not create Serial Notify pipe");
+
+	queue->sent = 0;
+	queue->pending = false;
+	queue->outdated = false;
+	queue->stalled = false;
+	return 0;
+}
+
+void
+notify_queue_cleanup(struct notify_queue *queue)
+{
+	if (queue->stalled) {
+		pthread_mutex_lock(&lock);
+		stats.stalled--;
+		pthread_mutex_unlock(&lock);
+	}
+
+	close(queue->pipe[0]);
+	close(queue->pipe[1]);
+}
+
+/* Serializes the Serial Notify of the latest serial into @queue. */
+static void
+prepare(struct notify_queue *queue, int fd)
+{
+	serial_t serial;
+	uint8_t version;
+	bool version_set;
+
+	/* Routers that haven't asked for anything don't need to be told */
+	if (clients_get_rtr_version_set(fd, &version_set, &version) != 0 ||
+	    !version_set)
+		return;
+	if (get_last_serial_number(&serial) != 0)
+		return;
+
+	build_serial_notify_pdu(version, serial, queue->pdu);
+	queue->sent = 0;
+	queue->pending = true;
+
+	pthread_mutex_lock(&lock);
+	queue->queued = queued_at;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Call when @queue's pipe is readable. Queues the Serial Notify of the latest
+ * serial for client @fd.
+ */
+void
+notify_queue_wakeup(struct notify_queue *queue, int fd)
+{
+	char buffer[16];
+
+	while (read(queue->pipe[0], buffer, sizeof(buffer)) > 0)
+		;
+
+	/* Half sent? Send the newer one afterwards */
+	if (queue->pending && queue->sent > 0) {
+		queue->outdated = true;
+		return;
+	}
+
+	prepare(queue, fd);
+}
+
+static long
+elapsed_ms(struct timespec const *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000
+	    + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void
+record_latency(struct notify_queue *queue)
+{
+	unsigned long latency;
+
+	latency = elapsed_ms(&queue->queued);
+
+	pthread_mutex_lock(&lock);
+	stats.sent++;
+	stats.latency_sum += latency;
+	if (latency > stats.latency_max)
+		stats.latency_max = latency;
+	if (queue->stalled)
+		stats.stalled--;
+	pthread_mutex_unlock(&lock);
+
+	queue->stalled = false;
+	pr_debug("Serial Notify reached the client after %lu ms.", latency);
+}
+
+/*
+ * Sends the queued Serial Notify to client @fd, if any. Unless @block, gives up
+ * (and returns 0) as soon as the socket can't take any more. (The caller is
+ * then expected to poll() for POLLOUT.)
+ */
+int
+notify_queue_flush(struct notify_queue *queue, int fd, bool block)
+{
+	ssize_t sent;
+
+	while (queue->pending) {
+		sent = send(fd, queue->pdu + queue->sent,
+		    RTRPDU_SERIAL_NOTIFY_LEN - queue->sent,
+		    MSG_NOSIGNAL | (block ? 0 : MSG_DONTWAIT));
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlogical-op"
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+#pragma GCC diagnostic pop
+			return pr_errno(errno, "Error sending Serial Notify");
+		}
+
+		queue->sent += sent;
+		if (queue->sent < RTRPDU_SERIAL_NOTIFY_LEN)
+			continue;
+
+		pr_debug("Sent %s PDU to client.",
+		    pdutype2str(PDU_TYPE_SERIAL_NOTIFY));
+		metrics_pdu_sent(PDU_TYPE_SERIAL_NOTIFY,
+		    RTRPDU_SERIAL_NOTIFY_LEN);
+		record_latency(queue);
+		queue->pending = false;
+
+		if (queue->outdated) {
+			queue->outdated = false;
+			prepare(queue, fd);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Flags client @fd (once) if its Serial Notify has been waiting for too long.
+ * (Presumably, its TCP window is full.)
+ */
+void
+notify_queue_check(struct notify_queue *queue, int fd)
+{
+	if (!queue->pending || queue->stalled)
+		return;
+	if (elapsed_ms(&queue->queued) < NOTIFY_STALL_THRESHOLD * 1000)
+		return;
+
+	pr_warn("Client %d hasn't taken its Serial Notify for %d seconds; it seems to be stuck.",
+	    fd, NOTIFY_STALL_THRESHOLD);
+
+	queue->stalled = true;
+	pthread_mutex_lock(&lock);
+	stats.stalled++;
+	pthread_mutex_unlock(&lock);
 }
@@ -1,6 +1,52 @@
 #ifndef SRC_NOTIFY_H_
 #define SRC_NOTIFY_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "rtr/pdu.h"
+
+/*
+ * Serial Notifies are not written to the clients' sockets by notify_clients();
+ * it only wakes up each client's thread (through a pipe), which then sends the
+ * PDU without blocking, in between its responses.
+ */
+
 int notify_clients(void);
+time_t notify_postponed_at(void);
+
+struct notify_stats {
+	/* Serial Notifies that reached their clients */
+	unsigned long sent;
+	/* Milliseconds between notify_clients() and the PDUs being sent */
+	unsigned long latency_sum;
+	unsigned long latency_max;
+	/* Clients whose Serial Notify is currently stuck */
+	unsigned int stalled;
+};
+
+void notify_get_stats(struct notify_stats *);
+
+/* Per-client outbound Serial Notify. Only the client's thread touches it. */
+struct notify_queue {
+	/* Written by notify_clients() to wake up the client's thread */
+	int pipe[2];
+	/* The serialized PDU, and how much of it has been sent */
+	unsigned char pdu[RTRPDU_SERIAL_NOTIFY_LEN];
+	size_t sent;
+	bool pending;
+	/* A newer serial arrived while @pdu was half sent */
+	bool outdated;
+	/* When notify_clients() queued @pdu (monotonic clock) */
+	struct timespec queued;
+	/* Has it been waiting for too long? */
+	bool stalled;
+};
+
+int notify_queue_init(struct notify_queue *);
+void notify_queue_cleanup(struct notify_queue *);
+void notify_queue_wakeup(struct notify_queue *, int);
+int notify_queue_flush(struct notify_queue *, int, bool);
+void notify_queue_check(struct notify_queue *, int);
 
 #endif /* SRC_NOTIFY_H_ */
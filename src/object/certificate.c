@@ -14,6 +14,8 @@
 #include "asn1/decode.h"
 #include "asn1/oid.h"
 #include "asn1/asn1c/IPAddrBlocks.h"
+#include "fetch_scheduler.h"
+#include "rpp_cache.h"
 #include "crypto/hash.h"
 #include "object/bgpsec.h"
 #include "object/name.h"
@@ -1907,7 +1909,7 @@ exec_rsync_method(struct sia_ca_uris *sia_uris)
 {
 	int error;
 
-	error = download_files(sia_uris->caRepository.uri, false, false);
+	error = download_files_async(sia_uris->caRepository.uri);
 	if (error)
 		return error;
 
@@ -1920,7 +1922,7 @@ exec_rsync_method(struct sia_ca_uris *sia_uris)
  * change (and probably the sia_ca_uris struct as well).
  */
 static int
-use_access_method(struct sia_ca_uris *sia_uris,
+__use_access_method(struct sia_ca_uris *sia_uris,
     access_method_exec rsync_cb, access_method_exec rrdp_cb,
     bool *rsync_utilized)
 {
@@ -1928,6 +1930,7 @@ use_access_method(struct sia_ca_uris *sia_uris,
 	access_method_exec *cb_secondary;
 	rrdp_req_status_t rrdp_req_status;
 	bool primary_rrdp;
+	int primary_error;
 	int error;
 
 	/*
@@ -1974,6 +1977,13 @@ use_access_method(struct sia_ca_uris *sia_uris,
 		primary_rrdp = config_get_rsync_priority()
 		    < config_get_rrdp_priority();
 
+	/* Don't wait for a failing host if the other one seems fine */
+	if (fetch_scheduler_is_down(primary_rrdp
+	    ? sia_uris->rpkiNotify.uri : sia_uris->caRepository.uri) &&
+	    !fetch_scheduler_is_down(primary_rrdp
+	    ? sia_uris->caRepository.uri : sia_uris->rpkiNotify.uri))
+		primary_rrdp = !primary_rrdp;
+
 	cb_primary = primary_rrdp ? rrdp_cb : rsync_cb;
 	cb_secondary = primary_rrdp ? rsync_cb : rrdp_cb;
 
@@ -1983,6 +1993,10 @@ use_access_method(struct sia_ca_uris *sia_uris,
 		(*rsync_utilized) = !primary_rrdp;
 		return 0;
 	}
+	if (error == -EINPROGRESS) {
+		(*rsync_utilized) = !primary_rrdp;
+		return error;
+	}
 
 	if (primary_rrdp) {
 		if (error != -EPERM)
@@ -1999,8 +2013,59 @@ use_access_method(struct sia_ca_uris *sia_uris,
 		    uri_get_global(sia_uris->rpkiNotify.uri));
 	}
 
+	primary_error = error;
 	(*rsync_utilized) = primary_rrdp;
-	return cb_secondary(sia_uris);
+	error = cb_secondary(sia_uris);
+
+	/* The preferred one might still work later; retry the whole thing */
+	if (error && primary_error == -EAGAIN)
+		return -EAGAIN;
+	return error;
+}
+
+static int
+use_access_method(struct sia_ca_uris *sia_uris,
+    access_method_exec rsync_cb, access_method_exec rrdp_cb,
+    bool *rsync_utilized)
+{
+	int error;
+
+	error = __use_access_method(sia_uris, rsync_cb, rrdp_cb,
+	    rsync_utilized);
+
+	/* Being downloaded in the background; come back later */
+	return (error == -EINPROGRESS) ? -EAGAIN : error;
+}
+
+/*
+ * Validates and traverses @pp, the RPP of manifest @mft, and records its result
+ * so the next cycles can reuse it. (See rpp_cache.h.)
+ */
+static void
+traverse_rpp(struct validation *state, struct rpki_uri *cert_uri,
+    struct rpki_uri *mft, struct rpp *pp)
+{
+	struct rpp_output *output;
+	int error;
+
+	if (!config_get_incremental_validation() ||
+	    rpp_output_create(&output) != 0) {
+		rpp_traverse(pp);
+		return;
+	}
+
+	validation_set_rpp_output(state, output);
+	error = rpp_traverse(pp);
+	validation_set_rpp_output(state, NULL);
+
+	if (error) {
+		/* Validate it again next time, so the errors are reported */
+		rpp_output_destroy(output);
+		return;
+	}
+
+	rpp_cache_store(cert_uri, mft, pp, output,
+	    validation_changeset_version(state));
 }
 
 /** Boilerplate code for CA certificate validation and recursive traversal. */
@@ -2021,6 +2086,7 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	enum cert_type type;
 	struct rpp *pp;
 	bool mft_retry;
+	bool reused;
 	int error;
 
 	state = state_retrieve();
@@ -2125,6 +2191,7 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	 * Avoid to re-download the repo if the mft was fetched with RRDP.
 	 */
 	mft_retry = true;
+	reused = false;
 	error = use_access_method(&sia_uris, exec_rsync_method,
 	    exec_rrdp_method, &mft_retry);
 	if (error)
@@ -2139,6 +2206,13 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 
 		cert = NULL; /* Ownership stolen */
 
+		/* Skip the validation if nothing changed since the last one */
+		error = rpp_cache_replay(cert_uri, sia_uris.mft.uri, &pp);
+		if (error != -ENOENT) {
+			reused = (error == 0);
+			break;
+		}
+
 		error = handle_manifest(sia_uris.mft.uri, &pp);
 		if (error == 0 || !mft_retry)
 			break;
@@ -2164,7 +2238,10 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	}
 
 	/* -- Validate & traverse the RPP (@pp) described by the manifest -- */
-	rpp_traverse(pp);
+	if (reused)
+		rpp_traverse(pp);
+	else
+		traverse_rpp(state, cert_uri, sia_uris.mft.uri, pp);
 
 	rpp_refput(pp);
 revert_uris:
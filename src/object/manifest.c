@@ -4,6 +4,7 @@
 
 #include "algorithm.h"
 #include "log.h"
+#include "object_store.h"
 #include "thread_var.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
@@ -146,6 +147,31 @@ validate_manifest(struct Manifest *manifest)
 	return 0;
 }
 
+/*
+ * Validates the file against its manifest hash. If the file already is the
+ * stored object of that hash, it's known to match, so it's not hashed again.
+ */
+static int
+validate_file_hash(struct rpki_uri *uri, BIT_STRING_t const *hash)
+{
+	int error;
+
+	if (hash->bits_unused == 0 &&
+	    object_store_contains(uri_get_local(uri), hash->buf, hash->size))
+		return 0;
+
+	error = hash_validate_mft_file("sha256", uri, hash);
+	if (error)
+		return error;
+
+	/* The store is only an optimization; the file is fine anyway. */
+	if (object_store_adopt(uri_get_local(uri), hash->buf, hash->size))
+		pr_warn("Couldn't add '%s' to the object store.",
+		    uri_get_printable(uri));
+
+	return 0;
+}
+
 static int
 build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, struct rpp **pp)
 {
@@ -170,7 +196,7 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, struct rpp **pp)
 		if (error)
 			goto fail;
 
-		error = hash_validate_mft_file("sha256", uri, &fah->hash);
+		error = validate_file_hash(uri, &fah->hash);
 		if (error) {
 			uri_refput(uri);
 			continue;
@@ -253,6 +279,7 @@ handle_manifest(struct rpki_uri *uri, struct rpp **pp)
 	error = validate_manifest(mft);
 	if (error)
 		goto revert_args;
+	rpp_set_next_update(*pp, asn_GT2time(&mft->nextUpdate, NULL, false));
 	error = refs_validate_ee(&sobj_args.refs, *pp, uri);
 	if (error)
 		goto revert_args;
@@ -7,17 +7,22 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <openssl/evp.h>
 
 #include "cert_stack.h"
+#include "changeset.h"
 #include "common.h"
 #include "config.h"
+#include "file.h"
 #include "line_file.h"
 #include "log.h"
+#include "object_store.h"
 #include "random.h"
+#include "rpp_cache.h"
 #include "state.h"
 #include "thread_var.h"
 #include "validation_handler.h"
@@ -25,10 +30,10 @@
 #include "http/http.h"
 #include "object/certificate.h"
 #include "rsync/rsync.h"
+#include "rsync/rsync_pool.h"
 #include "rtr/db/vrps.h"
 #include "rrdp/db/db_rrdp.h"
-
-#define TAL_FILE_EXTENSION	".tal"
+#include "rrdp/rrdp_generation.h"
 
 struct uris {
 	struct rpki_uri **array; /* This is an array of rpki URIs. */
@@ -46,6 +51,9 @@ struct tal {
 struct fv_param {
 	int *exit_status; /* Return status of the file validation */
 	char *tal_file;
+	/* The TAL files to validate; NULL means all of them */
+	struct string_array const *tals;
+	tal_table_cb cb;
 	void *arg;
 };
 
@@ -442,12 +450,111 @@ write_http_cer(unsigned char *content, size_t size, size_t nmemb, void *arg)
 	return read;
 }
 
+/*
+ * The rsync TAs only get here between validation cycles (see tal_poll_ta());
+ * handle_tal_uri() downloads them itself.
+ */
 static int
-handle_https_uri(struct rpki_uri *uri)
+download_ta(struct rpki_uri *uri)
 {
+	if (uri_is_rsync(uri))
+		return download_ta_poll(uri);
 	return http_download_file(uri, write_http_cer);
 }
 
+/*
+ * Downloads the TA certificate @uri, and tells whether it's any different from
+ * the previous copy. The changeset (see changeset.h) is told as well.
+ */
+static int
+download_and_compare(struct rpki_uri *uri, bool *changed)
+{
+	struct file_contents old;
+	struct file_contents new;
+	struct stat st;
+	int error;
+
+	old.buffer = NULL;
+	if (stat(uri_get_local(uri), &st) == 0 &&
+	    file_load(uri_get_local(uri), &old) != 0)
+		old.buffer = NULL;
+
+	error = download_ta(uri);
+	if (error)
+		goto end;
+
+	error = file_load(uri_get_local(uri), &new);
+	if (error)
+		goto end;
+	*changed = old.buffer == NULL ||
+	    old.buffer_size != new.buffer_size ||
+	    memcmp(old.buffer, new.buffer, new.buffer_size) != 0;
+	file_free(&new);
+
+	if (*changed)
+		error = changeset_add_file(uri_get_global(uri));
+
+end:
+	if (old.buffer != NULL)
+		file_free(&old);
+	return error;
+}
+
+/*
+ * The whole certificate is downloaded every time, so the changeset needs to be
+ * told whether it's any different from the previous copy.
+ */
+static int
+handle_https_uri(struct rpki_uri *uri)
+{
+	bool changed;
+
+	if (!config_get_incremental_validation())
+		return http_download_file(uri, write_http_cer);
+
+	return download_and_compare(uri, &changed);
+}
+
+static int
+poll_ta_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
+{
+	/* Same as handle_tal_uri(): 0 means "try the next URI" */
+	return (download_and_compare(uri, arg) == 0) ? 1 : 0;
+}
+
+/*
+ * Downloads the TA certificate of @tal again, from the first URI that works,
+ * and tells whether it changed. Meant to be called between validation cycles.
+ */
+void
+tal_poll_ta(struct tal *tal, bool *changed)
+{
+	*changed = false;
+	if (foreach_uri(tal, poll_ta_uri, changed) == 0)
+		pr_debug("None of the URIs of the TAL '%s' could be polled.",
+		    tal->file_name);
+}
+
+/*
+ * If a fetch was postponed (see fetch_scheduler.h), waits until it can be
+ * retried. Returns false if there's nothing to wait for.
+ */
+static bool
+wait_for_retry(struct validation *state)
+{
+	time_t retry_at;
+	time_t now;
+
+	retry_at = validation_pop_retry(state);
+	if (retry_at == 0)
+		return false;
+
+	now = time(NULL);
+	if (retry_at > now)
+		sleep(retry_at - now);
+	return true;
+}
+
 /**
  * Performs the whole validation walkthrough on uri @uri, which is assumed to
  * have been extracted from a TAL.
@@ -473,6 +580,8 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	struct validation *state;
 	struct cert_stack *certstack;
 	struct deferred_cert deferred;
+	time_t retry_at;
+	time_t now;
 	int error;
 
 	validation_handler.handle_roa_v4 = handle_roa_v4;
@@ -484,10 +593,13 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	if (error)
 		return ENSURE_NEGATIVE(error);
 
-	if (uri_is_rsync(uri))
-		error = download_files(uri, true, false);
-	else
+	if (uri_is_rsync(uri)) {
+		do {
+			error = download_files(uri, true, false);
+		} while (error == -EAGAIN && wait_for_retry(state));
+	} else {
 		error = handle_https_uri(uri);
+	}
 
 	if (error) {
 		validation_destroy(state);
@@ -511,8 +623,13 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	if (error)
 		goto end;
 
-	/* Handle root certificate. */
-	error = certificate_traverse(NULL, uri);
+	/*
+	 * Handle root certificate. Nothing else can be validated meanwhile, so
+	 * if its repository has to be retried, just wait.
+	 */
+	do {
+		error = certificate_traverse(NULL, uri);
+	} while (error == -EAGAIN && wait_for_retry(state));
 	if (error) {
 		switch (validation_pubkey_state(state)) {
 		case PKS_INVALID:
@@ -547,14 +664,35 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 		} else if (error) /* All other errors are critical, currently */
 			pr_crit("deferstack_pop() returned illegal %d.", error);
 
+		/*
+		 * Postponed certificates are only popped early once nothing
+		 * else can be traversed sooner, so there's nothing left to do
+		 * but wait.
+		 */
+		now = time(NULL);
+		if (deferred.retry_at > now)
+			sleep(deferred.retry_at - now);
+
 		/*
 		 * Ignore result code; remaining certificates are unrelated,
 		 * so they should not be affected.
 		 */
-		certificate_traverse(deferred.pp, deferred.uri);
+		error = certificate_traverse(deferred.pp, deferred.uri);
+
+		/* Repository fetch postponed; queue it after the siblings */
+		retry_at = validation_pop_retry(state);
+		if (error == -EAGAIN && retry_at != 0) {
+			deferred.retry_at = retry_at;
+			error = deferstack_postpone(certstack, &deferred);
+		} else {
+			error = 0;
+		}
 
 		uri_refput(deferred.uri);
 		rpp_refput(deferred.pp);
+		/* Don't lose the subtree silently; reject the TAL instead */
+		if (error)
+			goto fail;
 	} while (true);
 
 fail:	error = ENSURE_NEGATIVE(error);
@@ -563,11 +701,56 @@ end:	validation_destroy(state);
 	return error;
 }
 
+/*
+ * Attributes the VRPs that will be added to @table to the TAL at @tal_file. The
+ * Trust Anchor is named after the file, minus the directory and extension.
+ */
+static int
+set_table_ta(struct db_table *table, char const *tal_file)
+{
+	char const *ta;
+	char *name;
+	size_t len;
+
+	ta = strrchr(tal_file, '/');
+	ta = (ta != NULL) ? (ta + 1) : tal_file;
+	len = strlen(ta);
+	if (len > 4 && strcmp(ta + len - 4, ".tal") == 0)
+		len -= 4;
+
+	name = strndup(ta, len);
+	if (name == NULL)
+		return pr_enomem();
+	ta = db_table_intern_ta(name);
+	free(name);
+	if (ta == NULL)
+		return pr_enomem();
+
+	db_table_set_ta(table, ta);
+	return 0;
+}
+
+/* Hands the VRPs of the TAL over, since they're complete */
+static int
+publish_table(struct fv_param *param, struct db_table *table)
+{
+	int state;
+	int error;
+
+	/* Don't let terminate_standalone_validation() leave the DB locked */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	error = param->cb(param->tal_file, table, param->arg);
+	pthread_setcancelstate(state, NULL);
+
+	return error;
+}
+
 static void *
 do_file_validation(void *thread_arg)
 {
 	struct fv_param param;
 	struct tal *tal;
+	struct db_table *table;
 	int error;
 
 	memcpy(&param, thread_arg, sizeof(param));
@@ -576,13 +759,23 @@ do_file_validation(void *thread_arg)
 	fnstack_init();
 	fnstack_push(param.tal_file);
 
+	table = db_table_create();
+	if (table == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	error = set_table_ta(table, param.tal_file);
+	if (error)
+		goto destroy_table;
+
 	error = tal_load(param.tal_file, &tal);
 	if (error)
-		goto end;
+		goto destroy_table;
 
 	if (config_get_shuffle_tal_uris())
 		tal_shuffle_uris(tal);
-	error = foreach_uri(tal, handle_tal_uri, param.arg);
+	error = foreach_uri(tal, handle_tal_uri, table);
 	if (error > 0)
 		error = 0;
 	else if (error == 0)
@@ -590,6 +783,14 @@ do_file_validation(void *thread_arg)
 		    param.tal_file);
 
 	tal_destroy(tal);
+	if (error)
+		goto destroy_table;
+
+	error = publish_table(&param, table);
+	goto end;
+
+destroy_table:
+	db_table_destroy(table);
 end:
 	fnstack_cleanup();
 	free(param.tal_file);
@@ -606,16 +807,35 @@ thread_destroy(struct thread *thread)
 	free(thread);
 }
 
+static bool
+is_selected(struct string_array const *tals, char const *tal_file)
+{
+	size_t i;
+
+	if (tals == NULL)
+		return true;
+
+	for (i = 0; i < tals->length; i++)
+		if (strcmp(tals->array[i], tal_file) == 0)
+			return true;
+
+	return false;
+}
+
 /* Creates a thread for the @tal_file */
 static int
 __do_file_validation(char const *tal_file, void *arg)
 {
+	struct fv_param *parent = arg;
 	struct thread *thread;
 	struct fv_param *param;
 	static pthread_t pid;
 	int *exit_status;
 	int error;
 
+	if (!is_selected(parent->tals, tal_file))
+		return 0;
+
 	error = db_rrdp_add_tal(tal_file);
 	if (error)
 		return error;
@@ -634,7 +854,9 @@ __do_file_validation(char const *tal_file, void *arg)
 
 	param->exit_status = exit_status;
 	param->tal_file = strdup(tal_file);
-	param->arg = arg;
+	param->tals = NULL;
+	param->cb = parent->cb;
+	param->arg = parent->arg;
 
 	errno = pthread_create(&pid, NULL, do_file_validation, param);
 	if (errno) {
@@ -666,18 +888,41 @@ free_db_rrdp:
 	return error;
 }
 
+/*
+ * Validates the TAL files listed in @tals (all of them if @tals is NULL), each
+ * one in its own thread. As soon as a TAL is done, @cb receives its VRPs (and
+ * owns them from then on). TALs that fail don't call @cb.
+ *
+ * Returns the error of the last failed TAL, if any. @cb might have already
+ * been called for the other TALs.
+ */
 int
-perform_standalone_validation(struct db_table *table)
+perform_standalone_validation(struct string_array const *tals,
+    tal_table_cb cb, void *arg)
 {
+	struct fv_param param;
 	struct thread *thread;
 	int error, t_error;
 
 	/* Set existent tal RRDP info to non visited */
-	db_rrdp_reset_visited_tals();
+	if (tals == NULL)
+		db_rrdp_reset_visited_tals();
+
+	/* Staging dirs of RRDP updates that were interrupted */
+	rrdp_generation_cleanup();
+
+	/* Every repository has to be rsync'd again */
+	reset_downloaded();
+
+	rpp_cache_new_cycle();
+
+	param.tals = tals;
+	param.cb = cb;
+	param.arg = arg;
 
 	SLIST_INIT(&threads);
 	error = process_file_or_dir(config_get_tal(), TAL_FILE_EXTENSION,
-	    __do_file_validation, table);
+	    __do_file_validation, &param);
 	if (error)
 		return error;
 
@@ -692,13 +937,26 @@ perform_standalone_validation(struct db_table *table)
 		SLIST_REMOVE_HEAD(&threads, next);
 		if (*thread->exit_status) {
 			t_error = *thread->exit_status;
-			pr_warn("Validation from TAL '%s' yielded error, discarding any other validation results.",
+			pr_warn("Validation from TAL '%s' yielded error, keeping its previous results.",
 			    thread->file);
 		}
 		thread_destroy(thread);
 	}
 
-	/* One thread has errors, validation can't keep the resulting table */
+	/* Postponed CAs might have been abandoned; don't leave rsyncs behind */
+	rsync_pool_wait();
+
+	/* Nobody's using the store now; drop what's no longer published */
+	object_store_purge();
+
+	/* The TALs that weren't validated still need the rest */
+	if (tals != NULL)
+		return t_error;
+
+	/* Forget the RPPs that weren't reached this time */
+	rpp_cache_purge();
+
+	/* Some TAL failed, so the visited RRDPs are not the whole picture */
 	if (t_error)
 		return t_error;
 
@@ -3,10 +3,14 @@
 
 /* This is RFC 8630. */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include "uri.h"
+#include "config/string_array.h"
 #include "rtr/db/db_table.h"
 
+#define TAL_FILE_EXTENSION	".tal"
+
 struct tal;
 
 int tal_load(char const *, struct tal **);
@@ -18,8 +22,12 @@ void tal_shuffle_uris(struct tal *);
 
 char const *tal_get_file_name(struct tal *);
 void tal_get_spki(struct tal *, unsigned char const **, size_t *);
+void tal_poll_ta(struct tal *, bool *);
 
-int perform_standalone_validation(struct db_table *);
+/* Receives the file name of a TAL, and the VRPs it yielded */
+typedef int (*tal_table_cb)(char const *, struct db_table *, void *);
+int perform_standalone_validation(struct string_array const *, tal_table_cb,
+    void *);
 void terminate_standalone_validation(void);
 
 #endif /* TAL_OBJECT_H_ */
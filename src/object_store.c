@@ -0,0 +1,326 @@
+#define _XOPEN_SOURCE 700
+
+#include "object_store.h"
+
+#include <errno.h>
+#include <ftw.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "crypto/hash.h"
+
+#define OBJECTS_DIR	".objects"
+#define SHA256_LEN	32
+#define MAX_FD_ALLOWED	20
+
+bool
+object_store_enabled(void)
+{
+	return config_get_object_store_enabled();
+}
+
+/* Returns "<local-repository>/.objects" */
+static int
+get_store_path(char **result)
+{
+	char const *repository;
+	size_t repository_len;
+	char *path;
+
+	repository = config_get_local_repository();
+	repository_len = strlen(repository);
+	if (repository_len > 0 && repository[repository_len - 1] == '/')
+		repository_len--;
+
+	path = malloc(repository_len + strlen(OBJECTS_DIR) + 2);
+	if (path == NULL)
+		return pr_enomem();
+
+	memcpy(path, repository, repository_len);
+	path[repository_len] = '/';
+	strcpy(path + repository_len + 1, OBJECTS_DIR);
+
+	*result = path;
+	return 0;
+}
+
+/* Returns "<local-repository>/.objects/<first hash byte>/<hash>" */
+static int
+get_object_path(unsigned char const *hash, size_t hash_len, char **result)
+{
+	char *store;
+	char *path;
+	char *cursor;
+	size_t i;
+	int error;
+
+	error = get_store_path(&store);
+	if (error)
+		return error;
+
+	/* "/xx/" + hex + NUL */
+	path = malloc(strlen(store) + 4 + 2 * hash_len + 1);
+	if (path == NULL) {
+		free(store);
+		return pr_enomem();
+	}
+
+	cursor = path + sprintf(path, "%s/%02x/", store, hash[0]);
+	for (i = 0; i < hash_len; i++)
+		cursor += sprintf(cursor, "%02x", hash[i]);
+
+	free(store);
+	*result = path;
+	return 0;
+}
+
+/*
+ * Temporal name, next to @path. Unique per thread, so threads don't step on
+ * each other while creating the same object or link.
+ */
+static int
+get_tmp_path(char const *path, char **result)
+{
+	char *tmp;
+	size_t len;
+
+	len = strlen(path) + 32;
+	tmp = malloc(len);
+	if (tmp == NULL)
+		return pr_enomem();
+
+	snprintf(tmp, len, "%s.%lx.tmp", path, (unsigned long) pthread_self());
+	*result = tmp;
+	return 0;
+}
+
+static bool
+same_file(char const *path1, char const *path2)
+{
+	struct stat stat1;
+	struct stat stat2;
+
+	if (stat(path1, &stat1) != 0 || stat(path2, &stat2) != 0)
+		return false;
+
+	return stat1.st_dev == stat2.st_dev && stat1.st_ino == stat2.st_ino;
+}
+
+/* Atomically replaces @path with a hard link to @object. */
+static int
+link_to_object(char const *object, char const *path)
+{
+	char *tmp;
+	int error;
+
+	if (same_file(object, path))
+		return 0;
+
+	error = get_tmp_path(path, &tmp);
+	if (error)
+		return error;
+
+	unlink(tmp);
+	if (link(object, tmp) != 0) {
+		error = pr_errno(errno, "Couldn't link '%s' to '%s'", tmp,
+		    object);
+		goto end;
+	}
+
+	if (rename(tmp, path) != 0) {
+		error = pr_errno(errno, "Couldn't rename '%s' to '%s'", tmp,
+		    path);
+		unlink(tmp);
+	}
+
+end:
+	free(tmp);
+	return error;
+}
+
+static int
+create_object(char const *object, unsigned char const *content,
+    size_t content_len)
+{
+	char *tmp;
+	FILE *file;
+	size_t written;
+	int error;
+
+	error = create_dir_recursive(object);
+	if (error)
+		return error;
+
+	error = get_tmp_path(object, &tmp);
+	if (error)
+		return error;
+
+	file = fopen(tmp, "wb");
+	if (file == NULL) {
+		error = pr_errno(errno, "Could not open file '%s'", tmp);
+		goto end;
+	}
+
+	written = fwrite(content, 1, content_len, file);
+	if (fclose(file) != 0 || written != content_len) {
+		error = pr_err("Couldn't write bytes to file '%s'", tmp);
+		unlink(tmp);
+		goto end;
+	}
+
+	/* Other thread might have created it meanwhile; it's the same data. */
+	if (rename(tmp, object) != 0) {
+		error = pr_errno(errno, "Couldn't rename '%s' to '%s'", tmp,
+		    object);
+		unlink(tmp);
+	}
+
+end:
+	free(tmp);
+	return error;
+}
+
+/*
+ * Stores @content (unless an identical object is already stored), and leaves
+ * @path as a link to it. If @path already was the same object, it's not
+ * rewritten.
+ *
+ * @path's parent directories must already exist.
+ */
+int
+object_store_write(char const *path, unsigned char const *content,
+    size_t content_len)
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+	struct stat object_stat;
+	char *object;
+	int error;
+
+	error = hash_buffer("sha256", content, content_len, hash, &hash_len);
+	if (error)
+		return error;
+
+	error = get_object_path(hash, hash_len, &object);
+	if (error)
+		return error;
+
+	if (stat(object, &object_stat) != 0) {
+		error = create_object(object, content, content_len);
+		if (error)
+			goto end;
+	}
+
+	error = link_to_object(object, path);
+end:
+	free(object);
+	return error;
+}
+
+/*
+ * Returns true if the file at @path is the stored object whose SHA-256 is
+ * @hash. In that case, there's no need to hash the file again.
+ */
+bool
+object_store_contains(char const *path, unsigned char const *hash,
+    size_t hash_len)
+{
+	char *object;
+	bool result;
+
+	if (!object_store_enabled() || hash_len != SHA256_LEN)
+		return false;
+
+	if (get_object_path(hash, hash_len, &object) != 0)
+		return false;
+
+	result = same_file(object, path);
+
+	free(object);
+	return result;
+}
+
+/*
+ * The file at @path is known to have the SHA-256 @hash (usually because it was
+ * just validated against its manifest), so move it into the store. If the
+ * object already exists, @path is deduplicated.
+ */
+int
+object_store_adopt(char const *path, unsigned char const *hash,
+    size_t hash_len)
+{
+	struct stat object_stat;
+	char *object;
+	int error;
+
+	if (!object_store_enabled() || hash_len != SHA256_LEN)
+		return 0;
+
+	error = get_object_path(hash, hash_len, &object);
+	if (error)
+		return error;
+
+	if (stat(object, &object_stat) == 0) {
+		error = link_to_object(object, path);
+		goto end;
+	}
+
+	error = create_dir_recursive(object);
+	if (error)
+		goto end;
+
+	if (link(path, object) != 0 && errno != EEXIST)
+		error = pr_errno(errno, "Couldn't link '%s' to '%s'", object,
+		    path);
+
+end:
+	free(object);
+	return error;
+}
+
+static int
+purge_object(char const *path, struct stat const *sb, int flag,
+    struct FTW *ftwbuf)
+{
+	/* Only the store references it, so it's no longer published */
+	if (flag == FTW_F && sb->st_nlink <= 1) {
+		pr_debug("Removing unreferenced object '%s'.", path);
+		if (unlink(path) != 0)
+			pr_warn("Couldn't delete '%s': %s", path,
+			    strerror(errno));
+	}
+
+	return 0;
+}
+
+/* Removes the objects that are no longer linked from the local repository. */
+int
+object_store_purge(void)
+{
+	char *store;
+	int error;
+
+	if (!object_store_enabled())
+		return 0;
+
+	error = get_store_path(&store);
+	if (error)
+		return error;
+
+	errno = 0;
+	if (nftw(store, purge_object, MAX_FD_ALLOWED, FTW_PHYS) != 0 &&
+	    errno != ENOENT)
+		error = pr_errno(errno, "Couldn't purge the object store '%s'",
+		    store);
+
+	free(store);
+	return error;
+}
@@ -0,0 +1,27 @@
+#ifndef SRC_OBJECT_STORE_H_
+#define SRC_OBJECT_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Content-addressed store of repository objects, shared by rsync and RRDP.
+ *
+ * Objects are kept at "<local-repository>/.objects/", named after their
+ * SHA-256. The regular (URI-based) local files are hard links to them, so the
+ * link itself is the URI -> hash index: if the file of a URI is the same inode
+ * as the object of a hash, the file's content is known to match the hash.
+ *
+ * Nothing here is fatal; if the store can't be used, the callers fall back to
+ * the regular files.
+ */
+
+bool object_store_enabled(void);
+
+int object_store_write(char const *, unsigned char const *, size_t);
+bool object_store_contains(char const *, unsigned char const *, size_t);
+int object_store_adopt(char const *, unsigned char const *, size_t);
+
+int object_store_purge(void);
+
+#endif /* SRC_OBJECT_STORE_H_ */
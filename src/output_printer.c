@@ -1,150 +1,683 @@
 #include "output_printer.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include "common.h"
 #include "config.h"
-#include "file.h"
 #include "log.h"
-#include "crypto/base64.h"
-#include "rtr/db/vrp.h"
 
-char addr_buf[INET6_ADDRSTRLEN];
+/*
+ * The files are printed by a thread of their own, from sorted copies of the
+ * base (see snapshot.h), so whoever requests them doesn't wait for the disk.
+ * Every format is printed from the same copy.
+ * If a newer copy arrives before the thread gets to the previous one, the
+ * previous one is dropped.
+ *
+ * Each file is written into a temporal file, which then replaces it, so
+ * readers never see a partial one.
+ */
 
-static int
-load_output_file(char const *output, FILE **result, bool *fopen)
-{
-	FILE *tmp;
-	struct stat stat;
+#define OUTPUT_BUFFER_SIZE	(1 << 16)
+/* More than the longest line (a JSON router key) needs */
+#define OUTPUT_LINE_MAX		1024
+
+struct output_buffer {
+	int fd;
+	char data[OUTPUT_BUFFER_SIZE];
+	size_t len;
+	/* errno of the first write() that failed */
 	int error;
+};
+
+/* Everything a file is printed from */
+struct output_job {
+	struct snapshot_header hdr;
+	struct snapshot_records records;
+};
+
+typedef void (*print_records_cb)(struct output_buffer *,
+    struct output_job const *);
+
+static struct output_buffer buffer;
+
+static pthread_t thread;
+static bool thread_running;
+/* Protects the variables below */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+/* The job the thread should print next, if @pending */
+static struct output_job next;
+static bool pending;
+static bool stopping;
+
+static void
+buffer_flush(struct output_buffer *out)
+{
+	char const *data;
+	ssize_t written;
+
+	data = out->data;
+	while (out->len > 0 && !out->error) {
+		written = write(out->fd, data, out->len);
+		if (written < 0) {
+			if (errno != EINTR)
+				out->error = errno;
+			continue;
+		}
+		data += written;
+		out->len -= written;
+	}
+
+	out->len = 0;
+}
+
+/* Returns where the next line (up to OUTPUT_LINE_MAX bytes) should go. */
+static char *
+buffer_line(struct output_buffer *out)
+{
+	if (out->len + OUTPUT_LINE_MAX > sizeof(out->data))
+		buffer_flush(out);
+	return out->data + out->len;
+}
+
+/* Accepts the line that was printed into buffer_line(), up to @end. */
+static void
+buffer_commit(struct output_buffer *out, char *end)
+{
+	out->len = end - out->data;
+}
+
+static char *
+print_str(char *dst, char const *str)
+{
+	while (*str != '\0')
+		*dst++ = *str++;
+	return dst;
+}
+
+static char *
+print_u32(char *dst, uint32_t value)
+{
+	char digits[10];
+	unsigned int i;
+
+	i = 0;
+	do {
+		digits[i++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	while (i > 0)
+		*dst++ = digits[--i];
+	return dst;
+}
+
+/* Lowercase, no leading zeroes */
+static char *
+print_hex16(char *dst, unsigned int value)
+{
+	static char const hex[] = "0123456789abcdef";
+	unsigned int digit;
+	bool started;
+	int shift;
 
-	if (output == NULL) {
-		*result = NULL;
-		return 0;
+	started = false;
+	for (shift = 12; shift >= 0; shift -= 4) {
+		digit = (value >> shift) & 0xF;
+		if (digit != 0 || started || shift == 0) {
+			*dst++ = hex[digit];
+			started = true;
+		}
 	}
 
-	*fopen = false;
-	if (strcmp(output, "-") == 0) {
-		*result = stdout;
-		return 0;
+	return dst;
+}
+
+static char *
+print_ipv4(char *dst, uint8_t const *addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		if (i != 0)
+			*dst++ = '.';
+		dst = print_u32(dst, addr[i]);
 	}
 
-	error = file_write(output, &tmp, &stat);
-	if (error) {
-		*result = NULL;
-		return error;
+	return dst;
+}
+
+/*
+ * Same output as inet_ntop(): RFC 5952 (the first longest run of two or more
+ * zero groups becomes "::"), and glibc's dotted quad for IPv4-compatible and
+ * IPv4-mapped addresses.
+ */
+static char *
+print_ipv6(char *dst, uint8_t const *addr)
+{
+	unsigned int words[8];
+	int best_start, best_len;
+	int cur_start, cur_len;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		words[i] = (addr[2 * i] << 8) | addr[2 * i + 1];
+
+	best_start = -1;
+	best_len = 0;
+	cur_start = -1;
+	cur_len = 0;
+	for (i = 0; i < 8; i++) {
+		if (words[i] != 0) {
+			cur_start = -1;
+			continue;
+		}
+		if (cur_start == -1) {
+			cur_start = i;
+			cur_len = 0;
+		}
+		cur_len++;
+		if (cur_len > best_len) {
+			best_start = cur_start;
+			best_len = cur_len;
+		}
 	}
+	if (best_len < 2)
+		best_start = -1;
 
-	*fopen = true;
-	*result = tmp;
-	return 0;
+	for (i = 0; i < 8; i++) {
+		if (best_start != -1 && best_start <= i &&
+		    i < best_start + best_len) {
+			if (i == best_start)
+				*dst++ = ':';
+			continue;
+		}
+		if (i != 0)
+			*dst++ = ':';
+		if (i == 6 && best_start == 0 && (best_len == 6 ||
+		    (best_len == 5 && words[5] == 0xFFFF)))
+			return print_ipv4(dst, addr + 12);
+		dst = print_hex16(dst, words[i]);
+	}
+
+	if (best_start != -1 && best_start + best_len == 8)
+		*dst++ = ':';
+	return dst;
 }
 
-static int
-print_roa(struct vrp const *vrp, void *arg)
+/* Uppercase */
+static char *
+print_hex(char *dst, uint8_t const *src, size_t len)
 {
-	FILE *out = arg;
+	static char const hex[] = "0123456789ABCDEF";
 
-	switch (vrp->addr_fam) {
-	case AF_INET:
-		fprintf(out, "AS%u,%s/%u,%u\n", vrp->asn,
-		    addr2str4(&vrp->prefix.v4, addr_buf), vrp->prefix_length,
-		    vrp->max_prefix_length);
-		break;
-	case AF_INET6:
-		fprintf(out, "AS%u,%s/%u,%u\n", vrp->asn,
-		    addr2str6(&vrp->prefix.v6, addr_buf), vrp->prefix_length,
-		    vrp->max_prefix_length);
-		break;
-	default:
-		pr_crit("Unknown family type");
+	for (; len > 0; len--, src++) {
+		*dst++ = hex[*src >> 4];
+		*dst++ = hex[*src & 0xF];
 	}
 
-	return 0;
+	return dst;
 }
 
-/* Print as base64url strings without trailing pad */
-static int
-print_router_key(struct router_key const *key, void *arg)
+static char *
+print_base64_alphabet(char *dst, uint8_t const *src, size_t len,
+    char const *alphabet, bool pad)
 {
-	FILE *out = arg;
-	char *buf1, *buf2;
-	int error;
+	for (; len >= 3; len -= 3, src += 3) {
+		*dst++ = alphabet[src[0] >> 2];
+		*dst++ = alphabet[((src[0] & 0x03) << 4) | (src[1] >> 4)];
+		*dst++ = alphabet[((src[1] & 0x0F) << 2) | (src[2] >> 6)];
+		*dst++ = alphabet[src[2] & 0x3F];
+	}
 
-	error = base64url_encode(key->ski, RK_SKI_LEN, &buf1);
-	if (error)
-		return error;
+	if (len == 1) {
+		*dst++ = alphabet[src[0] >> 2];
+		*dst++ = alphabet[(src[0] & 0x03) << 4];
+	} else if (len == 2) {
+		*dst++ = alphabet[src[0] >> 2];
+		*dst++ = alphabet[((src[0] & 0x03) << 4) | (src[1] >> 4)];
+		*dst++ = alphabet[(src[1] & 0x0F) << 2];
+	}
 
-	error = base64url_encode(key->spk, RK_SPKI_LEN, &buf2);
-	if (error)
-		goto free1;
+	if (pad && len != 0) {
+		*dst++ = '=';
+		if (len == 1)
+			*dst++ = '=';
+	}
 
-	fprintf(out, "AS%u,%s,%s\n", key->as, buf1, buf2);
+	return dst;
+}
 
-	free(buf2);
-free1:
-	free(buf1);
-	return error;
+/* Base64url, without trailing pad */
+static char *
+print_base64url(char *dst, uint8_t const *src, size_t len)
+{
+	return print_base64_alphabet(dst, src, len,
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+	    false);
 }
 
-static int
-open_file(char const *loc, FILE **out, bool *fopen)
+/* Plain base64, padded */
+static char *
+print_base64(char *dst, uint8_t const *src, size_t len)
 {
-	int error;
+	return print_base64_alphabet(dst, src, len,
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+	    true);
+}
 
-	error = load_output_file(loc, out, fopen);
-	if (error)
-		return pr_err("Error getting file '%s'", loc);
+/* Quoted and escaped; at most 6 bytes per character of @str, plus 2. */
+static char *
+print_json_str(char *dst, char const *str)
+{
+	static char const hex[] = "0123456789abcdef";
+	unsigned char chr;
 
-	/* No output configured */
-	if (*out == NULL)
-		return -ENOENT;
+	*dst++ = '"';
+	for (; *str != '\0'; str++) {
+		chr = *str;
+		if (chr == '"' || chr == '\\') {
+			*dst++ = '\\';
+			*dst++ = chr;
+		} else if (chr < 0x20) {
+			dst = print_str(dst, "\\u00");
+			*dst++ = hex[chr >> 4];
+			*dst++ = hex[chr & 0xF];
+		} else {
+			*dst++ = chr;
+		}
+	}
+	*dst++ = '"';
 
-	return 0;
+	return dst;
 }
 
 static void
-print_roas(struct db_table *db)
+print_roas(struct output_buffer *out, struct output_job const *job)
 {
-	FILE *out;
-	bool fopen;
-	int error;
+	struct snapshot_records const *records = &job->records;
+	struct snapshot_vrp4 const *v4;
+	struct snapshot_vrp6 const *v6;
+	char *line;
+	size_t i;
 
-	out = NULL;
-	error = open_file(config_get_output_roa(), &out, &fopen);
-	if (error)
+	line = buffer_line(out);
+	line = print_str(line, "ASN,Prefix,Max prefix length\n");
+	buffer_commit(out, line);
+
+	for (i = 0; i < records->v4_count; i++) {
+		v4 = &records->v4[i];
+		line = buffer_line(out);
+		line = print_str(line, "AS");
+		line = print_u32(line, ntohl(v4->asn));
+		*line++ = ',';
+		line = print_ipv4(line, v4->prefix);
+		*line++ = '/';
+		line = print_u32(line, v4->prefix_length);
+		*line++ = ',';
+		line = print_u32(line, v4->max_length);
+		*line++ = '\n';
+		buffer_commit(out, line);
+	}
+
+	for (i = 0; i < records->v6_count; i++) {
+		v6 = &records->v6[i];
+		line = buffer_line(out);
+		line = print_str(line, "AS");
+		line = print_u32(line, ntohl(v6->asn));
+		*line++ = ',';
+		line = print_ipv6(line, v6->prefix);
+		*line++ = '/';
+		line = print_u32(line, v6->prefix_length);
+		*line++ = ',';
+		line = print_u32(line, v6->max_length);
+		*line++ = '\n';
+		buffer_commit(out, line);
+	}
+}
+
+static void
+print_router_keys(struct output_buffer *out, struct output_job const *job)
+{
+	struct snapshot_records const *records = &job->records;
+	struct snapshot_rk const *rk;
+	char *line;
+	size_t i;
+
+	line = buffer_line(out);
+	line = print_str(line,
+	    "ASN,Subject Key Identifier,Subject Public Key Info\n");
+	buffer_commit(out, line);
+
+	for (i = 0; i < records->rk_count; i++) {
+		rk = &records->rks[i];
+		line = buffer_line(out);
+		line = print_str(line, "AS");
+		line = print_u32(line, ntohl(rk->asn));
+		*line++ = ',';
+		line = print_base64url(line, rk->ski, RK_SKI_LEN);
+		*line++ = ',';
+		line = print_base64url(line, rk->spk, RK_SPKI_LEN);
+		*line++ = '\n';
+		buffer_commit(out, line);
+	}
+}
+
+/*
+ * The TA names of @records, as JSON values. The list is indexed by the ta field
+ * of the records, so the first one is null.
+ */
+static char **
+json_tas(struct snapshot_records const *records)
+{
+	char name[SNAPSHOT_TA_NAME_LEN];
+	char **tas;
+	size_t i;
+
+	tas = calloc(records->ta_count + 1, sizeof(char *));
+	if (tas == NULL)
+		return NULL;
+
+	tas[0] = strdup("null");
+	if (tas[0] == NULL)
+		goto fail;
+
+	for (i = 0; i < records->ta_count; i++) {
+		/* Same names as the snapshot */
+		strncpy(name, records->tas[i], sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+
+		tas[i + 1] = malloc(6 * strlen(name) + 3);
+		if (tas[i + 1] == NULL)
+			goto fail;
+		*print_json_str(tas[i + 1], name) = '\0';
+	}
+
+	return tas;
+
+fail:
+	for (i = 0; i <= records->ta_count; i++)
+		free(tas[i]);
+	free(tas);
+	return NULL;
+}
+
+static char *
+print_json_time(char *dst, time_t time)
+{
+	struct tm tm;
+
+	if (gmtime_r(&time, &tm) == NULL)
+		return print_str(dst, "null");
+	return dst + strftime(dst, 32, "\"%Y-%m-%dT%H:%M:%SZ\"", &tm);
+}
+
+/*
+ * Same layout as rpki-client's JSON output, so the tools that read one can read
+ * the other.
+ */
+static void
+print_json(struct output_buffer *out, struct output_job const *job)
+{
+	struct snapshot_records const *records = &job->records;
+	struct snapshot_vrp4 const *v4;
+	struct snapshot_vrp6 const *v6;
+	struct snapshot_rk const *rk;
+	char **tas;
+	char *line;
+	size_t i;
+
+	tas = json_tas(records);
+	if (tas == NULL) {
+		out->error = ENOMEM;
 		return;
+	}
 
-	fprintf(out, "ASN,Prefix,Max prefix length\n");
-	error = db_table_foreach_roa(db, print_roa, out);
-	if (fopen)
-		file_close(out);
-	if (error)
-		pr_err("Error printing ROAs");
+	line = buffer_line(out);
+	line = print_str(line, "{\n\t\"metadata\": {\n\t\t\"buildtime\": ");
+	line = print_json_time(line, job->hdr.time);
+	line = print_str(line, ",\n\t\t\"serial\": ");
+	line = print_u32(line, job->hdr.serial);
+	line = print_str(line, ",\n\t\t\"vrps\": ");
+	line = print_u32(line, records->v4_count + records->v6_count);
+	line = print_str(line, ",\n\t\t\"bgpsec_keys\": ");
+	line = print_u32(line, records->rk_count);
+	line = print_str(line, "\n\t},\n\t\"roas\": [\n");
+	buffer_commit(out, line);
+
+	for (i = 0; i < records->v4_count; i++) {
+		v4 = &records->v4[i];
+		line = buffer_line(out);
+		line = print_str(line, "\t\t{ \"asn\": ");
+		line = print_u32(line, ntohl(v4->asn));
+		line = print_str(line, ", \"prefix\": \"");
+		line = print_ipv4(line, v4->prefix);
+		*line++ = '/';
+		line = print_u32(line, v4->prefix_length);
+		line = print_str(line, "\", \"maxLength\": ");
+		line = print_u32(line, v4->max_length);
+		line = print_str(line, ", \"ta\": ");
+		line = print_str(line, tas[ntohs(v4->ta)]);
+		line = print_str(line, (i + 1 < records->v4_count ||
+		    records->v6_count > 0) ? " },\n" : " }\n");
+		buffer_commit(out, line);
+	}
+
+	for (i = 0; i < records->v6_count; i++) {
+		v6 = &records->v6[i];
+		line = buffer_line(out);
+		line = print_str(line, "\t\t{ \"asn\": ");
+		line = print_u32(line, ntohl(v6->asn));
+		line = print_str(line, ", \"prefix\": \"");
+		line = print_ipv6(line, v6->prefix);
+		*line++ = '/';
+		line = print_u32(line, v6->prefix_length);
+		line = print_str(line, "\", \"maxLength\": ");
+		line = print_u32(line, v6->max_length);
+		line = print_str(line, ", \"ta\": ");
+		line = print_str(line, tas[ntohs(v6->ta)]);
+		line = print_str(line, (i + 1 < records->v6_count) ? " },\n"
+		    : " }\n");
+		buffer_commit(out, line);
+	}
+
+	line = buffer_line(out);
+	line = print_str(line, "\t],\n\t\"bgpsec_keys\": [\n");
+	buffer_commit(out, line);
+
+	for (i = 0; i < records->rk_count; i++) {
+		rk = &records->rks[i];
+		line = buffer_line(out);
+		line = print_str(line, "\t\t{ \"asn\": ");
+		line = print_u32(line, ntohl(rk->asn));
+		line = print_str(line, ", \"ski\": \"");
+		line = print_hex(line, rk->ski, RK_SKI_LEN);
+		line = print_str(line, "\", \"pubkey\": \"");
+		line = print_base64(line, rk->spk, RK_SPKI_LEN);
+		line = print_str(line, "\", \"ta\": ");
+		line = print_str(line, tas[ntohs(rk->ta)]);
+		line = print_str(line, (i + 1 < records->rk_count) ? " },\n"
+		    : " }\n");
+		buffer_commit(out, line);
+	}
+
+	line = buffer_line(out);
+	line = print_str(line, "\t]\n}\n");
+	buffer_commit(out, line);
+
+	for (i = 0; i <= records->ta_count; i++)
+		free(tas[i]);
+	free(tas);
 }
 
+/* Prints @job into @path ("-" is the standard output) through @cb. */
 static void
-print_router_keys(struct db_table *db)
+print_file(char const *path, print_records_cb cb,
+    struct output_job const *job)
 {
-	FILE *out;
-	bool fopen;
+	char *tmp_path;
 	int error;
 
-	out = NULL;
-	error = open_file(config_get_output_bgpsec(), &out, &fopen);
-	if (error)
+	if (path == NULL)
+		return; /* No output configured */
+
+	tmp_path = NULL;
+	if (strcmp(path, "-") == 0) {
+		fflush(stdout);
+		buffer.fd = STDOUT_FILENO;
+	} else {
+		tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+		if (tmp_path == NULL) {
+			pr_enomem();
+			return;
+		}
+		strcpy(tmp_path, path);
+		strcat(tmp_path, ".tmp");
+
+		buffer.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (buffer.fd == -1) {
+			pr_errno(errno, "Could not open '%s'", tmp_path);
+			free(tmp_path);
+			return;
+		}
+	}
+
+	buffer.len = 0;
+	buffer.error = 0;
+	cb(&buffer, job);
+	buffer_flush(&buffer);
+	error = buffer.error;
+
+	if (tmp_path == NULL) {
+		if (error)
+			pr_errno(error, "Could not print to the standard output");
 		return;
+	}
 
-	fprintf(out, "ASN,Subject Key Identifier,Subject Public Key Info\n");
-	error = db_table_foreach_router_key(db, print_router_key, out);
-	if (fopen)
-		file_close(out);
-	if (error)
-		pr_err("Error printing Router Keys");
+	if (close(buffer.fd) != 0 && !error)
+		error = errno;
+	if (error) {
+		pr_errno(error, "Could not write '%s'", tmp_path);
+		remove(tmp_path);
+	} else if (rename(tmp_path, path) != 0) {
+		pr_errno(errno, "Could not rename '%s' to '%s'", tmp_path, path);
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+}
+
+static void
+print_job(struct output_job const *job)
+{
+	char const *path;
+
+	print_file(config_get_output_roa(), print_roas, job);
+	print_file(config_get_output_bgpsec(), print_router_keys, job);
+	print_file(config_get_output_json(), print_json, job);
+
+	path = config_get_output_snapshot();
+	if (path != NULL &&
+	    snapshot_write_records(path, &job->hdr, &job->records) != 0)
+		pr_warn("Could not print the VRP snapshot.");
+}
+
+static void *
+printer_loop(void *arg)
+{
+	struct output_job job;
+
+	pthread_mutex_lock(&lock);
+	do {
+		while (!pending && !stopping)
+			pthread_cond_wait(&cond, &lock);
+		if (!pending)
+			break; /* Stopping, and nothing left to print */
+
+		job = next;
+		pending = false;
+		pthread_mutex_unlock(&lock);
+
+		print_job(&job);
+		snapshot_records_cleanup(&job.records);
+
+		pthread_mutex_lock(&lock);
+	} while (true);
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/* Is there anything to print? */
+bool
+output_printer_enabled(void)
+{
+	return config_get_output_roa() != NULL ||
+	    config_get_output_bgpsec() != NULL ||
+	    config_get_output_json() != NULL ||
+	    config_get_output_snapshot() != NULL;
 }
 
+/* Prints @records (described by @hdr) in the background. Steals @records. */
 void
-output_print_data(struct db_table *db)
+output_print_records(struct snapshot_header const *hdr,
+    struct snapshot_records *records)
 {
-	print_roas(db);
-	print_router_keys(db);
+	struct output_job job;
+
+	job.hdr = *hdr;
+	job.records = *records;
+
+	pthread_mutex_lock(&lock);
+
+	if (!thread_running) {
+		errno = pthread_create(&thread, NULL, printer_loop, NULL);
+		if (errno) {
+			pthread_mutex_unlock(&lock);
+			pr_errno(errno, "Could not spawn the output printer thread; printing in the foreground");
+			print_job(&job);
+			snapshot_records_cleanup(&job.records);
+			return;
+		}
+		thread_running = true;
+	}
+
+	/* Outdated before it was printed */
+	if (pending)
+		snapshot_records_cleanup(&next.records);
+
+	next = job;
+	pending = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Waits for the pending output, if any, and stops the thread. */
+void
+output_printer_destroy(void)
+{
+	int error;
+
+	if (!thread_running)
+		return;
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+
+	error = pthread_join(thread, NULL);
+	if (error)
+		pr_crit("pthread_join() threw %d on the output printer thread.",
+		    error);
+
+	thread_running = false;
+	stopping = false;
 }
@@ -1,8 +1,12 @@
 #ifndef SRC_OUTPUT_PRINTER_H_
 #define SRC_OUTPUT_PRINTER_H_
 
-#include "rtr/db/db_table.h"
+#include <stdbool.h>
+#include "rtr/db/snapshot.h"
 
-void output_print_data(struct db_table *);
+bool output_printer_enabled(void);
+void output_print_records(struct snapshot_header const *,
+    struct snapshot_records *);
+void output_printer_destroy(void);
 
 #endif /* SRC_OUTPUT_PRINTER_H_ */
@@ -0,0 +1,134 @@
+#include "repo_watcher.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "thread_var.h"
+#include "object/tal.h"
+#include "rrdp/rrdp_parser.h"
+#include "rrdp/db/db_rrdp.h"
+
+/* Returns 1 if the notification @uri_str moved on since @last was processed. */
+static int
+poll_notification(char const *uri_str, struct global_data const *last,
+    long last_update, void *arg)
+{
+	struct rpki_uri *uri;
+	struct global_data current;
+	bool changed;
+	int error;
+
+	error = uri_create_https_str(&uri, uri_str, strlen(uri_str));
+	if (error)
+		return 0;
+
+	error = rrdp_peek_notification(uri, last_update, &current);
+	uri_refput(uri);
+	if (error < 0) {
+		/* Can't tell; leave it to the validation cycle */
+		pr_debug("Couldn't poll '%s'.", uri_str);
+		return 0;
+	}
+	if (error > 0)
+		return 0; /* Not modified */
+
+	changed = strcmp(current.session_id, last->session_id) != 0 ||
+	    current.serial != last->serial;
+	if (changed)
+		pr_debug("'%s' moved from serial %lu to %lu.", uri_str,
+		    last->serial, current.serial);
+
+	global_data_cleanup(&current);
+	return changed;
+}
+
+static bool
+rrdp_changed(char const *tal_file)
+{
+	struct db_rrdp_uri *uris;
+
+	if (!config_get_rrdp_enabled())
+		return false;
+
+	uris = db_rrdp_get_uris(tal_file);
+	if (uris == NULL)
+		return true; /* Never validated */
+
+	return db_rrdp_uris_foreach(uris, poll_notification, NULL) > 0;
+}
+
+static bool
+ta_changed(char const *tal_file)
+{
+	struct tal *tal;
+	bool changed;
+
+	if (tal_load(tal_file, &tal) != 0)
+		return false; /* The validation will complain */
+
+	tal_poll_ta(tal, &changed);
+
+	tal_destroy(tal);
+	return changed;
+}
+
+static int
+add_tal(struct string_array *tals, char const *tal_file)
+{
+	char **tmp;
+	char *copy;
+
+	copy = strdup(tal_file);
+	if (copy == NULL)
+		return pr_enomem();
+
+	tmp = realloc(tals->array, (tals->length + 1) * sizeof(char *));
+	if (tmp == NULL) {
+		free(copy);
+		return pr_enomem();
+	}
+
+	tmp[tals->length++] = copy;
+	tals->array = tmp;
+	return 0;
+}
+
+static int
+poll_tal(char const *tal_file, void *arg)
+{
+	bool changed;
+
+	fnstack_push(tal_file);
+	changed = rrdp_changed(tal_file) || ta_changed(tal_file);
+	fnstack_pop();
+
+	if (!changed)
+		return 0;
+
+	pr_info("The repositories of TAL '%s' changed.", tal_file);
+	return add_tal(arg, tal_file);
+}
+
+/*
+ * Appends to @result (which is expected to be empty) the TAL files whose
+ * repositories changed. The caller has to clean it up, even on error.
+ */
+int
+repo_watcher_poll(struct string_array *result)
+{
+	int error;
+
+	if (config_get_work_offline())
+		return 0;
+
+	fnstack_init();
+	error = process_file_or_dir(config_get_tal(), TAL_FILE_EXTENSION,
+	    poll_tal, result);
+	fnstack_cleanup();
+
+	return error;
+}
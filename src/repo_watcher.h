@@ -0,0 +1,22 @@
+#ifndef SRC_REPO_WATCHER_H_
+#define SRC_REPO_WATCHER_H_
+
+#include "config/string_array.h"
+
+/*
+ * Cheap checks for repository changes, meant to be run between validation
+ * cycles (never during one), so TALs can be validated again as soon as their
+ * repositories change.
+ *
+ * A TAL is considered changed if any of the RRDP notification files it used
+ * during its last validation announces a different session or serial (they're
+ * requested conditionally, with If-Modified-Since), or its TA certificate
+ * changed. TALs that haven't been validated yet are always considered changed.
+ *
+ * Changes to repositories only reachable through rsync can't be detected this
+ * way; they're only noticed by the regular validation cycles.
+ */
+
+int repo_watcher_poll(struct string_array *);
+
+#endif /* SRC_REPO_WATCHER_H_ */
@@ -37,7 +37,8 @@ struct rpp {
 		int error;
 	} crl;
 
-	/* The Manifest is not needed for now. */
+	/* The manifest's nextUpdate */
+	time_t next_update;
 
 	struct uris roas; /* Route Origin Attestations */
 
@@ -63,6 +64,7 @@ rpp_create(void)
 	result->crl.uri = NULL;
 	result->crl.stack = NULL;
 	result->crl.error = 0;
+	result->next_update = 0;
 	uris_init(&result->roas);
 	uris_init(&result->ghostbusters);
 	result->references = 1;
@@ -137,6 +139,34 @@ rpp_get_crl(struct rpp const *pp)
 	return pp->crl.uri;
 }
 
+void
+rpp_set_next_update(struct rpp *pp, time_t next_update)
+{
+	pp->next_update = next_update;
+}
+
+time_t
+rpp_get_next_update(struct rpp const *pp)
+{
+	return pp->next_update;
+}
+
+int
+rpp_foreach_cert(struct rpp *pp, rpp_uri_cb cb, void *arg)
+{
+	struct rpki_uri **uri;
+	array_index i;
+	int error;
+
+	ARRAYLIST_FOREACH(&pp->certs, uri, i) {
+		error = cb(*uri, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 static int
 add_crl_to_stack(struct rpp *pp, STACK_OF(X509_CRL) *crls)
 {
@@ -228,6 +258,7 @@ __cert_traverse(struct rpp *pp)
 	certstack = validation_certstack(state);
 
 	deferred.pp = pp;
+	deferred.retry_at = 0;
 	/*
 	 * The for is inverted, to achieve FIFO behavior since the separator.
 	 * Not really important; it simply makes the traversal order more
@@ -245,18 +276,23 @@ __cert_traverse(struct rpp *pp)
 
 /**
  * Traverses through all of @pp's known files, validating them.
+ *
+ * Returns nonzero if any of the ROAs or ghostbusters were invalid. (They don't
+ * prevent the others from being validated.)
  */
-void
+int
 rpp_traverse(struct rpp *pp)
 {
 	struct rpki_uri **uri;
 	array_index i;
+	int result;
 
 	/*
 	 * A subtree should not invalidate the rest of the tree, so error codes
 	 * are ignored.
 	 * (Errors log messages anyway.)
 	 */
+	result = 0;
 
 	/*
 	 * Certificates cannot be validated now, because then the algorithm
@@ -268,12 +304,16 @@ rpp_traverse(struct rpp *pp)
 
 	/* Validate ROAs, apply validation_handler on them. */
 	ARRAYLIST_FOREACH(&pp->roas, uri, i)
-		roa_traverse(*uri, pp);
+		if (roa_traverse(*uri, pp) != 0)
+			result = -EINVAL;
 
 	/*
 	 * We don't do much with the ghostbusters right now.
 	 * Just validate them.
 	 */
 	ARRAYLIST_FOREACH(&pp->ghostbusters, uri, i)
-		ghostbusters_traverse(*uri, pp);
+		if (ghostbusters_traverse(*uri, pp) != 0)
+			result = -EINVAL;
+
+	return result;
 }
@@ -1,6 +1,7 @@
 #ifndef SRC_RPP_H_
 #define SRC_RPP_H_
 
+#include <time.h>
 #include "uri.h"
 
 struct rpp;
@@ -17,6 +18,12 @@ int rpp_add_ghostbusters(struct rpp *, struct rpki_uri *);
 struct rpki_uri *rpp_get_crl(struct rpp const *);
 int rpp_crl(struct rpp *, STACK_OF(X509_CRL) **);
 
-void rpp_traverse(struct rpp *);
+void rpp_set_next_update(struct rpp *, time_t);
+time_t rpp_get_next_update(struct rpp const *);
+
+typedef int (*rpp_uri_cb)(struct rpki_uri *, void *);
+int rpp_foreach_cert(struct rpp *, rpp_uri_cb, void *);
+
+int rpp_traverse(struct rpp *);
 
 #endif /* SRC_RPP_H_ */
@@ -0,0 +1,417 @@
+#include "rpp_cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "changeset.h"
+#include "config.h"
+#include "log.h"
+#include "thread_var.h"
+#include "validation_handler.h"
+#include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
+
+struct vrp4 {
+	uint32_t asn;
+	struct ipv4_prefix prefix;
+	uint8_t max_length;
+};
+
+struct vrp6 {
+	uint32_t asn;
+	struct ipv6_prefix prefix;
+	uint8_t max_length;
+};
+
+DEFINE_ARRAY_LIST_STRUCT(vrps4, struct vrp4);
+DEFINE_ARRAY_LIST_FUNCTIONS(vrps4, struct vrp4, static)
+DEFINE_ARRAY_LIST_STRUCT(vrps6, struct vrp6);
+DEFINE_ARRAY_LIST_FUNCTIONS(vrps6, struct vrp6, static)
+DEFINE_ARRAY_LIST_STRUCT(cert_uris, char *);
+DEFINE_ARRAY_LIST_FUNCTIONS(cert_uris, char *, static)
+
+/* The VRPs yielded by the ROAs of an RPP */
+struct rpp_output {
+	struct vrps4 v4;
+	struct vrps6 v6;
+};
+
+struct cached_rpp {
+	/* Global URI of the manifest; the key */
+	char *mft;
+	/* Global URI of the certificate the manifest belongs to */
+	char *cert;
+	/* Global URIs of the RPP's CRL and certificates */
+	char *crl;
+	struct cert_uris certs;
+
+	struct rpp_output *output;
+
+	/* The manifest's nextUpdate */
+	time_t next_update;
+	/* Changeset version the RPP was validated at */
+	unsigned long version;
+	/* Last cycle the result was recorded or reused */
+	unsigned int cycle;
+
+	UT_hash_handle hh;
+};
+
+static struct cached_rpp *cache;
+static unsigned int cycle;
+
+/** Mutex, which protects @cache and @cycle. */
+static pthread_mutex_t lock;
+
+int
+rpp_cache_init(void)
+{
+	int error;
+
+	error = pthread_mutex_init(&lock, NULL);
+	if (error)
+		return pr_errno(error, "RPP cache pthread_mutex_init() errored");
+
+	cache = NULL;
+	cycle = 0;
+	return 0;
+}
+
+static void
+free_str(char **str)
+{
+	free(*str);
+}
+
+static void
+cached_rpp_destroy(struct cached_rpp *rpp)
+{
+	free(rpp->mft);
+	free(rpp->cert);
+	free(rpp->crl);
+	cert_uris_cleanup(&rpp->certs, free_str);
+	if (rpp->output != NULL)
+		rpp_output_destroy(rpp->output);
+	free(rpp);
+}
+
+void
+rpp_cache_destroy(void)
+{
+	struct cached_rpp *rpp, *tmp;
+
+	HASH_ITER(hh, cache, rpp, tmp) {
+		HASH_DEL(cache, rpp);
+		cached_rpp_destroy(rpp);
+	}
+	pthread_mutex_destroy(&lock);
+}
+
+/* Call before the validation cycle starts. */
+void
+rpp_cache_new_cycle(void)
+{
+	pthread_mutex_lock(&lock);
+	cycle++;
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Drops the results that weren't recorded or reused during the current cycle.
+ * (Their RPPs are gone, invalid, or weren't reached.)
+ */
+void
+rpp_cache_purge(void)
+{
+	struct cached_rpp *rpp, *tmp;
+
+	pthread_mutex_lock(&lock);
+	HASH_ITER(hh, cache, rpp, tmp) {
+		if (rpp->cycle != cycle) {
+			HASH_DEL(cache, rpp);
+			cached_rpp_destroy(rpp);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int
+rpp_output_create(struct rpp_output **result)
+{
+	struct rpp_output *output;
+
+	output = malloc(sizeof(struct rpp_output));
+	if (output == NULL)
+		return pr_enomem();
+
+	vrps4_init(&output->v4);
+	vrps6_init(&output->v6);
+
+	*result = output;
+	return 0;
+}
+
+void
+rpp_output_destroy(struct rpp_output *output)
+{
+	vrps4_cleanup(&output->v4, NULL);
+	vrps6_cleanup(&output->v6, NULL);
+	free(output);
+}
+
+int
+rpp_output_add_v4(struct rpp_output *output, uint32_t asn,
+    struct ipv4_prefix const *prefix, uint8_t max_length)
+{
+	struct vrp4 vrp;
+
+	vrp.asn = asn;
+	vrp.prefix = *prefix;
+	vrp.max_length = max_length;
+	return vrps4_add(&output->v4, &vrp);
+}
+
+int
+rpp_output_add_v6(struct rpp_output *output, uint32_t asn,
+    struct ipv6_prefix const *prefix, uint8_t max_length)
+{
+	struct vrp6 vrp;
+
+	vrp.asn = asn;
+	vrp.prefix = *prefix;
+	vrp.max_length = max_length;
+	return vrps6_add(&output->v6, &vrp);
+}
+
+/* Rebuilds the part of the RPP its children need (its CRL and certificates) */
+static int
+build_rpp(struct cached_rpp *cached, struct rpp **result)
+{
+	struct rpp *pp;
+	struct rpki_uri *uri;
+	char **cert;
+	array_index i;
+	int error;
+
+	pp = rpp_create();
+	if (pp == NULL)
+		return pr_enomem();
+
+	error = uri_create_rsync_str(&uri, cached->crl, strlen(cached->crl));
+	if (error)
+		goto fail;
+	error = rpp_add_crl(pp, uri);
+	if (error) {
+		uri_refput(uri);
+		goto fail;
+	}
+
+	ARRAYLIST_FOREACH(&cached->certs, cert, i) {
+		error = uri_create_rsync_str(&uri, *cert, strlen(*cert));
+		if (error)
+			goto fail;
+		error = rpp_add_cert(pp, uri);
+		if (error) {
+			uri_refput(uri);
+			goto fail;
+		}
+	}
+
+	*result = pp;
+	return 0;
+
+fail:
+	rpp_refput(pp);
+	return error;
+}
+
+static int
+replay(struct rpp_output *output)
+{
+	struct vrp4 *vrp4;
+	struct vrp6 *vrp6;
+	array_index i;
+	int error;
+
+	ARRAYLIST_FOREACH(&output->v4, vrp4, i) {
+		error = vhandler_handle_roa_v4(vrp4->asn, &vrp4->prefix,
+		    vrp4->max_length);
+		if (error)
+			return error;
+	}
+
+	ARRAYLIST_FOREACH(&output->v6, vrp6, i) {
+		error = vhandler_handle_roa_v6(vrp6->asn, &vrp6->prefix,
+		    vrp6->max_length);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static unsigned long
+get_dir_version(struct rpki_uri *mft)
+{
+	char const *global;
+	char const *slash;
+
+	global = uri_get_global(mft);
+	slash = strrchr(global, '/');
+	return (slash != NULL) ? changeset_get_dir(global, slash - global) : 0;
+}
+
+/* Call while holding the lock */
+static bool
+is_reusable(struct cached_rpp *cached, struct rpki_uri *cert,
+    struct rpki_uri *mft, unsigned long chain_version)
+{
+	if (strcmp(cached->cert, uri_get_global(cert)) != 0)
+		return false;
+	if (chain_version > cached->version)
+		return false;
+	if (get_dir_version(mft) > cached->version)
+		return false;
+	return time(NULL) < cached->next_update;
+}
+
+/*
+ * If the RPP of manifest @mft (which belongs to certificate @cert, the top of
+ * the x509 stack) didn't change since the last time it was validated, hands
+ * its VRPs to the validation handler, and returns its CRL and certificates in
+ * @result.
+ *
+ * Returns -ENOENT if the RPP has to be validated.
+ */
+int
+rpp_cache_replay(struct rpki_uri *cert, struct rpki_uri *mft,
+    struct rpp **result)
+{
+	struct validation *state;
+	struct cached_rpp *cached;
+	unsigned long chain_version;
+	int error;
+
+	if (!config_get_incremental_validation())
+		return -ENOENT;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return -EINVAL;
+	chain_version = x509stack_peek_version(validation_certstack(state));
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND_STR(cache, uri_get_global(mft), cached);
+	if (cached == NULL || !is_reusable(cached, cert, mft, chain_version)) {
+		error = -ENOENT;
+		goto end;
+	}
+
+	error = build_rpp(cached, result);
+	if (error)
+		goto end;
+	error = replay(cached->output);
+	if (error) {
+		rpp_refput(*result);
+		goto end;
+	}
+
+	cached->cycle = cycle;
+	pr_debug("RPP of '%s' didn't change; reusing its previous result.",
+	    uri_get_printable(mft));
+
+end:
+	pthread_mutex_unlock(&lock);
+	return error;
+}
+
+static int
+copy_str(char const *str, char **result)
+{
+	*result = strdup(str);
+	return (*result != NULL) ? 0 : pr_enomem();
+}
+
+static int
+add_cert(struct rpki_uri *uri, void *arg)
+{
+	struct cert_uris *certs = arg;
+	char *copy;
+	int error;
+
+	error = copy_str(uri_get_global(uri), &copy);
+	if (error)
+		return error;
+
+	error = cert_uris_add(certs, &copy);
+	if (error)
+		free(copy);
+	return error;
+}
+
+/*
+ * Records @output as the result of @pp, the RPP of manifest @mft, which
+ * belongs to certificate @cert. @version is the changeset version sampled
+ * before any of the chain was read.
+ *
+ * Steals ownership of @output.
+ */
+int
+rpp_cache_store(struct rpki_uri *cert, struct rpki_uri *mft, struct rpp *pp,
+    struct rpp_output *output, unsigned long version)
+{
+	struct cached_rpp *cached;
+	struct cached_rpp *old;
+	int error;
+
+	cached = calloc(1, sizeof(struct cached_rpp));
+	if (cached == NULL) {
+		rpp_output_destroy(output);
+		return pr_enomem();
+	}
+	cert_uris_init(&cached->certs);
+	cached->output = output;
+	cached->next_update = rpp_get_next_update(pp);
+	cached->version = version;
+
+	error = copy_str(uri_get_global(mft), &cached->mft);
+	if (error)
+		goto fail;
+	error = copy_str(uri_get_global(cert), &cached->cert);
+	if (error)
+		goto fail;
+	error = copy_str(uri_get_global(rpp_get_crl(pp)), &cached->crl);
+	if (error)
+		goto fail;
+	error = rpp_foreach_cert(pp, add_cert, &cached->certs);
+	if (error)
+		goto fail;
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND_STR(cache, cached->mft, old);
+	if (old != NULL) {
+		HASH_DEL(cache, old);
+		cached_rpp_destroy(old);
+	}
+
+	cached->cycle = cycle;
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, cache, cached->mft, strlen(cached->mft), cached);
+	if (errno) {
+		pthread_mutex_unlock(&lock);
+		error = -pr_errno(errno, "RPP result couldn't be added to hash table");
+		goto fail;
+	}
+
+	pthread_mutex_unlock(&lock);
+	return 0;
+
+fail:
+	cached_rpp_destroy(cached);
+	return error;
+}
@@ -0,0 +1,43 @@
+#ifndef SRC_RPP_CACHE_H_
+#define SRC_RPP_CACHE_H_
+
+#include <stdint.h>
+#include "address.h"
+#include "rpp.h"
+#include "uri.h"
+
+/*
+ * Results (VRPs) of the RPPs validated during previous cycles, shared by all
+ * the TAL threads. Enabled by "incremental-validation".
+ *
+ * An RPP is not validated again if none of its files, nor any of the
+ * certificates of its chain, changed since its result was recorded (see
+ * changeset.h), and its manifest hasn't expired. Its VRPs are handed to the
+ * validation handler again instead, and its certificates are still traversed,
+ * since their own RPPs might have changed.
+ *
+ * RPPs that contained invalid objects are not recorded, so their errors are
+ * reported every cycle. Results nobody asked for during a cycle are dropped at
+ * the end of it.
+ */
+
+struct rpp_output;
+
+int rpp_cache_init(void);
+void rpp_cache_destroy(void);
+
+void rpp_cache_new_cycle(void);
+void rpp_cache_purge(void);
+
+int rpp_output_create(struct rpp_output **);
+void rpp_output_destroy(struct rpp_output *);
+int rpp_output_add_v4(struct rpp_output *, uint32_t,
+    struct ipv4_prefix const *, uint8_t);
+int rpp_output_add_v6(struct rpp_output *, uint32_t,
+    struct ipv6_prefix const *, uint8_t);
+
+int rpp_cache_replay(struct rpki_uri *, struct rpki_uri *, struct rpp **);
+int rpp_cache_store(struct rpki_uri *, struct rpki_uri *, struct rpp *,
+    struct rpp_output *, unsigned long);
+
+#endif /* SRC_RPP_CACHE_H_ */
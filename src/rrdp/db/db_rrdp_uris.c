@@ -330,6 +330,30 @@ db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
 	return 0;
 }
 
+/*
+ * Calls @cb on every notification URI of @uris, along with the session ID and
+ * serial last processed, and the moment they were. Stops as soon as @cb
+ * returns nonzero, and returns that.
+ *
+ * Unlike most of these functions, this one doesn't need a validation state,
+ * but it must not be called during a validation cycle.
+ */
+int
+db_rrdp_uris_foreach(struct db_rrdp_uri *uris, rrdp_uri_cb cb, void *arg)
+{
+	struct uris_table *uri_node, *uri_tmp;
+	int error;
+
+	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
+		error = cb(uri_node->uri, &uri_node->data,
+		    uri_node->last_update, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 int
 db_rrdp_uris_remove_all_local(struct db_rrdp_uri *uris)
 {
@@ -36,6 +36,10 @@ int db_rrdp_uris_set_all_unvisited(void);
 
 int db_rrdp_uris_get_visited_uris(char const *, struct visited_uris **);
 
+typedef int (*rrdp_uri_cb)(char const *, struct global_data const *, long,
+    void *);
+int db_rrdp_uris_foreach(struct db_rrdp_uri *, rrdp_uri_cb, void *);
+
 int db_rrdp_uris_remove_all_local(struct db_rrdp_uri *);
 
 #endif /* SRC_RRDP_DB_DB_RRDP_URIS_H_ */
@@ -0,0 +1,763 @@
+#define _XOPEN_SOURCE 700
+
+#include "rrdp/rrdp_generation.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "changeset.h"
+#include "common.h"
+#include "config.h"
+#include "file.h"
+#include "log.h"
+#include "object_store.h"
+#include "crypto/hash.h"
+#include "data_structure/uthash_nonfatal.h"
+
+#define GENERATIONS_DIR	".rrdp"
+#define MAX_FD_ALLOWED	20
+
+/* A file touched by the update */
+struct staged_file {
+	/* Its global URI is the key */
+	struct rpki_uri *uri;
+	/* The update removes it from the repository */
+	bool withdrawn;
+	/* The live version was linked into the backup directory */
+	bool backed_up;
+	/* The live repository already shows the update's version */
+	bool applied;
+	/* The commit added it (a published manifest) to the visited URIs */
+	bool listed;
+	UT_hash_handle hh;
+	/* Key: local path; only the published files (see prepare_publish()) */
+	UT_hash_handle hh_live;
+};
+
+struct rrdp_generation {
+	/* Directory where the published files are staged */
+	char *path;
+	/* Directory where the replaced files are kept until the commit ends */
+	char *backup_path;
+	size_t repository_len;
+	struct staged_file *files;
+	struct staged_file *live;
+};
+
+static int
+remove_node(char const *path, struct stat const *sb, int flag,
+    struct FTW *ftwbuf)
+{
+	if (remove(path) != 0)
+		return pr_errno(errno, "Couldn't delete '%s'", path);
+	return 0;
+}
+
+static int
+remove_tree(char const *path)
+{
+	int error;
+
+	errno = 0;
+	error = nftw(path, remove_node, MAX_FD_ALLOWED, FTW_DEPTH | FTW_PHYS);
+	if (error == -1) {
+		if (errno == ENOENT)
+			return 0;
+		return pr_errno(errno, "Couldn't delete '%s'", path);
+	}
+
+	return error;
+}
+
+/* Returns "<local-repository>/.rrdp" */
+static int
+get_generations_path(char **result)
+{
+	char const *repository;
+	size_t repository_len;
+	char *path;
+
+	repository = config_get_local_repository();
+	repository_len = strlen(repository);
+	if (repository_len > 0 && repository[repository_len - 1] == '/')
+		repository_len--;
+
+	path = malloc(repository_len + strlen(GENERATIONS_DIR) + 2);
+	if (path == NULL)
+		return pr_enomem();
+
+	memcpy(path, repository, repository_len);
+	path[repository_len] = '/';
+	strcpy(path + repository_len + 1, GENERATIONS_DIR);
+
+	*result = path;
+	return 0;
+}
+
+/*
+ * The directory is named after the notification URI and the thread, since two
+ * TALs might be updating the same notification at the same time.
+ */
+int
+rrdp_generation_create(char const *notification_uri,
+    struct rrdp_generation **result)
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+	struct rrdp_generation *tmp;
+	char *root;
+	char *cursor;
+	unsigned int i;
+	int error;
+
+	error = hash_buffer("sha256", (unsigned char const *) notification_uri,
+	    strlen(notification_uri), hash, &hash_len);
+	if (error)
+		return error;
+
+	tmp = malloc(sizeof(struct rrdp_generation));
+	if (tmp == NULL)
+		return pr_enomem();
+
+	error = get_generations_path(&root);
+	if (error)
+		goto release_tmp;
+
+	/* "/" + hex + "." + thread + NUL */
+	tmp->path = malloc(strlen(root) + 2 * hash_len + 2 * sizeof(long) + 3);
+	if (tmp->path == NULL) {
+		error = pr_enomem();
+		goto release_root;
+	}
+
+	cursor = tmp->path + sprintf(tmp->path, "%s/", root);
+	for (i = 0; i < hash_len; i++)
+		cursor += sprintf(cursor, "%02x", hash[i]);
+	sprintf(cursor, ".%lx", (unsigned long) pthread_self());
+
+	tmp->backup_path = malloc(strlen(tmp->path) + strlen(".old") + 1);
+	if (tmp->backup_path == NULL) {
+		error = pr_enomem();
+		goto release_path;
+	}
+	sprintf(tmp->backup_path, "%s.old", tmp->path);
+
+	/* Leftovers of an interrupted update */
+	error = remove_tree(tmp->path);
+	if (error)
+		goto release_backup;
+	error = remove_tree(tmp->backup_path);
+	if (error)
+		goto release_backup;
+
+	tmp->repository_len = strlen(config_get_local_repository());
+	tmp->files = NULL;
+	tmp->live = NULL;
+
+	free(root);
+	*result = tmp;
+	return 0;
+release_backup:
+	free(tmp->backup_path);
+release_path:
+	free(tmp->path);
+release_root:
+	free(root);
+release_tmp:
+	free(tmp);
+	return error;
+}
+
+/* Discards whatever wasn't committed */
+void
+rrdp_generation_destroy(struct rrdp_generation *generation)
+{
+	struct staged_file *file, *tmp;
+
+	remove_tree(generation->path);
+	remove_tree(generation->backup_path);
+
+	HASH_CLEAR(hh_live, generation->live);
+	HASH_ITER(hh, generation->files, file, tmp) {
+		HASH_DEL(generation->files, file);
+		uri_refput(file->uri);
+		free(file);
+	}
+
+	free(generation->backup_path);
+	free(generation->path);
+	free(generation);
+}
+
+/* Returns "@root/<@uri's path, relative to the local repository>" */
+static int
+get_path(struct rrdp_generation *generation, char const *root,
+    struct rpki_uri *uri, char **result)
+{
+	char const *relative;
+	char *path;
+
+	relative = uri_get_local(uri) + generation->repository_len;
+	while (relative[0] == '/')
+		relative++;
+
+	path = malloc(strlen(root) + strlen(relative) + 2);
+	if (path == NULL)
+		return pr_enomem();
+
+	sprintf(path, "%s/%s", root, relative);
+	*result = path;
+	return 0;
+}
+
+/* Where the new version of @uri's file is written */
+static int
+get_staged_path(struct rrdp_generation *generation, struct rpki_uri *uri,
+    char **result)
+{
+	return get_path(generation, generation->path, uri, result);
+}
+
+/* Where the old version of @uri's file is kept during the commit */
+static int
+get_backup_path(struct rrdp_generation *generation, struct rpki_uri *uri,
+    char **result)
+{
+	return get_path(generation, generation->backup_path, uri, result);
+}
+
+static struct staged_file *
+find_file(struct rrdp_generation *generation, struct rpki_uri *uri)
+{
+	struct staged_file *file;
+
+	HASH_FIND_STR(generation->files, uri_get_global(uri), file);
+	return file;
+}
+
+static int
+add_file(struct rrdp_generation *generation, struct rpki_uri *uri,
+    struct staged_file **result)
+{
+	struct staged_file *file;
+	char const *key;
+
+	file = malloc(sizeof(struct staged_file));
+	if (file == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(file, 0, sizeof(struct staged_file));
+
+	uri_refget(uri);
+	file->uri = uri;
+	file->withdrawn = false;
+
+	key = uri_get_global(uri);
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, generation->files, key, strlen(key), file);
+	if (errno) {
+		uri_refput(uri);
+		free(file);
+		return -pr_errno(errno, "Couldn't stage '%s'", key);
+	}
+
+	*result = file;
+	return 0;
+}
+
+static int
+write_file(char const *path, unsigned char const *content, size_t content_len)
+{
+	struct stat stat;
+	FILE *out;
+	size_t written;
+	int error;
+
+	if (object_store_enabled())
+		return object_store_write(path, content, content_len);
+
+	error = file_replace(path, &out, &stat);
+	if (error)
+		return error;
+
+	written = fwrite(content, sizeof(unsigned char), content_len, out);
+	file_close(out);
+	if (written != content_len)
+		return pr_err("Couldn't write bytes to file %s", path);
+
+	return 0;
+}
+
+int
+rrdp_generation_publish(struct rrdp_generation *generation,
+    struct rpki_uri *uri, unsigned char const *content, size_t content_len)
+{
+	struct staged_file *file;
+	char *path;
+	int error;
+
+	error = get_staged_path(generation, uri, &path);
+	if (error)
+		return error;
+
+	error = create_dir_recursive(path);
+	if (error)
+		goto end;
+
+	error = write_file(path, content, content_len);
+	if (error)
+		goto end;
+
+	file = find_file(generation, uri);
+	if (file == NULL) {
+		error = add_file(generation, uri, &file);
+		if (error)
+			goto end;
+	}
+	file->withdrawn = false;
+
+end:
+	free(path);
+	return error;
+}
+
+int
+rrdp_generation_withdraw(struct rrdp_generation *generation,
+    struct rpki_uri *uri)
+{
+	struct staged_file *file;
+	char *path;
+	int error;
+
+	file = find_file(generation, uri);
+	if (file == NULL) {
+		error = add_file(generation, uri, &file);
+		if (error)
+			return error;
+	} else if (!file->withdrawn) {
+		/* Published earlier during this same update */
+		error = get_staged_path(generation, uri, &path);
+		if (error)
+			return error;
+		if (remove(path) != 0)
+			error = pr_errno(errno, "Couldn't delete '%s'", path);
+		free(path);
+		if (error)
+			return error;
+	}
+
+	file->withdrawn = true;
+	return 0;
+}
+
+/*
+ * Validates the hash of @uri's file as it'd look if the update was committed
+ * right now.
+ */
+int
+rrdp_generation_validate_hash(struct rrdp_generation *generation,
+    struct rpki_uri *uri, unsigned char const *hash, size_t hash_len)
+{
+	struct staged_file *file;
+	char *path;
+	int error;
+
+	file = find_file(generation, uri);
+	if (file == NULL)
+		return hash_validate_file("sha256", uri, hash, hash_len);
+	if (file->withdrawn)
+		return pr_err("File '%s' was already withdrawn.",
+		    uri_get_printable(uri));
+
+	error = get_staged_path(generation, uri, &path);
+	if (error)
+		return error;
+
+	error = hash_validate_local("sha256", path, hash, hash_len);
+
+	free(path);
+	return error;
+}
+
+/* Only the manifests are remembered by the RRDP URIs DB */
+static bool
+is_mft(struct rpki_uri *uri)
+{
+	char const *extension;
+
+	extension = strrchr(uri_get_global(uri), '.');
+	return extension != NULL && strcmp(extension, ".mft") == 0;
+}
+
+/*
+ * Links the live version of @file into the backup directory, so the commit can
+ * be rolled back.
+ */
+static int
+back_up(struct rrdp_generation *generation, struct staged_file *file)
+{
+	char *backup;
+	int error;
+
+	error = get_backup_path(generation, file->uri, &backup);
+	if (error)
+		return error;
+
+	error = create_dir_recursive(backup);
+	if (error)
+		goto end;
+
+	if (link(uri_get_local(file->uri), backup) != 0) {
+		error = pr_errno(errno, "Couldn't link '%s' to '%s'", backup,
+		    uri_get_local(file->uri));
+		goto end;
+	}
+
+	file->backed_up = true;
+end:
+	free(backup);
+	return error;
+}
+
+/*
+ * Checks that @file can be committed: the staged version exists, and so does
+ * the live directory; the live version, if any, is a regular file, and is
+ * backed up. Doesn't modify the live repository.
+ *
+ * (The hashes the update expects from the live files were already validated
+ * while staging; see rrdp_generation_validate_hash().)
+ */
+static int
+prepare_publish(struct rrdp_generation *generation, struct staged_file *file)
+{
+	struct stat st;
+	char const *live;
+	char *staged;
+	int error;
+
+	error = get_staged_path(generation, file->uri, &staged);
+	if (error)
+		return error;
+	if (stat(staged, &st) != 0 || !S_ISREG(st.st_mode))
+		error = pr_err("The staged version of '%s' is missing.",
+		    uri_get_printable(file->uri));
+	free(staged);
+	if (error)
+		return error;
+
+	live = uri_get_local(file->uri);
+	error = create_dir_recursive(live);
+	if (error)
+		return error;
+
+	if (lstat(live, &st) != 0) {
+		if (errno != ENOENT)
+			return pr_errno(errno, "Couldn't stat '%s'", live);
+	} else {
+		if (!S_ISREG(st.st_mode))
+			return pr_err("'%s' is not a regular file; it can't be replaced.",
+			    live);
+		error = back_up(generation, file);
+		if (error)
+			return error;
+	}
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh_live, generation->live, live, strlen(live), file);
+	if (errno)
+		return -pr_errno(errno, "Couldn't index '%s'", live);
+
+	return 0;
+}
+
+static int
+prepare_withdraw(struct rrdp_generation *generation, struct staged_file *file,
+    struct visited_uris *visited_uris)
+{
+	struct stat st;
+	char const *live;
+
+	live = uri_get_local(file->uri);
+	if (lstat(live, &st) != 0 || !S_ISREG(st.st_mode))
+		return pr_err("The withdrawn file '%s' doesn't exist.",
+		    uri_get_printable(file->uri));
+
+	if (is_mft(file->uri) &&
+	    !visited_uris_contains(visited_uris, uri_get_global(file->uri)))
+		return pr_err("The withdrawn manifest '%s' wasn't known.",
+		    uri_get_printable(file->uri));
+
+	return back_up(generation, file);
+}
+
+static int
+apply_publish(struct rrdp_generation *generation, struct staged_file *file)
+{
+	char const *live;
+	char *staged;
+	int error;
+
+	error = get_staged_path(generation, file->uri, &staged);
+	if (error)
+		return error;
+
+	live = uri_get_local(file->uri);
+	if (rename(staged, live) != 0)
+		error = pr_errno(errno, "Couldn't rename '%s' to '%s'", staged,
+		    live);
+	else
+		file->applied = true;
+
+	free(staged);
+	return error;
+}
+
+static int
+apply_withdraw(struct staged_file *file)
+{
+	int error;
+
+	/* Delete parent dirs only if empty. */
+	error = delete_dir_recursive_bottom_up(uri_get_local(file->uri));
+	if (!error)
+		file->applied = true;
+	return error;
+}
+
+/* Puts the live version of @file back, if the commit already replaced it. */
+static void
+roll_back(struct rrdp_generation *generation, struct staged_file *file)
+{
+	char const *live;
+	char *backup;
+
+	if (!file->applied)
+		return;
+
+	live = uri_get_local(file->uri);
+	if (!file->backed_up) {
+		/* It didn't exist before the commit */
+		if (remove(live) != 0)
+			pr_errno(errno, "Couldn't delete '%s'", live);
+		return;
+	}
+
+	if (get_backup_path(generation, file->uri, &backup) != 0)
+		return;
+	if (create_dir_recursive(live) != 0 || rename(backup, live) != 0)
+		pr_err("Couldn't restore '%s'; it will be fixed by the next snapshot.",
+		    live);
+	free(backup);
+}
+
+/*
+ * Adds @file to @visited_uris, if it's a published manifest that wasn't there.
+ * Done before the live repository is touched, because it can fail; unlist()
+ * reverts it.
+ */
+static int
+list(struct staged_file *file, struct visited_uris *visited_uris)
+{
+	char const *global;
+	int error;
+
+	global = uri_get_global(file->uri);
+	if (file->withdrawn || !is_mft(file->uri) ||
+	    visited_uris_contains(visited_uris, global))
+		return 0;
+
+	error = visited_uris_add(visited_uris, global);
+	if (!error)
+		file->listed = true;
+	return error;
+}
+
+static void
+unlist(struct staged_file *file, struct visited_uris *visited_uris)
+{
+	if (file->listed) {
+		visited_uris_remove(visited_uris, uri_get_global(file->uri));
+		file->listed = false;
+	}
+}
+
+/*
+ * Deletes the files of @mft_uri's directory that the generation didn't
+ * publish. They're the leftovers of the previous session.
+ */
+static int
+delete_leftovers(char const *mft_uri, void *arg)
+{
+	struct rrdp_generation *generation = arg;
+	struct staged_file *published;
+	struct rpki_uri *uri;
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+	char *dir_path;
+	char *path;
+	char *slash;
+	int error;
+
+	slash = strrchr(mft_uri, '/');
+	if (slash == NULL)
+		return 0;
+
+	error = changeset_add_dir(mft_uri, slash - mft_uri);
+	if (error)
+		return error;
+
+	error = uri_create_mixed_str(&uri, mft_uri, strlen(mft_uri));
+	if (error)
+		return (error == -ENOMEM) ? error : 0;
+
+	dir_path = strdup(uri_get_local(uri));
+	uri_refput(uri);
+	if (dir_path == NULL)
+		return pr_enomem();
+	slash = strrchr(dir_path, '/');
+	if (slash != NULL)
+		*slash = '\0';
+
+	dir = opendir(dir_path);
+	if (dir == NULL) {
+		/* Already gone */
+		free(dir_path);
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		path = malloc(strlen(dir_path) + strlen(entry->d_name) + 2);
+		if (path == NULL) {
+			error = pr_enomem();
+			break;
+		}
+		sprintf(path, "%s/%s", dir_path, entry->d_name);
+
+		HASH_FIND(hh_live, generation->live, path, strlen(path),
+		    published);
+		if (published == NULL && lstat(path, &st) == 0 &&
+		    S_ISREG(st.st_mode)) {
+			pr_debug("Deleting '%s'; it's not part of the new session.",
+			    path);
+			if (remove(path) != 0)
+				pr_warn("Couldn't delete '%s': %s", path,
+				    strerror(errno));
+		}
+
+		free(path);
+	}
+
+	closedir(dir);
+	/* Only if empty */
+	rmdir(dir_path);
+	free(dir_path);
+	return error;
+}
+
+/*
+ * Moves the update into the live repository, and records its manifests at
+ * @visited_uris. Each file is replaced atomically, so a validator reading the
+ * repository meanwhile sees either the old or the new version of it.
+ *
+ * Either the whole update is applied, or none of it: every file is checked (and
+ * its live version backed up, and its manifest listed at @visited_uris) before
+ * the first one is replaced, and if a replacement (or its recording at the
+ * changeset) fails anyway, the ones already done are rolled back.
+ *
+ * If @old isn't NULL, it lists the manifests of the previous session; the files
+ * of their directories that the update didn't publish are deleted, once the
+ * update is in place.
+ */
+int
+rrdp_generation_commit(struct rrdp_generation *generation,
+    struct visited_uris *visited_uris, struct visited_uris *old)
+{
+	struct staged_file *file, *tmp;
+	int error;
+
+	HASH_ITER(hh, generation->files, file, tmp) {
+		error = file->withdrawn
+		    ? prepare_withdraw(generation, file, visited_uris)
+		    : prepare_publish(generation, file);
+		if (error)
+			return error;
+	}
+
+	HASH_ITER(hh, generation->files, file, tmp) {
+		error = list(file, visited_uris);
+		if (error)
+			goto unlist;
+	}
+
+	/* Publications first, so the withdrawals only delete empty dirs */
+	HASH_ITER(hh, generation->files, file, tmp) {
+		if (!file->withdrawn) {
+			error = apply_publish(generation, file);
+			if (error)
+				goto roll_back;
+		}
+	}
+	HASH_ITER(hh, generation->files, file, tmp) {
+		if (file->withdrawn) {
+			error = apply_withdraw(file);
+			if (error)
+				goto roll_back;
+		}
+	}
+
+	/* The changeset is updated once the files are; see changeset.h */
+	HASH_ITER(hh, generation->files, file, tmp) {
+		error = changeset_add_file(uri_get_global(file->uri));
+		if (error)
+			goto roll_back;
+	}
+
+	/* Nothing can fail from now on, except for the cleanup */
+	HASH_ITER(hh, generation->files, file, tmp) {
+		if (file->withdrawn && is_mft(file->uri))
+			visited_uris_remove(visited_uris,
+			    uri_get_global(file->uri));
+	}
+
+	return (old != NULL)
+	    ? visited_uris_foreach(old, delete_leftovers, generation)
+	    : 0;
+
+roll_back:
+	HASH_ITER(hh, generation->files, file, tmp)
+		roll_back(generation, file);
+unlist:
+	HASH_ITER(hh, generation->files, file, tmp)
+		unlist(file, visited_uris);
+	return error;
+}
+
+/*
+ * Removes every staging directory. Call while no updates are in progress, to
+ * get rid of the ones abandoned by a previous run.
+ */
+int
+rrdp_generation_cleanup(void)
+{
+	char *root;
+	int error;
+
+	error = get_generations_path(&root);
+	if (error)
+		return error;
+
+	error = remove_tree(root);
+
+	free(root);
+	return error;
+}
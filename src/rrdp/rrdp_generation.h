@@ -0,0 +1,41 @@
+#ifndef SRC_RRDP_RRDP_GENERATION_H_
+#define SRC_RRDP_RRDP_GENERATION_H_
+
+#include <stddef.h>
+#include "uri.h"
+#include "visited_uris.h"
+
+/*
+ * Staging area of an RRDP update (a snapshot or a sequence of deltas).
+ *
+ * Published files are written to a private directory
+ * ("<local-repository>/.rrdp/<notification hash>.<thread>/"), and withdrawals
+ * are only recorded, so the live repository isn't touched while the update is
+ * being downloaded and parsed. Unchanged files aren't copied; reads of a file
+ * that isn't part of the update fall through to the live repository.
+ *
+ * Once the whole update has been processed, rrdp_generation_commit() moves the
+ * staged files into the live repository (each one with an atomic rename) and
+ * applies the withdrawals. The commit itself is all or nothing: the files are
+ * checked and backed up (hard linked to
+ * "<local-repository>/.rrdp/<notification hash>.<thread>.old/") before any of
+ * them is replaced. If anything fails before or during the commit, destroying
+ * the generation discards it, and the live repository stays as it was.
+ */
+struct rrdp_generation;
+
+int rrdp_generation_create(char const *, struct rrdp_generation **);
+void rrdp_generation_destroy(struct rrdp_generation *);
+
+int rrdp_generation_publish(struct rrdp_generation *, struct rpki_uri *,
+    unsigned char const *, size_t);
+int rrdp_generation_withdraw(struct rrdp_generation *, struct rpki_uri *);
+int rrdp_generation_validate_hash(struct rrdp_generation *, struct rpki_uri *,
+    unsigned char const *, size_t);
+
+int rrdp_generation_commit(struct rrdp_generation *, struct visited_uris *,
+    struct visited_uris *);
+
+int rrdp_generation_cleanup(void);
+
+#endif /* SRC_RRDP_RRDP_GENERATION_H_ */
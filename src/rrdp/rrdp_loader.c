@@ -1,6 +1,7 @@
 #include "rrdp_loader.h"
 
 #include "rrdp/db/db_rrdp_uris.h"
+#include "rrdp/rrdp_generation.h"
 #include "rrdp/rrdp_objects.h"
 #include "rrdp/rrdp_parser.h"
 #include "rsync/rsync.h"
@@ -14,6 +15,7 @@ static int
 process_diff_serial(struct update_notification *notification,
     struct visited_uris **visited)
 {
+	struct rrdp_generation *generation;
 	unsigned long serial;
 	int error;
 
@@ -26,14 +28,28 @@ process_diff_serial(struct update_notification *notification,
 	if (error)
 		return error;
 
-	return rrdp_process_deltas(notification, serial, *visited);
+	error = rrdp_generation_create(notification->uri, &generation);
+	if (error)
+		return error;
+
+	error = rrdp_process_deltas(notification, serial, generation);
+	if (!error)
+		error = rrdp_generation_commit(generation, *visited, NULL);
+
+	rrdp_generation_destroy(generation);
+	return error;
 }
 
-/* Fetch and process the snapshot from the @notification */
+/*
+ * Fetch and process the snapshot from the @notification. If @old isn't NULL,
+ * the files of its session that the snapshot doesn't publish are deleted, once
+ * the snapshot is committed.
+ */
 static int
 process_snapshot(struct update_notification *notification,
-    struct visited_uris **visited)
+    struct visited_uris *old, struct visited_uris **visited)
 {
+	struct rrdp_generation *generation;
 	struct visited_uris *tmp;
 	int error;
 
@@ -42,28 +58,26 @@ process_snapshot(struct update_notification *notification,
 	if (error)
 		return error;
 
-	error = rrdp_parse_snapshot(notification, tmp);
-	if (error) {
-		visited_uris_refput(tmp);
-		return error;
-	}
-
-	*visited = tmp;
-	return 0;
-}
+	error = rrdp_generation_create(notification->uri, &generation);
+	if (error)
+		goto release_tmp;
 
-static int
-remove_rrdp_uri_files(char const *notification_uri)
-{
-	struct visited_uris *tmp;
-	int error;
+	error = rrdp_parse_snapshot(notification, generation);
+	if (error)
+		goto release_generation;
 
-	/* Work with the existent visited uris */
-	error = db_rrdp_uris_get_visited_uris(notification_uri, &tmp);
+	error = rrdp_generation_commit(generation, tmp, old);
 	if (error)
-		return error;
+		goto release_generation;
 
-	return visited_uris_delete_local(tmp);
+	rrdp_generation_destroy(generation);
+	*visited = tmp;
+	return 0;
+release_generation:
+	rrdp_generation_destroy(generation);
+release_tmp:
+	visited_uris_refput(tmp);
+	return error;
 }
 
 /* Mark the URI as errored with dummy data, so it won't be requested again */
@@ -101,12 +115,15 @@ mark_rrdp_uri_request_err(char const *notification_uri)
  *
  * If the @uri is being visited again, verify its previous visit state. If there
  * were no errors, just return success; otherwise, return error code -EPERM.
+ *
+ * If the server couldn't be reached, but can be retried later, returns -EAGAIN.
  */
 int
 rrdp_load(struct rpki_uri *uri)
 {
 	struct update_notification *upd_notification;
 	struct visited_uris *visited;
+	struct visited_uris *old;
 	rrdp_req_status_t requested;
 	rrdp_uri_cmp_result_t res;
 	int error, upd_error;
@@ -151,11 +168,12 @@ rrdp_load(struct rpki_uri *uri)
 	case RRDP_URI_EQUAL:
 		goto set_update;
 	case RRDP_URI_DIFF_SESSION:
-		/* Delete the old session files */
-		error = remove_rrdp_uri_files(upd_notification->uri);
+		/* Replace the old session files */
+		error = db_rrdp_uris_get_visited_uris(upd_notification->uri,
+		    &old);
 		if (error)
 			goto upd_destroy;
-		error = process_snapshot(upd_notification, &visited);
+		error = process_snapshot(upd_notification, old, &visited);
 		if (error)
 			goto upd_destroy;
 		break;
@@ -165,10 +183,15 @@ rrdp_load(struct rpki_uri *uri)
 			visited_uris_refget(visited);
 			break;
 		}
-		/* Something went wrong, use snapshot */
+		if (error == -EAGAIN)
+			goto upd_destroy;
+		/*
+		 * Something went wrong, use snapshot. (The deltas were
+		 * discarded, so it starts from the last committed state.)
+		 */
 		pr_info("There was an error processing RRDP deltas, using the snapshot instead.");
 	case RRDP_URI_NOTFOUND:
-		error = process_snapshot(upd_notification, &visited);
+		error = process_snapshot(upd_notification, NULL, &visited);
 		if (error)
 			goto upd_destroy;
 		break;
@@ -199,6 +222,18 @@ upd_destroy:
 		fnstack_pop(); /* Pop from rrdp_parse_notification */
 	}
 upd_error:
+	/*
+	 * The server is failing, but it can be retried later (the CA was
+	 * postponed), so don't mark the URI as error'd.
+	 */
+	if (error == -EAGAIN) {
+		upd_error = db_rrdp_uris_set_request_status(uri_get_global(uri),
+		    RRDP_URI_REQ_UNVISITED);
+		if (upd_error && upd_error != -ENOENT)
+			return upd_error;
+		return error;
+	}
+
 	/* Don't fall here on success */
 	if (error) {
 		/* Reset RSYNC visited URIs, this may force the update */
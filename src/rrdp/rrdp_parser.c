@@ -11,12 +11,14 @@
 #include <unistd.h>
 
 #include "rrdp/db/db_rrdp_uris.h"
+#include "rrdp/rrdp_generation.h"
 #include "crypto/base64.h"
 #include "crypto/hash.h"
 #include "http/http.h"
 #include "xml/relax_ng.h"
+#include "xml/rrdp_structure.h"
 #include "common.h"
-#include "file.h"
+#include "fetch_scheduler.h"
 #include "log.h"
 #include "thread_var.h"
 
@@ -55,8 +57,8 @@ struct rdr_snapshot_ctx {
 	struct snapshot *snapshot;
 	/* Parent data to validate session ID and serial */
 	struct update_notification *parent;
-	/* Visited URIs related to this thread */
-	struct visited_uris *visited_uris;
+	/* Where the files are staged */
+	struct rrdp_generation *generation;
 };
 
 /* Context while reading a delta */
@@ -67,34 +69,16 @@ struct rdr_delta_ctx {
 	struct update_notification *parent;
 	/* Current serial loaded from update notification deltas list */
 	unsigned long expected_serial;
-	/* Visited URIs related to this thread */
-	struct visited_uris *visited_uris;
+	/* Where the files are staged */
+	struct rrdp_generation *generation;
 };
 
 /* Args to send on update (snapshot/delta) files parsing */
 struct proc_upd_args {
 	struct update_notification *parent;
-	struct visited_uris *visited_uris;
+	struct rrdp_generation *generation;
 };
 
-static int
-add_mft_to_list(struct visited_uris *visited_uris, char const *uri)
-{
-	if (strcmp(".mft", strrchr(uri, '.')) != 0)
-		return 0;
-
-	return visited_uris_add(visited_uris, uri);
-}
-
-static int
-rem_mft_from_list(struct visited_uris *visited_uris, char const *uri)
-{
-	if (strcmp(".mft", strrchr(uri, '.')) != 0)
-		return 0;
-
-	return visited_uris_remove(visited_uris, uri);
-}
-
 static size_t
 write_local(unsigned char *content, size_t size, size_t nmemb, void *arg)
 {
@@ -109,36 +93,33 @@ write_local(unsigned char *content, size_t size, size_t nmemb, void *arg)
 	return read;
 }
 
+/*
+ * Returns -EAGAIN if the download failed (or the server is backing off), but
+ * can be retried later. See fetch_scheduler.h.
+ */
 static int
 download_file(struct rpki_uri *uri, long last_update)
 {
-	unsigned int retries;
 	int error;
 
-	retries = 0;
-	do {
-		if (last_update > 0)
-			error = http_download_file_with_ims(uri, write_local,
-			    last_update);
-		else
-			error = http_download_file(uri, write_local);
+	error = fetch_scheduler_request(uri, config_get_rrdp_retry_count());
+	if (error)
+		return error;
 
-		/* Remember: positive values are expected */
-		if (error >= 0)
-			return error;
+	if (last_update > 0)
+		error = http_download_file_with_ims(uri, write_local,
+		    last_update);
+	else
+		error = http_download_file(uri, write_local);
 
-		if (retries == config_get_rrdp_retry_count()) {
-			pr_info("Max RRDP retries (%u) reached fetching '%s', won't retry again.",
-			    retries, uri_get_global(uri));
-			return error;
-		}
-		pr_info("Retrying RRDP file download '%s' in %u seconds, %u attempts remaining.",
-		    uri_get_global(uri),
-		    config_get_rrdp_retry_interval(),
-		    config_get_rrdp_retry_count() - retries);
-		retries++;
-		sleep(config_get_rrdp_retry_interval());
-	} while (true);
+	/* Remember: positive values are expected */
+	if (error >= 0) {
+		fetch_scheduler_success(uri);
+		return error;
+	}
+
+	return fetch_scheduler_failure(uri, config_get_rrdp_retry_interval(),
+	    config_get_rrdp_retry_count(), error);
 }
 
 /* Left trim @from, setting the result at @result pointer */
@@ -281,8 +262,12 @@ parse_string(xmlTextReaderPtr reader, char const *attr, char **result)
 	xmlChar *xml_value;
 	char *tmp;
 
+	/*
+	 * Don't move the reader to the content node, the structural validator
+	 * needs to see it as well.
+	 */
 	if (attr == NULL)
-		xml_value = xmlTextReaderValue(reader);
+		xml_value = xmlTextReaderReadString(reader);
 	else
 		xml_value = xmlTextReaderGetAttribute(reader, BAD_CAST attr);
 
@@ -376,6 +361,21 @@ parse_hex_string(xmlTextReaderPtr reader, bool required, char const *attr,
 	return 0;
 }
 
+/* Parse the RRDP file at @path using the configured grammar validator */
+static int
+xml_parse(const char *path, xml_read_cb cb, void *arg)
+{
+	switch (config_get_rrdp_xml_validation()) {
+	case XML_VALIDATION_RELAX_NG:
+		return relax_ng_parse(path, cb, arg);
+	case XML_VALIDATION_STRUCTURAL:
+		return rrdp_structure_parse(path, cb, arg);
+	}
+
+	pr_crit("Unknown XML validation: %u",
+	    config_get_rrdp_xml_validation());
+}
+
 static int
 validate_version(xmlTextReaderPtr reader, unsigned long expected)
 {
@@ -496,7 +496,7 @@ end:
 
 static int
 parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
-    struct publish **publish)
+    struct rrdp_generation *generation, struct publish **publish)
 {
 	struct publish *tmp;
 	struct rpki_uri *uri;
@@ -513,12 +513,6 @@ parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 		goto release_tmp;
 
 	/* Read the text */
-	if (xmlTextReaderRead(reader) != 1) {
-		error = pr_err("Couldn't read publish content of element '%s'",
-		    tmp->doc_data.uri);
-		goto release_tmp;
-	}
-
 	error = parse_string(reader, NULL, &base64_str);
 	if (error)
 		goto release_tmp;
@@ -536,8 +530,8 @@ parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 		if (error)
 			goto release_base64;
 
-		error = hash_validate_file("sha256", uri, tmp->doc_data.hash,
-		    tmp->doc_data.hash_len);
+		error = rrdp_generation_validate_hash(generation, uri,
+		    tmp->doc_data.hash, tmp->doc_data.hash_len);
 		uri_refput(uri);
 		if (error != 0) {
 			pr_info("Hash of base64 decoded element from URI '%s' doesn't match <publish> element hash",
@@ -558,7 +552,8 @@ release_tmp:
 }
 
 static int
-parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
+parse_withdraw(xmlTextReaderPtr reader, struct rrdp_generation *generation,
+    struct withdraw **withdraw)
 {
 	struct withdraw *tmp;
 	struct rpki_uri *uri;
@@ -578,7 +573,7 @@ parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
 	if (error)
 		goto release_tmp;
 
-	error = hash_validate_file("sha256", uri,
+	error = rrdp_generation_validate_hash(generation, uri,
 	    tmp->doc_data.hash, tmp->doc_data.hash_len);
 	if (error)
 		goto release_uri;
@@ -595,12 +590,9 @@ release_tmp:
 
 static int
 write_from_uri(char const *location, unsigned char *content, size_t content_len,
-    struct visited_uris *visited_uris)
+    struct rrdp_generation *generation)
 {
 	struct rpki_uri *uri;
-	struct stat stat;
-	FILE *out;
-	size_t written;
 	int error;
 
 	/* rfc8181#section-2.2 must be an rsync URI */
@@ -608,56 +600,22 @@ write_from_uri(char const *location, unsigned char *content, size_t content_len,
 	if (error)
 		return error;
 
-	error = create_dir_recursive(uri_get_local(uri));
-	if (error) {
-		uri_refput(uri);
-		return error;
-	}
-
-	error = file_write(uri_get_local(uri), &out, &stat);
-	if (error) {
-		uri_refput(uri);
-		return error;
-	}
-
-	written = fwrite(content, sizeof(unsigned char), content_len, out);
-	if (written != content_len) {
-		uri_refput(uri);
-		file_close(out);
-		return pr_err("Couldn't write bytes to file %s",
-		    uri_get_local(uri));
-	}
-
-	error = add_mft_to_list(visited_uris, uri_get_global(uri));
-	if (error) {
-		uri_refput(uri);
-		file_close(out);
-		return error;
-	}
+	error = rrdp_generation_publish(generation, uri, content, content_len);
 
 	uri_refput(uri);
-	file_close(out);
-	return 0;
+	return error;
 }
 
 /* Remove a local file and its directory tree (if empty) */
 static int
-delete_from_uri(struct rpki_uri *uri, struct visited_uris *visited_uris)
+delete_from_uri(struct rpki_uri *uri)
 {
-	int error;
-
-	if (visited_uris) {
-		error = rem_mft_from_list(visited_uris, uri_get_global(uri));
-		if (error)
-			return error;
-	}
-
 	/* Delete parent dirs only if empty. */
 	return delete_dir_recursive_bottom_up(uri_get_local(uri));
 }
 
 static int
-__delete_from_uri(char const *location, struct visited_uris *visited_uris)
+__delete_from_uri(char const *location, struct rrdp_generation *generation)
 {
 	struct rpki_uri *uri;
 	int error;
@@ -667,7 +625,7 @@ __delete_from_uri(char const *location, struct visited_uris *visited_uris)
 	if (error)
 		return error;
 
-	error = delete_from_uri(uri, visited_uris);
+	error = rrdp_generation_withdraw(generation, uri);
 
 	/* Error 0 is ok */
 	uri_refput(uri);
@@ -675,23 +633,24 @@ __delete_from_uri(char const *location, struct visited_uris *visited_uris)
 }
 
 /*
- * This function will call 'xmlTextReaderRead' so there's no need to expect any
- * other type at the caller.
+ * This function reads the element's content, but it doesn't move the reader;
+ * the content node will still be received (and can be ignored) by the caller.
  */
 static int
 parse_publish_elem(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
-    struct visited_uris *visited_uris)
+    struct rrdp_generation *generation)
 {
 	struct publish *tmp;
 	int error;
 
 	tmp = NULL;
-	error = parse_publish(reader, parse_hash, hash_required, &tmp);
+	error = parse_publish(reader, parse_hash, hash_required, generation,
+	    &tmp);
 	if (error)
 		return error;
 
 	error = write_from_uri(tmp->doc_data.uri, tmp->content,
-	    tmp->content_len, visited_uris);
+	    tmp->content_len, generation);
 	publish_destroy(tmp);
 	if (error)
 		return error;
@@ -699,21 +658,18 @@ parse_publish_elem(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 	return 0;
 }
 
-/*
- * This function will call 'xmlTextReaderRead' so there's no need to expect any
- * other type at the caller.
- */
 static int
-parse_withdraw_elem(xmlTextReaderPtr reader, struct visited_uris *visited_uris)
+parse_withdraw_elem(xmlTextReaderPtr reader,
+    struct rrdp_generation *generation)
 {
 	struct withdraw *tmp;
 	int error;
 
-	error = parse_withdraw(reader, &tmp);
+	error = parse_withdraw(reader, generation, &tmp);
 	if (error)
 		return error;
 
-	error = __delete_from_uri(tmp->doc_data.uri, visited_uris);
+	error = __delete_from_uri(tmp->doc_data.uri, generation);
 	withdraw_destroy(tmp);
 	if (error)
 		return error;
@@ -886,7 +842,7 @@ parse_notification(struct rpki_uri *uri, struct update_notification **file)
 	tmp->uri = dup;
 
 	ctx.notification = tmp;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_notification,
+	error = xml_parse(uri_get_local(uri), xml_read_notification,
 	    &ctx);
 	if (error) {
 		update_notification_destroy(tmp);
@@ -911,7 +867,7 @@ xml_read_snapshot(xmlTextReaderPtr reader, void *arg)
 	case XML_READER_TYPE_ELEMENT:
 		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH))
 			error = parse_publish_elem(reader, false, false,
-			    ctx->visited_uris);
+			    ctx->generation);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_SNAPSHOT))
 			error = parse_global_data(reader,
 			    &ctx->snapshot->global_data,
@@ -950,8 +906,8 @@ parse_snapshot(struct rpki_uri *uri, struct proc_upd_args *args)
 
 	ctx.snapshot = snapshot;
 	ctx.parent = args->parent;
-	ctx.visited_uris = args->visited_uris;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_snapshot, &ctx);
+	ctx.generation = args->generation;
+	error = xml_parse(uri_get_local(uri), xml_read_snapshot, &ctx);
 
 	/* Error 0 is ok */
 	snapshot_destroy(snapshot);
@@ -974,9 +930,9 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 	case XML_READER_TYPE_ELEMENT:
 		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH))
 			error = parse_publish_elem(reader, true, false,
-			    ctx->visited_uris);
+			    ctx->generation);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_WITHDRAW))
-			error = parse_withdraw_elem(reader, ctx->visited_uris);
+			error = parse_withdraw_elem(reader, ctx->generation);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_DELTA))
 			error = parse_global_data(reader,
 			    &ctx->delta->global_data,
@@ -1018,9 +974,9 @@ parse_delta(struct rpki_uri *uri, struct delta_head *parents_data, void *arg)
 
 	ctx.delta = delta;
 	ctx.parent = args->parent;
-	ctx.visited_uris = args->visited_uris;
+	ctx.generation = args->generation;
 	ctx.expected_serial = parents_data->serial;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_delta, &ctx);
+	error = xml_parse(uri_get_local(uri), xml_read_delta, &ctx);
 
 	/* Error 0 is ok */
 	delta_destroy(delta);
@@ -1050,7 +1006,7 @@ process_delta(struct delta_head *delta_head, void *arg)
 
 	error = parse_delta(uri, delta_head, arg);
 
-	delete_from_uri(uri, NULL);
+	delete_from_uri(uri);
 	/* Error 0 its ok */
 release_uri:
 	uri_refput(uri);
@@ -1098,14 +1054,14 @@ rrdp_parse_notification(struct rpki_uri *uri,
 
 	/* No updates yet */
 	if (error > 0) {
-		delete_from_uri(uri, NULL);
+		delete_from_uri(uri);
 		*result = NULL;
 		return 0;
 	}
 
 	fnstack_push_uri(uri);
 	error = parse_notification(uri, result);
-	delete_from_uri(uri, NULL);
+	delete_from_uri(uri);
 	if (error) {
 		fnstack_pop();
 		return error;
@@ -1114,16 +1070,55 @@ rrdp_parse_notification(struct rpki_uri *uri,
 	return 0;
 }
 
+/*
+ * Lighter version of rrdp_parse_notification(), meant to be called between
+ * validation cycles: Downloads the notification file @uri if it was modified
+ * since @last_update (0 means "unconditionally"), and returns its session ID
+ * and serial in @result. (Which has to be cleaned up by the caller.)
+ *
+ * Returns a positive value if the server says the file didn't change. Doesn't
+ * touch the validation state, nor the RRDP database.
+ */
+int
+rrdp_peek_notification(struct rpki_uri *uri, long last_update,
+    struct global_data *result)
+{
+	struct update_notification *notification;
+	int error;
+
+	if (last_update > 0)
+		error = http_download_file_with_ims(uri, write_local,
+		    last_update);
+	else
+		error = http_download_file(uri, write_local);
+	if (error) {
+		delete_from_uri(uri);
+		return error;
+	}
+
+	error = parse_notification(uri, &notification);
+	delete_from_uri(uri);
+	if (error)
+		return error;
+
+	/* Steal it */
+	*result = notification->global_data;
+	global_data_init(&notification->global_data);
+
+	update_notification_destroy(notification);
+	return 0;
+}
+
 int
 rrdp_parse_snapshot(struct update_notification *parent,
-    struct visited_uris *visited_uris)
+    struct rrdp_generation *generation)
 {
 	struct proc_upd_args args;
 	struct rpki_uri *uri;
 	int error;
 
 	args.parent = parent;
-	args.visited_uris = visited_uris;
+	args.generation = generation;
 
 	pr_debug("Processing snapshot '%s'.", parent->snapshot.uri);
 	error = uri_create_https_str(&uri, parent->snapshot.uri,
@@ -1137,7 +1132,7 @@ rrdp_parse_snapshot(struct update_notification *parent,
 
 	error = parse_snapshot(uri, &args);
 
-	delete_from_uri(uri, NULL);
+	delete_from_uri(uri);
 	/* Error 0 is ok */
 release_uri:
 	uri_refput(uri);
@@ -1146,12 +1141,12 @@ release_uri:
 
 int
 rrdp_process_deltas(struct update_notification *parent,
-    unsigned long cur_serial, struct visited_uris *visited_uris)
+    unsigned long cur_serial, struct rrdp_generation *generation)
 {
 	struct proc_upd_args args;
 
 	args.parent = parent;
-	args.visited_uris = visited_uris;
+	args.generation = generation;
 
 	return deltas_head_for_each(parent->deltas_list,
 	    parent->global_data.serial, cur_serial, process_delta, &args);
@@ -1,14 +1,16 @@
 #ifndef SRC_RRDP_RRDP_PARSER_H_
 #define SRC_RRDP_RRDP_PARSER_H_
 
+#include "rrdp/rrdp_generation.h"
 #include "rrdp/rrdp_objects.h"
 #include "uri.h"
-#include "visited_uris.h"
 
 int rrdp_parse_notification(struct rpki_uri *, struct update_notification **);
-int rrdp_parse_snapshot(struct update_notification *, struct visited_uris *);
+int rrdp_peek_notification(struct rpki_uri *, long, struct global_data *);
+int rrdp_parse_snapshot(struct update_notification *,
+    struct rrdp_generation *);
 
 int rrdp_process_deltas(struct update_notification *,
-    unsigned long serial, struct visited_uris *);
+    unsigned long serial, struct rrdp_generation *);
 
 #endif /* SRC_RRDP_RRDP_PARSER_H_ */
@@ -1,85 +1,252 @@
+#define _GNU_SOURCE
+
 #include "rsync.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h> /* SIGINT, SIGQUIT, etc */
-#include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include "changeset.h"
 #include "common.h"
 #include "config.h"
+#include "fetch_scheduler.h"
 #include "log.h"
+#include "metrics.h"
+#include "state.h"
 #include "str.h"
 #include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "rsync/rsync_pool.h"
 
-struct uri {
-	struct rpki_uri *uri;
-	SLIST_ENTRY(uri) next;
+/*
+ * State of a path, regarding the current validation cycle.
+ */
+enum node_state {
+	/* Not downloaded (though its ancestors or descendants might be) */
+	NS_NONE,
+	/* Some thread is rsyncing it right now */
+	NS_DOWNLOADING,
+	/* Already rsync'd; its whole tree is fresh */
+	NS_DOWNLOADED,
+};
+
+/*
+ * Node of the trie of rsync'd URIs. Each level is a path component (split by
+ * '/'), so checking whether a URI or any of its ancestors was already
+ * downloaded only costs one hash lookup per component.
+ */
+struct rsync_node {
+	/* Path component; the key */
+	char *name;
+	enum node_state state;
+	struct rsync_node *children;
+	UT_hash_handle hh;
 };
 
-/** URIs that we have already downloaded. */
-SLIST_HEAD(uri_list, uri);
+/*
+ * URIs that have already been downloaded, by any TAL. Shared, so TALs that
+ * reference the same repository don't rsync it twice.
+ */
+static struct rsync_node *root;
+
+/* Protects @root; signals the end of every download */
+static pthread_mutex_t lock;
+static pthread_cond_t download_done;
 
 /* static char const *const RSYNC_PREFIX = "rsync://"; */
 
+extern char **environ;
+
 int
-rsync_create(struct uri_list **result)
+rsync_init(void)
 {
-	struct uri_list *visited_uris;
+	int error;
+
+	error = pthread_mutex_init(&lock, NULL);
+	if (error)
+		return pr_errno(error, "pthread_mutex_init() errored");
+
+	error = pthread_cond_init(&download_done, NULL);
+	if (error) {
+		pthread_mutex_destroy(&lock);
+		return pr_errno(error, "pthread_cond_init() errored");
+	}
+
+	root = NULL;
+
+	error = rsync_pool_init();
+	if (error) {
+		pthread_cond_destroy(&download_done);
+		pthread_mutex_destroy(&lock);
+	}
+
+	return error;
+}
 
-	visited_uris = malloc(sizeof(struct uri_list));
-	if (visited_uris == NULL)
+static void
+node_destroy(struct rsync_node *node)
+{
+	struct rsync_node *child, *tmp;
+
+	HASH_ITER(hh, node->children, child, tmp) {
+		HASH_DEL(node->children, child);
+		node_destroy(child);
+	}
+	free(node->name);
+	free(node);
+}
+
+void
+rsync_destroy(void)
+{
+	rsync_pool_destroy();
+	if (root != NULL)
+		node_destroy(root);
+	root = NULL;
+	pthread_cond_destroy(&download_done);
+	pthread_mutex_destroy(&lock);
+}
+
+static struct rsync_node *
+find_child(struct rsync_node *parent, struct string_tokenizer *tokenizer)
+{
+	struct rsync_node *child;
+
+	HASH_FIND(hh, parent->children, tokenizer->str + tokenizer->start,
+	    tokenizer->end - tokenizer->start, child);
+	return child;
+}
+
+static int
+create_node(char const *name, size_t name_len, struct rsync_node **result)
+{
+	struct rsync_node *node;
+
+	node = malloc(sizeof(struct rsync_node));
+	if (node == NULL)
 		return pr_enomem();
+	/* Needed by uthash */
+	memset(node, 0, sizeof(struct rsync_node));
 
-	SLIST_INIT(visited_uris);
+	node->name = malloc(name_len + 1);
+	if (node->name == NULL) {
+		free(node);
+		return pr_enomem();
+	}
+	memcpy(node->name, name, name_len);
+	node->name[name_len] = '\0';
+	node->state = NS_NONE;
+	node->children = NULL;
 
-	*result = visited_uris;
+	*result = node;
 	return 0;
 }
 
-void
-rsync_destroy(struct uri_list *list)
+static int
+add_child(struct rsync_node *parent, struct string_tokenizer *tokenizer,
+    struct rsync_node **result)
 {
-	struct uri *uri;
+	struct rsync_node *child;
+	size_t name_len;
+	int error;
+
+	name_len = tokenizer->end - tokenizer->start;
+	error = create_node(tokenizer->str + tokenizer->start, name_len,
+	    &child);
+	if (error)
+		return error;
 
-	while (!SLIST_EMPTY(list)) {
-		uri = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, next);
-		uri_refput(uri->uri);
-		free(uri);
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, parent->children, child->name, name_len, child);
+	if (errno) {
+		error = -pr_errno(errno, "Couldn't add rsync URI node");
+		free(child->name);
+		free(child);
+		return error;
 	}
-	free(list);
+
+	*result = child;
+	return 0;
 }
 
 /*
- * Returns true if @ancestor an ancestor of @descendant, or @descendant itself.
- * Returns false otherwise.
+ * Returns the state of the nearest downloaded (or downloading) node that
+ * covers @uri. Call while holding the lock.
+ *
+ * In strict mode, the ancestors don't count; only @uri itself.
  */
-static bool
-is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
+static enum node_state
+get_state(struct rpki_uri *uri)
+{
+	struct string_tokenizer tokenizer;
+	struct rsync_node *node;
+	enum node_state result;
+	bool strict;
+
+	if (root == NULL)
+		return NS_NONE;
+
+	strict = config_get_rsync_strategy() == RSYNC_STRICT;
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+
+	node = root;
+	result = NS_NONE;
+	while (string_tokenizer_next(&tokenizer)) {
+		node = find_child(node, &tokenizer);
+		if (node == NULL)
+			return NS_NONE;
+		if (strict)
+			continue;
+		if (node->state == NS_DOWNLOADED)
+			return NS_DOWNLOADED;
+		if (node->state == NS_DOWNLOADING)
+			result = NS_DOWNLOADING;
+	}
+
+	return strict ? node->state : result;
+}
+
+/* Returns @uri's node, creating the missing ones. Call while holding the lock */
+static int
+get_node(struct rpki_uri *uri, struct rsync_node **result)
 {
-	struct string_tokenizer ancestor_tokenizer;
-	struct string_tokenizer descendant_tokenizer;
+	struct string_tokenizer tokenizer;
+	struct rsync_node *node;
+	struct rsync_node *child;
+	int error;
 
-	string_tokenizer_init(&ancestor_tokenizer, uri_get_global(ancestor),
-	    uri_get_global_len(ancestor), '/');
-	string_tokenizer_init(&descendant_tokenizer, uri_get_global(descendant),
-	    uri_get_global_len(descendant), '/');
+	if (root == NULL) {
+		error = create_node("", 0, &root);
+		if (error)
+			return error;
+	}
 
-	if (config_get_rsync_strategy() == RSYNC_STRICT)
-		return strcmp(uri_get_global(ancestor),
-		    uri_get_global(descendant)) == 0;
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
 
-	do {
-		if (!string_tokenizer_next(&ancestor_tokenizer))
-			return true;
-		if (!string_tokenizer_next(&descendant_tokenizer))
-			return false;
-		if (!token_equals(&ancestor_tokenizer, &descendant_tokenizer))
-			return false;
-	} while (true);
+	node = root;
+	while (string_tokenizer_next(&tokenizer)) {
+		child = find_child(node, &tokenizer);
+		if (child == NULL) {
+			error = add_child(node, &tokenizer, &child);
+			if (error)
+				return error;
+		}
+		node = child;
+	}
+
+	*result = node;
+	return 0;
 }
 
 /*
@@ -87,33 +254,76 @@ is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
  * run.
  */
 static bool
-is_already_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+is_already_downloaded(struct rpki_uri *uri)
 {
-	struct uri *cursor;
+	enum node_state state;
 
-	/* TODO (next iteration) this is begging for a radix trie. */
-	SLIST_FOREACH(cursor, visited_uris, next)
-		if (is_descendant(cursor->uri, uri))
-			return true;
+	pthread_mutex_lock(&lock);
+	state = get_state(uri);
+	pthread_mutex_unlock(&lock);
 
-	return false;
+	return state == NS_DOWNLOADED;
 }
 
 static int
-mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+mark_as_downloaded(struct rpki_uri *uri)
 {
-	struct uri *node;
+	struct rsync_node *node;
+	int error;
 
-	node = malloc(sizeof(struct uri));
-	if (node == NULL)
-		return pr_enomem();
+	pthread_mutex_lock(&lock);
+	error = get_node(uri, &node);
+	if (!error)
+		node->state = NS_DOWNLOADED;
+	pthread_mutex_unlock(&lock);
+
+	return error;
+}
 
-	node->uri = uri;
-	uri_refget(uri);
+/*
+ * If @requested_uri hasn't been downloaded, claims @rsync_uri's download (so
+ * other threads wait for it, instead of rsyncing it as well) and returns it at
+ * @result. If it has (maybe by a thread this had to wait for), @result is
+ * NULL.
+ */
+static int
+claim_download(struct rpki_uri *requested_uri, struct rpki_uri *rsync_uri,
+    struct rsync_node **result)
+{
+	int error;
 
-	SLIST_INSERT_HEAD(visited_uris, node, next);
+	pthread_mutex_lock(&lock);
 
-	return 0;
+	do {
+		switch (get_state(requested_uri)) {
+		case NS_DOWNLOADED:
+			pthread_mutex_unlock(&lock);
+			*result = NULL;
+			return 0;
+		case NS_DOWNLOADING:
+			pthread_cond_wait(&download_done, &lock);
+			continue;
+		case NS_NONE:
+			break;
+		}
+		break;
+	} while (true);
+
+	error = get_node(rsync_uri, result);
+	if (!error)
+		(*result)->state = NS_DOWNLOADING;
+
+	pthread_mutex_unlock(&lock);
+	return error;
+}
+
+static void
+finish_download(struct rsync_node *node, int error)
+{
+	pthread_mutex_lock(&lock);
+	node->state = error ? NS_NONE : NS_DOWNLOADED;
+	pthread_cond_broadcast(&download_done);
+	pthread_mutex_unlock(&lock);
 }
 
 static int
@@ -171,226 +381,504 @@ get_rsync_uri(struct rpki_uri *requested_uri, bool is_ta,
 }
 
 /*
- * Duplicate parent FDs, to pipe rsync output:
- * - fds[0] = stderr
- * - fds[1] = stdout
+ * Builds the rsync command line: the program, the configured arguments (with
+ * $REMOTE and $LOCAL replaced) and the NULL terminator.
+ *
+ * The strings are borrowed from the configuration and @uri; only the array
+ * has to be freed.
  */
-static void
-duplicate_fds(int fds[2][2])
-{
-	/* Use the loop to catch interruptions */
-	while ((dup2(fds[0][1], STDERR_FILENO) == -1)
-		&& (errno == EINTR)) {}
-	close(fds[0][1]);
-	close(fds[0][0]);
-
-	while ((dup2(fds[1][1], STDOUT_FILENO) == -1)
-	    && (errno == EINTR)) {}
-	close(fds[1][1]);
-	close(fds[1][0]);
-}
-
-static void
-handle_child_thread(struct rpki_uri *uri, bool is_ta, int fds[2][2])
+static int
+prepare_args(struct rpki_uri *uri, bool is_ta, char ***result)
 {
-	/* THIS FUNCTION MUST NEVER RETURN!!! */
-
 	struct string_array const *config_args;
-	char **copy_args;
+	char **args;
 	unsigned int i;
-	int error;
 
 	config_args = config_get_rsync_args(is_ta);
-	/*
-	 * We need to work on a copy, because the config args are immutable,
-	 * and we need to add the program name (for some reason) and NULL
-	 * elements, and replace $REMOTE and $LOCAL.
-	 */
-	copy_args = calloc(config_args->length + 2, sizeof(char *));
-	if (copy_args == NULL)
-		exit(pr_enomem());
-
-	copy_args[0] = config_get_rsync_program();
-	copy_args[config_args->length + 1] = NULL;
 
-	memcpy(copy_args + 1, config_args->array,
-	    config_args->length * sizeof(char *));
+	args = calloc(config_args->length + 2, sizeof(char *));
+	if (args == NULL)
+		return pr_enomem();
 
-	for (i = 1; i < config_args->length + 1; i++) {
-		if (strcmp(copy_args[i], "$REMOTE") == 0)
-			copy_args[i] = strdup(uri_get_global(uri));
-		else if (strcmp(copy_args[i], "$LOCAL") == 0)
-			copy_args[i] = strdup(uri_get_local(uri));
-		if (copy_args[i] == NULL)
-			exit(pr_enomem());
+	args[0] = config_get_rsync_program();
+	for (i = 0; i < config_args->length; i++) {
+		if (strcmp(config_args->array[i], "$REMOTE") == 0)
+			args[i + 1] = (char *) uri_get_global(uri);
+		else if (strcmp(config_args->array[i], "$LOCAL") == 0)
+			args[i + 1] = (char *) uri_get_local(uri);
+		else
+			args[i + 1] = config_args->array[i];
 	}
+	args[config_args->length + 1] = NULL;
 
 	pr_debug("Executing RSYNC:");
 	for (i = 0; i < config_args->length + 1; i++)
-		pr_debug("    %s", copy_args[i]);
+		pr_debug("    %s", args[i]);
+
+	*result = args;
+	return 0;
+}
+
+/*
+ * Launches rsync, with its stderr and stdout piped to @fds[0] and @fds[1].
+ *
+ * posix_spawn() is used instead of fork() because this process can be huge,
+ * and fork() would have to copy its page tables (only to discard them right
+ * away, on exec).
+ */
+static int
+spawn_rsync(struct rpki_uri *uri, bool is_ta, int fds[2][2], pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	char **args = NULL;
+	int error;
 
-	duplicate_fds(fds);
+	error = prepare_args(uri, is_ta, &args);
+	if (error)
+		return error;
 
-	execvp(copy_args[0], copy_args);
-	error = errno;
-	pr_err("Could not execute the rsync command: %s",
-	    strerror(error));
+	error = posix_spawn_file_actions_init(&actions);
+	if (error) {
+		error = -pr_errno(error, "posix_spawn_file_actions_init() errored");
+		goto free_args;
+	}
 
-	/* https://stackoverflow.com/a/14493459/1735458 */
-	exit(error);
+	/* The rest of the descriptors are close-on-exec. */
+	error = posix_spawn_file_actions_adddup2(&actions, fds[0][1],
+	    STDERR_FILENO);
+	if (!error)
+		error = posix_spawn_file_actions_adddup2(&actions, fds[1][1],
+		    STDOUT_FILENO);
+	if (error) {
+		error = -pr_errno(error, "posix_spawn_file_actions_adddup2() errored");
+		goto destroy_actions;
+	}
+
+	error = posix_spawnp(pid, args[0], &actions, NULL, args, environ);
+	if (error)
+		error = -pr_errno(error, "Could not execute the rsync command");
+
+destroy_actions:
+	posix_spawn_file_actions_destroy(&actions);
+free_args:
+	free(args);
+	return error;
 }
 
 static int
-create_pipes(int fds[2][2])
+create_pipe(int fds[2], char const *name)
 {
-	if (pipe(fds[0]) == -1)
-		return -pr_errno(errno, "Piping rsync stderr");
-	if (pipe(fds[1]) == -1)
-		return -pr_errno(errno, "Piping rsync stdout");
+	/*
+	 * Don't leak them to the rsyncs other threads are spawning; they
+	 * would keep the pipe open, and delay the EOF. (Atomically; another
+	 * thread could spawn between a pipe() and a fcntl().)
+	 */
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		return -pr_errno(errno, "Piping rsync %s", name);
+
 	return 0;
 }
 
+static int
+create_pipes(int fds[2][2])
+{
+	int error;
+
+	error = create_pipe(fds[0], "stderr");
+	if (error)
+		return error;
+
+	error = create_pipe(fds[1], "stdout");
+	if (error) {
+		close(fds[0][0]);
+		close(fds[0][1]);
+	}
+
+	return error;
+}
+
 static void
-log_buffer(char const *buffer, ssize_t read, int type)
+close_pipes(int fds[2][2])
 {
+	close(fds[0][0]);
+	close(fds[0][1]);
+	close(fds[1][0]);
+	close(fds[1][1]);
+}
+
 #define PRE_RSYNC "[RSYNC exec]: "
-	char *cpy, *cur, *tmp;
+/* Length of the "YXcstpoguax" prefix printed by --itemize-changes */
+#define ITEMIZE_LEN 11
+
+/* What rsync did to the files, according to its --itemize-changes output */
+struct rsync_report {
+	unsigned int added;
+	unsigned int modified;
+	unsigned int removed;
+
+	/* The URI being rsync'd */
+	struct rpki_uri *uri;
+	/* Some of the changes couldn't be recorded at the changeset */
+	bool incomplete;
+};
+
+/* Pending (incomplete) line of one of the child's outputs */
+struct line_buffer {
+	char data[4096];
+	size_t len;
+};
+
+/*
+ * Records at the changeset (see changeset.h) that @path, as printed by
+ * --itemize-changes, changed.
+ *
+ * @path is relative to the destination directory, and might or might not start
+ * with the last component of the remote URI (that depends on whether rsync had
+ * to create the directory), so both candidates are recorded.
+ */
+static void
+record_change(struct rsync_report *report, char const *path)
+{
+	char const *remote;
+	size_t len;
+	char *candidate;
+	unsigned int i;
 
-	cpy = malloc(read + 1);
-	if (cpy == NULL) {
-		pr_enomem();
+	if (!config_get_incremental_validation())
 		return;
-	}
-	strncpy(cpy, buffer, read);
-	cpy[read] = '\0';
 
-	/* Break lines to one line at log */
-	cur = cpy;
-	while ((tmp = strchr(cur, '\n')) != NULL) {
-		*tmp = '\0';
-		if(strlen(cur) == 0) {
-			cur = tmp + 1;
-			continue;
+	remote = uri_get_global(report->uri);
+	len = strlen(remote);
+	while (len > 0 && remote[len - 1] == '/')
+		len--;
+
+	for (i = 0; i < 2; i++) {
+		if (i == 1) {
+			/* The parent of the remote URI */
+			while (len > 0 && remote[len - 1] != '/')
+				len--;
+			while (len > 0 && remote[len - 1] == '/')
+				len--;
 		}
-		if (type == 0)
-			pr_err(PRE_RSYNC "%s", cur);
-		else
-			pr_info(PRE_RSYNC "%s", cur);
-		cur = tmp + 1;
+
+		candidate = malloc(len + strlen(path) + 2);
+		if (candidate == NULL) {
+			report->incomplete = true;
+			return;
+		}
+		memcpy(candidate, remote, len);
+		candidate[len] = '/';
+		strcpy(candidate + len + 1, path);
+
+		if (changeset_add_file(candidate) != 0)
+			report->incomplete = true;
+		free(candidate);
 	}
-	free(cpy);
-#undef PRE_RSYNC
 }
 
-static int
-read_pipe(int fd_pipe[2][2], int type)
+/* Short options of rsync that take a value, such as "-T<dir>" or "-T <dir>" */
+#define RSYNC_SHORT_WITH_VALUE "@BefMT"
+
+/* Does @args include --itemize-changes (or its short form)? */
+static bool
+has_itemize(struct string_array const *args)
 {
-	char buffer[4096];
-	ssize_t count;
+	char const *arg;
+	char const *opt;
+	size_t i;
 
-	while (1) {
-		count = read(fd_pipe[type][0], buffer, sizeof(buffer));
-		if (count == -1) {
-			if (errno == EINTR)
-				continue;
-			return -pr_errno(errno, "Reading rsync buffer");
+	for (i = 0; i < args->length; i++) {
+		arg = args->array[i];
+		if (strcmp(arg, "--itemize-changes") == 0)
+			return true;
+		if (arg[0] != '-' || arg[1] == '-')
+			continue; /* Not an option, or a long one */
+
+		/* Bundled short options, such as "-rti" */
+		for (opt = arg + 1; *opt != '\0'; opt++) {
+			if (*opt == 'i')
+				return true;
+			if (strchr(RSYNC_SHORT_WITH_VALUE, *opt) != NULL) {
+				/* The rest is the value, or the next argument is */
+				if (opt[1] == '\0')
+					i++;
+				break;
+			}
 		}
-		if (count == 0)
-			break;
+	}
+
+	return false;
+}
+
+/* Will rsync print the changes it makes? (See parse_itemized().) */
+static bool
+prints_changes(bool is_ta)
+{
+	return has_itemize(config_get_rsync_args(is_ta));
+}
+
+/*
+ * If @line is one of the lines --itemize-changes prints, records it at
+ * @report and returns true. Directories and files that only changed
+ * attributes (ie. times) are not interesting, but still consumed.
+ */
+static bool
+parse_itemized(char const *line, struct rsync_report *report)
+{
+	char const *path;
+
+	if (strlen(line) <= ITEMIZE_LEN + 1 || line[ITEMIZE_LEN] != ' ')
+		return false;
+	path = line + ITEMIZE_LEN + 1;
 
-		log_buffer(buffer, count, type);
+	if (strncmp(line, "*deleting", strlen("*deleting")) == 0) {
+		pr_debug(PRE_RSYNC "Removed '%s'", path);
+		report->removed++;
+		record_change(report, path);
+		return true;
 	}
-	close(fd_pipe[type][0]);
-	return 0;
+
+	if (strchr("<>ch.", line[0]) == NULL ||
+	    strchr("fdLDS", line[1]) == NULL)
+		return false;
+
+	if (line[1] != 'f' || line[0] == '.')
+		return true;
+
+	if (line[2] == '+') {
+		pr_debug(PRE_RSYNC "Added '%s'", path);
+		report->added++;
+	} else {
+		pr_debug(PRE_RSYNC "Modified '%s'", path);
+		report->modified++;
+	}
+	record_change(report, path);
+
+	return true;
+}
+
+static void
+handle_line(char const *line, int type, struct rsync_report *report)
+{
+	if (strlen(line) == 0)
+		return;
+
+	if (type == 0)
+		pr_err(PRE_RSYNC "%s", line);
+	else if (!parse_itemized(line, report))
+		pr_info(PRE_RSYNC "%s", line);
 }
 
+/*
+ * Appends @buffer to @pending, and handles the lines it completes. If @eof,
+ * the last line is handled even if it lacks its newline.
+ */
+static void
+handle_output(struct line_buffer *pending, char const *buffer, size_t len,
+    bool eof, int type, struct rsync_report *report)
+{
+	char *start, *newline;
+	size_t copied;
+
+	do {
+		copied = sizeof(pending->data) - 1 - pending->len;
+		if (copied > len)
+			copied = len;
+		memcpy(pending->data + pending->len, buffer, copied);
+		pending->len += copied;
+		pending->data[pending->len] = '\0';
+		buffer += copied;
+		len -= copied;
+
+		start = pending->data;
+		while ((newline = strchr(start, '\n')) != NULL) {
+			*newline = '\0';
+			handle_line(start, type, report);
+			start = newline + 1;
+		}
+
+		pending->len -= start - pending->data;
+		memmove(pending->data, start, pending->len);
+
+		/* Line too long for the buffer; flush it as it is */
+		if (eof || pending->len == sizeof(pending->data) - 1) {
+			pending->data[pending->len] = '\0';
+			handle_line(pending->data, type, report);
+			pending->len = 0;
+		}
+	} while (len > 0);
+}
+
+/*
+ * Handles the child's stderr and stdout until both are closed. They're read as
+ * they come, so the child never blocks on a full pipe.
+ */
 static int
-read_pipes(int fds[2][2])
+read_pipes(int fds[2][2], struct rsync_report *report)
 {
+	struct pollfd pfds[2];
+	struct line_buffer pending[2];
+	char buffer[4096];
+	ssize_t count;
+	unsigned int open;
+	unsigned int i;
 	int error;
 
 	/* Won't be needed */
 	close(fds[0][1]);
 	close(fds[1][1]);
 
-	/* stderr pipe */
-	error = read_pipe(fds, 0);
-	if (error)
-		return error;
+	/* stderr is type 0, stdout is type 1 */
+	for (i = 0; i < 2; i++) {
+		pfds[i].fd = fds[i][0];
+		pfds[i].events = POLLIN;
+		pending[i].len = 0;
+	}
+
+	error = 0;
+	open = 2;
+	while (open > 0) {
+		if (poll(pfds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			error = -pr_errno(errno, "Polling rsync pipes");
+			break;
+		}
+
+		for (i = 0; i < 2; i++) {
+			if (pfds[i].fd == -1 || pfds[i].revents == 0)
+				continue;
+
+			count = read(pfds[i].fd, buffer, sizeof(buffer));
+			if (count == -1) {
+				if (errno == EINTR)
+					continue;
+				error = -pr_errno(errno, "Reading rsync buffer");
+				goto end;
+			}
+			if (count == 0) {
+				handle_output(&pending[i], buffer, 0, true, i,
+				    report);
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				open--;
+				continue;
+			}
+
+			handle_output(&pending[i], buffer, count, false, i,
+			    report);
+		}
+	}
 
-	/* stdout pipe */
-	return read_pipe(fds, 1);
+end:
+	for (i = 0; i < 2; i++)
+		if (pfds[i].fd != -1)
+			close(pfds[i].fd);
+	return error;
 }
+#undef PRE_RSYNC
 
 /*
  * Downloads the @uri->global file into the @uri->local path.
+ *
+ * Returns -EAGAIN if the rsync failed (or the server is backing off), but can
+ * be retried later. See fetch_scheduler.h.
+ *
+ * If @background, the calling thread has no validation to postpone (it's one
+ * of the rsync pool's, or the change checks'): the server was already checked
+ * by the caller, and a failure is only recorded. (In the pool's case, the
+ * validation that queued the rsync postpones itself once it collects the
+ * result.)
  */
 static int
-do_rsync(struct rpki_uri *uri, bool is_ta)
+do_rsync(struct rpki_uri *uri, bool is_ta, bool background)
 {
 	/* Descriptors to pipe stderr (first element) and stdout (second) */
-	int fork_fds[2][2];
+	int fds[2][2];
 	pid_t child_pid;
-	unsigned int retries;
 	int child_status;
+	struct rsync_report report;
+	struct timespec start;
+	int pipe_error;
+	int changes_error;
 	int error;
 
-	retries = 0;
-	do {
-		child_status = 0;
-		error = create_dir_recursive(uri_get_local(uri));
+	if (!background) {
+		error = fetch_scheduler_request(uri,
+		    config_get_rsync_retry_count());
 		if (error)
 			return error;
+	}
 
-		error = create_pipes(fork_fds);
-		if (error)
-			return error;
+	child_status = 0;
+	changes_error = 0;
+	error = create_dir_recursive(uri_get_local(uri));
+	if (error)
+		return error;
 
-		/* We need to fork because execvp() magics the thread away. */
-		child_pid = fork();
-		if (child_pid == 0) {
-			/* This code is run by the child. */
-			handle_child_thread(uri, is_ta, fork_fds);
-		}
+	error = create_pipes(fds);
+	if (error)
+		return error;
 
-		/* This code is run by us. */
-		error = read_pipes(fork_fds);
-		if (error)
+	metrics_now(&start);
+	error = spawn_rsync(uri, is_ta, fds, &child_pid);
+	if (error) {
+		close_pipes(fds);
+		return error;
+	}
+
+	memset(&report, 0, sizeof(report));
+	report.uri = uri;
+	pipe_error = read_pipes(fds, &report);
+
+	/* Reap it even if its output couldn't be read */
+	error = waitpid(child_pid, &child_status, 0);
+	metrics_fetch(uri, &start, pipe_error || error == -1 ||
+	    !WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0);
+
+	/*
+	 * If we don't know exactly what changed (failed rsyncs might have
+	 * transferred some files), assume anything did.
+	 */
+	if (pipe_error || error == -1 || !WIFEXITED(child_status) ||
+	    WEXITSTATUS(child_status) != 0 || report.incomplete ||
+	    !prints_changes(is_ta))
+		changes_error = changeset_add_tree(uri_get_global(uri),
+		    uri_get_global_len(uri));
+
+	if (pipe_error)
+		return pipe_error;
+	if (changes_error)
+		return changes_error;
+	if (error == -1) {
+		error = errno;
+		pr_err("The rsync sub-process returned error %d (%s)",
+		    error, strerror(error));
+		if (child_status <= 0)
 			return error;
+	}
 
-		error = waitpid(child_pid, &child_status, 0);
-		do {
-			if (error == -1) {
-				error = errno;
-				pr_err("The rsync sub-process returned error %d (%s)",
-				    error, strerror(error));
-				if (child_status > 0)
-					break;
-				return error;
-			}
-		} while (0);
-
-		if (WIFEXITED(child_status)) {
-			/* Happy path (but also sad path sometimes). */
-			error = WEXITSTATUS(child_status);
-			pr_debug("Child terminated with error code %d.", error);
-			if (!error)
-				return 0;
-			if (retries == config_get_rsync_retry_count()) {
-				pr_info("Max RSYNC retries (%u) reached on '%s', won't retry again.",
-				    retries, uri_get_global(uri));
-				return error;
-			}
-			pr_info("Retrying RSYNC '%s' in %u seconds, %u attempts remaining.",
-			    uri_get_global(uri),
+	if (WIFEXITED(child_status)) {
+		/* Happy path (but also sad path sometimes). */
+		error = WEXITSTATUS(child_status);
+		pr_debug("Child terminated with error code %d.", error);
+		if (!error) {
+			pr_debug("RSYNC of '%s': %u added, %u modified, %u removed.",
+			    uri_get_printable(uri), report.added,
+			    report.modified, report.removed);
+			fetch_scheduler_success(uri);
+			return 0;
+		}
+		if (background) {
+			fetch_scheduler_record_failure(uri,
 			    config_get_rsync_retry_interval(),
-			    config_get_rsync_retry_count() - retries);
-			retries++;
-			sleep(config_get_rsync_retry_interval());
-			continue;
+			    config_get_rsync_retry_count());
+			return error;
 		}
-		break;
-	} while (true);
+		return fetch_scheduler_failure(uri,
+		    config_get_rsync_retry_interval(),
+		    config_get_rsync_retry_count(), error);
+	}
 
 	if (WIFSIGNALED(child_status)) {
 		switch (WTERMSIG(child_status)) {
@@ -431,21 +919,14 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	 * @rsync_uri is the URL we're actually going to RSYNC.
 	 * (They can differ, depending on config_get_rsync_strategy().)
 	 */
-	struct validation *state;
-	struct uri_list *visited_uris;
 	struct rpki_uri *rsync_uri;
+	struct rsync_node *node;
 	int error;
 
 	if (!config_get_rsync_enabled())
 		return 0;
 
-	state = state_retrieve();
-	if (state == NULL)
-		return -EINVAL;
-
-	visited_uris = validation_rsync_visited_uris(state);
-
-	if (!force && is_already_downloaded(requested_uri, visited_uris)) {
+	if (!force && is_already_downloaded(requested_uri)) {
 		pr_debug("No need to redownload '%s'.",
 		    uri_get_printable(requested_uri));
 		return 0;
@@ -459,35 +940,165 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	if (error)
 		return error;
 
-	pr_debug("Going to RSYNC '%s'.", uri_get_printable(rsync_uri));
+	if (force) {
+		pr_debug("Going to RSYNC '%s'.", uri_get_printable(rsync_uri));
+		error = do_rsync(rsync_uri, is_ta, false);
+		if (!error)
+			error = mark_as_downloaded(rsync_uri);
+		goto end;
+	}
 
-	/* Don't store when "force" and if its already downloaded */
-	error = do_rsync(rsync_uri, is_ta);
-	if (!error &&
-	    !(force && is_already_downloaded(rsync_uri, visited_uris)))
-		error = mark_as_downloaded(rsync_uri, visited_uris);
+	/* Another TAL might have been downloading it meanwhile */
+	error = claim_download(requested_uri, rsync_uri, &node);
+	if (error || node == NULL) {
+		pr_debug("No need to redownload '%s'.",
+		    uri_get_printable(requested_uri));
+		goto end;
+	}
+
+	pr_debug("Going to RSYNC '%s'.", uri_get_printable(rsync_uri));
+	error = do_rsync(rsync_uri, is_ta, false);
+	finish_download(node, error);
 
+end:
 	uri_refput(rsync_uri);
 	return error;
 }
 
-void
-reset_downloaded(void)
+/*
+ * Downloads the TA certificate @uri again, outside of the validation cycles
+ * (see repo_watcher.h). There's no validation to postpone, so this doesn't
+ * need a validation state: if @uri's host is backing off, -EAGAIN is returned
+ * right away, and a failure is only recorded.
+ */
+int
+download_ta_poll(struct rpki_uri *uri)
+{
+	if (!config_get_rsync_enabled())
+		return 0;
+
+	if (fetch_scheduler_is_down(uri)) {
+		pr_debug("Not polling '%s'; its host is backing off.",
+		    uri_get_printable(uri));
+		return -EAGAIN;
+	}
+
+	pr_debug("Going to RSYNC '%s'.", uri_get_printable(uri));
+	return do_rsync(uri, true, true);
+}
+
+static int
+download_in_background(struct rpki_uri *uri, void *arg)
+{
+	struct rsync_node *node = arg;
+	int error;
+
+	error = do_rsync(uri, false, true);
+	finish_download(node, error);
+	return error;
+}
+
+/*
+ * Same as download_files(@requested_uri, false, false), except that, if the
+ * rsync pool is enabled, the download is queued and -EINPROGRESS is returned.
+ * The caller is expected to try again later (see validation_pop_retry()); the
+ * next call will wait for the download to finish.
+ */
+int
+download_files_async(struct rpki_uri *requested_uri)
 {
 	struct validation *state;
-	struct uri_list *list;
-	struct uri *uri;
+	struct rpki_uri *rsync_uri;
+	struct rsync_node *node;
+	int error;
+
+	if (!rsync_pool_enabled())
+		return download_files(requested_uri, false, false);
+
+	if (!config_get_rsync_enabled())
+		return 0;
+
+	if (is_already_downloaded(requested_uri)) {
+		pr_debug("No need to redownload '%s'.",
+		    uri_get_printable(requested_uri));
+		return 0;
+	}
 
 	state = state_retrieve();
 	if (state == NULL)
-		return;
+		return -EINVAL;
+
+	error = get_rsync_uri(requested_uri, false, &rsync_uri);
+	if (error)
+		return error;
+
+	error = claim_download(requested_uri, rsync_uri, &node);
+	if (error || node == NULL)
+		goto end;
+
+	/*
+	 * Don't queue it if its server is backing off. This is also where a
+	 * failed background download is collected: its node was released, so
+	 * the retried CA claims it again, and gets postponed (or told that the
+	 * server is down) here.
+	 */
+	error = fetch_scheduler_request(rsync_uri,
+	    config_get_rsync_retry_count());
+	if (error) {
+		finish_download(node, error);
+		goto end;
+	}
 
-	list = validation_rsync_visited_uris(state);
+	error = rsync_pool_submit(rsync_uri, download_in_background, node);
+	if (error) {
+		finish_download(node, error);
+		goto end;
+	}
+
+	pr_debug("Queued RSYNC of '%s'.", uri_get_printable(rsync_uri));
+	validation_schedule_retry(state, time(NULL));
+	error = -EINPROGRESS;
+
+end:
+	uri_refput(rsync_uri);
+	return error;
+}
+
+/*
+ * Forgets the downloaded marks of @node's tree, and frees whatever's not
+ * needed by an ongoing download. Returns whether @node can be freed.
+ */
+static bool
+prune(struct rsync_node *node)
+{
+	struct rsync_node *child, *tmp;
 
-	while (!SLIST_EMPTY(list)) {
-		uri = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, next);
-		uri_refput(uri->uri);
-		free(uri);
+	HASH_ITER(hh, node->children, child, tmp) {
+		if (prune(child)) {
+			HASH_DEL(node->children, child);
+			free(child->name);
+			free(child);
+		}
+	}
+
+	if (node->state == NS_DOWNLOADED)
+		node->state = NS_NONE;
+
+	return node->state == NS_NONE && node->children == NULL;
+}
+
+/*
+ * Forgets every download (from every TAL), so the next requests of each
+ * repository are rsync'd again.
+ */
+void
+reset_downloaded(void)
+{
+	pthread_mutex_lock(&lock);
+	if (root != NULL && prune(root)) {
+		free(root->name);
+		free(root);
+		root = NULL;
 	}
+	pthread_mutex_unlock(&lock);
 }
@@ -4,11 +4,12 @@
 #include <stdbool.h>
 #include "uri.h"
 
-struct uri_list;
+int rsync_init(void);
+void rsync_destroy(void);
 
 int download_files(struct rpki_uri *, bool, bool);
-int rsync_create(struct uri_list **);
-void rsync_destroy(struct uri_list *);
+int download_files_async(struct rpki_uri *);
+int download_ta_poll(struct rpki_uri *);
 
 void reset_downloaded(void);
 
@@ -0,0 +1,244 @@
+#include "rsync/rsync_pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "thread_var.h"
+
+struct rsync_job {
+	struct rpki_uri *uri;
+	rsync_pool_cb cb;
+	void *arg;
+	TAILQ_ENTRY(rsync_job) next;
+};
+
+TAILQ_HEAD(job_queue, rsync_job);
+
+/* Jobs nobody has picked yet */
+static struct job_queue queued;
+/* Jobs being executed by some worker */
+static struct job_queue running;
+
+static pthread_t *workers;
+static unsigned int workers_len;
+static bool stopping;
+
+/* Protects the queues and @stopping */
+static pthread_mutex_t lock;
+/* Signals a job was queued or finished, or the pool is stopping */
+static pthread_cond_t changed;
+
+static bool
+same_host(struct rpki_uri *uri1, struct rpki_uri *uri2)
+{
+	size_t len;
+
+	len = uri_get_host_len(uri1);
+	return len == uri_get_host_len(uri2) &&
+	    strncmp(uri_get_global(uri1), uri_get_global(uri2), len) == 0;
+}
+
+/* Call while holding the lock */
+static unsigned int
+count_running(struct rpki_uri *uri)
+{
+	struct rsync_job *job;
+	unsigned int result;
+
+	result = 0;
+	TAILQ_FOREACH(job, &running, next)
+		if (same_host(job->uri, uri))
+			result++;
+
+	return result;
+}
+
+/*
+ * Moves the oldest job whose host isn't saturated to the running queue.
+ * Call while holding the lock.
+ */
+static struct rsync_job *
+pick_job(void)
+{
+	struct rsync_job *job;
+	unsigned int per_host;
+
+	per_host = config_get_rsync_parallel_per_host();
+	TAILQ_FOREACH(job, &queued, next) {
+		if (count_running(job->uri) < per_host) {
+			TAILQ_REMOVE(&queued, job, next);
+			TAILQ_INSERT_TAIL(&running, job, next);
+			return job;
+		}
+	}
+
+	return NULL;
+}
+
+static void *
+work(void *arg)
+{
+	struct rsync_job *job;
+
+	fnstack_init();
+	pthread_mutex_lock(&lock);
+
+	while (true) {
+		job = pick_job();
+		if (job == NULL) {
+			if (stopping && TAILQ_EMPTY(&queued))
+				break;
+			pthread_cond_wait(&changed, &lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&lock);
+		job->cb(job->uri, job->arg);
+		pthread_mutex_lock(&lock);
+
+		TAILQ_REMOVE(&running, job, next);
+		uri_refput(job->uri);
+		free(job);
+		/* Its host has a free slot now */
+		pthread_cond_broadcast(&changed);
+	}
+
+	pthread_mutex_unlock(&lock);
+	fnstack_cleanup();
+	return NULL;
+}
+
+static void
+stop_workers(unsigned int len)
+{
+	unsigned int i;
+	int error;
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+
+	/* Not cancelled; they'd leave the lock taken */
+	for (i = 0; i < len; i++) {
+		error = pthread_join(workers[i], NULL);
+		if (error)
+			pr_crit("pthread_join() threw %d on an rsync worker.",
+			    error);
+	}
+}
+
+int
+rsync_pool_init(void)
+{
+	unsigned int i;
+	int error;
+
+	TAILQ_INIT(&queued);
+	TAILQ_INIT(&running);
+	stopping = false;
+	workers = NULL;
+	workers_len = 0;
+
+	if (config_get_rsync_parallel_total() == 0)
+		return 0;
+
+	error = pthread_mutex_init(&lock, NULL);
+	if (error)
+		return pr_errno(error, "rsync pool pthread_mutex_init() errored");
+	error = pthread_cond_init(&changed, NULL);
+	if (error) {
+		error = pr_errno(error, "rsync pool pthread_cond_init() errored");
+		goto destroy_lock;
+	}
+
+	workers = calloc(config_get_rsync_parallel_total(), sizeof(pthread_t));
+	if (workers == NULL) {
+		error = pr_enomem();
+		goto destroy_cond;
+	}
+
+	for (i = 0; i < config_get_rsync_parallel_total(); i++) {
+		error = pthread_create(&workers[i], NULL, work, NULL);
+		if (error) {
+			error = pr_errno(error, "Could not spawn rsync worker");
+			stop_workers(i);
+			goto free_workers;
+		}
+	}
+
+	workers_len = config_get_rsync_parallel_total();
+	return 0;
+free_workers:
+	free(workers);
+	workers = NULL;
+destroy_cond:
+	pthread_cond_destroy(&changed);
+destroy_lock:
+	pthread_mutex_destroy(&lock);
+	return error;
+}
+
+void
+rsync_pool_destroy(void)
+{
+	if (workers == NULL)
+		return;
+
+	stop_workers(workers_len);
+	free(workers);
+	workers = NULL;
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+bool
+rsync_pool_enabled(void)
+{
+	return workers != NULL;
+}
+
+/*
+ * Queues the download of @uri. @cb will be called by a worker thread, and is
+ * expected to do the actual rsync and notify whoever's waiting for it.
+ */
+int
+rsync_pool_submit(struct rpki_uri *uri, rsync_pool_cb cb, void *arg)
+{
+	struct rsync_job *job;
+
+	job = malloc(sizeof(struct rsync_job));
+	if (job == NULL)
+		return pr_enomem();
+
+	uri_refget(uri);
+	job->uri = uri;
+	job->cb = cb;
+	job->arg = arg;
+
+	pthread_mutex_lock(&lock);
+	TAILQ_INSERT_TAIL(&queued, job, next);
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/* Waits until every submitted job has finished. */
+void
+rsync_pool_wait(void)
+{
+	if (workers == NULL)
+		return;
+
+	pthread_mutex_lock(&lock);
+	while (!TAILQ_EMPTY(&queued) || !TAILQ_EMPTY(&running))
+		pthread_cond_wait(&changed, &lock);
+	pthread_mutex_unlock(&lock);
+}
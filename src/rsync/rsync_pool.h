@@ -0,0 +1,25 @@
+#ifndef SRC_RSYNC_RSYNC_POOL_H_
+#define SRC_RSYNC_RSYNC_POOL_H_
+
+#include <stdbool.h>
+#include "uri.h"
+
+/*
+ * Threads that run rsyncs in the background, so the validation threads don't
+ * have to wait for every one of them.
+ *
+ * At most "rsync.parallel.total" rsyncs run at the same time, and at most
+ * "rsync.parallel.per-host" of them against the same server. The rest are
+ * queued.
+ */
+
+typedef int (*rsync_pool_cb)(struct rpki_uri *, void *);
+
+int rsync_pool_init(void);
+void rsync_pool_destroy(void);
+
+bool rsync_pool_enabled(void);
+int rsync_pool_submit(struct rpki_uri *, rsync_pool_cb, void *);
+void rsync_pool_wait(void);
+
+#endif /* SRC_RSYNC_RSYNC_POOL_H_ */
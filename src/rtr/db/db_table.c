@@ -1,24 +1,105 @@
 #include "rtr/db/db_table.h"
 
+#include <pthread.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "data_structure/uthash_nonfatal.h"
 
 struct hashable_roa {
 	struct vrp data;
+	/* Trust Anchor it was validated under; see db_table_intern_ta() */
+	char const *ta;
 	UT_hash_handle hh;
 };
 
 struct hashable_key {
 	struct router_key data;
+	char const *ta;
 	UT_hash_handle hh;
 };
 
 struct db_table {
 	struct hashable_roa *roas;
 	struct hashable_key *router_keys;
+	/* Trust Anchor of the entries added from now on */
+	char const *ta;
 };
 
+struct ta_name {
+	char *name;
+	UT_hash_handle hh;
+};
+
+static struct ta_name *ta_names;
+static pthread_mutex_t ta_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns the copy of @name all tables share. Since it's never released (until
+ * db_table_ta_cleanup()), entries can move between tables (and the output
+ * printer) without caring for its lifetime. There's one per TAL, at most.
+ *
+ * Returns NULL on memory allocation failure.
+ */
+char const *
+db_table_intern_ta(char const *name)
+{
+	struct ta_name *ta;
+
+	pthread_mutex_lock(&ta_lock);
+
+	HASH_FIND_STR(ta_names, name, ta);
+	if (ta != NULL)
+		goto end;
+
+	ta = malloc(sizeof(struct ta_name));
+	if (ta == NULL)
+		goto end;
+	/* Needed by uthash */
+	memset(ta, 0, sizeof(struct ta_name));
+
+	ta->name = strdup(name);
+	if (ta->name == NULL)
+		goto fail;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, ta_names, ta->name, strlen(ta->name), ta);
+	if (errno) {
+		free(ta->name);
+		goto fail;
+	}
+
+end:
+	pthread_mutex_unlock(&ta_lock);
+	return (ta != NULL) ? ta->name : NULL;
+
+fail:
+	free(ta);
+	pthread_mutex_unlock(&ta_lock);
+	return NULL;
+}
+
+/* Call once no table needs its TAs anymore. */
+void
+db_table_ta_cleanup(void)
+{
+	struct ta_name *ta, *tmp;
+
+	pthread_mutex_lock(&ta_lock);
+	HASH_ITER(hh, ta_names, ta, tmp) {
+		HASH_DEL(ta_names, ta);
+		free(ta->name);
+		free(ta);
+	}
+	pthread_mutex_unlock(&ta_lock);
+}
+
+/* @ta has to come from db_table_intern_ta(), or be NULL (unknown). */
+void
+db_table_set_ta(struct db_table *table, char const *ta)
+{
+	table->ta = ta;
+}
+
 struct db_table *
 db_table_create(void)
 {
@@ -30,6 +111,7 @@ db_table_create(void)
 
 	table->roas = NULL;
 	table->router_keys = NULL;
+	table->ta = NULL;
 	return table;
 }
 
@@ -85,6 +167,39 @@ db_table_foreach_router_key(struct db_table *table, router_key_foreach_cb cb,
 	return 0;
 }
 
+/* Same as db_table_foreach_roa(), but also hands over each VRP's TA. */
+int
+db_table_foreach_roa_ta(struct db_table *table, vrp_ta_foreach_cb cb,
+    void *arg)
+{
+	struct hashable_roa *node, *tmp;
+	int error;
+
+	HASH_ITER(hh, table->roas, node, tmp) {
+		error = cb(&node->data, node->ta, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+int
+db_table_foreach_router_key_ta(struct db_table *table,
+    router_key_ta_foreach_cb cb, void *arg)
+{
+	struct hashable_key *node, *tmp;
+	int error;
+
+	HASH_ITER(hh, table->router_keys, node, tmp) {
+		error = cb(&node->data, node->ta, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 static struct hashable_roa *
 create_roa(uint32_t asn, uint8_t max_length)
 {
@@ -132,75 +247,86 @@ add_router_key(struct db_table *table, struct hashable_key *new)
 	return 0;
 }
 
+/* Copies @node (TA included) into @dst. */
 static int
-duplicate_roa(struct db_table *dst, struct hashable_roa *new)
+duplicate_roa(struct db_table *dst, struct hashable_roa *node)
 {
-	struct vrp vrp;
-	struct ipv4_prefix prefix4;
-	struct ipv6_prefix prefix6;
+	struct hashable_roa *roa;
+	int error;
 
-	vrp = new->data;
-	switch (vrp.addr_fam) {
-	case AF_INET:
-		prefix4.addr = vrp.prefix.v4;
-		prefix4.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v4(dst, vrp.asn, &prefix4,
-		    vrp.max_prefix_length);
-	case AF_INET6:
-		prefix6.addr = vrp.prefix.v6;
-		prefix6.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v6(dst, vrp.asn, &prefix6,
-		    vrp.max_prefix_length);
-	}
+	roa = malloc(sizeof(struct hashable_roa));
+	if (roa == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(roa, 0, sizeof(struct hashable_roa));
 
-	pr_crit("Unknown address family: %d", vrp.addr_fam);
+	/* Padding included; it's part of the key */
+	memcpy(&roa->data, &node->data, sizeof(roa->data));
+	roa->ta = node->ta;
+
+	error = add_roa(dst, roa);
+	if (error)
+		free(roa);
+	return error;
 }
 
 static int
-duplicate_key(struct db_table *dst, struct hashable_key *new)
+duplicate_key(struct db_table *dst, struct hashable_key *node)
 {
-	return rtrhandler_handle_router_key(dst, new->data.ski, new->data.as,
-	    new->data.spk);
+	struct hashable_key *key;
+	int error;
+
+	key = malloc(sizeof(struct hashable_key));
+	if (key == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(key, 0, sizeof(struct hashable_key));
+
+	memcpy(&key->data, &node->data, sizeof(key->data));
+	key->ta = node->ta;
+
+	error = add_router_key(dst, key);
+	if (error)
+		free(key);
+	return error;
 }
 
-#define MERGE_ITER(table_prop, name, err_var)				\
+#define MERGE_ITER(table_prop, name, filter_cb, err_var)		\
 	struct hashable_##name *node_##name, *tmp_##name, *found_##name;\
 	HASH_ITER(hh, src->table_prop, node_##name, tmp_##name) {	\
 		HASH_FIND(hh, dst->table_prop, &node_##name->data,	\
 			sizeof(node_##name->data), found_##name);	\
 		if (found_##name != NULL)				\
 			continue;					\
+		if (filter_cb != NULL && filter_cb(&node_##name->data, arg))\
+			continue;					\
 		err_var = duplicate_##name(dst, node_##name);		\
 		if (err_var)						\
 			return err_var;					\
 	}
 
-static int
+/* Adds the ROAs and router keys of @src that @dst lacks. */
+int
 db_table_merge(struct db_table *dst, struct db_table *src)
 {
-	int error;
-
-	/** Must look for elements due to the new mem allocation */
-	MERGE_ITER(roas, roa, error)
-	MERGE_ITER(router_keys, key, error)
-
-	return 0;
+	return db_table_merge_filtered(dst, src, NULL, NULL, NULL);
 }
 
+/*
+ * Same as db_table_merge(), except the ROAs and router keys @roa_filter and
+ * @key_filter return true for are skipped. (Either can be NULL.)
+ */
 int
-db_table_clone(struct db_table **dst, struct db_table *src)
+db_table_merge_filtered(struct db_table *dst, struct db_table *src,
+    vrp_filter_cb roa_filter, router_key_filter_cb key_filter, void *arg)
 {
 	int error;
 
-	*dst = db_table_create();
-	if (*dst == NULL)
-		return pr_enomem();
-
-	error = db_table_merge(*dst, src);
-	if (error)
-		free(*dst);
+	/** Must look for elements due to the new mem allocation */
+	MERGE_ITER(roas, roa, roa_filter, error)
+	MERGE_ITER(router_keys, key, key_filter, error)
 
-	return error;
+	return 0;
 }
 
 unsigned int
@@ -215,29 +341,15 @@ db_table_router_key_count(struct db_table *table)
 	return HASH_COUNT(table->router_keys);
 }
 
-void
-db_table_remove_roa(struct db_table *table, struct vrp const *del)
-{
-	struct hashable_roa *ptr;
-
-	HASH_FIND(hh, table->roas, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->roas, ptr);
-		free(ptr);
-	}
-}
-
-void
-db_table_remove_router_key(struct db_table *table,
-    struct router_key const *del)
+/* Returns the memory occupied by @table (minus malloc's overhead), in bytes. */
+size_t
+db_table_size(struct db_table *table)
 {
-	struct hashable_key *ptr;
-
-	HASH_FIND(hh, table->router_keys, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->router_keys, ptr);
-		free(ptr);
-	}
+	return sizeof(struct db_table)
+	    + HASH_COUNT(table->roas) * sizeof(struct hashable_roa)
+	    + HASH_OVERHEAD(hh, table->roas)
+	    + HASH_COUNT(table->router_keys) * sizeof(struct hashable_key)
+	    + HASH_OVERHEAD(hh, table->router_keys);
 }
 
 int
@@ -253,6 +365,7 @@ rtrhandler_handle_roa_v4(struct db_table *table, uint32_t asn,
 	roa->data.prefix.v4 = prefix4->addr;
 	roa->data.prefix_length = prefix4->len;
 	roa->data.addr_fam = AF_INET;
+	roa->ta = table->ta;
 
 	error = add_roa(table, roa);
 	if (error)
@@ -273,6 +386,7 @@ rtrhandler_handle_roa_v6(struct db_table *table, uint32_t asn,
 	roa->data.prefix.v6 = prefix6->addr;
 	roa->data.prefix_length = prefix6->len;
 	roa->data.addr_fam = AF_INET6;
+	roa->ta = table->ta;
 
 	error = add_roa(table, roa);
 	if (error)
@@ -294,6 +408,7 @@ rtrhandler_handle_router_key(struct db_table *table,
 	memset(key, 0, sizeof(struct hashable_key));
 
 	router_key_init(&key->data, ski, as, spk);
+	key->ta = table->ta;
 
 	error = add_router_key(table, key);
 	if (error)
@@ -1,6 +1,7 @@
 #ifndef SRC_RTR_DB_DB_TABLE_H_
 #define SRC_RTR_DB_DB_TABLE_H_
 
+#include <stdbool.h>
 #include "rtr/db/delta.h"
 #include "rtr/db/vrp.h"
 
@@ -9,17 +10,32 @@ struct db_table;
 struct db_table *db_table_create(void);
 void db_table_destroy(struct db_table *);
 
-int db_table_clone(struct db_table **, struct db_table *);
+char const *db_table_intern_ta(char const *);
+void db_table_ta_cleanup(void);
+void db_table_set_ta(struct db_table *, char const *);
+
+typedef bool (*vrp_filter_cb)(struct vrp const *, void *);
+typedef bool (*router_key_filter_cb)(struct router_key const *, void *);
+
+int db_table_merge(struct db_table *, struct db_table *);
+int db_table_merge_filtered(struct db_table *, struct db_table *,
+    vrp_filter_cb, router_key_filter_cb, void *);
 
 unsigned int db_table_roa_count(struct db_table *);
 unsigned int db_table_router_key_count(struct db_table *);
+size_t db_table_size(struct db_table *);
 
 int db_table_foreach_roa(struct db_table *, vrp_foreach_cb, void *);
-void db_table_remove_roa(struct db_table *, struct vrp const *);
-
 int db_table_foreach_router_key(struct db_table *, router_key_foreach_cb,
     void *);
-void db_table_remove_router_key(struct db_table *, struct router_key const *);
+
+typedef int (*vrp_ta_foreach_cb)(struct vrp const *, char const *, void *);
+typedef int (*router_key_ta_foreach_cb)(struct router_key const *,
+    char const *, void *);
+
+int db_table_foreach_roa_ta(struct db_table *, vrp_ta_foreach_cb, void *);
+int db_table_foreach_router_key_ta(struct db_table *,
+    router_key_ta_foreach_cb, void *);
 
 int rtrhandler_handle_roa_v4(struct db_table *, uint32_t,
     struct ipv4_prefix const *, uint8_t);
@@ -1,6 +1,8 @@
 #include "rtr/db/delta.h"
 
+#include <arpa/inet.h>
 #include <stdatomic.h>
+#include <string.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "data_structure/array_list.h"
@@ -159,6 +161,229 @@ deltas_is_empty(struct deltas *deltas)
 	    && (deltas->rk.removes.len == 0);
 }
 
+/* Returns the memory occupied by @deltas, in bytes. */
+size_t
+deltas_size(struct deltas *deltas)
+{
+	return sizeof(struct deltas)
+	    + (deltas->v4.adds.len + deltas->v4.removes.len)
+	    * sizeof(struct delta_v4)
+	    + (deltas->v6.adds.len + deltas->v6.removes.len)
+	    * sizeof(struct delta_v6)
+	    + (deltas->rk.adds.len + deltas->rk.removes.len)
+	    * sizeof(struct delta_rk);
+}
+
+/* Returns the number of announcements and withdrawals in @deltas. */
+size_t
+deltas_count(struct deltas *deltas)
+{
+	return deltas->v4.adds.len + deltas->v4.removes.len
+	    + deltas->v6.adds.len + deltas->v6.removes.len
+	    + deltas->rk.adds.len + deltas->rk.removes.len;
+}
+
+static int
+v4_cmp(void const *arg1, void const *arg2)
+{
+	struct delta_v4 const *d1 = arg1;
+	struct delta_v4 const *d2 = arg2;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	if (d1->prefix.addr.s_addr != d2->prefix.addr.s_addr)
+		return (ntohl(d1->prefix.addr.s_addr) <
+		    ntohl(d2->prefix.addr.s_addr)) ? -1 : 1;
+	if (d1->prefix.len != d2->prefix.len)
+		return (d1->prefix.len < d2->prefix.len) ? -1 : 1;
+	return d1->max_length - d2->max_length;
+}
+
+static int
+v6_cmp(void const *arg1, void const *arg2)
+{
+	struct delta_v6 const *d1 = arg1;
+	struct delta_v6 const *d2 = arg2;
+	int result;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	result = memcmp(&d1->prefix.addr, &d2->prefix.addr,
+	    sizeof(struct in6_addr));
+	if (result != 0)
+		return result;
+	if (d1->prefix.len != d2->prefix.len)
+		return (d1->prefix.len < d2->prefix.len) ? -1 : 1;
+	return d1->max_length - d2->max_length;
+}
+
+static int
+rk_cmp(void const *arg1, void const *arg2)
+{
+	struct delta_rk const *d1 = arg1;
+	struct delta_rk const *d2 = arg2;
+	int result;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	result = memcmp(d1->ski, d2->ski, RK_SKI_LEN);
+	if (result != 0)
+		return result;
+	return memcmp(d1->spk, d2->spk, RK_SPKI_LEN);
+}
+
+/*
+ * Removes the elements present in both @adds and @removes. (An announcement
+ * followed by a withdrawal, or the other way around, amounts to nothing.)
+ *
+ * Both arrays are sorted in the process.
+ */
+static void
+cancel_out(void *adds, size_t *adds_len, void *removes, size_t *removes_len,
+    size_t size, int (*cmp)(void const *, void const *))
+{
+	unsigned char *a = adds;
+	unsigned char *r = removes;
+	size_t i, j;
+	size_t a_len, r_len;
+	int diff;
+
+	qsort(adds, *adds_len, size, cmp);
+	qsort(removes, *removes_len, size, cmp);
+
+	i = j = 0;
+	a_len = r_len = 0;
+	while (i < *adds_len && j < *removes_len) {
+		diff = cmp(a + i * size, r + j * size);
+		if (diff == 0) {
+			i++;
+			j++;
+		} else if (diff < 0) {
+			memmove(a + a_len++ * size, a + i++ * size, size);
+		} else {
+			memmove(r + r_len++ * size, r + j++ * size, size);
+		}
+	}
+	for (; i < *adds_len; i++)
+		memmove(a + a_len++ * size, a + i * size, size);
+	for (; j < *removes_len; j++)
+		memmove(r + r_len++ * size, r + j * size, size);
+
+	*adds_len = a_len;
+	*removes_len = r_len;
+}
+
+static int
+append_v4(struct deltas_v4 *dst, struct deltas_v4 *src)
+{
+	struct delta_v4 *d;
+	array_index i;
+	int error;
+
+	ARRAYLIST_FOREACH(src, d, i) {
+		error = deltas_v4_add(dst, d);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int
+append_v6(struct deltas_v6 *dst, struct deltas_v6 *src)
+{
+	struct delta_v6 *d;
+	array_index i;
+	int error;
+
+	ARRAYLIST_FOREACH(src, d, i) {
+		error = deltas_v6_add(dst, d);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int
+append_rk(struct deltas_rk *dst, struct deltas_rk *src)
+{
+	struct delta_rk *d;
+	array_index i;
+	int error;
+
+	ARRAYLIST_FOREACH(src, d, i) {
+		error = deltas_rk_add(dst, d);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int
+append(struct deltas *dst, struct deltas *src)
+{
+	int error;
+
+	error = append_v4(&dst->v4.adds, &src->v4.adds);
+	if (error)
+		return error;
+	error = append_v4(&dst->v4.removes, &src->v4.removes);
+	if (error)
+		return error;
+	error = append_v6(&dst->v6.adds, &src->v6.adds);
+	if (error)
+		return error;
+	error = append_v6(&dst->v6.removes, &src->v6.removes);
+	if (error)
+		return error;
+	error = append_rk(&dst->rk.adds, &src->rk.adds);
+	if (error)
+		return error;
+	return append_rk(&dst->rk.removes, &src->rk.removes);
+}
+
+/*
+ * Creates, in @result, the deltas that amount to applying @older and then
+ * @newer. Operations that cancel each other are left out.
+ */
+int
+deltas_merge(struct deltas *older, struct deltas *newer,
+    struct deltas **result)
+{
+	struct deltas *merged;
+	int error;
+
+	error = deltas_create(&merged);
+	if (error)
+		return error;
+
+	error = append(merged, older);
+	if (error)
+		goto fail;
+	error = append(merged, newer);
+	if (error)
+		goto fail;
+
+	cancel_out(merged->v4.adds.array, &merged->v4.adds.len,
+	    merged->v4.removes.array, &merged->v4.removes.len,
+	    sizeof(struct delta_v4), v4_cmp);
+	cancel_out(merged->v6.adds.array, &merged->v6.adds.len,
+	    merged->v6.removes.array, &merged->v6.removes.len,
+	    sizeof(struct delta_v6), v6_cmp);
+	cancel_out(merged->rk.adds.array, &merged->rk.adds.len,
+	    merged->rk.removes.array, &merged->rk.removes.len,
+	    sizeof(struct delta_rk), rk_cmp);
+
+	*result = merged;
+	return 0;
+
+fail:
+	deltas_refput(merged);
+	return error;
+}
+
 static int
 __foreach_v4(struct deltas_v4 *array, delta_vrp_foreach_cb cb, void *arg,
     serial_t serial, uint8_t flags)
@@ -0,0 +1,621 @@
+#include "rtr/db/snapshot.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "log.h"
+
+static uint32_t crc_table[256];
+
+static void
+crc_init(void)
+{
+	uint32_t crc;
+	unsigned int i, j;
+
+	if (crc_table[1] != 0)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc & 1) ? (0xEDB88320u ^ (crc >> 1)) : (crc >> 1);
+		crc_table[i] = crc;
+	}
+}
+
+/* CRC-32 (the one from zlib and Ethernet.) Start with @crc = 0. */
+static uint32_t
+crc32_update(uint32_t crc, void const *buffer, size_t len)
+{
+	unsigned char const *bytes = buffer;
+
+	crc = ~crc;
+	for (; len > 0; len--, bytes++)
+		crc = crc_table[(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t
+sections_checksum(void const *v4, size_t v4_count, void const *v6,
+    size_t v6_count, void const *rks, size_t rk_count, void const *tas,
+    size_t ta_count)
+{
+	uint32_t crc;
+
+	crc_init();
+	crc = crc32_update(0, v4, v4_count * sizeof(struct snapshot_vrp4));
+	crc = crc32_update(crc, v6, v6_count * sizeof(struct snapshot_vrp6));
+	crc = crc32_update(crc, rks, rk_count * sizeof(struct snapshot_rk));
+	return crc32_update(crc, tas, ta_count * sizeof(struct snapshot_ta));
+}
+
+/* Returns the @ta field of the records that belong to @ta. */
+static int
+ta_index(struct snapshot_records *records, char const *ta, uint16_t *result)
+{
+	char const **tmp;
+	size_t i;
+
+	if (ta == NULL) {
+		*result = 0;
+		return 0;
+	}
+
+	for (i = 0; i < records->ta_count; i++) {
+		if (records->tas[i] == ta) {
+			*result = htons(i + 1);
+			return 0;
+		}
+	}
+
+	if (records->ta_count == UINT16_MAX - 1) {
+		*result = 0; /* Way too many; just lose track of them */
+		return 0;
+	}
+
+	tmp = realloc(records->tas, (records->ta_count + 1) * sizeof(*tmp));
+	if (tmp == NULL)
+		return pr_enomem();
+	records->tas = tmp;
+	records->tas[records->ta_count++] = ta;
+
+	*result = htons(records->ta_count);
+	return 0;
+}
+
+static int
+snapshot_add_roa(struct vrp const *vrp, char const *ta, void *arg)
+{
+	struct snapshot_records *records = arg;
+	struct snapshot_vrp4 *v4;
+	struct snapshot_vrp6 *v6;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		v4 = &records->v4[records->v4_count++];
+		memcpy(v4->prefix, &vrp->prefix.v4, sizeof(v4->prefix));
+		v4->prefix_length = vrp->prefix_length;
+		v4->max_length = vrp->max_prefix_length;
+		v4->asn = htonl(vrp->asn);
+		return ta_index(records, ta, &v4->ta);
+	case AF_INET6:
+		v6 = &records->v6[records->v6_count++];
+		memcpy(v6->prefix, &vrp->prefix.v6, sizeof(v6->prefix));
+		v6->prefix_length = vrp->prefix_length;
+		v6->max_length = vrp->max_prefix_length;
+		v6->asn = htonl(vrp->asn);
+		return ta_index(records, ta, &v6->ta);
+	}
+
+	pr_crit("Unknown address family: %d", vrp->addr_fam);
+}
+
+static int
+snapshot_add_router_key(struct router_key const *key, char const *ta,
+    void *arg)
+{
+	struct snapshot_records *records = arg;
+	struct snapshot_rk *rk;
+
+	rk = &records->rks[records->rk_count++];
+	rk->asn = htonl(key->as);
+	memcpy(rk->ski, key->ski, RK_SKI_LEN);
+	memcpy(rk->spk, key->spk, RK_SPKI_LEN);
+	memset(rk->zero, 0, sizeof(rk->zero));
+	return ta_index(records, ta, &rk->ta);
+}
+
+/* The TA is not part of the order; a table can't have the same VRP twice. */
+
+static int
+snapshot_vrp4_cmp(void const *a, void const *b)
+{
+	struct snapshot_vrp4 const *v4a = a;
+	struct snapshot_vrp4 const *v4b = b;
+	int cmp;
+
+	cmp = memcmp(v4a, v4b, offsetof(struct snapshot_vrp4, ta));
+	if (cmp != 0)
+		return cmp;
+	return memcmp(&v4a->asn, &v4b->asn, sizeof(v4a->asn));
+}
+
+static int
+snapshot_vrp6_cmp(void const *a, void const *b)
+{
+	struct snapshot_vrp6 const *v6a = a;
+	struct snapshot_vrp6 const *v6b = b;
+	int cmp;
+
+	cmp = memcmp(v6a, v6b, offsetof(struct snapshot_vrp6, ta));
+	if (cmp != 0)
+		return cmp;
+	return memcmp(&v6a->asn, &v6b->asn, sizeof(v6a->asn));
+}
+
+static int
+snapshot_rk_cmp(void const *a, void const *b)
+{
+	struct snapshot_rk const *rka = a;
+	struct snapshot_rk const *rkb = b;
+	int cmp;
+
+	cmp = memcmp(&rka->asn, &rkb->asn, sizeof(rka->asn));
+	if (cmp != 0)
+		return cmp;
+	/* SKI and SPKI are contiguous */
+	return memcmp(rka->ski, rkb->ski, RK_SKI_LEN + RK_SPKI_LEN);
+}
+
+void
+snapshot_records_cleanup(struct snapshot_records *records)
+{
+	free(records->v4);
+	free(records->v6);
+	free(records->rks);
+	free(records->tas);
+}
+
+/*
+ * Converts @table into sorted records. Release them with
+ * snapshot_records_cleanup() if it succeeds.
+ */
+int
+snapshot_records_init(struct snapshot_records *records, struct db_table *table)
+{
+	unsigned int roas;
+	unsigned int keys;
+	int error;
+
+	/* Each family is allocated for the worst case; it's temporal */
+	roas = db_table_roa_count(table);
+	keys = db_table_router_key_count(table);
+	records->v4 = malloc(roas * sizeof(struct snapshot_vrp4) + 1);
+	records->v6 = malloc(roas * sizeof(struct snapshot_vrp6) + 1);
+	records->rks = malloc(keys * sizeof(struct snapshot_rk) + 1);
+	records->v4_count = 0;
+	records->v6_count = 0;
+	records->rk_count = 0;
+	records->tas = NULL;
+	records->ta_count = 0;
+	if (records->v4 == NULL || records->v6 == NULL ||
+	    records->rks == NULL) {
+		snapshot_records_cleanup(records);
+		return pr_enomem();
+	}
+
+	error = db_table_foreach_roa_ta(table, snapshot_add_roa, records);
+	if (error)
+		goto fail;
+	error = db_table_foreach_router_key_ta(table, snapshot_add_router_key,
+	    records);
+	if (error)
+		goto fail;
+
+	qsort(records->v4, records->v4_count, sizeof(struct snapshot_vrp4),
+	    snapshot_vrp4_cmp);
+	qsort(records->v6, records->v6_count, sizeof(struct snapshot_vrp6),
+	    snapshot_vrp6_cmp);
+	qsort(records->rks, records->rk_count, sizeof(struct snapshot_rk),
+	    snapshot_rk_cmp);
+	return 0;
+
+fail:
+	snapshot_records_cleanup(records);
+	return error;
+}
+
+static int
+write_bytes(FILE *file, void const *bytes, size_t len)
+{
+	if (len != 0 && fwrite(bytes, len, 1, file) != 1)
+		return pr_errno(errno, "Could not write the VRP snapshot");
+	return 0;
+}
+
+static int
+write_contents(FILE *file, struct snapshot_header const *hdr,
+    struct snapshot_records const *records, struct snapshot_ta const *tas)
+{
+	struct snapshot_file_header fhdr;
+	uint64_t time;
+	int error;
+
+	time = hdr->time;
+	memcpy(fhdr.magic, SNAPSHOT_MAGIC, sizeof(fhdr.magic));
+	fhdr.version = htonl(SNAPSHOT_VERSION);
+	fhdr.serial = htonl(hdr->serial);
+	fhdr.v0_session_id = htons(hdr->v0_session_id);
+	fhdr.v1_session_id = htons(hdr->v1_session_id);
+	fhdr.time_high = htonl(time >> 32);
+	fhdr.time_low = htonl(time & 0xFFFFFFFFu);
+	fhdr.v4_count = htonl(records->v4_count);
+	fhdr.v6_count = htonl(records->v6_count);
+	fhdr.rk_count = htonl(records->rk_count);
+	fhdr.ta_count = htonl(records->ta_count);
+	fhdr.checksum = htonl(sections_checksum(records->v4,
+	    records->v4_count, records->v6, records->v6_count,
+	    records->rks, records->rk_count, tas, records->ta_count));
+
+	error = write_bytes(file, &fhdr, sizeof(fhdr));
+	if (error)
+		return error;
+	error = write_bytes(file, records->v4,
+	    records->v4_count * sizeof(struct snapshot_vrp4));
+	if (error)
+		return error;
+	error = write_bytes(file, records->v6,
+	    records->v6_count * sizeof(struct snapshot_vrp6));
+	if (error)
+		return error;
+	error = write_bytes(file, records->rks,
+	    records->rk_count * sizeof(struct snapshot_rk));
+	if (error)
+		return error;
+	error = write_bytes(file, tas,
+	    records->ta_count * sizeof(struct snapshot_ta));
+	if (error)
+		return error;
+
+	if (fflush(file) != 0)
+		return pr_errno(errno, "Could not write the VRP snapshot");
+	if (fsync(fileno(file)) != 0)
+		return pr_errno(errno, "Could not sync the VRP snapshot");
+	return 0;
+}
+
+/*
+ * Writes @records into @path, replacing it atomically. (They're written into a
+ * temporal file, which is then renamed.)
+ */
+int
+snapshot_write_records(char const *path, struct snapshot_header const *hdr,
+    struct snapshot_records const *records)
+{
+	struct snapshot_ta *tas;
+	char *tmp_path;
+	FILE *file;
+	struct stat stat;
+	size_t i;
+	int error;
+
+	/* calloc() pads the names */
+	tas = calloc(records->ta_count + 1, sizeof(struct snapshot_ta));
+	if (tas == NULL)
+		return pr_enomem();
+	for (i = 0; i < records->ta_count; i++)
+		strncpy(tas[i].name, records->tas[i], SNAPSHOT_TA_NAME_LEN - 1);
+
+	tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+	if (tmp_path == NULL) {
+		free(tas);
+		return pr_enomem();
+	}
+	strcpy(tmp_path, path);
+	strcat(tmp_path, ".tmp");
+
+	error = file_write(tmp_path, &file, &stat);
+	if (error)
+		goto end;
+
+	error = write_contents(file, hdr, records, tas);
+	file_close(file);
+	if (error)
+		goto remove_tmp;
+
+	if (rename(tmp_path, path) != 0) {
+		error = pr_errno(errno, "Could not rename '%s' to '%s'",
+		    tmp_path, path);
+		goto remove_tmp;
+	}
+
+	goto end;
+
+remove_tmp:
+	remove(tmp_path);
+end:
+	free(tmp_path);
+	free(tas);
+	return error;
+}
+
+/* Same as snapshot_write_records(), from the table. */
+int
+snapshot_write(char const *path, struct snapshot_header const *hdr,
+    struct db_table *table)
+{
+	struct snapshot_records records;
+	int error;
+
+	error = snapshot_records_init(&records, table);
+	if (error)
+		return error;
+
+	error = snapshot_write_records(path, hdr, &records);
+
+	snapshot_records_cleanup(&records);
+	return error;
+}
+
+static int
+corrupt(char const *path, char const *reason)
+{
+	return pr_err("The VRP snapshot '%s' is corrupt: %s", path, reason);
+}
+
+/* Validates the header of the mapped file, and points @snapshot to its data */
+static int
+init_snapshot(char const *path, struct mapped_snapshot *snapshot)
+{
+	struct snapshot_file_header const *fhdr;
+	unsigned char const *data;
+	size_t expected;
+	size_t i;
+
+	if (snapshot->map_len < sizeof(*fhdr))
+		return corrupt(path, "It's truncated.");
+
+	fhdr = snapshot->map;
+	if (memcmp(fhdr->magic, SNAPSHOT_MAGIC, sizeof(fhdr->magic)) != 0)
+		return corrupt(path, "It's not a VRP snapshot.");
+	if (ntohl(fhdr->version) != SNAPSHOT_VERSION)
+		return pr_err("The VRP snapshot '%s' has an unknown format version (%u).",
+		    path, ntohl(fhdr->version));
+
+	snapshot->hdr.serial = ntohl(fhdr->serial);
+	snapshot->hdr.v0_session_id = ntohs(fhdr->v0_session_id);
+	snapshot->hdr.v1_session_id = ntohs(fhdr->v1_session_id);
+	snapshot->hdr.time = (((uint64_t)ntohl(fhdr->time_high)) << 32)
+	    | ntohl(fhdr->time_low);
+	snapshot->v4_count = ntohl(fhdr->v4_count);
+	snapshot->v6_count = ntohl(fhdr->v6_count);
+	snapshot->rk_count = ntohl(fhdr->rk_count);
+	snapshot->ta_count = ntohl(fhdr->ta_count);
+
+	expected = sizeof(*fhdr)
+	    + snapshot->v4_count * sizeof(struct snapshot_vrp4)
+	    + snapshot->v6_count * sizeof(struct snapshot_vrp6)
+	    + snapshot->rk_count * sizeof(struct snapshot_rk)
+	    + snapshot->ta_count * sizeof(struct snapshot_ta);
+	if (snapshot->map_len != expected)
+		return corrupt(path, "Its length doesn't match its header.");
+
+	data = snapshot->map;
+	data += sizeof(*fhdr);
+	snapshot->v4 = (struct snapshot_vrp4 const *) data;
+	data += snapshot->v4_count * sizeof(struct snapshot_vrp4);
+	snapshot->v6 = (struct snapshot_vrp6 const *) data;
+	data += snapshot->v6_count * sizeof(struct snapshot_vrp6);
+	snapshot->rks = (struct snapshot_rk const *) data;
+	data += snapshot->rk_count * sizeof(struct snapshot_rk);
+	snapshot->tas = (struct snapshot_ta const *) data;
+
+	if (sections_checksum(snapshot->v4, snapshot->v4_count, snapshot->v6,
+	    snapshot->v6_count, snapshot->rks, snapshot->rk_count,
+	    snapshot->tas, snapshot->ta_count) != ntohl(fhdr->checksum))
+		return corrupt(path, "Checksum mismatch.");
+
+	for (i = 0; i < snapshot->ta_count; i++)
+		if (snapshot->tas[i].name[SNAPSHOT_TA_NAME_LEN - 1] != '\0')
+			return corrupt(path, "Unterminated TA name.");
+
+	return 0;
+}
+
+/*
+ * Maps the snapshot at @path into memory (read-only). The records are used in
+ * place; the only pass over them is the checksum's.
+ *
+ * Returns -ENOENT if there's no such file. Otherwise, release @snapshot with
+ * snapshot_unmap() if it succeeded.
+ */
+int
+snapshot_map(char const *path, struct mapped_snapshot *snapshot)
+{
+	struct stat st;
+	int fd;
+	int error;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		error = errno;
+		if (error == ENOENT)
+			return -ENOENT;
+		return -pr_errno(error, "Could not open the VRP snapshot '%s'",
+		    path);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		error = -pr_errno(errno, "fstat(%s) failed", path);
+		goto end;
+	}
+	if (st.st_size == 0) {
+		error = corrupt(path, "It's empty.");
+		goto end;
+	}
+
+	snapshot->map_len = st.st_size;
+	snapshot->map = mmap(NULL, snapshot->map_len, PROT_READ, MAP_SHARED, fd,
+	    0);
+	if (snapshot->map == MAP_FAILED) {
+		error = -pr_errno(errno, "Could not map the VRP snapshot '%s'",
+		    path);
+		goto end;
+	}
+
+	error = init_snapshot(path, snapshot);
+	if (error)
+		munmap(snapshot->map, snapshot->map_len);
+
+end:
+	close(fd);
+	return error;
+}
+
+void
+snapshot_unmap(struct mapped_snapshot *snapshot)
+{
+	munmap(snapshot->map, snapshot->map_len);
+}
+
+/* Returns the interned TA @index refers to, in @result. */
+static int
+load_ta(char const *path, struct mapped_snapshot *snapshot,
+    char const **tas, uint16_t index, char const **result)
+{
+	index = ntohs(index);
+	if (index > snapshot->ta_count) {
+		*result = NULL;
+		return corrupt(path, "Bogus TA index.");
+	}
+	*result = tas[index];
+	return 0;
+}
+
+static int
+load_records(char const *path, struct mapped_snapshot *snapshot,
+    char const **tas, struct db_table *table)
+{
+	struct snapshot_vrp4 const *v4;
+	struct snapshot_vrp6 const *v6;
+	struct snapshot_rk const *rk;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	char const *ta;
+	size_t i;
+	int error;
+
+	for (i = 0; i < snapshot->v4_count; i++) {
+		v4 = &snapshot->v4[i];
+		if (v4->prefix_length > 32 || v4->max_length > 32 ||
+		    v4->max_length < v4->prefix_length)
+			return corrupt(path, "Bogus IPv4 prefix length.");
+		error = load_ta(path, snapshot, tas, v4->ta, &ta);
+		if (error)
+			return error;
+		memcpy(&prefix4.addr, v4->prefix, sizeof(v4->prefix));
+		prefix4.len = v4->prefix_length;
+		db_table_set_ta(table, ta);
+		error = rtrhandler_handle_roa_v4(table, ntohl(v4->asn),
+		    &prefix4, v4->max_length);
+		if (error)
+			return error;
+	}
+
+	for (i = 0; i < snapshot->v6_count; i++) {
+		v6 = &snapshot->v6[i];
+		if (v6->prefix_length > 128 || v6->max_length > 128 ||
+		    v6->max_length < v6->prefix_length)
+			return corrupt(path, "Bogus IPv6 prefix length.");
+		error = load_ta(path, snapshot, tas, v6->ta, &ta);
+		if (error)
+			return error;
+		memcpy(&prefix6.addr, v6->prefix, sizeof(v6->prefix));
+		prefix6.len = v6->prefix_length;
+		db_table_set_ta(table, ta);
+		error = rtrhandler_handle_roa_v6(table, ntohl(v6->asn),
+		    &prefix6, v6->max_length);
+		if (error)
+			return error;
+	}
+
+	for (i = 0; i < snapshot->rk_count; i++) {
+		rk = &snapshot->rks[i];
+		error = load_ta(path, snapshot, tas, rk->ta, &ta);
+		if (error)
+			return error;
+		db_table_set_ta(table, ta);
+		error = rtrhandler_handle_router_key(table, rk->ski,
+		    ntohl(rk->asn), rk->spk);
+		if (error)
+			return error;
+	}
+
+	db_table_set_ta(table, NULL);
+	return 0;
+}
+
+/*
+ * Reads the snapshot written at @path by snapshot_write() into a new table.
+ *
+ * Returns -ENOENT if there's no such file.
+ */
+int
+snapshot_load(char const *path, struct snapshot_header *hdr,
+    struct db_table **result)
+{
+	struct mapped_snapshot snapshot;
+	struct db_table *table;
+	char const **tas;
+	size_t i;
+	int error;
+
+	error = snapshot_map(path, &snapshot);
+	if (error)
+		return error;
+
+	/* Index zero is "no TA" */
+	tas = calloc(snapshot.ta_count + 1, sizeof(char const *));
+	if (tas == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+	for (i = 0; i < snapshot.ta_count; i++) {
+		tas[i + 1] = db_table_intern_ta(snapshot.tas[i].name);
+		if (tas[i + 1] == NULL) {
+			error = pr_enomem();
+			goto free_tas;
+		}
+	}
+
+	table = db_table_create();
+	if (table == NULL) {
+		error = pr_enomem();
+		goto free_tas;
+	}
+
+	error = load_records(path, &snapshot, tas, table);
+	if (error) {
+		db_table_destroy(table);
+		goto free_tas;
+	}
+
+	*hdr = snapshot.hdr;
+	*result = table;
+free_tas:
+	free(tas);
+end:
+	snapshot_unmap(&snapshot);
+	return error;
+}
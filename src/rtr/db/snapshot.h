@@ -0,0 +1,131 @@
+#ifndef SRC_RTR_DB_SNAPSHOT_H_
+#define SRC_RTR_DB_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "rtr/db/db_table.h"
+
+/*
+ * A binary image of a set of VRPs and router keys, along with the serial and
+ * session IDs they were published with.
+ *
+ * The server rewrites it after every update, and reads it during startup, so
+ * it can answer the routers before the first validation cycle is over. Other
+ * tools can read it too (see "output.snapshot"); its layout is fixed, so once
+ * mapped, the records can be used in place.
+ *
+ * Layout: a header, followed by the IPv4 ROA, IPv6 ROA, router key and Trust
+ * Anchor sections, in that order. Every section is an array of fixed-length
+ * records; the first three are sorted as described below. There's no padding
+ * between anything. Every integer is big endian (ie. network byte order).
+ */
+
+#define SNAPSHOT_MAGIC		"FVRP"
+#define SNAPSHOT_VERSION	3
+
+struct snapshot_file_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t serial;
+	uint16_t v0_session_id;
+	uint16_t v1_session_id;
+	/* Seconds since the epoch; when it was written */
+	uint32_t time_high;
+	uint32_t time_low;
+	uint32_t v4_count;
+	uint32_t v6_count;
+	uint32_t rk_count;
+	uint32_t ta_count;
+	/* CRC-32 of the sections */
+	uint32_t checksum;
+};
+
+/*
+ * Ordered by prefix, prefix length, max length, then ASN.
+ * @ta is the index of the record's Trust Anchor in the TA section, plus one.
+ * (Zero means it has none; eg. it came from SLURM.)
+ */
+struct snapshot_vrp4 {
+	uint8_t prefix[4];
+	uint8_t prefix_length;
+	uint8_t max_length;
+	uint16_t ta;
+	uint32_t asn;
+};
+
+struct snapshot_vrp6 {
+	uint8_t prefix[16];
+	uint8_t prefix_length;
+	uint8_t max_length;
+	uint16_t ta;
+	uint32_t asn;
+};
+
+/* Ordered by ASN, SKI, then SPKI */
+struct snapshot_rk {
+	uint32_t asn;
+	uint16_t ta;
+	uint8_t ski[RK_SKI_LEN];
+	uint8_t spk[RK_SPKI_LEN];
+	uint8_t zero[3];
+};
+
+/* Names are padded with NUL characters (and truncated, if they don't fit) */
+#define SNAPSHOT_TA_NAME_LEN	64
+
+struct snapshot_ta {
+	char name[SNAPSHOT_TA_NAME_LEN];
+};
+
+/* The header, in host byte order */
+struct snapshot_header {
+	serial_t serial;
+	uint16_t v0_session_id;
+	uint16_t v1_session_id;
+	time_t time;
+};
+
+/* The sorted records of a table: the sections of a snapshot, in memory */
+struct snapshot_records {
+	struct snapshot_vrp4 *v4;
+	size_t v4_count;
+	struct snapshot_vrp6 *v6;
+	size_t v6_count;
+	struct snapshot_rk *rks;
+	size_t rk_count;
+	/* Interned (see db_table_intern_ta()) */
+	char const **tas;
+	size_t ta_count;
+};
+
+/* A snapshot file, mapped into memory. */
+struct mapped_snapshot {
+	struct snapshot_header hdr;
+
+	struct snapshot_vrp4 const *v4;
+	size_t v4_count;
+	struct snapshot_vrp6 const *v6;
+	size_t v6_count;
+	struct snapshot_rk const *rks;
+	size_t rk_count;
+	struct snapshot_ta const *tas;
+	size_t ta_count;
+
+	void *map;
+	size_t map_len;
+};
+
+int snapshot_records_init(struct snapshot_records *, struct db_table *);
+void snapshot_records_cleanup(struct snapshot_records *);
+
+int snapshot_write(char const *, struct snapshot_header const *,
+    struct db_table *);
+int snapshot_write_records(char const *, struct snapshot_header const *,
+    struct snapshot_records const *);
+
+int snapshot_map(char const *, struct mapped_snapshot *);
+void snapshot_unmap(struct mapped_snapshot *);
+
+int snapshot_load(char const *, struct snapshot_header *, struct db_table **);
+
+#endif /* SRC_RTR_DB_SNAPSHOT_H_ */
@@ -6,12 +6,17 @@
 #include <sys/queue.h>
 #include "clients.h"
 #include "common.h"
+#include "config.h"
+#include "metrics.h"
+#include "notify.h"
 #include "output_printer.h"
 #include "validation_handler.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/router_key.h"
 #include "object/tal.h"
 #include "rtr/db/db_table.h"
+#include "rtr/db/snapshot.h"
 #include "slurm/slurm_loader.h"
 
 /*
@@ -20,6 +25,13 @@
  */
 
 #define START_SERIAL		0
+/*
+ * The frontends (see frontends.h) only see the serials that reach the state
+ * file, so the TALs published during the cycle are saved as well. Like the
+ * Serial Notifies, no more often than this (seconds); the end of the cycle
+ * saves the rest.
+ */
+#define EXPORT_INTERVAL		60
 
 DEFINE_ARRAY_LIST_FUNCTIONS(deltas_db, struct delta_group, )
 
@@ -42,7 +54,51 @@ struct sorted_lists {
 	struct rk_slist router_keys;
 };
 
+/* The VRPs of a TAL, as of its last successful validation */
+struct tal_table {
+	/* File name of the TAL; the key */
+	char *file;
+	struct db_table *table;
+	/* Was it validated during the current cycle? */
+	bool current;
+	UT_hash_handle hh;
+};
+
+/*
+ * The deltas between the last serials, oldest first. It's a ring with room for
+ * "server.deltas.lifetime" groups (plus the one being added).
+ *
+ * Once it's full, or its deltas take more memory than "server.deltas.max-memory"
+ * allows, two consecutive groups are merged into a checkpoint: a single group
+ * (with the serial of the newest) from which the operations that cancel each
+ * other have been removed. Routers at the serial in between lose their deltas,
+ * but those at older serials don't. The oldest pair no connected router sits
+ * in between is chosen, if any.
+ */
+struct deltas_history {
+	struct delta_group *groups;
+	unsigned int capacity;
+	/* Index of the oldest group */
+	unsigned int first;
+	unsigned int len;
+	/* The serial the oldest group applies to */
+	serial_t from;
+	/* Memory used by the deltas, in bytes */
+	size_t size;
+};
+
+/* Context of a vrps_update() */
+struct cycle {
+	/* Publish each TAL as soon as it's validated? */
+	bool incremental;
+	/* Did the base change? */
+	bool changed;
+};
+
 struct state {
+	/** Last good VRPs of each TAL. @base is their union (after SLURM). */
+	struct tal_table *tals;
+
 	/**
 	 * All the current valid ROAs.
 	 *
@@ -52,10 +108,17 @@ struct state {
 	 */
 	struct db_table *base;
 	/** DB changes to @base over time. */
-	struct deltas_db deltas;
+	struct deltas_history deltas;
+	/**
+	 * Was @base loaded from the snapshot of a previous run? (And no
+	 * validation cycle has finished since.)
+	 */
+	bool stale;
+	/** Have the TAL tables changed since @base was built out of them? */
+	bool unpublished;
 
 	/* Last valid SLURM applied to base */
-	struct db_slurm *slurm;
+	struct slurm_cache slurm;
 
 	serial_t next_serial;
 	uint16_t v0_session_id;
@@ -64,9 +127,18 @@ struct state {
 
 /** Read/write lock, which protects @state and its inhabitants. */
 static pthread_rwlock_t state_lock;
+/**
+ * Serializes the writers of @state. Whoever holds it can read @state without
+ * @state_lock (nobody else modifies it), so the new base and its deltas are
+ * built without blocking the readers; the write lock is only needed to swap
+ * them in. See publish().
+ */
+static pthread_mutex_t publish_lock;
 
-/** Lock to protect ROA table during construction. */
-static pthread_rwlock_t table_lock;
+/* When the state file was last written */
+static time_t last_export;
+/** Mutex, which protects @last_export and serializes the state file writes. */
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void
 deltagroup_cleanup(struct delta_group *group)
@@ -74,14 +146,183 @@ deltagroup_cleanup(struct delta_group *group)
 	deltas_refput(group->deltas);
 }
 
+static int
+history_init(struct deltas_history *history)
+{
+	history->capacity = config_get_deltas_lifetime() + 1;
+	history->groups = calloc(history->capacity, sizeof(struct delta_group));
+	if (history->groups == NULL)
+		return pr_enomem();
+
+	history->first = 0;
+	history->len = 0;
+	history->from = START_SERIAL;
+	history->size = 0;
+	return 0;
+}
+
+static struct delta_group *
+history_get(struct deltas_history *history, unsigned int index)
+{
+	return &history->groups[(history->first + index) % history->capacity];
+}
+
+static void
+history_drop_oldest(struct deltas_history *history)
+{
+	struct delta_group *oldest;
+
+	oldest = history_get(history, 0);
+	history->from = oldest->serial;
+	history->size -= deltas_size(oldest->deltas);
+	deltas_refput(oldest->deltas);
+
+	history->first = (history->first + 1) % history->capacity;
+	history->len--;
+}
+
+static void
+history_cleanup(struct deltas_history *history)
+{
+	while (history->len > 0)
+		history_drop_oldest(history);
+	free(history->groups);
+}
+
+/* Returns the index of the oldest group whose serial no router is at. */
+static unsigned int
+history_find_unused(struct deltas_history *history)
+{
+	unsigned int i;
+
+	for (i = 0; i < history->len - 1; i++)
+		if (clients_count_serial(history_get(history, i)->serial) == 0)
+			return i;
+
+	return 0;
+}
+
+/* Merges the groups at @index and @index + 1 into a checkpoint. */
+static int
+history_merge(struct deltas_history *history, unsigned int index)
+{
+	struct delta_group *older;
+	struct delta_group *newer;
+	struct deltas *merged;
+	unsigned int i;
+	int error;
+
+	older = history_get(history, index);
+	newer = history_get(history, index + 1);
+
+	error = deltas_merge(older->deltas, newer->deltas, &merged);
+	if (error)
+		return error;
+
+	pr_debug("Merging the deltas of serials %u and %u into a checkpoint.",
+	    older->serial, newer->serial);
+
+	history->size -= deltas_size(older->deltas);
+	history->size -= deltas_size(newer->deltas);
+	history->size += deltas_size(merged);
+	deltas_refput(older->deltas);
+	deltas_refput(newer->deltas);
+	newer->deltas = merged;
+
+	/* Close the gap */
+	for (i = index; i > 0; i--)
+		*history_get(history, i) = *history_get(history, i - 1);
+	history->first = (history->first + 1) % history->capacity;
+	history->len--;
+	return 0;
+}
+
+/* Brings @history back within its limits. */
+static void
+history_compact(struct deltas_history *history)
+{
+	size_t max_size;
+
+	max_size = ((size_t) config_get_deltas_max_memory()) << 20;
+
+	while (history->len >= history->capacity ||
+	    (history->len > 0 && history->size > max_size)) {
+		/* If merging fails (or can't be done), forget instead */
+		if (history->len < 2 ||
+		    history_merge(history, history_find_unused(history)) != 0)
+			history_drop_oldest(history);
+	}
+}
+
+/*
+ * Records @deltas as the way to reach @serial from the previous serial. Steals
+ * the reference.
+ */
+static void
+history_add(struct deltas_history *history, serial_t serial,
+    struct deltas *deltas)
+{
+	struct delta_group *group;
+
+	group = history_get(history, history->len);
+	group->serial = serial;
+	group->deltas = deltas;
+	history->len++;
+	history->size += deltas_size(deltas);
+
+	history_compact(history);
+}
+
+/*
+ * Resumes the base, serial and session IDs of the previous run, so routers can
+ * be served before the first validation cycle is over.
+ */
+static void
+load_snapshot(void)
+{
+	struct snapshot_header hdr;
+	struct db_table *base;
+	char const *path;
+	int error;
+
+	path = config_get_server_state_file();
+	if (config_get_mode() != SERVER || path == NULL)
+		return;
+
+	error = snapshot_load(path, &hdr, &base);
+	if (error) {
+		if (error == -ENOENT)
+			pr_info("There's no VRP snapshot at '%s' yet.", path);
+		else
+			pr_warn("Could not load the VRP snapshot; the routers will have to wait for the first validation cycle.");
+		return;
+	}
+
+	state.base = base;
+	state.stale = true;
+	state.next_serial = hdr.serial + 1;
+	state.deltas.from = hdr.serial;
+	state.v0_session_id = hdr.v0_session_id;
+	state.v1_session_id = hdr.v1_session_id;
+
+	pr_info("Serving the %u VRPs and %u router keys of the previous run (serial %u) until the first validation cycle is over.",
+	    db_table_roa_count(base), db_table_router_key_count(base),
+	    hdr.serial);
+}
+
 int
 vrps_init(void)
 {
 	int error;
 
+	state.tals = NULL;
 	state.base = NULL;
+	state.stale = false;
+	state.unpublished = false;
 
-	deltas_db_init(&state.deltas);
+	error = history_init(&state.deltas);
+	if (error)
+		return error;
 
 	/*
 	 * Use the same start serial, the session ID will avoid
@@ -97,284 +338,515 @@ vrps_init(void)
 	    ? (state.v0_session_id - 1)
 	    : (0xFFFFu);
 
-	state.slurm = NULL;
+	slurm_cache_init(&state.slurm);
 
 	error = pthread_rwlock_init(&state_lock, NULL);
 	if (error) {
-		error = pr_errno(error, "state pthread_rwlock_init() errored");
-		goto release_deltas;
+		history_cleanup(&state.deltas);
+		return pr_errno(error, "state pthread_rwlock_init() errored");
 	}
-
-	error = pthread_rwlock_init(&table_lock, NULL);
+	error = pthread_mutex_init(&publish_lock, NULL);
 	if (error) {
-		error = pr_errno(error, "table pthread_rwlock_init() errored");
-		goto release_state_lock;
+		pthread_rwlock_destroy(&state_lock);
+		history_cleanup(&state.deltas);
+		return pr_errno(error, "publish pthread_mutex_init() errored");
 	}
 
+	load_snapshot();
 	return 0;
-release_state_lock:
-	pthread_rwlock_destroy(&state_lock);
-release_deltas:
-	deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-	return error;
+}
+
+static void
+tal_table_destroy(struct tal_table *tal)
+{
+	free(tal->file);
+	db_table_destroy(tal->table);
+	free(tal);
 }
 
 void
 vrps_destroy(void)
 {
+	struct tal_table *tal, *tmp;
+
+	/* Let the last output files finish */
+	output_printer_destroy();
+
+	HASH_ITER(hh, state.tals, tal, tmp) {
+		HASH_DEL(state.tals, tal);
+		tal_table_destroy(tal);
+	}
 	if (state.base != NULL)
 		db_table_destroy(state.base);
-	if (state.slurm != NULL)
-		db_slurm_destroy(state.slurm);
-	deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
+	slurm_cache_cleanup(&state.slurm);
+	history_cleanup(&state.deltas);
+	db_table_ta_cleanup();
 	/* Nothing to do with error codes from now on */
+	pthread_mutex_destroy(&publish_lock);
 	pthread_rwlock_destroy(&state_lock);
-	pthread_rwlock_destroy(&table_lock);
 }
 
-#define WLOCK_HANDLER(lock, cb)						\
-	int error;							\
-	rwlock_write_lock(lock);					\
-	error = cb;							\
-	rwlock_unlock(lock);						\
-	return error;
-
-#define RLOCK_HANDLER(lock, cb)						\
-	int error;							\
-	rwlock_read_lock(lock);						\
-	error = cb;							\
-	rwlock_unlock(lock);						\
-	return error;
+/* No locking needed; every TAL thread validates into its own table. */
 
 int
 handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v4(arg, as, prefix, max_length))
+	return rtrhandler_handle_roa_v4(arg, as, prefix, max_length);
 }
 
 int
 handle_roa_v6(uint32_t as, struct ipv6_prefix const * prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v6(arg, as, prefix, max_length))
+	return rtrhandler_handle_roa_v6(arg, as, prefix, max_length);
 }
 
 int
 handle_router_key(unsigned char const *ski, uint32_t as,
     unsigned char const *spk, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_router_key(arg, ski, as, spk))
+	return rtrhandler_handle_router_key(arg, ski, as, spk);
 }
 
+/*
+ * Records @table as the latest VRPs of the TAL @file; steals it.
+ * Call while holding both locks.
+ */
 static int
-__perform_standalone_validation(struct db_table **result)
+set_tal_table(char const *file, struct db_table *table)
+{
+	struct tal_table *tal;
+
+	state.unpublished = true;
+
+	HASH_FIND_STR(state.tals, file, tal);
+	if (tal != NULL) {
+		db_table_destroy(tal->table);
+		tal->table = table;
+		tal->current = true;
+		return 0;
+	}
+
+	tal = malloc(sizeof(struct tal_table));
+	if (tal == NULL) {
+		db_table_destroy(table);
+		return pr_enomem();
+	}
+	/* Needed by uthash */
+	memset(tal, 0, sizeof(struct tal_table));
+
+	tal->file = strdup(file);
+	if (tal->file == NULL) {
+		free(tal);
+		db_table_destroy(table);
+		return pr_enomem();
+	}
+	tal->table = table;
+	tal->current = true;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, state.tals, tal->file, strlen(tal->file), tal);
+	if (errno) {
+		tal_table_destroy(tal);
+		return -pr_errno(errno, "TAL table couldn't be added to hash table");
+	}
+
+	return 0;
+}
+
+/*
+ * Builds a new base out of the TAL tables, with the SLURM applied. (The TAL
+ * tables stay unfiltered.) Call while holding the publish lock.
+ */
+static int
+merge_tal_tables(struct db_table **result)
 {
 	struct db_table *db;
+	struct tal_table *tal, *tmp;
 	int error;
 
 	db = db_table_create();
 	if (db == NULL)
 		return pr_enomem();
 
-	error = perform_standalone_validation(db);
-	if (error) {
-		terminate_standalone_validation();
-		db_table_destroy(db);
-		return error;
+	HASH_ITER(hh, state.tals, tal, tmp) {
+		error = slurm_merge(db, tal->table, state.slurm.db);
+		if (error)
+			goto fail;
 	}
 
+	error = slurm_add_assertions(db, state.slurm.db);
+	if (error)
+		goto fail;
+
 	*result = db;
 	return 0;
+
+fail:
+	db_table_destroy(db);
+	return error;
 }
 
 /*
- * Make an empty dummy delta array.
- * It's annoying, but temporary. (Until it expires.) Otherwise, it'd be a pain
- * to have to check NULL delta_group.deltas all the time.
+ * Replaces the base with the union of the TAL tables, and stores the
+ * difference as a new serial. Call while holding the publish lock (and not the
+ * state lock); the base and its deltas are built before the write lock is
+ * taken, so the readers only wait for the swap.
+ *
+ * The old base is returned in @old_base, so the caller can destroy it after
+ * releasing the publish lock.
  */
 static int
-create_empty_delta(struct deltas **deltas)
+publish(bool *changed, struct db_table **old_base)
 {
-	struct delta_group deltas_node;
+	struct db_table *new_base = NULL;
+	struct deltas *deltas = NULL;
+	struct timespec start;
 	int error;
 
-	error = deltas_create(deltas);
-	if (error)
-		return error;
+	metrics_now(&start);
 
-	deltas_node.serial = state.next_serial;
-	deltas_node.deltas = *deltas;
-	error = deltas_db_add(&state.deltas, &deltas_node);
+	error = merge_tal_tables(&new_base);
 	if (error)
-		deltas_refput(*deltas);
+		goto end;
+
+	/* Nothing validated; probably couldn't reach the repositories */
+	if (state.stale && db_table_roa_count(new_base) +
+	    db_table_router_key_count(new_base) == 0)
+		goto revert_base; /* error == 0 is good */
+
+	if (state.base != NULL) {
+		error = compute_deltas(state.base, new_base, &deltas);
+		if (error)
+			goto revert_base;
+
+		if (deltas_is_empty(deltas)) {
+			deltas_refput(deltas);
+			rwlock_write_lock(&state_lock);
+			state.stale = false; /* Validation agrees with it */
+			state.unpublished = false;
+			rwlock_unlock(&state_lock);
+			goto revert_base; /* error == 0 is good */
+		}
+	} else if (db_table_roa_count(new_base) +
+	    db_table_router_key_count(new_base) == 0) {
+		/* There's also an empty base, don't alter state */
+		state.unpublished = false;
+		goto revert_base; /* error == 0 is good */
+	}
+
+	rwlock_write_lock(&state_lock);
+	if (deltas != NULL) {
+		/* Kept even if nobody's connected; routers can come back */
+		metrics_delta(deltas_count(deltas));
+		history_add(&state.deltas, state.next_serial, deltas);
+	} else {
+		/* The first serial; there's nothing older to update from */
+		state.deltas.from = state.next_serial;
+	}
+	*old_base = state.base;
+	state.base = new_base;
+	state.stale = false;
+	state.unpublished = false;
+	state.next_serial++;
+	rwlock_unlock(&state_lock);
+
+	*changed = true;
+	goto end;
+
+revert_base:
+	db_table_destroy(new_base);
+end:
+	metrics_phase(METRICS_PHASE_PUBLISH, &start);
 	return error;
 }
 
-/**
- * Reallocate the array of @db starting at @start, the length and capacity are
- * calculated according to the new start.
+static void
+notify_new_serial(void)
+{
+	int error;
+
+	error = notify_clients();
+	if (error)
+		pr_debug("Could not notify clients of the new VRPs. (Error code %d.)",
+		    error);
+}
+
+/*
+ * Saves the base into the state file (if @changed), and prints it into the
+ * output files (if @print). Both are written from the same sorted copy, which
+ * is the only part that needs the lock.
  */
-static int
-resize_deltas_db(struct deltas_db *db, struct delta_group *start)
+static void
+export_base(bool changed, bool print)
 {
-	struct delta_group *tmp, *ptr;
+	struct snapshot_records records;
+	struct snapshot_header hdr;
+	struct timespec start;
+	char const *path;
+	int error;
 
-	db->len -= (start - db->array);
-	while (db->len < db->capacity / 2)
-		db->capacity /= 2;
-	tmp = malloc(sizeof(struct delta_group) * db->capacity);
-	if (tmp == NULL)
-		return pr_enomem();
+	path = config_get_server_state_file();
+	if (config_get_mode() != SERVER || !changed)
+		path = NULL;
+	print = print && output_printer_enabled();
+	if (path == NULL && !print)
+		return;
 
-	memcpy(tmp, start, db->len * sizeof(struct delta_group));
-	/* Release memory allocated */
-	for (ptr = db->array; ptr < start; ptr++)
-		deltas_refput(ptr->deltas);
-	free(db->array);
-	db->array = tmp;
+	metrics_now(&start);
 
-	return 0;
+	rwlock_read_lock(&state_lock);
+	if (state.base == NULL) {
+		rwlock_unlock(&state_lock);
+		return;
+	}
+	error = snapshot_records_init(&records, state.base);
+	hdr.serial = state.next_serial - 1;
+	hdr.v0_session_id = state.v0_session_id;
+	hdr.v1_session_id = state.v1_session_id;
+	hdr.time = time(NULL);
+	rwlock_unlock(&state_lock);
+
+	if (error)
+		return;
+
+	if (path != NULL) {
+		pthread_mutex_lock(&export_lock);
+		/* Not fatal; the next restart will just be a cold one */
+		if (snapshot_write_records(path, &hdr, &records) != 0)
+			pr_warn("Could not save the VRP snapshot.");
+		last_export = time(NULL);
+		pthread_mutex_unlock(&export_lock);
+	}
+
+	if (print)
+		output_print_records(&hdr, &records);
+	else
+		snapshot_records_cleanup(&records);
+
+	metrics_phase(METRICS_PHASE_EXPORT, &start);
+}
+
+/* Is it time to save the state file again? (See EXPORT_INTERVAL.) */
+static bool
+export_due(void)
+{
+	bool result;
+
+	pthread_mutex_lock(&export_lock);
+	result = time(NULL) >= last_export + EXPORT_INTERVAL;
+	if (result)
+		last_export = time(NULL); /* Claim it; other TALs might be done */
+	pthread_mutex_unlock(&export_lock);
+
+	return result;
 }
 
 /*
- * Lock must be requested before calling this function
+ * Is @table the same as the previous table of the TAL @file, which is already
+ * part of the base? Then there's nothing to publish; only the TAL is diffed,
+ * rather than the whole base. Call while holding the publish lock.
  */
-static int
-vrps_purge(struct deltas **deltas)
+static bool
+is_published(char const *file, struct db_table *table)
 {
-	struct delta_group *group;
-	array_index i;
-	serial_t min_serial;
-
-	if (clients_get_min_serial(&min_serial) != 0) {
-		/* Nobody will need deltas, just leave an empty one */
-		deltas_refput(*deltas);
-		deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-		deltas_db_init(&state.deltas);
-		return create_empty_delta(deltas);
-	}
+	struct tal_table *tal;
+	struct deltas *deltas;
+	bool result;
 
-	/* Assume its ordered by serial, so get the new initial pointer */
-	ARRAYLIST_FOREACH(&state.deltas, group, i)
-		if (group->serial >= min_serial)
-			break;
+	if (state.unpublished)
+		return false;
 
-	/* Its the first element or reached end, nothing to purge */
-	if (group == state.deltas.array ||
-	    (group - state.deltas.array) == state.deltas.len)
-		return 0;
+	HASH_FIND_STR(state.tals, file, tal);
+	if (tal == NULL)
+		return false;
 
-	return resize_deltas_db(&state.deltas, group);
+	if (compute_deltas(tal->table, table, &deltas) != 0)
+		return false;
+	result = deltas_is_empty(deltas);
+	deltas_refput(deltas);
+	return result;
 }
 
+/* Receives the VRPs of a TAL, as soon as its validation is done. */
 static int
-__vrps_update(bool *changed)
+handle_tal_table(char const *file, struct db_table *table, void *arg)
 {
+	struct cycle *cycle = arg;
 	struct db_table *old_base;
-	struct db_table *new_base;
-	struct deltas *deltas; /* Deltas in raw form */
-	struct delta_group deltas_node; /* Deltas in database node form */
-	serial_t min_serial;
+	serial_t serial;
+	bool unchanged;
+	bool changed;
 	int error;
 
-	*changed = false;
+	changed = false;
 	old_base = NULL;
-	new_base = NULL;
 
-	error = __perform_standalone_validation(&new_base);
-	if (error)
-		return error;
+	pthread_mutex_lock(&publish_lock);
+
+	unchanged = cycle->incremental && is_published(file, table);
 
 	rwlock_write_lock(&state_lock);
+	error = set_tal_table(file, table);
+	if (!error && unchanged)
+		state.unpublished = false;
+	rwlock_unlock(&state_lock);
 
-	error = slurm_apply(&new_base, &state.slurm);
-	if (error) {
-		rwlock_unlock(&state_lock);
-		goto revert_base;
+	if (!error && cycle->incremental && !unchanged)
+		error = publish(&changed, &old_base);
+	if (changed)
+		cycle->changed = true;
+	serial = state.next_serial - 1;
+
+	pthread_mutex_unlock(&publish_lock);
+
+	if (old_base != NULL)
+		db_table_destroy(old_base);
+
+	if (changed) {
+		pr_info("Published the VRPs of TAL '%s'. (Serial number %u.)",
+		    file, serial);
+		notify_new_serial();
+		if (config_get_server_frontends() > 0 && export_due())
+			export_base(true, false);
 	}
 
-	if (state.base != NULL) {
-		error = compute_deltas(state.base, new_base, &deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
-		}
+	return error;
+}
 
-		if (deltas_is_empty(deltas)) {
-			rwlock_unlock(&state_lock);
-			goto revert_deltas; /* error == 0 is good */
-		}
+static int
+__vrps_update(struct string_array const *tals, bool *changed)
+{
+	struct cycle cycle;
+	struct tal_table *tal, *tmp;
+	struct db_table *old_base;
+	struct timespec start, validation_start;
+	bool slurm_changed;
+	bool published;
+	bool dropped;
+	int error, v_error;
 
-		/* Just store deltas if someone will care about it */
-		if (clients_get_min_serial(&min_serial) == 0) {
-			deltas_node.serial = state.next_serial;
-			deltas_node.deltas = deltas;
-			error = deltas_db_add(&state.deltas, &deltas_node);
-			if (error) {
-				rwlock_unlock(&state_lock);
-				goto revert_deltas;
-			}
-		}
+	metrics_now(&start);
 
-		/*
-		 * Postpone destruction of the old database,
-		 * to release the lock ASAP.
-		 */
-		old_base = state.base;
+	/*
+	 * Each TAL is published as soon as it's done, unless there's no base
+	 * yet. (Routers shouldn't mistake a partial first set for the whole.)
+	 * A stale base doesn't count; the TALs that aren't done yet would be
+	 * withdrawn.
+	 */
+	pthread_mutex_lock(&publish_lock);
+	/* Once per cycle; the TALs are published with the same SLURM */
+	error = slurm_update(&state.slurm, &slurm_changed);
+	if (!error && slurm_changed)
+		state.unpublished = true;
+	cycle.incremental = (state.base != NULL) && !state.stale;
+	cycle.changed = false;
+	HASH_ITER(hh, state.tals, tal, tmp)
+		tal->current = false;
+	pthread_mutex_unlock(&publish_lock);
+	if (error) {
+		metrics_cycle(&start, true);
+		return error;
+	}
 
-		/* Remove unnecessary deltas */
-		error = vrps_purge(&deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
-		}
-	} else {
-		/* There's also an empty base, don't alter state */
-		if (db_table_roa_count(new_base) +
-		    db_table_router_key_count(new_base) == 0) {
-			rwlock_unlock(&state_lock);
-			error = 0; /* OK (said explicitly) */
-			goto revert_base;
-		}
-		error = create_empty_delta(&deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
+	/* TALs that fail keep their previous tables */
+	metrics_now(&validation_start);
+	v_error = perform_standalone_validation(tals, handle_tal_table, &cycle);
+	if (v_error)
+		terminate_standalone_validation();
+	metrics_phase(METRICS_PHASE_VALIDATION, &validation_start);
+
+	published = false;
+	dropped = false;
+	old_base = NULL;
+
+	pthread_mutex_lock(&publish_lock);
+
+	/* Forget the TALs that were removed (if we can tell) */
+	if (tals == NULL && !v_error) {
+		rwlock_write_lock(&state_lock);
+		HASH_ITER(hh, state.tals, tal, tmp) {
+			if (!tal->current) {
+				HASH_DEL(state.tals, tal);
+				tal_table_destroy(tal);
+				dropped = true;
+			}
 		}
+		rwlock_unlock(&state_lock);
 	}
 
-	*changed = true;
-	state.base = new_base;
-	state.next_serial++;
+	error = 0;
+	if (!cycle.incremental || dropped || state.unpublished)
+		error = publish(&published, &old_base);
 
-	rwlock_unlock(&state_lock);
+	pthread_mutex_unlock(&publish_lock);
 
 	if (old_base != NULL)
 		db_table_destroy(old_base);
+	if (published)
+		notify_new_serial();
+
+	*changed = cycle.changed || published;
 
 	/* Print after validation to avoid duplicated info */
-	output_print_data(new_base);
+	export_base(*changed, true);
 
-	return 0;
+	metrics_cycle(&start, v_error || error);
+	return v_error ? v_error : error;
+}
+
+/*
+ * Applies the SLURM again to the VRPs of the last validation, if its files
+ * changed, and publishes the result. No validation needed.
+ *
+ * Has to be called from the validation thread, between cycles.
+ */
+int
+vrps_update_slurm(void)
+{
+	struct db_table *old_base;
+	serial_t serial;
+	bool slurm_changed;
+	bool changed;
+	int error;
+
+	changed = false;
+	old_base = NULL;
+
+	pthread_mutex_lock(&publish_lock);
+	error = slurm_update(&state.slurm, &slurm_changed);
+	if (!error && slurm_changed)
+		state.unpublished = true;
+	/* Otherwise, there are no VRPs to filter yet; the cycle will do it */
+	if (!error && slurm_changed && state.base != NULL && !state.stale)
+		error = publish(&changed, &old_base);
+	serial = state.next_serial - 1;
+	pthread_mutex_unlock(&publish_lock);
+
+	if (old_base != NULL)
+		db_table_destroy(old_base);
+
+	if (changed) {
+		pr_info("Published the new SLURM. (Serial number %u.)", serial);
+		notify_new_serial();
+		export_base(true, true);
+	}
 
-revert_deltas:
-	deltas_refput(deltas);
-revert_base:
-	/* Print info that was already validated */
-	output_print_data(new_base);
-	db_table_destroy(new_base);
 	return error;
 }
 
+/*
+ * Validates the TAL files listed in @tals (all of them if @tals is NULL), and
+ * publishes their VRPs. The other TALs keep their previous VRPs.
+ */
 int
-vrps_update(bool *changed)
+vrps_update(struct string_array const *tals, bool *changed)
 {
 	time_t start, finish;
 	long int exec_time;
+	double phases[METRICS_PHASE_COUNT];
+	double phases_after[METRICS_PHASE_COUNT];
 	serial_t serial;
 	int error;
 
@@ -383,9 +855,12 @@ vrps_update(bool *changed)
 	 * need don't do unnecessary calls
 	 */
 	if (!log_info_enabled())
-		return __vrps_update(changed);
+		return __vrps_update(tals, changed);
 
-	pr_info("Starting validation.");
+	if (tals == NULL)
+		pr_info("Starting validation.");
+	else
+		pr_info("Starting validation of %zu TAL(s).", tals->length);
 	serial = START_SERIAL;
 	if (config_get_mode() == SERVER) {
 		error = get_last_serial_number(&serial);
@@ -393,10 +868,12 @@ vrps_update(bool *changed)
 			pr_info("- Current serial number is %u.", serial);
 	}
 
+	metrics_phase_totals(phases);
 	time(&start);
-	error = __vrps_update(changed);
+	error = __vrps_update(tals, changed);
 	time(&finish);
 	exec_time = finish - start;
+	metrics_phase_totals(phases_after);
 
 	pr_info("Validation finished:");
 	rwlock_read_lock(&state_lock);
@@ -421,9 +898,88 @@ vrps_update(bool *changed)
 		rwlock_unlock(&state_lock);
 	} while(0);
 	pr_info("- Real execution time: %ld secs.", exec_time);
+	pr_info("- Phase times: validation %.3f, publish %.3f, export %.3f secs.",
+	    phases_after[METRICS_PHASE_VALIDATION] -
+	    phases[METRICS_PHASE_VALIDATION],
+	    phases_after[METRICS_PHASE_PUBLISH] - phases[METRICS_PHASE_PUBLISH],
+	    phases_after[METRICS_PHASE_EXPORT] - phases[METRICS_PHASE_EXPORT]);
+
+	return error;
+}
+
+/*
+ * Replaces the base with @table, which the validator published as @hdr's
+ * serial. (This is how the RTR frontends update; see frontends.h.) Steals
+ * @table.
+ *
+ * The serials the frontend missed are skipped; the delta from its previous
+ * serial leads straight to the new one.
+ */
+int
+vrps_follow(struct db_table *table, struct snapshot_header const *hdr)
+{
+	struct db_table *old_base;
+	struct deltas *deltas;
+	bool changed;
+	int error;
+
+	old_base = NULL;
+	changed = false;
+	error = 0;
+
+	pthread_mutex_lock(&publish_lock);
+	rwlock_write_lock(&state_lock);
+
+	/* A different validator; our serials mean nothing to its clients */
+	if (hdr->v0_session_id != state.v0_session_id ||
+	    hdr->v1_session_id != state.v1_session_id) {
+		while (state.deltas.len > 0)
+			history_drop_oldest(&state.deltas);
+		old_base = state.base;
+		state.base = NULL;
+		state.v0_session_id = hdr->v0_session_id;
+		state.v1_session_id = hdr->v1_session_id;
+	}
+
+	if (state.base == NULL) {
+		/* There's nothing older to update from */
+		state.deltas.from = hdr->serial;
+	} else if (hdr->serial == state.next_serial - 1) {
+		goto revert_table; /* Already following it */
+	} else if (hdr->serial - state.next_serial >= (1u << 31)) {
+		pr_warn("Ignoring serial %u of the VRP snapshot; it's older than ours (%u).",
+		    hdr->serial, state.next_serial - 1);
+		goto revert_table;
+	} else {
+		error = compute_deltas(state.base, table, &deltas);
+		if (error)
+			goto revert_table;
+		history_add(&state.deltas, hdr->serial, deltas);
+		old_base = state.base;
+	}
+
+	changed = true;
+	state.base = table;
+	state.stale = false;
+	state.next_serial = hdr->serial + 1;
+	goto unlock;
+
+revert_table:
+	db_table_destroy(table);
+unlock:
+	rwlock_unlock(&state_lock);
+	pthread_mutex_unlock(&publish_lock);
+
+	if (old_base != NULL)
+		db_table_destroy(old_base);
+	if (changed) {
+		pr_info("Following serial %u of the VRP snapshot.", hdr->serial);
+		notify_new_serial();
+	}
 
 	return error;
 }
+
 /**
  * Please keep in mind that there is at least one errcode-aware caller. The most
  * important ones are
@@ -589,42 +1145,47 @@ int
 vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
 {
 	struct delta_group *group;
-	array_index i;
-	bool from_found;
+	unsigned int i;
 	int error;
 
-	from_found = false;
-
 	error = rwlock_read_lock(&state_lock);
 	if (error)
 		return error;
 
 	if (state.base == NULL) {
-		rwlock_unlock(&state_lock);
-		return -EAGAIN;
+		error = -EAGAIN;
+		goto unlock;
 	}
 
-	ARRAYLIST_FOREACH(&state.deltas, group, i) {
-		if (!from_found) {
-			if (group->serial == from) {
-				from_found = true;
-				*to = group->serial;
-			}
-			continue;
+	/* Find the group that leads to @from; the next ones are the deltas */
+	if (state.deltas.from == from) {
+		i = 0;
+	} else {
+		for (i = 0; i < state.deltas.len; i++)
+			if (history_get(&state.deltas, i)->serial == from)
+				break;
+		if (i == state.deltas.len) {
+			error = -ESRCH;
+			goto unlock;
 		}
+		i++;
+	}
+
+	*to = from;
+	for (; i < state.deltas.len; i++) {
+		group = history_get(&state.deltas, i);
 
 		error = deltas_db_add(result, group);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			return error;
-		}
+		if (error)
+			goto unlock;
 
 		deltas_refget(group->deltas);
 		*to = group->serial;
 	}
 
+unlock:
 	rwlock_unlock(&state_lock);
-	return from_found ? 0 : -ESRCH;
+	return error;
 }
 
 int
@@ -649,8 +1210,44 @@ get_last_serial_number(serial_t *result)
 uint16_t
 get_current_session_id(uint8_t rtr_version)
 {
-	/* Semaphore isn't needed since this value is set at initialization */
+	/*
+	 * Semaphore isn't needed since this value is set at initialization.
+	 * (Frontends can change it in vrps_follow(), but a stale read only
+	 * makes a router reset sooner or later.)
+	 */
 	if (rtr_version == 1)
 		return state.v1_session_id;
 	return state.v0_session_id;
 }
+
+void
+vrps_get_stats(struct vrps_stats *result)
+{
+	memset(result, 0, sizeof(*result));
+
+	rwlock_read_lock(&state_lock);
+	if (state.base != NULL) {
+		result->published = true;
+		result->serial = state.next_serial - 1;
+		result->vrps = db_table_roa_count(state.base);
+		result->router_keys = db_table_router_key_count(state.base);
+		result->base_size = db_table_size(state.base);
+	}
+	result->deltas = state.deltas.len;
+	result->deltas_size = state.deltas.size;
+	rwlock_unlock(&state_lock);
+}
+
+/* Calls @cb with the counts of each TAL table. */
+void
+vrps_foreach_tal_stats(vrps_tal_stats_cb cb, void *arg)
+{
+	struct tal_table *tal, *tmp;
+
+	rwlock_read_lock(&state_lock);
+	HASH_ITER(hh, state.tals, tal, tmp)
+		cb(tal->file, db_table_roa_count(tal->table),
+		    db_table_router_key_count(tal->table),
+		    db_table_size(tal->table), arg);
+	rwlock_unlock(&state_lock);
+}
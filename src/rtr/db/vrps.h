@@ -2,8 +2,10 @@
 #define SRC_VRPS_H_
 
 #include <stdbool.h>
+#include "config/string_array.h"
 #include "data_structure/array_list.h"
 #include "rtr/db/delta.h"
+#include "rtr/db/snapshot.h"
 
 /*
  * Deltas that share a serial.
@@ -21,7 +23,9 @@ DECLARE_ARRAY_LIST_FUNCTIONS(deltas_db, struct delta_group)
 int vrps_init(void);
 void vrps_destroy(void);
 
-int vrps_update(bool *);
+int vrps_update(struct string_array const *, bool *);
+int vrps_update_slurm(void);
+int vrps_follow(struct db_table *, struct snapshot_header const *);
 
 /*
  * The following three functions return -EAGAIN when vrps_update() has never
@@ -43,4 +47,23 @@ int handle_router_key(unsigned char const *, uint32_t, unsigned char const *,
 
 uint16_t get_current_session_id(uint8_t);
 
+struct vrps_stats {
+	/* Is there a serial yet? */
+	bool published;
+	serial_t serial;
+	unsigned int vrps;
+	unsigned int router_keys;
+	/* Memory used by the base, in bytes */
+	size_t base_size;
+	/* Serials whose deltas are kept, and their memory in bytes */
+	unsigned int deltas;
+	size_t deltas_size;
+};
+
+void vrps_get_stats(struct vrps_stats *);
+
+typedef void (*vrps_tal_stats_cb)(char const *, unsigned int, unsigned int,
+    size_t, void *);
+void vrps_foreach_tal_stats(vrps_tal_stats_cb, void *);
+
 #endif /* SRC_VRPS_H_ */
@@ -0,0 +1,216 @@
+#include "rtr/frontends.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "config.h"
+#include "log.h"
+#include "notify.h"
+#include "rtr/rtr.h"
+#include "rtr/db/snapshot.h"
+#include "rtr/db/vrps.h"
+
+/* Seconds between checks of the state file */
+#define FOLLOW_INTERVAL 1
+
+/* The validator's children */
+static pid_t *pids;
+static unsigned int pid_count;
+
+/* Is this process a frontend? If so, @validator is its parent. */
+static bool frontend;
+static pid_t validator;
+
+static pthread_t follower;
+
+static int
+frontend_run(void)
+{
+	int error;
+
+	error = vrps_init();
+	if (error)
+		return error;
+
+	error = rtr_listen();
+
+	vrps_destroy();
+	return error;
+}
+
+/*
+ * Forks the frontends. Has to be called before any thread is spawned; only the
+ * calling thread survives a fork().
+ *
+ * Returns in the validator only.
+ */
+int
+frontends_start(void)
+{
+	unsigned int count;
+	pid_t pid;
+	int error;
+
+	count = config_get_server_frontends();
+	if (config_get_mode() != SERVER || count == 0)
+		return 0;
+
+	pids = calloc(count, sizeof(pid_t));
+	if (pids == NULL)
+		return pr_enomem();
+
+	while (pid_count < count) {
+		/* Otherwise, the children would print our buffered output too */
+		fflush(NULL);
+
+		pid = fork();
+		if (pid == -1) {
+			error = -pr_errno(errno, "Could not spawn an RTR frontend");
+			frontends_stop();
+			return error;
+		}
+
+		if (pid == 0) {
+			frontend = true;
+			validator = getppid();
+			free(pids);
+			pids = NULL;
+			pid_count = 0;
+			exit(frontend_run() ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+
+		pids[pid_count++] = pid;
+	}
+
+	pr_info("Spawned %u RTR frontend(s).", pid_count);
+	return 0;
+}
+
+void
+frontends_stop(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < pid_count; i++)
+		if (kill(pids[i], SIGTERM) == -1)
+			pr_warn("Could not stop RTR frontend %d: %s", pids[i],
+			    strerror(errno));
+	for (i = 0; i < pid_count; i++)
+		waitpid(pids[i], NULL, 0);
+
+	free(pids);
+	pids = NULL;
+	pid_count = 0;
+}
+
+bool
+is_frontend(void)
+{
+	return frontend;
+}
+
+static bool
+file_changed(struct stat const *old, struct stat const *new)
+{
+	/* The validator renames a new file over the old one every time */
+	return old->st_ino != new->st_ino ||
+	    old->st_mtime != new->st_mtime ||
+	    old->st_size != new->st_size;
+}
+
+static void
+follow_file(char const *path)
+{
+	struct snapshot_header hdr;
+	struct db_table *table;
+	int error;
+
+	error = snapshot_load(path, &hdr, &table);
+	if (error) {
+		pr_warn("Could not load the VRP snapshot; will try again when it changes.");
+		return;
+	}
+
+	error = vrps_follow(table, &hdr);
+	if (error)
+		pr_warn("Could not follow serial %u of the VRP snapshot. (Error code %d.)",
+		    hdr.serial, error);
+}
+
+static void *
+follow(void *arg)
+{
+	struct stat last, current;
+	char const *path;
+	time_t notify_at;
+	bool orphan, was_orphan, draining;
+	int error;
+
+	path = config_get_server_state_file();
+	/* Load it again, in case it changed after vrps_init() */
+	memset(&last, 0, sizeof(last));
+	orphan = false;
+	draining = false;
+
+	do {
+		/*
+		 * A change seen after the validator died can only come from a
+		 * new one. (The ones seen as it dies might be its own.)
+		 */
+		was_orphan = orphan;
+		if (!orphan && getppid() != validator) {
+			pr_warn("The validator is gone; serving its last VRPs until a new one takes over.");
+			orphan = true;
+		}
+
+		notify_at = notify_postponed_at();
+		if (notify_at != 0 && time(NULL) >= notify_at) {
+			error = notify_clients();
+			if (error)
+				pr_debug("Could not notify clients of the new VRPs. (Error code %d.)",
+				    error);
+		}
+
+		if (stat(path, &current) == 0 && file_changed(&last, &current)) {
+			last = current;
+			follow_file(path);
+
+			if (was_orphan && !draining) {
+				pr_info("A new validator took over; this frontend will exit once its clients are gone.");
+				rtr_stop_accepting();
+				draining = true;
+			}
+		}
+
+		sleep(FOLLOW_INTERVAL);
+	} while (true);
+
+	return NULL;
+}
+
+int
+follower_start(void)
+{
+	errno = pthread_create(&follower, NULL, follow, NULL);
+	if (errno)
+		return -pr_errno(errno,
+		    "Could not spawn the state file follower thread");
+
+	return 0;
+}
+
+void
+follower_destroy(void)
+{
+	close_thread(follower, "Follower");
+}
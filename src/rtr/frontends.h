@@ -0,0 +1,31 @@
+#ifndef SRC_RTR_FRONTENDS_H_
+#define SRC_RTR_FRONTENDS_H_
+
+#include <stdbool.h>
+
+/*
+ * RTR frontends: processes that serve the routers, so the validator doesn't
+ * have to. (See "server.frontends".)
+ *
+ * They're forked before anything else starts, and share nothing with the
+ * validator but the state file ("server.state-file"), which it replaces
+ * (atomically) after every update. Each frontend polls it, and publishes
+ * whatever it finds as a serial of its own, with the deltas from the previous
+ * one. They all listen on the same port (SO_REUSEPORT), so the kernel spreads
+ * the connections among them.
+ *
+ * If the validator dies, its frontends keep serving its last VRPs. Once a new
+ * validator replaces the file, they stop accepting connections, and exit as
+ * soon as their routers are gone. (Hopefully to the new validator's
+ * frontends.)
+ */
+
+int frontends_start(void);
+void frontends_stop(void);
+
+bool is_frontend(void);
+
+int follower_start(void);
+void follower_destroy(void);
+
+#endif /* SRC_RTR_FRONTENDS_H_ */
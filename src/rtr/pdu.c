@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "address.h"
 #include "clients.h"
@@ -104,22 +105,107 @@ validate_rtr_version(int fd, struct pdu_header *header,
 	return clients_set_rtr_version(fd, header->protocol_version);
 }
 
+void
+pdu_stream_init(struct pdu_stream *stream, int fd)
+{
+	stream->fd = fd;
+	stream->start = 0;
+	stream->end = 0;
+}
+
+static size_t
+buffered(struct pdu_stream *stream)
+{
+	return stream->end - stream->start;
+}
+
+/*
+ * Reads whatever the client has sent so far (up to the capacity of the
+ * buffer), until there are at least @len unconsumed bytes.
+ *
+ * If @allow_eof is true, EOF before any bytes of the PDU is not worth a
+ * warning.
+ */
+static int
+fill(struct pdu_stream *stream, size_t len, bool allow_eof)
+{
+	ssize_t read_result;
+
+	/* Move the unconsumed bytes to the beginning if @len doesn't fit */
+	if (stream->start + len > sizeof(stream->buffer)) {
+		memmove(stream->buffer, stream->buffer + stream->start,
+		    buffered(stream));
+		stream->end -= stream->start;
+		stream->start = 0;
+	}
+
+	while (buffered(stream) < len) {
+		read_result = read(stream->fd, stream->buffer + stream->end,
+		    sizeof(stream->buffer) - stream->end);
+		if (read_result == -1) {
+			if (errno == EINTR)
+				continue;
+			return -pr_errno(errno, "Client socket read interrupted");
+		}
+
+		if (read_result == 0) {
+			if (!allow_eof || buffered(stream) != 0)
+				pr_warn("Stream ended mid-PDU.");
+			return -EPIPE;
+		}
+
+		stream->end += read_result;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns true if a complete PDU has already been read from the socket.
+ * (poll() won't report it, since it's no longer in the kernel.)
+ */
+bool
+pdu_stream_has_pdu(struct pdu_stream *stream)
+{
+	unsigned char *length;
+	uint32_t pdu_len;
+
+	if (buffered(stream) < RTRPDU_HDR_LEN)
+		return false;
+
+	length = stream->buffer + stream->start + 4;
+	pdu_len = (((uint32_t)length[0]) << 24)
+	    | (((uint32_t)length[1]) << 16)
+	    | (((uint32_t)length[2]) << 8)
+	    | (((uint32_t)length[3]));
+
+	/* Let pdu_load() handle bogus lengths */
+	return pdu_len < RTRPDU_HDR_LEN
+	    || pdu_len > RTRPDU_MAX_RECV_LEN
+	    || buffered(stream) >= pdu_len;
+}
+
 int
-pdu_load(int fd, struct sockaddr_storage *client_addr,
+pdu_load(struct pdu_stream *stream, struct sockaddr_storage *client_addr,
     struct rtr_request *request, struct pdu_metadata const **metadata)
 {
-	unsigned char hdr_bytes[RTRPDU_HDR_LEN];
+	unsigned char *hdr_bytes;
 	struct pdu_reader reader;
 	struct pdu_header header;
 	struct pdu_metadata const *meta;
 	uint8_t version;
+	int fd;
 	int error;
 
-	/* Read the header into its buffer. */
-	error = pdu_reader_init(&reader, fd, hdr_bytes, RTRPDU_HDR_LEN, true);
+	fd = stream->fd;
+
+	/* Read the header into the buffer. */
+	error = fill(stream, RTRPDU_HDR_LEN, true);
 	if (error)
 		/* Communication interrupted; omit error response */
 		return error;
+	hdr_bytes = stream->buffer + stream->start;
+	pdu_reader_wrap(&reader, hdr_bytes, RTRPDU_HDR_LEN);
 	error = pdu_header_from_reader(&reader, &header);
 	if (error)
 		/* No error response because the PDU might have been an error */
@@ -158,39 +244,33 @@ pdu_load(int fd, struct sockaddr_storage *client_addr,
 	 * Most error messages are bound to be two phrases tops.
 	 * (Warning: I'm assuming english tho.)
 	 */
-	if (header.length > 512)
+	if (header.length > RTRPDU_MAX_RECV_LEN)
 		return RESPOND_ERROR(err_pdu_send_invalid_request_truncated(fd,
 		    version, hdr_bytes, "PDU is too large. (> 512 bytes)"));
 
-	/* Read the rest of the PDU into its buffer. */
-	request->bytes_len = header.length;
-	request->bytes = malloc(header.length);
-	if (request->bytes == NULL)
-		/* No error report PDU on allocation failures. */
-		return pr_enomem();
-
-	memcpy(request->bytes, hdr_bytes, RTRPDU_HDR_LEN);
-	error = pdu_reader_init(&reader, fd,
-	    request->bytes + RTRPDU_HDR_LEN,
-	    header.length - RTRPDU_HDR_LEN,
-	    false);
+	/* Read the rest of the PDU, unless it's already in the buffer. */
+	error = fill(stream, header.length, false);
 	if (error)
 		/* Communication interrupted; no error PDU. */
-		goto revert_bytes;
+		return error;
+
+	/* fill() might have moved it */
+	request->bytes = stream->buffer + stream->start;
+	request->bytes_len = header.length;
+	request->pdu = &stream->pdu;
+	pdu_reader_wrap(&reader, request->bytes + RTRPDU_HDR_LEN,
+	    header.length - RTRPDU_HDR_LEN);
+
+	/* The next PDU starts right after this one. */
+	stream->start += header.length;
+	if (stream->start == stream->end)
+		stream->start = stream->end = 0;
 
 	/* Deserialize the PDU. */
 	meta = pdu_get_metadata(header.pdu_type);
-	if (!meta) {
-		error = RESPOND_ERROR(err_pdu_send_unsupported_pdu_type(fd,
+	if (!meta)
+		return RESPOND_ERROR(err_pdu_send_unsupported_pdu_type(fd,
 		    version, request));
-		goto revert_bytes;
-	}
-
-	request->pdu = malloc(meta->length);
-	if (request->pdu == NULL) {
-		error = pr_enomem();
-		goto revert_bytes;
-	}
 
 	error = meta->from_stream(&header, &reader, request->pdu);
 	if (reader.size != 0) {
@@ -209,9 +289,8 @@ pdu_load(int fd, struct sockaddr_storage *client_addr,
 	return 0;
 
 revert_pdu:
-	free(request->pdu);
-revert_bytes:
-	free(request->bytes);
+	if (meta->destructor != NULL)
+		meta->destructor(request->pdu);
 	return error;
 }
 
@@ -314,6 +393,7 @@ error_report_from_stream(struct pdu_header *header, struct pdu_reader *reader,
 	int error;
 
 	memcpy(&pdu->header, header, sizeof(*header));
+	pdu->error_message = NULL;
 
 	error = read_int32(reader, &pdu->error_pdu_length);
 	if (error)
@@ -333,7 +413,6 @@ error_report_destroy(void *pdu_void)
 {
 	struct error_report_pdu *pdu = pdu_void;
 	free(pdu->error_message);
-	free(pdu);
 }
 
 #define DEFINE_METADATA(name, dtor)					\
@@ -344,15 +423,15 @@ error_report_destroy(void *pdu_void)
 		.destructor = dtor,					\
 	}
 
-DEFINE_METADATA(serial_notify, free);
-DEFINE_METADATA(serial_query, free);
-DEFINE_METADATA(reset_query, free);
-DEFINE_METADATA(cache_response, free);
-DEFINE_METADATA(ipv4_prefix, free);
-DEFINE_METADATA(ipv6_prefix, free);
-DEFINE_METADATA(end_of_data, free);
-DEFINE_METADATA(cache_reset, free);
-DEFINE_METADATA(router_key, free);
+DEFINE_METADATA(serial_notify, NULL);
+DEFINE_METADATA(serial_query, NULL);
+DEFINE_METADATA(reset_query, NULL);
+DEFINE_METADATA(cache_response, NULL);
+DEFINE_METADATA(ipv4_prefix, NULL);
+DEFINE_METADATA(ipv6_prefix, NULL);
+DEFINE_METADATA(end_of_data, NULL);
+DEFINE_METADATA(cache_reset, NULL);
+DEFINE_METADATA(router_key, NULL);
 DEFINE_METADATA(error_report, error_report_destroy);
 
 struct pdu_metadata const *const pdu_metadatas[] = {
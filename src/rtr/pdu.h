@@ -11,7 +11,12 @@
 #define RTR_V0	0
 #define RTR_V1	1
 
-/** A request from an RTR client. */
+/**
+ * A request from an RTR client.
+ *
+ * Both @bytes and @pdu belong to the client's pdu_stream, so they're only valid
+ * until the next pdu_load().
+ */
 struct rtr_request {
 	/** Raw bytes. */
 	unsigned char *bytes;
@@ -60,6 +65,12 @@ char const *pdutype2str(enum pdu_type);
 #define RTRPDU_MAX_LEN			RTRPDU_IPV6_PREFIX_LEN
 #define RTRPDU_ERR_MAX_LEN		256
 
+/*
+ * Largest PDU we're willing to receive. (Error Reports are the only ones that
+ * can be larger; they're rejected.)
+ */
+#define RTRPDU_MAX_RECV_LEN		512
+
 struct pdu_header {
 	uint8_t	protocol_version;
 	uint8_t	pdu_type;
@@ -138,6 +149,37 @@ struct error_report_pdu {
 	rtr_char	*error_message;
 };
 
+/* Any of the above. */
+union rtr_pdu {
+	struct pdu_header		header;
+	struct serial_notify_pdu	serial_notify;
+	struct serial_query_pdu		serial_query;
+	struct reset_query_pdu		reset_query;
+	struct cache_response_pdu	cache_response;
+	struct ipv4_prefix_pdu		ipv4_prefix;
+	struct ipv6_prefix_pdu		ipv6_prefix;
+	struct end_of_data_pdu		end_of_data;
+	struct cache_reset_pdu		cache_reset;
+	struct router_key_pdu		router_key;
+	struct error_report_pdu		error_report;
+};
+
+/*
+ * The receiving end of a client connection. Owned by the client's thread, so
+ * receiving PDUs needs no allocations.
+ *
+ * Several PDUs might arrive in a single read(); they're consumed one by one.
+ */
+struct pdu_stream {
+	int fd;
+	/* Bytes read from @fd; the unconsumed ones are [@start, @end) */
+	unsigned char buffer[4 * RTRPDU_MAX_RECV_LEN];
+	size_t start;
+	size_t end;
+	/* The latest PDU */
+	union rtr_pdu pdu;
+};
+
 struct pdu_metadata {
 	size_t	length;
 	/**
@@ -154,11 +196,14 @@ struct pdu_metadata {
 	 * Also, they are supposed to send error PDUs on discretion.
 	 */
 	int	(*handle)(int, struct rtr_request const *);
+	/** Releases whatever @from_stream allocated. Can be NULL. */
 	void	(*destructor)(void *);
 };
 
-int pdu_load(int, struct sockaddr_storage *, struct rtr_request *,
-    struct pdu_metadata const **);
+void pdu_stream_init(struct pdu_stream *, int);
+bool pdu_stream_has_pdu(struct pdu_stream *);
+int pdu_load(struct pdu_stream *, struct sockaddr_storage *,
+    struct rtr_request *, struct pdu_metadata const **);
 struct pdu_metadata const *pdu_get_metadata(uint8_t);
 struct pdu_header *pdu_get_header(void *);
 
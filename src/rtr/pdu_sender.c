@@ -11,6 +11,7 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
 #include "rtr/pdu_serializer.h"
 #include "rtr/db/vrps.h"
 
@@ -37,14 +38,21 @@ send_response(int fd, uint8_t pdu_type, unsigned char *data, size_t data_len)
 	if (error < 0)
 		return pr_errno(errno, "Error sending response");
 
+	metrics_pdu_sent(pdu_type, data_len);
 	return 0;
 }
 
-int
-send_serial_notify_pdu(int fd, uint8_t version, serial_t start_serial)
+/*
+ * Serializes a Serial Notify PDU into @data, which must be
+ * RTRPDU_SERIAL_NOTIFY_LEN bytes long.
+ *
+ * (It's not sent right away; see notify.h.)
+ */
+void
+build_serial_notify_pdu(uint8_t version, serial_t start_serial,
+    unsigned char *data)
 {
 	struct serial_notify_pdu pdu;
-	unsigned char data[RTRPDU_SERIAL_NOTIFY_LEN];
 	size_t len;
 
 	set_header_values(&pdu.header, version, PDU_TYPE_SERIAL_NOTIFY,
@@ -56,8 +64,6 @@ send_serial_notify_pdu(int fd, uint8_t version, serial_t start_serial)
 	len = serialize_serial_notify_pdu(&pdu, data);
 	if (len != RTRPDU_SERIAL_NOTIFY_LEN)
 		pr_crit("Serialized Serial Notify is %zu bytes.", len);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
 }
 
 int
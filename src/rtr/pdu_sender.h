@@ -5,7 +5,7 @@
 #include "object/router_key.h"
 #include "rtr/db/vrps.h"
 
-int send_serial_notify_pdu(int, uint8_t, serial_t);
+void build_serial_notify_pdu(uint8_t, serial_t, unsigned char *);
 int send_cache_reset_pdu(int, uint8_t);
 int send_cache_response_pdu(int, uint8_t);
 int send_prefix_pdu(int, uint8_t, struct vrp const *, uint8_t);
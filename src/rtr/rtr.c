@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -13,11 +14,18 @@
 #include "config.h"
 #include "clients.h"
 #include "log.h"
+#include "metrics.h"
+#include "notify.h"
 #include "updates_daemon.h"
 #include "rtr/err_pdu.h"
+#include "rtr/frontends.h"
 #include "rtr/pdu.h"
 #include "rtr/db/vrps.h"
 
+/* The socket that accepts the clients, and whether it still should */
+static int listener = -1;
+static bool draining;
+
 struct thread_param {
 	int fd;
 	pthread_t tid;
@@ -209,8 +217,8 @@ retry:
 static void
 clean_request(struct rtr_request *request, const struct pdu_metadata *meta)
 {
-	free(request->bytes);
-	meta->destructor(request->pdu);
+	if (meta->destructor != NULL)
+		meta->destructor(request->pdu);
 }
 
 static void
@@ -242,6 +250,77 @@ print_client_addr(struct sockaddr_storage *addr, char const *action, int fd)
 	    sockaddr2str(addr, buffer));
 }
 
+static int
+handle_request(struct thread_param *param, struct pdu_stream *stream)
+{
+	struct pdu_metadata const *meta;
+	struct rtr_request request;
+	struct timespec start;
+	uint8_t type;
+	int error;
+
+	error = pdu_load(stream, &param->addr, &request, &meta);
+	if (error)
+		return error;
+
+	metrics_now(&start);
+	type = pdu_get_header(request.pdu)->pdu_type;
+	error = meta->handle(param->fd, &request);
+	if (type == PDU_TYPE_RESET_QUERY)
+		metrics_query(METRICS_QUERY_RESET, &start);
+	else if (type == PDU_TYPE_SERIAL_QUERY)
+		metrics_query(METRICS_QUERY_SERIAL, &start);
+	clean_request(&request, meta);
+	return error;
+}
+
+/*
+ * Waits for requests from the client, and for Serial Notifies to send it.
+ * Returns when the connection should be closed.
+ */
+static void
+serve_client(struct thread_param *param, struct notify_queue *notify)
+{
+	struct pdu_stream stream;
+	struct pollfd fds[2];
+
+	pdu_stream_init(&stream, param->fd);
+
+	fds[0].fd = param->fd;
+	fds[1].fd = notify->pipe[0];
+	fds[1].events = POLLIN;
+
+	while (true) {
+		/* Only wait for room if there's a Serial Notify stuck */
+		fds[0].events = POLLIN | (notify->pending ? POLLOUT : 0);
+
+		if (poll(fds, 2, notify->pending ? 1000 : -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			pr_errno(errno, "poll() failed on the client's socket");
+			return;
+		}
+
+		if (fds[1].revents & POLLIN)
+			notify_queue_wakeup(notify, param->fd);
+		if (notify->pending) {
+			if (notify_queue_flush(notify, param->fd, false) != 0)
+				return;
+			notify_queue_check(notify, param->fd);
+		}
+
+		if (fds[0].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+			/* Responses must not interleave with the notify */
+			if (notify_queue_flush(notify, param->fd, true) != 0)
+				return;
+			do {
+				if (handle_request(param, &stream) != 0)
+					return;
+			} while (pdu_stream_has_pdu(&stream));
+		}
+	}
+}
+
 /*
  * The client socket threads' entry routine.
  * @arg must be released.
@@ -249,34 +328,34 @@ print_client_addr(struct sockaddr_storage *addr, char const *action, int fd)
 static void *
 client_thread_cb(void *arg)
 {
-	struct pdu_metadata const *meta;
-	struct rtr_request request;
 	struct thread_param param;
+	struct notify_queue notify;
 	int error;
 
 	memcpy(&param, arg, sizeof(param));
 	free(arg);
 
-	error = clients_add(param.fd, param.addr, param.tid);
+	error = notify_queue_init(&notify);
 	if (error) {
 		close(param.fd);
 		return NULL;
 	}
 
-	while (true) { /* For each PDU... */
-		error = pdu_load(param.fd, &param.addr, &request, &meta);
-		if (error)
-			break;
-
-		error = meta->handle(param.fd, &request);
-		clean_request(&request, meta);
-		if (error)
-			break;
+	error = clients_add(param.fd, param.addr, param.tid, notify.pipe[1]);
+	if (error) {
+		notify_queue_cleanup(&notify);
+		close(param.fd);
+		return NULL;
 	}
 
+	metrics_session_opened();
+	serve_client(&param, &notify);
+
 	print_client_addr(&param.addr, "closed", param.fd);
 	end_client(param.fd);
 	clients_forget(param.fd);
+	metrics_session_closed();
+	notify_queue_cleanup(&notify);
 
 	/* Release to avoid the wait till the parent tries to join */
 	pthread_detach(param.tid);
@@ -304,6 +383,8 @@ handle_client_connections(int server_fd)
 	do {
 		client_fd = accept(server_fd, (struct sockaddr *) &client_addr,
 		    &sizeof_client_addr);
+		if (client_fd < 0 && draining)
+			return 0;
 		switch (handle_accept_result(client_fd, errno)) {
 		case VERDICT_SUCCESS:
 			break;
@@ -348,6 +429,19 @@ handle_client_connections(int server_fd)
 	return 0; /* Unreachable. */
 }
 
+/*
+ * Makes rtr_listen() stop accepting clients, and return once the current ones
+ * are gone. Meant to be called from another thread.
+ */
+void
+rtr_stop_accepting(void)
+{
+	draining = true;
+	/* Wakes up accept() */
+	if (shutdown(listener, SHUT_RD) == -1)
+		pr_warn("Could not stop accepting clients: %s", strerror(errno));
+}
+
 /*
  * Receive @arg to be called as a clients_foreach_cb
  */
@@ -394,27 +488,42 @@ rtr_listen(void)
 		return error;
 
 	if (config_get_mode() == STANDALONE) {
-		error = vrps_update(&changed);
+		error = vrps_update(NULL, &changed);
 		if (error)
 			pr_err("Error %d while trying to update the ROA database.",
 			    error);
 		goto revert_clients_db; /* Error 0 it's ok */
 	}
 
+	/* The frontends serve the clients; see frontends.h */
+	if (config_get_server_frontends() > 0 && !is_frontend()) {
+		updates_daemon_run();
+		goto revert_clients_db;
+	}
+
 	error = create_server_socket(&server_fd);
 	if (error)
 		goto revert_clients_db;
+	listener = server_fd;
 
-	error = updates_daemon_start();
+	error = is_frontend() ? follower_start() : updates_daemon_start();
 	if (error)
 		goto revert_server_socket;
 
 	error = handle_client_connections(server_fd);
 
+	/* Let the remaining clients finish on their own */
+	while (draining && clients_count() > 0)
+		sleep(1);
+
 	end_clients();
-	updates_daemon_destroy();
+	if (is_frontend())
+		follower_destroy();
+	else
+		updates_daemon_destroy();
 revert_server_socket:
 	close(server_fd);
+	listener = -1;
 revert_clients_db:
 	clients_db_destroy(join_thread, NULL);
 	return error;
@@ -2,5 +2,6 @@
 #define RTR_RTR_H_
 
 int rtr_listen(void);
+void rtr_stop_accepting(void);
 
 #endif /* RTR_RTR_H_ */
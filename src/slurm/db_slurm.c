@@ -1,11 +1,14 @@
 #include "db_slurm.h"
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <arpa/inet.h>
 
 #include "crypto/base64.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/router_key.h"
 #include "common.h"
 
@@ -24,11 +27,46 @@ ARRAY_LIST(al_assertion_prefix, struct slurm_prefix_ctx)
 ARRAY_LIST(al_filter_bgpsec, struct slurm_bgpsec_ctx)
 ARRAY_LIST(al_assertion_bgpsec, struct slurm_bgpsec_ctx)
 
+/*
+ * The filters are also indexed, so the VRPs and router keys can be matched
+ * against them without walking the lists. (Which would be one walk per VRP.)
+ *
+ * Filters with a prefix go to a binary trie (one per family), at the node of
+ * their prefix. A VRP is filtered by the nodes on the path from the root to
+ * its own prefix. The rest of them only need a hash lookup.
+ */
+struct filter_node {
+	struct filter_node *children[2];
+	/* A filter with this prefix, and no ASN, exists */
+	bool any_asn;
+	/* ASNs of the filters with this prefix (sorted, for bsearch()) */
+	uint32_t *asns;
+	size_t asn_count;
+};
+
+/* A filter without a prefix */
+struct hashed_filter {
+	struct {
+		/* Which of the fields below are set */
+		uint8_t data_flag;
+		unsigned char ski[RK_SKI_LEN];
+		uint32_t asn;
+	} key;
+	UT_hash_handle hh;
+};
+
 struct db_slurm {
 	struct al_filter_prefix filter_pfx_al;
 	struct al_assertion_prefix assertion_pfx_al;
 	struct al_filter_bgpsec filter_bgps_al;
 	struct al_assertion_bgpsec assertion_bgps_al;
+
+	struct filter_node *filter_v4;
+	struct filter_node *filter_v6;
+	/* Prefix filters that only have ASN */
+	struct hashed_filter *filter_asns;
+	struct hashed_filter *filter_bgpsec;
+
 	bool loaded_date_set;
 	time_t loaded_date;
 };
@@ -49,6 +87,10 @@ db_slurm_create(struct db_slurm **result)
 	al_assertion_prefix_init(&db->assertion_pfx_al);
 	al_filter_bgpsec_init(&db->filter_bgps_al);
 	al_assertion_bgpsec_init(&db->assertion_bgps_al);
+	db->filter_v4 = NULL;
+	db->filter_v6 = NULL;
+	db->filter_asns = NULL;
+	db->filter_bgpsec = NULL;
 	db->loaded_date_set = false;
 
 	*result = db;
@@ -173,7 +215,7 @@ bgpsec_filtered_by(struct slurm_bgpsec *bgpsec, struct slurm_bgpsec *filter,
 	/* Both have a SKI */
 	if ((bgpsec->data_flag & SLURM_BGPS_FLAG_SKI) > 0 &&
 	    (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0)
-		return memcmp(bgpsec->ski, filter->ski, RK_SPKI_LEN) == 0;
+		return memcmp(bgpsec->ski, filter->ski, RK_SKI_LEN) == 0;
 
 	return false;
 }
@@ -235,8 +277,210 @@ bgpsec_equal(struct slurm_bgpsec_ctx *left_ctx, struct slurm_bgpsec *right,
 	return equal;
 }
 
+static int
+hashed_filter_add(struct hashed_filter **table, uint8_t data_flag,
+    uint32_t asn, unsigned char const *ski)
+{
+	struct hashed_filter *filter;
+	struct hashed_filter *old;
+
+	filter = malloc(sizeof(struct hashed_filter));
+	if (filter == NULL)
+		return pr_enomem();
+	/* Needed by uthash; the key is compared with memcmp() */
+	memset(filter, 0, sizeof(struct hashed_filter));
+
+	filter->key.data_flag = data_flag;
+	if (data_flag & SLURM_COM_FLAG_ASN)
+		filter->key.asn = asn;
+	if (data_flag & SLURM_BGPS_FLAG_SKI)
+		memcpy(filter->key.ski, ski, RK_SKI_LEN);
+
+	HASH_FIND(hh, *table, &filter->key, sizeof(filter->key), old);
+	if (old != NULL) {
+		free(filter);
+		return 0;
+	}
+
+	errno = 0;
+	HASH_ADD(hh, *table, key, sizeof(filter->key), filter);
+	if (errno) {
+		free(filter);
+		return -pr_errno(errno, "Could not index a SLURM filter");
+	}
+
+	return 0;
+}
+
+static bool
+hashed_filter_exists(struct hashed_filter *table, uint8_t data_flag,
+    uint32_t asn, unsigned char const *ski)
+{
+	struct hashed_filter filter;
+	struct hashed_filter *found;
+
+	if (table == NULL)
+		return false;
+
+	memset(&filter.key, 0, sizeof(filter.key));
+	filter.key.data_flag = data_flag;
+	if (data_flag & SLURM_COM_FLAG_ASN)
+		filter.key.asn = asn;
+	if (data_flag & SLURM_BGPS_FLAG_SKI)
+		memcpy(filter.key.ski, ski, RK_SKI_LEN);
+
+	HASH_FIND(hh, table, &filter.key, sizeof(filter.key), found);
+	return found != NULL;
+}
+
+static void
+hashed_filter_cleanup(struct hashed_filter **table)
+{
+	struct hashed_filter *filter, *tmp;
+
+	HASH_ITER(hh, *table, filter, tmp) {
+		HASH_DEL(*table, filter);
+		free(filter);
+	}
+}
+
+/* Bit @index of @addr, counting from the most significant one. */
+static unsigned int
+addr_bit(uint8_t const *addr, unsigned int index)
+{
+	return (addr[index >> 3] >> (7 - (index & 7))) & 1;
+}
+
+static int
+filter_node_add_asn(struct filter_node *node, uint32_t asn)
+{
+	uint32_t *tmp;
+	size_t i;
+
+	for (i = 0; i < node->asn_count && node->asns[i] <= asn; i++)
+		if (node->asns[i] == asn)
+			return 0;
+
+	tmp = realloc(node->asns, (node->asn_count + 1) * sizeof(uint32_t));
+	if (tmp == NULL)
+		return pr_enomem();
+	node->asns = tmp;
+
+	memmove(&node->asns[i + 1], &node->asns[i],
+	    (node->asn_count - i) * sizeof(uint32_t));
+	node->asns[i] = asn;
+	node->asn_count++;
+	return 0;
+}
+
+static int
+filter_trie_add(struct filter_node **root, uint8_t const *addr,
+    unsigned int len, struct slurm_prefix const *filter)
+{
+	struct filter_node **node;
+	unsigned int i;
+
+	node = root;
+	for (i = 0; ; i++) {
+		if (*node == NULL) {
+			*node = calloc(1, sizeof(struct filter_node));
+			if (*node == NULL)
+				return pr_enomem();
+		}
+		if (i == len)
+			break;
+		node = &(*node)->children[addr_bit(addr, i)];
+	}
+
+	if (filter->data_flag & SLURM_COM_FLAG_ASN)
+		return filter_node_add_asn(*node, filter->vrp.asn);
+
+	(*node)->any_asn = true;
+	return 0;
+}
+
+static int
+asn_cmp(void const *a, void const *b)
+{
+	uint32_t asn_a = *(uint32_t const *) a;
+	uint32_t asn_b = *(uint32_t const *) b;
+
+	return (asn_a > asn_b) - (asn_a < asn_b);
+}
+
+/* Is the prefix @addr/@len, originated by @asn, covered by a filter? */
+static bool
+filter_trie_matches(struct filter_node *node, uint8_t const *addr,
+    unsigned int len, uint32_t asn)
+{
+	unsigned int i;
+
+	for (i = 0; node != NULL; i++) {
+		if (node->any_asn)
+			return true;
+		if (node->asn_count > 0 && bsearch(&asn, node->asns,
+		    node->asn_count, sizeof(uint32_t), asn_cmp) != NULL)
+			return true;
+		if (i == len)
+			break;
+		node = node->children[addr_bit(addr, i)];
+	}
+
+	return false;
+}
+
+static void
+filter_trie_destroy(struct filter_node *node)
+{
+	if (node == NULL)
+		return;
+
+	filter_trie_destroy(node->children[0]);
+	filter_trie_destroy(node->children[1]);
+	free(node->asns);
+	free(node);
+}
+
+static int
+index_prefix_filter(struct db_slurm *db, struct slurm_prefix const *filter)
+{
+	struct vrp const *vrp = &filter->vrp;
+
+	if (!(filter->data_flag & SLURM_PFX_FLAG_PREFIX))
+		return (filter->data_flag & SLURM_COM_FLAG_ASN)
+		    ? hashed_filter_add(&db->filter_asns, SLURM_COM_FLAG_ASN,
+		      vrp->asn, NULL)
+		    : 0;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		return filter_trie_add(&db->filter_v4,
+		    (uint8_t const *) &vrp->prefix.v4, vrp->prefix_length,
+		    filter);
+	case AF_INET6:
+		return filter_trie_add(&db->filter_v6,
+		    vrp->prefix.v6.s6_addr, vrp->prefix_length, filter);
+	}
+
+	pr_crit("Unknown addr family type: %u", vrp->addr_fam);
+}
+
+static int
+index_bgpsec_filter(struct db_slurm *db, struct slurm_bgpsec const *filter)
+{
+	uint8_t data_flag;
+
+	data_flag = filter->data_flag &
+	    (SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI);
+	if (data_flag == 0)
+		return 0;
+
+	return hashed_filter_add(&db->filter_bgpsec, data_flag, filter->asn,
+	    filter->ski);
+}
+
 #define ADD_FUNCS(name, type, list_name, db_list, db_alt_list, equal_cb,\
-    cont_cb, filter)							\
+    cont_cb, filter, index_cb)						\
 	static type *							\
 	name##_locate(struct db_slurm *db, type *obj, bool flt, int ctx)\
 	{								\
@@ -267,32 +511,55 @@ bgpsec_equal(struct slurm_bgpsec_ctx *left_ctx, struct slurm_bgpsec *right,
 	db_slurm_add_##name(struct db_slurm *db, type *elem, int ctx)	\
 	{								\
 		type##_ctx new_elem;					\
+		int error;						\
 		if (name##_exists(db, elem, !filter, ctx))		\
 			return -EEXIST;					\
+		error = index_cb(db, elem);				\
+		if (error)						\
+			return error;					\
 		new_elem.element = *elem;				\
 		new_elem.ctx = ctx;					\
 		return list_name##_add(&db->db_list, &new_elem);	\
 	}
 
+/* Assertions aren't indexed */
+#define NO_INDEX(db, elem) 0
+
 ADD_FUNCS(prefix_filter, struct slurm_prefix, al_filter_prefix, filter_pfx_al,
-    assertion_pfx_al, prefix_equal, prefix_contained, true)
+    assertion_pfx_al, prefix_equal, prefix_contained, true,
+    index_prefix_filter)
 ADD_FUNCS(bgpsec_filter, struct slurm_bgpsec, al_filter_bgpsec, filter_bgps_al,
-    assertion_bgps_al, bgpsec_equal, bgpsec_contained, true)
+    assertion_bgps_al, bgpsec_equal, bgpsec_contained, true,
+    index_bgpsec_filter)
 ADD_FUNCS(prefix_assertion, struct slurm_prefix, al_assertion_prefix,
-    assertion_pfx_al, filter_pfx_al, prefix_equal, prefix_contained, false)
+    assertion_pfx_al, filter_pfx_al, prefix_equal, prefix_contained, false,
+    NO_INDEX)
 ADD_FUNCS(bgpsec_assertion, struct slurm_bgpsec, al_assertion_bgpsec,
-    assertion_bgps_al, filter_bgps_al, bgpsec_equal, bgpsec_contained, false)
+    assertion_bgps_al, filter_bgps_al, bgpsec_equal, bgpsec_contained, false,
+    NO_INDEX)
 
+/*
+ * A filter with ASN and prefix removes the VRPs with that ASN, covered by the
+ * prefix. A filter with only one of them removes the VRPs that match it.
+ */
 bool
 db_slurm_vrp_is_filtered(struct db_slurm *db, struct vrp const *vrp)
 {
-	struct slurm_prefix slurm_prefix;
+	if (hashed_filter_exists(db->filter_asns, SLURM_COM_FLAG_ASN, vrp->asn,
+	    NULL))
+		return true;
 
-	slurm_prefix.data_flag = SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX
-	    | SLURM_PFX_FLAG_MAX_LENGTH;
-	slurm_prefix.vrp = *vrp;
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		return filter_trie_matches(db->filter_v4,
+		    (uint8_t const *) &vrp->prefix.v4, vrp->prefix_length,
+		    vrp->asn);
+	case AF_INET6:
+		return filter_trie_matches(db->filter_v6,
+		    vrp->prefix.v6.s6_addr, vrp->prefix_length, vrp->asn);
+	}
 
-	return prefix_filter_exists(db, &slurm_prefix, true, -1);
+	return false;
 }
 
 #define ITERATE_LIST_FUNC(type, object, db_list)			\
@@ -318,28 +585,19 @@ ITERATE_LIST_FUNC(filter, bgpsec, filter_bgps_al)
 ITERATE_LIST_FUNC(assertion, prefix, assertion_pfx_al)
 ITERATE_LIST_FUNC(assertion, bgpsec, assertion_bgps_al)
 
+/* Same as db_slurm_vrp_is_filtered(), with the SKI instead of the prefix. */
 bool
 db_slurm_bgpsec_is_filtered(struct db_slurm *db, struct router_key const *key)
 {
-	struct slurm_bgpsec slurm_bgpsec;
-	unsigned char *tmp;
-	bool result;
+	struct hashed_filter *filters = db->filter_bgpsec;
 
-	tmp = malloc(RK_SKI_LEN);
-	if (tmp == NULL) {
-		pr_enomem();
-		return false;
-	}
-	slurm_bgpsec.data_flag = SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI;
-	slurm_bgpsec.asn = key->as;
-	memcpy(tmp, key->ski, RK_SKI_LEN);
-	slurm_bgpsec.ski = tmp;
 	/* Router public key isn't used at filters */
-	slurm_bgpsec.router_public_key = NULL;
-
-	result = bgpsec_filter_exists(db, &slurm_bgpsec, true, -1);
-	free(tmp);
-	return result;
+	return hashed_filter_exists(filters, SLURM_COM_FLAG_ASN, key->as,
+	    key->ski) ||
+	    hashed_filter_exists(filters, SLURM_BGPS_FLAG_SKI, key->as,
+	    key->ski) ||
+	    hashed_filter_exists(filters,
+	    SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI, key->as, key->ski);
 }
 
 static void
@@ -469,5 +727,9 @@ db_slurm_destroy(struct db_slurm *db)
 	al_assertion_prefix_cleanup(&db->assertion_pfx_al, NULL);
 	al_assertion_bgpsec_cleanup(&db->assertion_bgps_al,
 	    clean_slurm_bgpsec);
+	filter_trie_destroy(db->filter_v4);
+	filter_trie_destroy(db->filter_v6);
+	hashed_filter_cleanup(&db->filter_asns);
+	hashed_filter_cleanup(&db->filter_bgpsec);
 	free(db);
 }
@@ -1,7 +1,10 @@
 #include "slurm_loader.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 
@@ -10,8 +13,6 @@
 #include "common.h"
 #include "slurm/slurm_parser.h"
 
-#define SLURM_FILE_EXTENSION	".slurm"
-
 /*
  * Load the SLURM file(s) from the configured path, if the path is valid but no
  * data is loaded (specific error for a SLURM folder) no error is returned and
@@ -46,21 +47,22 @@ slurm_load(struct slurm_parser_params *params)
 	return 0;
 }
 
-static int
-slurm_pfx_filters_apply(struct vrp const *vrp, void *arg)
+static bool
+slurm_pfx_filtered(struct vrp const *vrp, void *arg)
 {
-	struct slurm_parser_params *params = arg;
-
-	if (db_slurm_vrp_is_filtered(params->db_slurm, vrp))
-		db_table_remove_roa(params->db_table, vrp);
+	return db_slurm_vrp_is_filtered(arg, vrp);
+}
 
-	return 0;
+static bool
+slurm_bgpsec_filtered(struct router_key const *key, void *arg)
+{
+	return db_slurm_bgpsec_is_filtered(arg, key);
 }
 
 static int
 slurm_pfx_assertions_add(struct slurm_prefix *prefix, void *arg)
 {
-	struct slurm_parser_params *params = arg;
+	struct db_table *table = arg;
 	struct ipv4_prefix prefix4;
 	struct ipv6_prefix prefix6;
 	struct vrp vrp;
@@ -72,140 +74,161 @@ slurm_pfx_assertions_add(struct slurm_prefix *prefix, void *arg)
 	if (vrp.addr_fam == AF_INET) {
 		prefix4.addr = vrp.prefix.v4;
 		prefix4.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v4(params->db_table, vrp.asn,
-		    &prefix4, vrp.max_prefix_length);
+		return rtrhandler_handle_roa_v4(table, vrp.asn, &prefix4,
+		    vrp.max_prefix_length);
 	}
 	if (vrp.addr_fam == AF_INET6) {
 		prefix6.addr = vrp.prefix.v6;
 		prefix6.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v6(params->db_table, vrp.asn,
-		    &prefix6, vrp.max_prefix_length);
+		return rtrhandler_handle_roa_v6(table, vrp.asn, &prefix6,
+		    vrp.max_prefix_length);
 	}
 
 	pr_crit("Unknown addr family type: %u", vrp.addr_fam);
 }
 
 static int
-slurm_pfx_assertions_apply(struct slurm_parser_params *params)
+slurm_bgpsec_assertions_add(struct slurm_bgpsec *bgpsec, void *arg)
 {
-	return db_slurm_foreach_assertion_prefix(params->db_slurm,
-	    slurm_pfx_assertions_add, params);
+	struct db_table *table = arg;
+
+	return rtrhandler_handle_router_key(table, bgpsec->ski, bgpsec->asn,
+	    bgpsec->router_public_key);
 }
 
-static int
-slurm_bgpsec_filters_apply(struct router_key const *key, void *arg)
+void
+slurm_cache_init(struct slurm_cache *cache)
 {
-	struct slurm_parser_params *params = arg;
-
-	if (db_slurm_bgpsec_is_filtered(params->db_slurm, key))
-		db_table_remove_router_key(params->db_table, key);
-
-	return 0;
+	cache->db = NULL;
+	cache->fingerprint = 0;
+	cache->fingerprint_set = false;
 }
 
-static int
-slurm_bgpsec_assertions_add(struct slurm_bgpsec *bgpsec, void *arg)
+void
+slurm_cache_cleanup(struct slurm_cache *cache)
 {
-	struct slurm_parser_params *params = arg;
-
-	return rtrhandler_handle_router_key(params->db_table, bgpsec->ski,
-	    bgpsec->asn, bgpsec->router_public_key);
+	if (cache->db != NULL)
+		db_slurm_destroy(cache->db);
+	slurm_cache_init(cache);
 }
 
-static int
-slurm_bgpsec_assertions_apply(struct slurm_parser_params *params)
+/* FNV-1a */
+static uint64_t
+hash_bytes(uint64_t hash, void const *bytes, size_t len)
 {
-	return db_slurm_foreach_assertion_bgpsec(params->db_slurm,
-	    slurm_bgpsec_assertions_add, params);
+	unsigned char const *cursor = bytes;
+
+	for (; len > 0; len--, cursor++) {
+		hash ^= *cursor;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
 }
 
 static int
-slurm_create_parser_params(struct slurm_parser_params **result)
+fingerprint_file(char const *location, void *arg)
 {
-	struct slurm_parser_params *params;
+	uint64_t *fingerprint = arg;
+	struct stat attr;
+	uint64_t hash;
 
-	params = malloc(sizeof(struct slurm_parser_params));
-	if (params == NULL)
-		return pr_enomem();
+	if (stat(location, &attr) != 0)
+		return -errno;
 
-	params->db_table = NULL;
-	params->db_slurm = NULL;
-	params->cur_ctx = 0;
+	hash = hash_bytes(0xcbf29ce484222325ULL, location, strlen(location));
+	hash = hash_bytes(hash, &attr.st_dev, sizeof(attr.st_dev));
+	hash = hash_bytes(hash, &attr.st_ino, sizeof(attr.st_ino));
+	hash = hash_bytes(hash, &attr.st_size, sizeof(attr.st_size));
+	hash = hash_bytes(hash, &attr.st_mtim, sizeof(attr.st_mtim));
 
-	*result = params;
+	/* Commutative, so the order of the directory entries doesn't matter */
+	*fingerprint += hash;
 	return 0;
 }
 
+/*
+ * Summarizes the identity, size and modification time of the SLURM files, so
+ * they're only parsed again when they change.
+ */
+static int
+slurm_fingerprint(uint64_t *result)
+{
+	*result = 0;
+	return process_file_or_dir(config_get_slurm(), SLURM_FILE_EXTENSION,
+	    fingerprint_file, result);
+}
+
 int
-slurm_apply(struct db_table **base, struct db_slurm **last_slurm)
+slurm_update(struct slurm_cache *cache, bool *changed)
 {
-	struct slurm_parser_params *params = NULL;
+	struct slurm_parser_params params;
+	uint64_t fingerprint;
+	bool fingerprint_set;
 	int error;
 
+	*changed = false;
 	if (config_get_slurm() == NULL)
 		return 0;
 
-	pr_info("Applying configured SLURM");
-	error = slurm_create_parser_params(&params);
-	if (error)
-		return error;
+	/* If the files can't be listed, let the parser complain */
+	fingerprint_set = (slurm_fingerprint(&fingerprint) == 0);
+	if (fingerprint_set && cache->fingerprint_set &&
+	    fingerprint == cache->fingerprint)
+		return 0; /* Same files as last time */
+	cache->fingerprint = fingerprint;
+	cache->fingerprint_set = fingerprint_set;
 
-	error = slurm_load(params);
-	if (!error) {
-		/* Use new SLURM as last valid slurm */
-		if (*last_slurm != NULL)
-			db_slurm_destroy(*last_slurm);
-		*last_slurm = params->db_slurm;
-		if (*last_slurm != NULL)
-			db_slurm_update_time(*last_slurm);
-	} else {
+	pr_info("Loading configured SLURM");
+	params.db_slurm = NULL;
+	params.cur_ctx = 0;
+
+	error = slurm_load(&params);
+	if (error) {
 		/* Any error: use last valid SLURM */
 		pr_warn("Error loading SLURM, the validation will still continue.");
-		if (*last_slurm != NULL) {
+		if (cache->db != NULL) {
 			pr_warn("A previous valid version of the SLURM exists and will be applied.");
-			params->db_slurm = *last_slurm;
 			/* Log applied SLURM as info */
-			db_slurm_log(params->db_slurm);
+			db_slurm_log(cache->db);
 		}
+		return 0;
 	}
 
-	/* If there's no new SLURM loaded, stop */
-	if (params->db_slurm == NULL)
-		goto success;
+	/* Use new SLURM as last valid slurm */
+	if (cache->db != NULL)
+		db_slurm_destroy(cache->db);
+	cache->db = params.db_slurm;
+	if (cache->db != NULL)
+		db_slurm_update_time(cache->db);
+	*changed = true;
+	return 0;
+}
 
-	/* Deep copy of the base so that updates can be reverted */
-	error = db_table_clone(&params->db_table, *base);
-	if (error)
-		goto release_slurm;
+int
+slurm_merge(struct db_table *dst, struct db_table *src,
+    struct db_slurm *slurm)
+{
+	if (slurm == NULL)
+		return db_table_merge(dst, src);
 
-	error = db_table_foreach_roa(params->db_table, slurm_pfx_filters_apply,
-	    params);
-	if (error)
-		goto release_table;
+	return db_table_merge_filtered(dst, src, slurm_pfx_filtered,
+	    slurm_bgpsec_filtered, slurm);
+}
 
-	error = db_table_foreach_router_key(params->db_table,
-	    slurm_bgpsec_filters_apply, params);
-	if (error)
-		goto release_table;
+int
+slurm_add_assertions(struct db_table *table, struct db_slurm *slurm)
+{
+	int error;
 
-	error = slurm_pfx_assertions_apply(params);
-	if (error)
-		goto release_table;
+	if (slurm == NULL)
+		return 0;
 
-	error = slurm_bgpsec_assertions_apply(params);
-	if (error) {
-		goto release_table;
-	}
+	error = db_slurm_foreach_assertion_prefix(slurm,
+	    slurm_pfx_assertions_add, table);
+	if (error)
+		return error;
 
-	db_table_destroy(*base);
-	*base = params->db_table;
-success:
-	free(params);
-	return 0;
-release_table:
-	db_table_destroy(params->db_table);
-release_slurm:
-	db_slurm_destroy(params->db_slurm);
-	free(params);
-	return error;
+	return db_slurm_foreach_assertion_bgpsec(slurm,
+	    slurm_bgpsec_assertions_add, table);
 }
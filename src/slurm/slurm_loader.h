@@ -1,22 +1,47 @@
 #ifndef SRC_SLURM_SLURM_LOADER_H_
 #define SRC_SLURM_SLURM_LOADER_H_
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "rtr/db/db_table.h"
 #include "slurm/db_slurm.h"
 
 /*
- * Load the SLURM file/dir and try to apply it on @db_table, point to the SLURM
- * applied at @db_slurm.
- *
- * Return error only when there's a major issue on the process (no memory,
- * SLURM loaded but something happened applying it).
+ * SLURM (RFC 8416) is applied while the TAL tables are merged into the base:
+ * the filtered VRPs and router keys are never copied, and the assertions are
+ * added afterwards. The TAL tables themselves are left untouched, so they're
+ * still there (unfiltered) for the next merge.
+ */
+
+/* Only these files are loaded out of the SLURM directory */
+#define SLURM_FILE_EXTENSION	".slurm"
+
+/* The last valid SLURM, and the version of the files it was loaded from. */
+struct slurm_cache {
+	/* NULL if there's none (or the files were empty) */
+	struct db_slurm *db;
+	/* Of the files last seen; see slurm_update() */
+	uint64_t fingerprint;
+	bool fingerprint_set;
+};
+
+void slurm_cache_init(struct slurm_cache *);
+void slurm_cache_cleanup(struct slurm_cache *);
+
+/*
+ * Load the SLURM file/dir into @cache, unless it hasn't changed since the last
+ * call. (Files are compared by identity, size and modification time.)
+ * @changed tells whether @cache->db was replaced.
  *
- * Return 0 when there's no problem applying the SLURM:
- * - There's no SLURM configured
- * - The SLURM was successfully applied
- * - The @last_slurm was applied due to a syntax problem with a newer SLURM
- * - SLURM configured but couldn't be read (file doesn't exists, no permission)
+ * If the SLURM can't be loaded (syntax problem, file doesn't exist, no
+ * permission), the last valid one is kept, and 0 is returned; the validation
+ * continues with it (if any). It won't be attempted again until the files
+ * change. Same if there's no SLURM configured.
  */
-int slurm_apply(struct db_table **, struct db_slurm **);
+int slurm_update(struct slurm_cache *, bool *);
+
+/* Adds the entries of the second table, except the filtered ones, to the first */
+int slurm_merge(struct db_table *, struct db_table *, struct db_slurm *);
+int slurm_add_assertions(struct db_table *, struct db_slurm *);
 
 #endif /* SRC_SLURM_SLURM_LOADER_H_ */
@@ -5,7 +5,6 @@
 #include "slurm/db_slurm.h"
 
 struct slurm_parser_params {
-	struct db_table *db_table;
 	struct db_slurm *db_slurm;
 	unsigned int 	cur_ctx; /* Context (file number) */
 };
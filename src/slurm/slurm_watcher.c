@@ -0,0 +1,172 @@
+#include "slurm/slurm_watcher.h"
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "configure_ac.h"
+#include "config.h"
+#include "log.h"
+#include "slurm/slurm_loader.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+
+/* Files replaced in place, and files moved in or out of the directory */
+#define WATCHED_EVENTS \
+	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB)
+
+static int fd = -1;
+/* If the SLURM is a single file, its name. Otherwise, NULL. */
+static char *file_name;
+
+int
+slurm_watcher_init(void)
+{
+	char const *slurm;
+	char *tmp;
+	char *dir;
+	struct stat attr;
+	int error;
+
+	slurm = config_get_slurm();
+	if (slurm == NULL)
+		return 0;
+
+	if (stat(slurm, &attr) != 0)
+		return -pr_errno(errno, "Could not stat the SLURM '%s'", slurm);
+
+	/* Files are often replaced rather than written; watch the directory */
+	tmp = strdup(slurm);
+	if (tmp == NULL)
+		return pr_enomem();
+	if (S_ISDIR(attr.st_mode)) {
+		dir = tmp;
+	} else {
+		file_name = strdup(basename(tmp));
+		strcpy(tmp, slurm);
+		dir = dirname(tmp);
+		if (file_name == NULL) {
+			free(tmp);
+			return pr_enomem();
+		}
+	}
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1) {
+		error = -pr_errno(errno, "Could not initialize inotify");
+		goto fail;
+	}
+
+	if (inotify_add_watch(fd, dir, WATCHED_EVENTS) == -1) {
+		error = -pr_errno(errno, "Could not watch '%s'", dir);
+		close(fd);
+		fd = -1;
+		goto fail;
+	}
+
+	pr_debug("Watching '%s' for SLURM changes.", dir);
+	free(tmp);
+	return 0;
+
+fail:
+	free(tmp);
+	free(file_name);
+	file_name = NULL;
+	return error;
+}
+
+void
+slurm_watcher_destroy(void)
+{
+	if (fd != -1)
+		close(fd);
+	fd = -1;
+	free(file_name);
+	file_name = NULL;
+}
+
+/* File descriptor that becomes readable (POLLIN) when there are changes */
+int
+slurm_watcher_fd(void)
+{
+	return fd;
+}
+
+static bool
+is_slurm(char const *name)
+{
+	size_t len, ext_len;
+
+	if (file_name != NULL)
+		return strcmp(name, file_name) == 0;
+
+	len = strlen(name);
+	ext_len = strlen(SLURM_FILE_EXTENSION);
+	return len > ext_len &&
+	    strcmp(name + len - ext_len, SLURM_FILE_EXTENSION) == 0;
+}
+
+/*
+ * Consumes the pending events. Returns true if any of them involved a SLURM
+ * file.
+ */
+bool
+slurm_watcher_read(void)
+{
+	char buffer[4096]
+	    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event const *event;
+	ssize_t len;
+	char *cursor;
+	bool changed;
+
+	changed = false;
+	do {
+		len = read(fd, buffer, sizeof(buffer));
+		if (len <= 0)
+			break; /* EAGAIN, most likely; nothing left */
+
+		for (cursor = buffer; cursor < buffer + len;
+		    cursor += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event const *) cursor;
+			/* Queue overflow; anything could have changed */
+			if ((event->mask & IN_Q_OVERFLOW) ||
+			    (event->len > 0 && is_slurm(event->name)))
+				changed = true;
+		}
+	} while (true);
+
+	return changed;
+}
+
+#else /* HAVE_SYS_INOTIFY_H */
+
+int
+slurm_watcher_init(void)
+{
+	return 0;
+}
+
+void
+slurm_watcher_destroy(void)
+{
+	/* Nothing to do */
+}
+
+int
+slurm_watcher_fd(void)
+{
+	return -1;
+}
+
+bool
+slurm_watcher_read(void)
+{
+	return false;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
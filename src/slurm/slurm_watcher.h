@@ -0,0 +1,24 @@
+#ifndef SRC_SLURM_SLURM_WATCHER_H_
+#define SRC_SLURM_SLURM_WATCHER_H_
+
+#include <stdbool.h>
+
+/*
+ * Notices changes to the SLURM files (see "slurm") as soon as they happen, so
+ * they can be applied without waiting for the next validation cycle.
+ *
+ * The directory that holds them is watched through inotify. Where inotify
+ * isn't available, slurm_watcher_fd() returns -1, and the changes are only
+ * noticed by the change checks and the validation cycles.
+ *
+ * Either way, the files are compared before they're parsed again (see
+ * slurm_update()), so a false positive is cheap.
+ */
+
+int slurm_watcher_init(void);
+void slurm_watcher_destroy(void);
+
+int slurm_watcher_fd(void);
+bool slurm_watcher_read(void);
+
+#endif /* SRC_SLURM_SLURM_WATCHER_H_ */
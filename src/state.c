@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include "rrdp/db/db_rrdp.h"
+#include "changeset.h"
 #include "log.h"
 #include "thread_var.h"
 
@@ -23,14 +24,26 @@ struct validation {
 
 	struct cert_stack *certstack;
 
-	struct uri_list *rsync_visited_uris;
-
 	/* Shallow copy of RRDP URIs and its corresponding visited uris */
 	struct db_rrdp_uri *rrdp_uris;
 
 	/* Did the TAL's public key match the root certificate's public key? */
 	enum pubkey_state pubkey_state;
 
+	/*
+	 * Earliest moment a failed fetch can be retried (0 if none failed
+	 * since the last validation_pop_retry()).
+	 */
+	time_t retry_at;
+
+	/*
+	 * Changeset version sampled before the validation read any file.
+	 * (See changeset.h.)
+	 */
+	unsigned long changeset_version;
+	/* Collects the output of the RPP being validated, if not NULL */
+	struct rpp_output *rpp_output;
+
 	/**
 	 * Two buffers calling code will store stringified IP addresses in,
 	 * to prevent proliferation of similar buffers on the stack.
@@ -122,23 +135,20 @@ validation_prepare(struct validation **out, struct tal *tal,
 	if (error)
 		goto abort3;
 
-	error = rsync_create(&result->rsync_visited_uris);
-	if (error)
-		goto abort4;
-
 	uris_table = db_rrdp_get_uris(tal_get_file_name(tal));
 	if (uris_table == NULL)
 		pr_crit("db_rrdp_get_uris() returned NULL, means it hasn't been initialized");
 	result->rrdp_uris = uris_table;
 
 	result->pubkey_state = PKS_UNTESTED;
+	result->retry_at = 0;
+	result->changeset_version = changeset_get_version();
+	result->rpp_output = NULL;
 	result->validation_handler = *validation_handler;
 	result->x509_data.params = params; /* Ownership transfered */
 
 	*out = result;
 	return 0;
-abort4:
-	certstack_destroy(result->certstack);
 abort3:
 	X509_VERIFY_PARAM_free(params);
 abort2:
@@ -154,7 +164,6 @@ validation_destroy(struct validation *state)
 	X509_VERIFY_PARAM_free(state->x509_data.params);
 	X509_STORE_free(state->x509_data.store);
 	certstack_destroy(state->certstack);
-	rsync_destroy(state->rsync_visited_uris);
 	free(state);
 }
 
@@ -176,12 +185,6 @@ validation_certstack(struct validation *state)
 	return state->certstack;
 }
 
-struct uri_list *
-validation_rsync_visited_uris(struct validation *state)
-{
-	return state->rsync_visited_uris;
-}
-
 void
 validation_pubkey_valid(struct validation *state)
 {
@@ -200,6 +203,31 @@ validation_pubkey_state(struct validation *state)
 	return state->pubkey_state;
 }
 
+/*
+ * A repository couldn't be fetched, but can be retried at @retry_at. Whatever
+ * needed it should be postponed.
+ */
+void
+validation_schedule_retry(struct validation *state, time_t retry_at)
+{
+	if (state->retry_at == 0 || retry_at < state->retry_at)
+		state->retry_at = retry_at;
+}
+
+/*
+ * Returns (and forgets) the moment the fetches that failed since the last call
+ * can be retried. Returns 0 if there's nothing to retry.
+ */
+time_t
+validation_pop_retry(struct validation *state)
+{
+	time_t result;
+
+	result = state->retry_at;
+	state->retry_at = 0;
+	return result;
+}
+
 char *
 validation_get_ip_buffer1(struct validation *state)
 {
@@ -223,3 +251,21 @@ validation_get_rrdp_uris(struct validation *state)
 {
 	return state->rrdp_uris;
 }
+
+unsigned long
+validation_changeset_version(struct validation *state)
+{
+	return state->changeset_version;
+}
+
+void
+validation_set_rpp_output(struct validation *state, struct rpp_output *output)
+{
+	state->rpp_output = output;
+}
+
+struct rpp_output *
+validation_get_rpp_output(struct validation *state)
+{
+	return state->rpp_output;
+}
@@ -1,8 +1,10 @@
 #ifndef SRC_STATE_H_
 #define SRC_STATE_H_
 
+#include <time.h>
 #include <openssl/x509.h>
 #include "cert_stack.h"
+#include "rpp_cache.h"
 #include "validation_handler.h"
 #include "object/tal.h"
 #include "rsync/rsync.h"
@@ -17,7 +19,6 @@ void validation_destroy(struct validation *);
 struct tal *validation_tal(struct validation *);
 X509_STORE *validation_store(struct validation *);
 struct cert_stack *validation_certstack(struct validation *);
-struct uri_list *validation_rsync_visited_uris(struct validation *);
 
 enum pubkey_state {
 	PKS_VALID,
@@ -29,6 +30,9 @@ void validation_pubkey_valid(struct validation *);
 void validation_pubkey_invalid(struct validation *);
 enum pubkey_state validation_pubkey_state(struct validation *);
 
+void validation_schedule_retry(struct validation *, time_t);
+time_t validation_pop_retry(struct validation *);
+
 char *validation_get_ip_buffer1(struct validation *);
 char *validation_get_ip_buffer2(struct validation *);
 
@@ -37,4 +41,8 @@ validation_get_validation_handler(struct validation *);
 
 struct db_rrdp_uri *validation_get_rrdp_uris(struct validation *);
 
+unsigned long validation_changeset_version(struct validation *);
+void validation_set_rpp_output(struct validation *, struct rpp_output *);
+struct rpp_output *validation_get_rpp_output(struct validation *);
+
 #endif /* SRC_STATE_H_ */
@@ -1,26 +1,142 @@
 #include "updates_daemon.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "config.h"
 #include "log.h"
 #include "notify.h"
+#include "repo_watcher.h"
 #include "object/tal.h"
 #include "rtr/db/vrps.h"
+#include "slurm/slurm_watcher.h"
 
 static pthread_t thread;
 
+static void
+notify_postponed(void)
+{
+	int error;
+
+	error = notify_clients();
+	if (error)
+		pr_debug("Could not notify clients of the new VRPs. (Error code %d.)",
+		    error);
+}
+
+static void
+update_slurm(void)
+{
+	int error;
+
+	error = vrps_update_slurm();
+	if (error)
+		pr_warn("Could not apply the SLURM changes. (Error code %d.)",
+		    error);
+}
+
+/*
+ * Sleeps @seconds, or until the SLURM watcher reports a change. Returns true
+ * in the latter case.
+ */
+static bool
+sleep_or_watch(unsigned int seconds)
+{
+	struct pollfd pfd;
+
+	pfd.fd = slurm_watcher_fd();
+	if (pfd.fd == -1) {
+		sleep(seconds);
+		return false;
+	}
+
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, seconds * 1000) <= 0)
+		return false; /* Timeout or signal; the caller looks at the clock */
+
+	return slurm_watcher_read();
+}
+
+/*
+ * Sleeps until the next full validation cycle is due (at @end), unless the
+ * change checks (see repo_watcher.h) find something first. In that case, @tals
+ * receives the TALs that need to be validated again.
+ *
+ * Meanwhile, sends the Serial Notify the rate limit held back, if any, and
+ * applies the SLURM as soon as it changes.
+ */
+static void
+wait_interval(time_t end, struct string_array *tals)
+{
+	unsigned int check_interval;
+	time_t now, wake, notify_at, check_at;
+	int error;
+
+	now = time(NULL);
+	check_interval = config_get_interval_change_check();
+	check_at = (check_interval != 0) ? (now + check_interval) : 0;
+
+	for (; now < end; now = time(NULL)) {
+		wake = end;
+		notify_at = notify_postponed_at();
+		if (notify_at != 0 && notify_at < wake)
+			wake = notify_at;
+		if (check_at != 0 && check_at < wake)
+			wake = check_at;
+
+		if (wake > now && sleep_or_watch(wake - now))
+			update_slurm();
+		now = time(NULL);
+
+		if (notify_at != 0 && now >= notify_at)
+			notify_postponed();
+
+		if (check_at != 0 && now >= check_at) {
+			/* Without inotify, this is when SLURM changes are seen */
+			if (slurm_watcher_fd() == -1)
+				update_slurm();
+			error = repo_watcher_poll(tals);
+			if (!error && tals->length > 0)
+				return;
+			string_array_cleanup(tals);
+			tals->array = NULL;
+			tals->length = 0;
+			check_at = time(NULL) + check_interval;
+		}
+	}
+}
+
 static void *
 check_vrps_updates(void *param_void)
 {
+	struct string_array tals;
+	time_t deadline;
+	bool full;
 	bool changed;
 	int error;
 
+	tals.array = NULL;
+	tals.length = 0;
+
+	/* Not fatal; the SLURM is also reloaded before every validation */
+	if (slurm_watcher_init() != 0)
+		pr_warn("SLURM changes will not be applied until the next validation cycle.");
+
+	deadline = 0;
+
 	do {
-		error = vrps_update(&changed);
+		/* Everything, unless the change checks found something */
+		full = (tals.length == 0);
+		error = vrps_update(full ? NULL : &tals, &changed);
+		string_array_cleanup(&tals);
+		tals.array = NULL;
+		tals.length = 0;
+
 		if (error == -EINTR)
 			break; /* Process interrupted, terminate thread */
 
@@ -30,19 +146,21 @@ check_vrps_updates(void *param_void)
 			goto sleep;
 		}
 
-		if (changed) {
-			error = notify_clients();
-			if (error)
-				pr_debug("Could not notify clients of the new VRPs. (Error code %d.) Sleeping...",
-				    error);
-			else
-				pr_debug("Database updated successfully. Sleeping...");
-		}
+		/* Clients were notified as each TAL was published */
+		if (changed)
+			pr_debug("Database updated successfully. Sleeping...");
 
 sleep:
-		sleep(config_get_validation_interval());
+		/*
+		 * The partial cycles don't postpone the next full one; otherwise,
+		 * frequent changes could put it off forever.
+		 */
+		if (full)
+			deadline = time(NULL) + config_get_validation_interval();
+		wait_interval(deadline, &tals);
 	} while (true);
 
+	slurm_watcher_destroy();
 	return NULL;
 }
 
@@ -62,3 +180,10 @@ updates_daemon_destroy(void)
 {
 	close_thread(thread, "Validation");
 }
+
+/* Same as the daemon, but in the current thread. Returns on interruption. */
+void
+updates_daemon_run(void)
+{
+	check_vrps_updates(NULL);
+}
@@ -3,5 +3,6 @@
 
 int updates_daemon_start(void);
 void updates_daemon_destroy(void);
+void updates_daemon_run(void);
 
 #endif /* SRC_UPDATES_DAEMON_H_ */
@@ -280,6 +280,15 @@ g2l(char const *global, size_t global_len, uint8_t flags, char **result,
 
 	global += prefix_len;
 	global_len -= prefix_len;
+
+	/*
+	 * Host names never start with a dot, and the local repository uses
+	 * such names for its own purposes (see object_store.h).
+	 */
+	if (global_len > 0 && global[0] == '.')
+		return pr_err("URI '%.*s' has an invalid host name.",
+		    (int) (prefix_len + global_len), global - prefix_len);
+
 	extra_slash = (repository[repository_len - 1] == '/') ? 0 : 1;
 
 	local = malloc(repository_len + extra_slash + global_len + 1);
@@ -478,6 +487,20 @@ uri_get_global_len(struct rpki_uri *uri)
 	return uri->global_len;
 }
 
+/* Length of the "<scheme>://<host>" prefix of @uri's global URI */
+size_t
+uri_get_host_len(struct rpki_uri *uri)
+{
+	char const *host;
+	char const *slash;
+
+	host = strstr(uri->global, "://");
+	host = (host != NULL) ? (host + 3) : uri->global;
+	slash = memchr(host, '/', uri->global_len - (host - uri->global));
+
+	return (slash != NULL) ? (slash - uri->global) : uri->global_len;
+}
+
 bool
 uri_equals(struct rpki_uri *u1, struct rpki_uri *u2)
 {
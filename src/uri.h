@@ -27,6 +27,7 @@ void uri_refput(struct rpki_uri *);
 char const *uri_get_global(struct rpki_uri *);
 char const *uri_get_local(struct rpki_uri *);
 size_t uri_get_global_len(struct rpki_uri *);
+size_t uri_get_host_len(struct rpki_uri *);
 
 bool uri_equals(struct rpki_uri *, struct rpki_uri *);
 bool uri_has_extension(struct rpki_uri *, char const *);
@@ -5,7 +5,8 @@
 #include "thread_var.h"
 
 static int
-get_current_threads_handler(struct validation_handler const **result)
+get_current_threads_handler(struct validation **state_result,
+    struct validation_handler const **result)
 {
 	struct validation *state;
 	struct validation_handler const *handler;
@@ -17,6 +18,7 @@ get_current_threads_handler(struct validation_handler const **result)
 	if (handler == NULL)
 		pr_crit("This thread lacks a validation handler.");
 
+	*state_result = state;
 	*result = handler;
 	return 0;
 }
@@ -25,15 +27,26 @@ int
 vhandler_handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length)
 {
+	struct validation *state;
 	struct validation_handler const *handler;
+	struct rpp_output *output;
 	int error;
 
-	error = get_current_threads_handler(&handler);
+	error = get_current_threads_handler(&state, &handler);
 	if (error)
 		return error;
 
-	return (handler->handle_roa_v4 != NULL)
-	    ? handler->handle_roa_v4(as, prefix, max_length, handler->arg)
+	if (handler->handle_roa_v4 != NULL) {
+		error = handler->handle_roa_v4(as, prefix, max_length,
+		    handler->arg);
+		if (error)
+			return error;
+	}
+
+	/* The RPP's result is being recorded (see rpp_cache.h) */
+	output = validation_get_rpp_output(state);
+	return (output != NULL)
+	    ? rpp_output_add_v4(output, as, prefix, max_length)
 	    : 0;
 }
 
@@ -41,15 +54,26 @@ int
 vhandler_handle_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
     uint8_t max_length)
 {
+	struct validation *state;
 	struct validation_handler const *handler;
+	struct rpp_output *output;
 	int error;
 
-	error = get_current_threads_handler(&handler);
+	error = get_current_threads_handler(&state, &handler);
 	if (error)
 		return error;
 
-	return (handler->handle_roa_v6 != NULL)
-	    ? handler->handle_roa_v6(as, prefix, max_length, handler->arg)
+	if (handler->handle_roa_v6 != NULL) {
+		error = handler->handle_roa_v6(as, prefix, max_length,
+		    handler->arg);
+		if (error)
+			return error;
+	}
+
+	/* The RPP's result is being recorded (see rpp_cache.h) */
+	output = validation_get_rpp_output(state);
+	return (output != NULL)
+	    ? rpp_output_add_v6(output, as, prefix, max_length)
 	    : 0;
 }
 
@@ -57,10 +81,11 @@ int
 vhandler_handle_router_key(unsigned char const *ski, uint32_t as,
     unsigned char const *spk)
 {
+	struct validation *state;
 	struct validation_handler const *handler;
 	int error;
 
-	error = get_current_threads_handler(&handler);
+	error = get_current_threads_handler(&state, &handler);
 	if (error)
 		return error;
 
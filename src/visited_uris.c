@@ -3,6 +3,7 @@
 #include <sys/queue.h>
 #include <stddef.h>
 #include <string.h>
+#include "changeset.h"
 #include "log.h"
 #include "delete_dir_daemon.h"
 #include "data_structure/array_list.h"
@@ -135,6 +136,28 @@ visited_uris_remove(struct visited_uris *uris, char const *uri)
 	return 0;
 }
 
+bool
+visited_uris_contains(struct visited_uris *uris, char const *uri)
+{
+	return elem_find(uris, uri) != NULL;
+}
+
+int
+visited_uris_foreach(struct visited_uris *uris, visited_uris_foreach_cb cb,
+    void *arg)
+{
+	struct visited_elem *elem;
+	int error;
+
+	for (elem = uris->table; elem != NULL; elem = elem->hh.next) {
+		error = cb(elem->uri, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 static int
 visited_uris_to_arr(struct visited_uris *uris, struct uris_roots *roots)
 {
@@ -166,6 +189,8 @@ int
 visited_uris_delete_local(struct visited_uris *uris)
 {
 	struct uris_roots roots;
+	char **root;
+	array_index i;
 	int error;
 
 	uris_roots_init(&roots);
@@ -177,6 +202,12 @@ visited_uris_delete_local(struct visited_uris *uris)
 	if (roots.len == 0)
 		goto success;
 
+	ARRAYLIST_FOREACH(&roots, root, i) {
+		error = changeset_add_dir(*root, strlen(*root));
+		if (error)
+			goto err;
+	}
+
 	error = delete_dir_daemon_start(roots.array, roots.len);
 	if (error)
 		goto err;
@@ -11,6 +11,12 @@ void visited_uris_refget(struct visited_uris *);
 
 int visited_uris_add(struct visited_uris *, char const *);
 int visited_uris_remove(struct visited_uris *, char const *);
+bool visited_uris_contains(struct visited_uris *, char const *);
+
+typedef int (*visited_uris_foreach_cb)(char const *, void *);
+int visited_uris_foreach(struct visited_uris *, visited_uris_foreach_cb,
+    void *);
+
 int visited_uris_delete_local(struct visited_uris *);
 
 #endif /* SRC_VISITED_URIS_H_ */
@@ -0,0 +1,424 @@
+#include "rrdp_structure.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+#define RRDP_NAMESPACE "http://www.ripe.net/rpki/rrdp"
+
+/* Validates the value of an attribute. Returns true if it's valid. */
+typedef bool (*attr_check)(char const *);
+
+struct attr_rule {
+	char const *name;
+	bool required;
+	attr_check check;
+};
+
+/* Whitespace as defined by the XML spec */
+static bool
+is_xml_space(int chara)
+{
+	return chara == ' ' || chara == '\t' || chara == '\n' || chara == '\r';
+}
+
+/* xsd:positiveInteger, after whitespace collapsing */
+static bool
+check_positive_integer(char const *value)
+{
+	bool non_zero;
+
+	while (is_xml_space(*value))
+		value++;
+	if (*value == '+')
+		value++;
+	if (!isdigit((unsigned char) *value))
+		return false;
+
+	non_zero = false;
+	for (; isdigit((unsigned char) *value); value++)
+		if (*value != '0')
+			non_zero = true;
+
+	while (is_xml_space(*value))
+		value++;
+	return non_zero && *value == '\0';
+}
+
+/* "version" must be a positiveInteger, and its maxInclusive is 1 */
+static bool
+check_version(char const *value)
+{
+	if (!check_positive_integer(value))
+		return false;
+
+	while (is_xml_space(*value))
+		value++;
+	if (*value == '+')
+		value++;
+	while (*value == '0')
+		value++;
+
+	return value[0] == '1' && (value[1] == '\0' || is_xml_space(value[1]));
+}
+
+/* Pattern "[\-0-9a-fA-F]+" */
+static bool
+check_uuid(char const *value)
+{
+	if (*value == '\0')
+		return false;
+	for (; *value != '\0'; value++)
+		if (!isxdigit((unsigned char) *value) && *value != '-')
+			return false;
+	return true;
+}
+
+/* Pattern "[0-9a-fA-F]+" */
+static bool
+check_hash(char const *value)
+{
+	if (*value == '\0')
+		return false;
+	for (; *value != '\0'; value++)
+		if (!isxdigit((unsigned char) *value))
+			return false;
+	return true;
+}
+
+static const struct attr_rule root_attrs[] = {
+	{ "version", true, check_version },
+	{ "session_id", true, check_uuid },
+	{ "serial", true, check_positive_integer },
+	{ NULL },
+};
+
+static const struct attr_rule notification_snapshot_attrs[] = {
+	{ "uri", true, NULL },
+	{ "hash", true, check_hash },
+	{ NULL },
+};
+
+static const struct attr_rule notification_delta_attrs[] = {
+	{ "serial", true, check_positive_integer },
+	{ "uri", true, NULL },
+	{ "hash", true, check_hash },
+	{ NULL },
+};
+
+static const struct attr_rule snapshot_publish_attrs[] = {
+	{ "uri", true, NULL },
+	{ NULL },
+};
+
+static const struct attr_rule delta_publish_attrs[] = {
+	{ "uri", true, NULL },
+	{ "hash", false, check_hash },
+	{ NULL },
+};
+
+static const struct attr_rule withdraw_attrs[] = {
+	{ "uri", true, NULL },
+	{ "hash", true, check_hash },
+	{ NULL },
+};
+
+void
+rrdp_structure_init(struct rrdp_structure *rs)
+{
+	rs->state = RS_ROOT;
+	rs->parent = RS_END;
+	rs->b64_chars = 0;
+	rs->b64_padding = 0;
+}
+
+static int
+validate_attrs(xmlTextReaderPtr reader, char const *element,
+    struct attr_rule const *rules)
+{
+	struct attr_rule const *rule;
+	xmlChar const *name;
+	xmlChar const *value;
+	unsigned int found; /* Bit per rule */
+	unsigned int i;
+	int read;
+
+	found = 0;
+	for (read = xmlTextReaderMoveToFirstAttribute(reader);
+	    read == 1;
+	    read = xmlTextReaderMoveToNextAttribute(reader)) {
+		if (xmlTextReaderIsNamespaceDecl(reader) == 1)
+			continue;
+
+		name = xmlTextReaderConstLocalName(reader);
+		if (xmlTextReaderConstNamespaceUri(reader) != NULL)
+			goto unexpected;
+
+		for (rule = rules, i = 0; rule->name != NULL; rule++, i++)
+			if (xmlStrEqual(name, BAD_CAST rule->name))
+				break;
+		if (rule->name == NULL)
+			goto unexpected;
+
+		value = xmlTextReaderConstValue(reader);
+		if (value == NULL)
+			value = BAD_CAST "";
+		if (rule->check != NULL && !rule->check((char const *) value)) {
+			xmlTextReaderMoveToElement(reader);
+			return pr_err("RRDP file: Invalid '%s' attribute value at <%s>: '%s'",
+			    rule->name, element, value);
+		}
+
+		found |= (1u << i);
+	}
+	xmlTextReaderMoveToElement(reader);
+
+	if (read < 0)
+		return pr_err("RRDP file: Couldn't read the attributes of <%s>",
+		    element);
+
+	for (rule = rules, i = 0; rule->name != NULL; rule++, i++)
+		if (rule->required && !(found & (1u << i)))
+			return pr_err("RRDP file: <%s> lacks the '%s' attribute",
+			    element, rule->name);
+
+	return 0;
+
+unexpected:
+	xmlTextReaderMoveToElement(reader);
+	return pr_err("RRDP file: Unexpected attribute '%s' at <%s>", name,
+	    element);
+}
+
+static int
+close_element(struct rrdp_structure *rs)
+{
+	switch (rs->state) {
+	case RS_PUBLISH:
+		/* xsd:base64Binary; padding is already known to be at the end */
+		if ((rs->b64_chars + rs->b64_padding) % 4 != 0)
+			return pr_err("RRDP file: <publish> content isn't valid base64 (bad length or padding)");
+		rs->state = rs->parent;
+		return 0;
+	case RS_EMPTY:
+		rs->state = rs->parent;
+		return 0;
+	case RS_NOTIFICATION:
+		return pr_err("RRDP file: <notification> lacks its <snapshot> element");
+	case RS_DELTA:
+		return pr_err("RRDP file: <delta> must contain at least one <publish> or <withdraw> element");
+	case RS_NOTIFICATION_DELTAS:
+	case RS_SNAPSHOT:
+	case RS_DELTA_ELEMENTS:
+		rs->state = RS_END;
+		return 0;
+	case RS_ROOT:
+	case RS_END:
+		break;
+	}
+
+	return pr_err("RRDP file: Unexpected end of element");
+}
+
+static int
+open_child(struct rrdp_structure *rs, xmlTextReaderPtr reader,
+    char const *element, struct attr_rule const *rules,
+    enum rrdp_structure_state child, enum rrdp_structure_state parent)
+{
+	int error;
+
+	error = validate_attrs(reader, element, rules);
+	if (error)
+		return error;
+
+	rs->parent = parent;
+	rs->state = child;
+	rs->b64_chars = 0;
+	rs->b64_padding = 0;
+	return 0;
+}
+
+static int
+open_element(struct rrdp_structure *rs, xmlTextReaderPtr reader)
+{
+	xmlChar const *name;
+	int error;
+
+	name = xmlTextReaderConstLocalName(reader);
+	if (!xmlStrEqual(xmlTextReaderConstNamespaceUri(reader),
+	    BAD_CAST RRDP_NAMESPACE))
+		return pr_err("RRDP file: Element <%s> isn't at namespace '%s'",
+		    name, RRDP_NAMESPACE);
+
+	switch (rs->state) {
+	case RS_ROOT:
+		if (xmlStrEqual(name, BAD_CAST "notification"))
+			rs->state = RS_NOTIFICATION;
+		else if (xmlStrEqual(name, BAD_CAST "snapshot"))
+			rs->state = RS_SNAPSHOT;
+		else if (xmlStrEqual(name, BAD_CAST "delta"))
+			rs->state = RS_DELTA;
+		else
+			break;
+		error = validate_attrs(reader, (char const *) name, root_attrs);
+		goto end;
+	case RS_NOTIFICATION:
+		if (!xmlStrEqual(name, BAD_CAST "snapshot"))
+			break;
+		error = open_child(rs, reader, "snapshot",
+		    notification_snapshot_attrs, RS_EMPTY,
+		    RS_NOTIFICATION_DELTAS);
+		goto end;
+	case RS_NOTIFICATION_DELTAS:
+		if (!xmlStrEqual(name, BAD_CAST "delta"))
+			break;
+		error = open_child(rs, reader, "delta",
+		    notification_delta_attrs, RS_EMPTY,
+		    RS_NOTIFICATION_DELTAS);
+		goto end;
+	case RS_SNAPSHOT:
+		if (!xmlStrEqual(name, BAD_CAST "publish"))
+			break;
+		error = open_child(rs, reader, "publish",
+		    snapshot_publish_attrs, RS_PUBLISH, RS_SNAPSHOT);
+		goto end;
+	case RS_DELTA:
+	case RS_DELTA_ELEMENTS:
+		if (xmlStrEqual(name, BAD_CAST "publish"))
+			error = open_child(rs, reader, "publish",
+			    delta_publish_attrs, RS_PUBLISH,
+			    RS_DELTA_ELEMENTS);
+		else if (xmlStrEqual(name, BAD_CAST "withdraw"))
+			error = open_child(rs, reader, "withdraw",
+			    withdraw_attrs, RS_EMPTY, RS_DELTA_ELEMENTS);
+		else
+			break;
+		goto end;
+	case RS_PUBLISH:
+	case RS_EMPTY:
+	case RS_END:
+		break;
+	}
+
+	return pr_err("RRDP file: Unexpected '%s' element", name);
+
+end:
+	if (error)
+		return error;
+
+	/* Empty elements don't get an XML_READER_TYPE_END_ELEMENT */
+	return (xmlTextReaderIsEmptyElement(reader) == 1)
+	    ? close_element(rs)
+	    : 0;
+}
+
+static int
+validate_text(struct rrdp_structure *rs, xmlTextReaderPtr reader)
+{
+	xmlChar const *text;
+
+	text = xmlTextReaderConstValue(reader);
+	if (text == NULL)
+		return 0;
+
+	if (rs->state != RS_PUBLISH) {
+		for (; *text != '\0'; text++)
+			if (!is_xml_space(*text))
+				return pr_err("RRDP file: Unexpected text content");
+		return 0;
+	}
+
+	for (; *text != '\0'; text++) {
+		if (is_xml_space(*text))
+			continue;
+		if (*text == '=') {
+			if (++rs->b64_padding > 2)
+				goto invalid;
+			continue;
+		}
+		if (rs->b64_padding > 0)
+			goto invalid;
+		if (!isalnum(*text) && *text != '+' && *text != '/')
+			goto invalid;
+		rs->b64_chars++;
+	}
+
+	return 0;
+invalid:
+	return pr_err("RRDP file: <publish> content isn't valid base64");
+}
+
+/*
+ * Validates the node @reader is currently positioned at. Has to be called on
+ * every node of the document, in order.
+ */
+int
+rrdp_structure_validate(struct rrdp_structure *rs, xmlTextReaderPtr reader)
+{
+	switch (xmlTextReaderNodeType(reader)) {
+	case XML_READER_TYPE_ELEMENT:
+		return open_element(rs, reader);
+	case XML_READER_TYPE_END_ELEMENT:
+		return close_element(rs);
+	case XML_READER_TYPE_TEXT:
+	case XML_READER_TYPE_CDATA:
+		return validate_text(rs, reader);
+	default:
+		/* Whitespace, comments, processing instructions, etc. */
+		return 0;
+	}
+}
+
+/* Call once the whole document has been read */
+int
+rrdp_structure_finish(struct rrdp_structure *rs)
+{
+	return (rs->state == RS_END)
+	    ? 0
+	    : pr_err("RRDP file: Unexpected end of document");
+}
+
+/*
+ * Same as relax_ng_parse(), except the document is validated with the
+ * structural validator instead of the Relax NG schema.
+ */
+int
+rrdp_structure_parse(const char *path, xml_read_cb cb, void *arg)
+{
+	struct rrdp_structure rs;
+	xmlTextReaderPtr reader;
+	int read;
+	int error;
+
+	reader = xmlNewTextReaderFilename(path);
+	if (reader == NULL)
+		return pr_err("Couldn't get XML '%s' file.", path);
+
+	rrdp_structure_init(&rs);
+
+	while ((read = xmlTextReaderRead(reader)) == 1) {
+		error = rrdp_structure_validate(&rs, reader);
+		if (error)
+			goto free_reader;
+		error = cb(reader, arg);
+		if (error)
+			goto free_reader;
+	}
+
+	if (read < 0) {
+		error = pr_err("Error parsing XML document.");
+		goto free_reader;
+	}
+
+	error = rrdp_structure_finish(&rs);
+	if (error)
+		goto free_reader;
+
+	xmlFreeTextReader(reader);
+	return 0;
+free_reader:
+	xmlFreeTextReader(reader);
+	return error;
+}
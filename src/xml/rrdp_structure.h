@@ -0,0 +1,57 @@
+#ifndef SRC_XML_RRDP_STRUCTURE_H_
+#define SRC_XML_RRDP_STRUCTURE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <libxml/xmlreader.h>
+
+#include "xml/relax_ng.h"
+
+/*
+ * Hand-written streaming validator of the RRDP v1 grammar (RFC 8182).
+ *
+ * It checks the same things as the Relax NG schema at relax_ng.h (element
+ * order, required and unknown attributes, hex and base64 charsets, serials and
+ * the version number), but it only looks at each node once and doesn't build
+ * any state besides a couple of counters, so it's considerably cheaper on huge
+ * snapshots.
+ */
+
+enum rrdp_structure_state {
+	/* Expecting the root element */
+	RS_ROOT,
+	/* Inside <notification>, expecting <snapshot> */
+	RS_NOTIFICATION,
+	/* Inside <notification>, after <snapshot>; expecting <delta>s */
+	RS_NOTIFICATION_DELTAS,
+	/* Inside <snapshot>, expecting <publish>s */
+	RS_SNAPSHOT,
+	/* Inside <delta>, expecting the first <publish> or <withdraw> */
+	RS_DELTA,
+	/* Inside <delta>, expecting more <publish>s or <withdraw>s */
+	RS_DELTA_ELEMENTS,
+	/* Inside <publish>, reading base64 content */
+	RS_PUBLISH,
+	/* Inside an element that must not have content */
+	RS_EMPTY,
+	/* Root element closed */
+	RS_END,
+};
+
+struct rrdp_structure {
+	enum rrdp_structure_state state;
+	/* State to return to once the current child element is closed */
+	enum rrdp_structure_state parent;
+	/* Base64 characters (not including padding) read at <publish> */
+	size_t b64_chars;
+	/* Base64 padding characters read at <publish> */
+	unsigned int b64_padding;
+};
+
+void rrdp_structure_init(struct rrdp_structure *);
+int rrdp_structure_validate(struct rrdp_structure *, xmlTextReaderPtr);
+int rrdp_structure_finish(struct rrdp_structure *);
+
+int rrdp_structure_parse(const char *, xml_read_cb cb, void *);
+
+#endif /* SRC_XML_RRDP_STRUCTURE_H_ */
@@ -0,0 +1,96 @@
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "impersonator.c"
+#include "log.c"
+#include "changeset.c"
+
+#define DIR_VERSION(dir) changeset_get_dir(dir, strlen(dir))
+
+START_TEST(changeset_test_files)
+{
+	unsigned long before;
+
+	ck_assert_int_eq(0, changeset_init());
+
+	ck_assert_uint_eq(0, DIR_VERSION("rsync://a.com/b"));
+	before = changeset_get_version();
+
+	ck_assert_int_eq(0, changeset_add_file("rsync://a.com/b/c.roa"));
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b"), before);
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b/"), before);
+	ck_assert_uint_eq(0, DIR_VERSION("rsync://a.com"));
+	ck_assert_uint_eq(0, DIR_VERSION("rsync://a.com/b/c"));
+	/* Only certificates are tracked individually */
+	ck_assert_uint_eq(0, changeset_get_file("rsync://a.com/b/c.roa"));
+
+	before = changeset_get_version();
+	ck_assert_int_eq(0, changeset_add_file("rsync://a.com/b/d.cer"));
+	ck_assert_uint_gt(changeset_get_file("rsync://a.com/b/d.cer"), before);
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b"), before);
+	ck_assert_uint_eq(0, changeset_get_file("rsync://a.com/b/e.cer"));
+
+	ck_assert_int_eq(0, changeset_add_dir("rsync://x.com/y/", 16));
+	ck_assert_uint_eq(changeset_get_version(), DIR_VERSION("rsync://x.com/y"));
+
+	changeset_destroy();
+}
+END_TEST
+
+START_TEST(changeset_test_trees)
+{
+	unsigned long before;
+
+	ck_assert_int_eq(0, changeset_init());
+
+	ck_assert_int_eq(0, changeset_add_file("rsync://a.com/b/c/d.roa"));
+	before = changeset_get_version();
+	ck_assert_int_eq(0, changeset_add_tree("rsync://a.com/b/", 16));
+
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b"), before);
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b/c"), before);
+	ck_assert_uint_gt(DIR_VERSION("rsync://a.com/b/x/y"), before);
+	ck_assert_uint_gt(changeset_get_file("rsync://a.com/b/c/e.cer"), before);
+	ck_assert_uint_eq(0, DIR_VERSION("rsync://a.com"));
+	ck_assert_uint_eq(0, DIR_VERSION("rsync://a.com/bc"));
+	ck_assert_uint_eq(0, changeset_get_file("rsync://a.com/bc/e.cer"));
+
+	changeset_destroy();
+}
+END_TEST
+
+Suite *changeset_load_suite(void)
+{
+	Suite *suite;
+	TCase *files, *trees;
+
+	files = tcase_create("files");
+	tcase_add_test(files, changeset_test_files);
+
+	trees = tcase_create("trees");
+	tcase_add_test(trees, changeset_test_trees);
+
+	suite = suite_create("changeset");
+	suite_add_tcase(suite, files);
+	suite_add_tcase(suite, trees);
+
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = changeset_load_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -58,10 +58,10 @@ START_TEST(basic_test)
 	 */
 
 	for (i = 0; i < 4; i++) {
-		ck_assert_int_eq(0, clients_add(1, addr, 10));
-		ck_assert_int_eq(0, clients_add(2, addr, 20));
-		ck_assert_int_eq(0, clients_add(3, addr, 30));
-		ck_assert_int_eq(0, clients_add(4, addr, 40));
+		ck_assert_int_eq(0, clients_add(1, addr, 10, -1));
+		ck_assert_int_eq(0, clients_add(2, addr, 20, -1));
+		ck_assert_int_eq(0, clients_add(3, addr, 30, -1));
+		ck_assert_int_eq(0, clients_add(4, addr, 40, -1));
 	}
 
 	clients_forget(3);
@@ -74,6 +74,57 @@ START_TEST(basic_test)
 }
 END_TEST
 
+START_TEST(serial_test)
+{
+	struct sockaddr_storage addr;
+	serial_t serial;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = AF_INET;
+
+	ck_assert_int_eq(0, clients_db_init());
+
+	/* No clients, or none of them have been served yet */
+	ck_assert_int_eq(-ENOENT, clients_get_min_serial(&serial));
+	ck_assert_int_eq(0, clients_add(1, addr, 10, -1));
+	ck_assert_int_eq(0, clients_add(2, addr, 20, -1));
+	ck_assert_int_eq(0, clients_add(3, addr, 30, -1));
+	ck_assert_int_eq(-ENOENT, clients_get_min_serial(&serial));
+
+	clients_update_serial(1, 5);
+	clients_update_serial(2, 3);
+	clients_update_serial(3, 5);
+	ck_assert_int_eq(0, clients_get_min_serial(&serial));
+	ck_assert_uint_eq(3, serial);
+	ck_assert_uint_eq(2, clients_count_serial(5));
+	ck_assert_uint_eq(1, clients_count_serial(3));
+	ck_assert_uint_eq(0, clients_count_serial(4));
+
+	/* The minimum moves on */
+	clients_update_serial(2, 6);
+	ck_assert_int_eq(0, clients_get_min_serial(&serial));
+	ck_assert_uint_eq(5, serial);
+	ck_assert_uint_eq(0, clients_count_serial(3));
+
+	/* Same serial again (keepalive) */
+	clients_update_serial(1, 5);
+	ck_assert_uint_eq(2, clients_count_serial(5));
+
+	/* Forgotten and replaced clients no longer count */
+	clients_forget(1);
+	ck_assert_uint_eq(1, clients_count_serial(5));
+	ck_assert_int_eq(0, clients_add(3, addr, 30, -1));
+	ck_assert_uint_eq(0, clients_count_serial(5));
+	ck_assert_int_eq(0, clients_get_min_serial(&serial));
+	ck_assert_uint_eq(6, serial);
+
+	clients_forget(2);
+	ck_assert_int_eq(-ENOENT, clients_get_min_serial(&serial));
+
+	clients_db_destroy(join_threads, NULL);
+}
+END_TEST
+
 Suite *clients_load_suite(void)
 {
 	Suite *suite;
@@ -81,6 +132,7 @@ Suite *clients_load_suite(void)
 
 	core = tcase_create("Core");
 	tcase_add_test(core, basic_test);
+	tcase_add_test(core, serial_test);
 
 	suite = suite_create("Clients suite");
 	suite_add_tcase(suite, core);
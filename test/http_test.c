@@ -9,6 +9,18 @@
 #include "uri.c"
 #include "http/http.c"
 
+void
+metrics_now(struct timespec *now)
+{
+	memset(now, 0, sizeof(*now));
+}
+
+void
+metrics_fetch(struct rpki_uri *uri, struct timespec const *start, bool error)
+{
+	/* Empty */
+}
+
 struct response {
 	unsigned char *content;
 	size_t size;
@@ -125,6 +125,48 @@ config_get_rsync_args(bool is_ta)
 	return &array;
 }
 
+unsigned int
+config_get_rsync_retry_count(void)
+{
+	return 0;
+}
+
+unsigned int
+config_get_rsync_retry_interval(void)
+{
+	return 0;
+}
+
+bool
+config_get_incremental_validation(void)
+{
+	return true;
+}
+
+char const *
+config_get_server_state_file(void)
+{
+	return NULL;
+}
+
+unsigned int
+config_get_server_frontends(void)
+{
+	return 0;
+}
+
+char const *
+config_get_server_metrics_address(void)
+{
+	return NULL;
+}
+
+char const *
+config_get_server_metrics_port(void)
+{
+	return NULL;
+}
+
 char const *
 config_get_slurm(void)
 {
@@ -149,6 +191,18 @@ config_get_output_bgpsec(void)
 	return NULL;
 }
 
+char const *
+config_get_output_json(void)
+{
+	return NULL;
+}
+
+char const *
+config_get_output_snapshot(void)
+{
+	return NULL;
+}
+
 uint8_t
 config_get_log_level(void)
 {
@@ -0,0 +1,195 @@
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "uri.c"
+#include "metrics.c"
+
+void
+vrps_get_stats(struct vrps_stats *result)
+{
+	memset(result, 0, sizeof(*result));
+	result->published = true;
+	result->serial = 7;
+	result->vrps = 3;
+}
+
+void
+vrps_foreach_tal_stats(vrps_tal_stats_cb cb, void *arg)
+{
+	cb("ta\"1", 2, 1, 100, arg);
+}
+
+static char *
+print_all(void)
+{
+	char *result;
+	size_t size;
+
+	ck_assert_int_eq(0, print_metrics(&result, &size));
+	ck_assert_uint_eq(strlen(result), size);
+	return result;
+}
+
+static void
+assert_contains(char const *haystack, char const *needle)
+{
+	if (strstr(haystack, needle) == NULL)
+		ck_abort_msg("'%s' not found in:\n%s", needle, haystack);
+}
+
+START_TEST(test_histogram)
+{
+	struct histogram histogram;
+	char *result;
+	size_t size;
+	FILE *out;
+
+	memset(&histogram, 0, sizeof(histogram));
+	observe(&histogram, &delta_buckets, 0);
+	observe(&histogram, &delta_buckets, 10);
+	observe(&histogram, &delta_buckets, 11);
+	observe(&histogram, &delta_buckets, 1000000);
+
+	out = open_memstream(&result, &size);
+	ck_assert_ptr_ne(NULL, out);
+	print_histogram(out, "x", "a=\"b\",", &histogram, &delta_buckets);
+	fclose(out);
+
+	/* Cumulative */
+	ck_assert_str_eq("x_bucket{a=\"b\",le=\"1\"} 1\n"
+	    "x_bucket{a=\"b\",le=\"10\"} 2\n"
+	    "x_bucket{a=\"b\",le=\"100\"} 3\n"
+	    "x_bucket{a=\"b\",le=\"1000\"} 3\n"
+	    "x_bucket{a=\"b\",le=\"10000\"} 3\n"
+	    "x_bucket{a=\"b\",le=\"100000\"} 3\n"
+	    "x_bucket{a=\"b\",le=\"+Inf\"} 4\n"
+	    "x_sum{a=\"b\"} 1000021.000000\n"
+	    "x_count{a=\"b\"} 4\n", result);
+	free(result);
+}
+END_TEST
+
+START_TEST(test_print)
+{
+	struct rpki_uri *uri;
+	struct timespec start;
+	char const *uri_str = "rsync://example.com/repo/";
+	char *result;
+
+	ck_assert_int_eq(0, metrics_init());
+
+	metrics_pdu_sent(PDU_TYPE_IPV4_PREFIX, 20);
+	metrics_pdu_sent(PDU_TYPE_IPV4_PREFIX, 20);
+	metrics_session_opened();
+	metrics_session_opened();
+	metrics_session_closed();
+	metrics_now(&start);
+	metrics_query(METRICS_QUERY_RESET, &start);
+
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str,
+	    strlen(uri_str)));
+	metrics_fetch(uri, &start, true);
+	metrics_fetch(uri, &start, false);
+	uri_refput(uri);
+
+	result = print_all();
+	assert_contains(result, "\nfort_rtr_pdus_sent_total{type=\"ipv4_prefix\"} 2\n");
+	assert_contains(result, "\nfort_rtr_bytes_sent_total{type=\"ipv4_prefix\"} 40\n");
+	assert_contains(result, "\nfort_rtr_sessions 1\n");
+	assert_contains(result, "\nfort_rtr_sessions_total 2\n");
+	assert_contains(result, "\nfort_rtr_query_seconds_count{type=\"reset\"} 1\n");
+	assert_contains(result, "\nfort_rtr_query_seconds_count{type=\"serial\"} 0\n");
+	assert_contains(result, "\nfort_fetch_seconds_count{protocol=\"rsync\",host=\"example.com\"} 2\n");
+	assert_contains(result, "\nfort_fetch_failures_total{protocol=\"rsync\",host=\"example.com\"} 1\n");
+	assert_contains(result, "\nfort_serial 7\n");
+	assert_contains(result, "\nfort_vrps 3\n");
+	assert_contains(result, "\nfort_tal_vrps{tal=\"ta\\\"1\"} 2\n");
+	assert_contains(result, "\nfort_tal_table_bytes{tal=\"ta\\\"1\"} 100\n");
+	free(result);
+
+	metrics_destroy();
+}
+END_TEST
+
+static char *
+request(char const *req)
+{
+	char response[65536];
+	size_t len;
+	ssize_t got;
+	int fds[2];
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	ck_assert_int_eq(strlen(req), write(fds[0], req, strlen(req)));
+	serve(fds[1]);
+	close(fds[1]);
+
+	len = 0;
+	while ((got = read(fds[0], response + len,
+	    sizeof(response) - 1 - len)) > 0)
+		len += got;
+	response[len] = '\0';
+	close(fds[0]);
+
+	return strdup(response);
+}
+
+START_TEST(test_serve)
+{
+	char *response;
+
+	ck_assert_int_eq(0, metrics_init());
+
+	response = request("GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n");
+	ck_assert_ptr_ne(NULL, strstr(response, "HTTP/1.0 200 OK\r\n"));
+	ck_assert_ptr_ne(NULL, strstr(response, "\r\n\r\n# HELP "));
+	free(response);
+
+	response = request("GET /other HTTP/1.1\r\n\r\n");
+	ck_assert_ptr_eq(response, strstr(response, "HTTP/1.0 404 "));
+	free(response);
+
+	response = request("POST /metrics HTTP/1.1\r\n\r\n");
+	ck_assert_ptr_eq(response, strstr(response, "HTTP/1.0 405 "));
+	free(response);
+
+	metrics_destroy();
+}
+END_TEST
+
+Suite *metrics_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_histogram);
+	tcase_add_test(core, test_print);
+	tcase_add_test(core, test_serve);
+
+	suite = suite_create("Metrics");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = metrics_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,306 @@
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+#include "address.c"
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "output_printer.c"
+#include "crypto/base64.c"
+#include "object/router_key.c"
+#include "rtr/db/delta.c"
+#include "rtr/db/db_table.c"
+#include "rtr/db/snapshot.c"
+
+static void
+check_ipv6(uint8_t const *addr)
+{
+	char expected[INET6_ADDRSTRLEN];
+	char actual[INET6_ADDRSTRLEN];
+	char *end;
+
+	ck_assert_ptr_ne(NULL, inet_ntop(AF_INET6, addr, expected,
+	    sizeof(expected)));
+	end = print_ipv6(actual, addr);
+	*end = '\0';
+	ck_assert_str_eq(expected, actual);
+}
+
+static void
+check_ipv6_words(unsigned int w0, unsigned int w1, unsigned int w2,
+    unsigned int w3, unsigned int w4, unsigned int w5, unsigned int w6,
+    unsigned int w7)
+{
+	unsigned int words[8] = { w0, w1, w2, w3, w4, w5, w6, w7 };
+	uint8_t addr[16];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		addr[2 * i] = words[i] >> 8;
+		addr[2 * i + 1] = words[i] & 0xFF;
+	}
+	check_ipv6(addr);
+}
+
+START_TEST(test_ipv6)
+{
+	uint8_t addr[16];
+	unsigned int i, j;
+
+	check_ipv6_words(0, 0, 0, 0, 0, 0, 0, 0);
+	check_ipv6_words(0, 0, 0, 0, 0, 0, 0, 1);
+	check_ipv6_words(1, 0, 0, 0, 0, 0, 0, 0);
+	check_ipv6_words(0x2001, 0xdb8, 0, 0, 1, 0, 0, 1);
+	check_ipv6_words(0x2001, 0xdb8, 0, 1, 1, 1, 1, 1);
+	check_ipv6_words(0x2001, 0, 0, 1, 0, 0, 0, 1);
+	check_ipv6_words(0xffff, 0xffff, 0xffff, 0xffff, 0xffff, 0xffff,
+	    0xffff, 0xffff);
+	check_ipv6_words(0, 0, 0, 0, 0, 0xffff, 0xc000, 0x0201);
+	check_ipv6_words(0, 0, 0, 0, 0, 0, 0xc000, 0x0201);
+	check_ipv6_words(0, 0, 0, 0, 0, 0xfffe, 0xc000, 0x0201);
+	check_ipv6_words(0, 0, 0, 0, 1, 0xffff, 0xc000, 0x0201);
+
+	/* Every combination of zero and non-zero groups */
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 8; j++) {
+			addr[2 * j] = 0;
+			addr[2 * j + 1] = (i & (1 << j)) ? (j * 17 + 1) : 0;
+		}
+		check_ipv6(addr);
+	}
+
+	srandom(1);
+	for (i = 0; i < 10000; i++) {
+		for (j = 0; j < 16; j++)
+			addr[j] = (random() % 3 == 0) ? 0 : random();
+		check_ipv6(addr);
+	}
+}
+END_TEST
+
+START_TEST(test_ipv4)
+{
+	uint8_t addr[4] = { 192, 0, 2, 0 };
+	char actual[INET_ADDRSTRLEN];
+
+	*print_ipv4(actual, addr) = '\0';
+	ck_assert_str_eq("192.0.2.0", actual);
+
+	*print_u32(actual, 4294967295u) = '\0';
+	ck_assert_str_eq("4294967295", actual);
+	*print_u32(actual, 0) = '\0';
+	ck_assert_str_eq("0", actual);
+}
+END_TEST
+
+START_TEST(test_base64)
+{
+	uint8_t bytes[RK_SPKI_LEN];
+	char padded[128];
+	char actual[128];
+	char *expected;
+	unsigned int len, i;
+
+	for (i = 0; i < RK_SPKI_LEN; i++)
+		bytes[i] = i * 37 + 251;
+
+	for (len = 1; len <= RK_SPKI_LEN; len++) {
+		ck_assert_int_eq(0, base64url_encode(bytes, len, &expected));
+		*print_base64url(actual, bytes, len) = '\0';
+		ck_assert_str_eq(expected, actual);
+		free(expected);
+
+		EVP_EncodeBlock((unsigned char *) padded, bytes, len);
+		*print_base64(actual, bytes, len) = '\0';
+		ck_assert_str_eq(padded, actual);
+	}
+}
+END_TEST
+
+START_TEST(test_json_str)
+{
+	char actual[64];
+
+	*print_json_str(actual, "ripe") = '\0';
+	ck_assert_str_eq("\"ripe\"", actual);
+	*print_json_str(actual, "a\"b\\c\nd") = '\0';
+	ck_assert_str_eq("\"a\\\"b\\\\c\\u000ad\"", actual);
+}
+END_TEST
+
+static void
+check_file(char const *path, char const *expected)
+{
+	char tmp_path[64] = "";
+	char actual[2048];
+	FILE *file;
+	size_t len;
+
+	file = fopen(path, "rb");
+	ck_assert_ptr_ne(NULL, file);
+	len = fread(actual, 1, sizeof(actual) - 1, file);
+	actual[len] = '\0';
+	fclose(file);
+	ck_assert_str_eq(expected, actual);
+
+	/* The temporal file was renamed */
+	strcat(tmp_path, path);
+	strcat(tmp_path, ".tmp");
+	ck_assert_int_ne(0, access(tmp_path, F_OK));
+	remove(path);
+}
+
+static void
+create_output(char *path)
+{
+	int fd;
+
+	fd = mkstemp(path);
+	ck_assert_int_ge(fd, 0);
+	close(fd);
+}
+
+START_TEST(test_file)
+{
+	static char const expected[] = "ASN,Prefix,Max prefix length\n"
+	    "AS10,192.0.2.0/24,24\n"
+	    "AS11,192.0.2.0/24,24\n"
+	    "AS10,203.0.113.0/24,32\n"
+	    "AS12,2001:db8::/32,48\n";
+	char path[] = "/tmp/fort_output_XXXXXX";
+	struct output_job job;
+	struct db_table *table;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+
+	create_output(path);
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+	prefix4.addr.s_addr = htonl(0xCB007100);
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 10, &prefix4, 32));
+	prefix4.addr.s_addr = htonl(0xC0000200);
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 11, &prefix4, 24));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 10, &prefix4, 24));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 0);
+	prefix6.len = 32;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 12, &prefix6, 48));
+
+	/* Sorted by prefix, then ASN; IPv4 first */
+	ck_assert_int_eq(0, snapshot_records_init(&job.records, table));
+	print_file(path, print_roas, &job);
+	snapshot_records_cleanup(&job.records);
+	db_table_destroy(table);
+
+	check_file(path, expected);
+}
+END_TEST
+
+START_TEST(test_json)
+{
+	static char const expected[] = "{\n"
+	    "\t\"metadata\": {\n"
+	    "\t\t\"buildtime\": \"2021-01-01T00:00:00Z\",\n"
+	    "\t\t\"serial\": 5,\n"
+	    "\t\t\"vrps\": 3,\n"
+	    "\t\t\"bgpsec_keys\": 1\n"
+	    "\t},\n"
+	    "\t\"roas\": [\n"
+	    "\t\t{ \"asn\": 10, \"prefix\": \"192.0.2.0/24\", \"maxLength\": 24, \"ta\": \"ripe\" },\n"
+	    "\t\t{ \"asn\": 11, \"prefix\": \"192.0.2.0/24\", \"maxLength\": 24, \"ta\": null },\n"
+	    "\t\t{ \"asn\": 12, \"prefix\": \"2001:db8::/32\", \"maxLength\": 48, \"ta\": \"ripe\" }\n"
+	    "\t],\n"
+	    "\t\"bgpsec_keys\": [\n"
+	    "\t\t{ \"asn\": 65000, \"ski\": \"000102030405060708090A0B0C0D0E0F10111213\", "
+	    "\"pubkey\": \"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+	    "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA==\", "
+	    "\"ta\": \"a\\\"b\" }\n"
+	    "\t]\n"
+	    "}\n";
+	char path[] = "/tmp/fort_output_XXXXXX";
+	struct output_job job;
+	struct db_table *table;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	uint8_t ski[RK_SKI_LEN];
+	uint8_t spk[RK_SPKI_LEN];
+	unsigned int i;
+
+	create_output(path);
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+
+	db_table_set_ta(table, db_table_intern_ta("ripe"));
+	prefix4.addr.s_addr = htonl(0xC0000200);
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 10, &prefix4, 24));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 0);
+	prefix6.len = 32;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 12, &prefix6, 48));
+
+	db_table_set_ta(table, NULL);
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 11, &prefix4, 24));
+
+	db_table_set_ta(table, db_table_intern_ta("a\"b"));
+	for (i = 0; i < RK_SKI_LEN; i++)
+		ski[i] = i;
+	memset(spk, 0, sizeof(spk));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(table, ski, 65000,
+	    spk));
+
+	job.hdr.serial = 5;
+	job.hdr.v0_session_id = 0;
+	job.hdr.v1_session_id = 0;
+	job.hdr.time = 1609459200;
+	ck_assert_int_eq(0, snapshot_records_init(&job.records, table));
+	ck_assert_uint_eq(2, job.records.ta_count);
+	print_file(path, print_json, &job);
+	snapshot_records_cleanup(&job.records);
+	db_table_destroy(table);
+	db_table_ta_cleanup();
+
+	check_file(path, expected);
+}
+END_TEST
+
+Suite *output_printer_suite(void)
+{
+	Suite *suite;
+	TCase *format, *file;
+
+	format = tcase_create("Formatting");
+	tcase_add_test(format, test_ipv4);
+	tcase_add_test(format, test_ipv6);
+	tcase_add_test(format, test_base64);
+	tcase_add_test(format, test_json_str);
+
+	file = tcase_create("File");
+	tcase_add_test(file, test_file);
+	tcase_add_test(file, test_json);
+
+	suite = suite_create("Output printer");
+	suite_add_tcase(suite, format);
+	suite_add_tcase(suite, file);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = output_printer_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,276 @@
+#include "rrdp/rrdp_generation.c"
+
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "changeset.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "uri.c"
+#include "visited_uris.c"
+
+/* Impersonate functions that won't be utilized by tests */
+
+int
+hash_buffer(char const *algorithm, unsigned char const *content, size_t len,
+    unsigned char *hash, unsigned int *hash_len)
+{
+	memset(hash, 0xAB, 32);
+	*hash_len = 32;
+	return 0;
+}
+
+int
+hash_validate_file(char const *algorithm, struct rpki_uri *uri,
+    unsigned char const *expected, size_t expected_len)
+{
+	return 0;
+}
+
+int
+hash_validate_local(char const *algorithm, char const *path,
+    unsigned char const *expected, size_t expected_len)
+{
+	return 0;
+}
+
+bool
+object_store_enabled(void)
+{
+	return false;
+}
+
+int
+object_store_write(char const *path, unsigned char const *content,
+    size_t content_len)
+{
+	ck_abort_msg("The object store is disabled.");
+	return -EINVAL;
+}
+
+int
+delete_dir_daemon_start(char **roots, size_t len)
+{
+	return 0;
+}
+
+/* Tests */
+
+#define DIR "repository/a.com/x/"
+
+/* create_dir_recursive() needs a writable string */
+static void
+create_dirs(char const *path)
+{
+	char *copy;
+
+	copy = strdup(path);
+	ck_assert_ptr_ne(NULL, copy);
+	ck_assert_int_eq(0, create_dir_recursive(copy));
+	free(copy);
+}
+
+static void
+write_live(char const *path, char const *content)
+{
+	FILE *file;
+
+	create_dirs(path);
+	file = fopen(path, "w");
+	ck_assert_ptr_ne(NULL, file);
+	fputs(content, file);
+	fclose(file);
+}
+
+static void
+assert_live(char const *path, char const *expected)
+{
+	char content[32];
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (expected == NULL) {
+		ck_assert_ptr_eq(NULL, file);
+		return;
+	}
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_ptr_ne(NULL, fgets(content, sizeof(content), file));
+	fclose(file);
+	ck_assert_str_eq(expected, content);
+}
+
+static void
+publish(struct rrdp_generation *generation, char const *name,
+    char const *content)
+{
+	struct rpki_uri *uri;
+	char global[64];
+
+	snprintf(global, sizeof(global), "rsync://a.com/x/%s", name);
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, global,
+	    strlen(global)));
+	ck_assert_int_eq(0, rrdp_generation_publish(generation, uri,
+	    (unsigned char const *) content, strlen(content)));
+	uri_refput(uri);
+}
+
+static void
+withdraw(struct rrdp_generation *generation, char const *name)
+{
+	struct rpki_uri *uri;
+	char global[64];
+
+	snprintf(global, sizeof(global), "rsync://a.com/x/%s", name);
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, global,
+	    strlen(global)));
+	ck_assert_int_eq(0, rrdp_generation_withdraw(generation, uri));
+	uri_refput(uri);
+}
+
+#define WORKDIR "/tmp/rrdp_generation_test.XXXXXX"
+static char workdir[sizeof(WORKDIR)];
+
+static void
+setup(void)
+{
+	strcpy(workdir, WORKDIR);
+	ck_assert_ptr_ne(NULL, mkdtemp(workdir));
+	ck_assert_int_eq(0, chdir(workdir));
+	ck_assert_int_eq(0, changeset_init());
+}
+
+static void
+teardown(void)
+{
+	changeset_destroy();
+	ck_assert_int_eq(0, chdir("/"));
+	ck_assert_int_eq(0, remove_tree(workdir));
+}
+
+START_TEST(test_commit)
+{
+	struct rrdp_generation *generation;
+	struct visited_uris *visited;
+
+	write_live(DIR "a.roa", "old a");
+	write_live(DIR "c.roa", "old c");
+
+	ck_assert_int_eq(0, visited_uris_create(&visited));
+	ck_assert_int_eq(0, rrdp_generation_create("https://a.com/n.xml",
+	    &generation));
+	publish(generation, "a.roa", "new a");
+	publish(generation, "b.roa", "new b");
+	publish(generation, "m.mft", "new m");
+	withdraw(generation, "c.roa");
+
+	/* Not visible until committed */
+	assert_live(DIR "a.roa", "old a");
+	assert_live(DIR "b.roa", NULL);
+	assert_live(DIR "c.roa", "old c");
+
+	ck_assert_int_eq(0, rrdp_generation_commit(generation, visited, NULL));
+	rrdp_generation_destroy(generation);
+
+	assert_live(DIR "a.roa", "new a");
+	assert_live(DIR "b.roa", "new b");
+	assert_live(DIR "c.roa", NULL);
+	ck_assert(visited_uris_contains(visited, "rsync://a.com/x/m.mft"));
+
+	visited_uris_refput(visited);
+}
+END_TEST
+
+START_TEST(test_commit_nothing_on_error)
+{
+	struct rrdp_generation *generation;
+	struct visited_uris *visited;
+
+	write_live(DIR "a.roa", "old a");
+	/* Can't be replaced by a file */
+	create_dirs(DIR "d.roa/");
+
+	ck_assert_int_eq(0, visited_uris_create(&visited));
+	ck_assert_int_eq(0, rrdp_generation_create("https://a.com/n.xml",
+	    &generation));
+	publish(generation, "a.roa", "new a");
+	publish(generation, "b.roa", "new b");
+	publish(generation, "d.roa", "new d");
+	publish(generation, "m.mft", "new m");
+
+	ck_assert_int_ne(0, rrdp_generation_commit(generation, visited, NULL));
+	rrdp_generation_destroy(generation);
+
+	assert_live(DIR "a.roa", "old a");
+	assert_live(DIR "b.roa", NULL);
+	ck_assert(!visited_uris_contains(visited, "rsync://a.com/x/m.mft"));
+
+	visited_uris_refput(visited);
+}
+END_TEST
+
+START_TEST(test_commit_new_session)
+{
+	struct rrdp_generation *generation;
+	struct visited_uris *old;
+	struct visited_uris *visited;
+
+	write_live(DIR "m.mft", "old m");
+	write_live(DIR "a.roa", "old a");
+	write_live(DIR "b.roa", "old b");
+
+	ck_assert_int_eq(0, visited_uris_create(&old));
+	ck_assert_int_eq(0, visited_uris_add(old, "rsync://a.com/x/m.mft"));
+
+	ck_assert_int_eq(0, visited_uris_create(&visited));
+	ck_assert_int_eq(0, rrdp_generation_create("https://a.com/n.xml",
+	    &generation));
+	publish(generation, "m.mft", "new m");
+	publish(generation, "a.roa", "new a");
+
+	ck_assert_int_eq(0, rrdp_generation_commit(generation, visited, old));
+	rrdp_generation_destroy(generation);
+
+	assert_live(DIR "m.mft", "new m");
+	assert_live(DIR "a.roa", "new a");
+	/* Leftover of the previous session */
+	assert_live(DIR "b.roa", NULL);
+
+	visited_uris_refput(visited);
+	visited_uris_refput(old);
+}
+END_TEST
+
+Suite *rrdp_generation_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Commit");
+	tcase_add_checked_fixture(core, setup, teardown);
+	tcase_add_test(core, test_commit);
+	tcase_add_test(core, test_commit_nothing_on_error);
+	tcase_add_test(core, test_commit_new_session);
+
+	suite = suite_create("RRDP generation");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = rrdp_generation_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,125 @@
+/*
+ * Measures how long it takes to launch (and reap) a trivial child process,
+ * through fork() + exec() and through posix_spawn(), as the resident memory of
+ * the parent grows.
+ *
+ * This is what do_rsync() pays for every rsync, on top of the rsync itself.
+ *
+ * Usage: ./rsync_spawn.bench [iterations [MiB...]]
+ * Default: 200 iterations, at 0, 256 and 1024 MiB.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static char *args[] = { "true", NULL };
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+launch_fork(void)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid == -1)
+		return errno;
+	if (pid == 0) {
+		execvp(args[0], args);
+		_exit(127);
+	}
+
+	return (waitpid(pid, &status, 0) == -1) ? errno : 0;
+}
+
+static int
+launch_spawn(void)
+{
+	pid_t pid;
+	int status;
+	int error;
+
+	error = posix_spawnp(&pid, args[0], NULL, NULL, args, environ);
+	if (error)
+		return error;
+
+	return (waitpid(pid, &status, 0) == -1) ? errno : 0;
+}
+
+/* Returns the average latency, in microseconds. */
+static double
+measure(int (*launch)(void), unsigned int iterations)
+{
+	double start;
+	unsigned int i;
+	int error;
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		error = launch();
+		if (error) {
+			fprintf(stderr, "Launch failed: %s\n", strerror(error));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return (now() - start) * 1e6 / iterations;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned long DEFAULT_SIZES[] = { 0, 256, 1024 };
+	unsigned int iterations;
+	unsigned long mib;
+	char *memory;
+	int i, sizes;
+
+	iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200;
+	if (iterations == 0)
+		iterations = 1;
+	sizes = (argc > 2) ? (argc - 2) : 3;
+
+	printf("%10s %16s %16s\n", "RSS (MiB)", "fork+exec (us)",
+	    "posix_spawn (us)");
+
+	for (i = 0; i < sizes; i++) {
+		mib = (argc > 2)
+		    ? strtoul(argv[i + 2], NULL, 10)
+		    : DEFAULT_SIZES[i];
+
+		/* Touch it, so it's actually resident */
+		memory = NULL;
+		if (mib > 0) {
+			memory = malloc(mib << 20);
+			if (memory == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				return EXIT_FAILURE;
+			}
+			memset(memory, 1, mib << 20);
+		}
+
+		printf("%10lu %16.1f %16.1f\n", mib,
+		    measure(launch_fork, iterations),
+		    measure(launch_spawn, iterations));
+
+		free(memory);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include "rsync/rsync.c"
+
 #include <check.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -6,8 +8,6 @@
 #include "impersonator.c"
 #include "str.c"
 #include "uri.c"
-#include "rsync/rsync.c"
-
 
 struct validation *
 state_retrieve(void)
@@ -15,94 +15,178 @@ state_retrieve(void)
 	return NULL;
 }
 
-START_TEST(rsync_load_normal)
+int
+fetch_scheduler_request(struct rpki_uri *uri, unsigned int retry_count)
 {
+	return 0;
+}
 
+void
+fetch_scheduler_success(struct rpki_uri *uri)
+{
+	/* Empty */
 }
-END_TEST
 
-static void
-assert_descendant(bool expected, char *ancestor, char *descendant)
+bool
+fetch_scheduler_is_down(struct rpki_uri *uri)
 {
-	struct rpki_uri *ancestor_uri;
-	struct rpki_uri *descendant_uri;
+	return false;
+}
 
-	ck_assert_int_eq(0, uri_create_rsync_str(&ancestor_uri, ancestor,
-	    strlen(ancestor)));
-	ck_assert_int_eq(0, uri_create_rsync_str(&descendant_uri, descendant,
-	    strlen(descendant)));
+int
+rsync_pool_init(void)
+{
+	return 0;
+}
 
-	ck_assert_int_eq(is_descendant(ancestor_uri, descendant_uri), expected);
+void
+rsync_pool_destroy(void)
+{
+	/* Empty */
+}
 
-	uri_refput(ancestor_uri);
-	uri_refput(descendant_uri);
+bool
+rsync_pool_enabled(void)
+{
+	return false;
 }
 
-START_TEST(rsync_test_prefix_equals)
+int
+rsync_pool_submit(struct rpki_uri *uri, rsync_pool_cb cb, void *arg)
 {
-	char *ancestor;
+	return -EINVAL;
+}
 
-	ancestor = "rsync://a/b/c";
-	assert_descendant(true, ancestor, "rsync://a/b/c");
-	assert_descendant(false, ancestor, "rsync://a/b/");
-	assert_descendant(true, ancestor, "rsync://a/b/c/c");
-	assert_descendant(false, ancestor, "rsync://a/b/cc");
-	assert_descendant(false, ancestor, "rsync://a/b/cc/");
+int
+create_dir_recursive(char const *path)
+{
+	return 0;
+}
+
+time_t
+fetch_scheduler_record_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count)
+{
+	return 0;
+}
+
+int
+fetch_scheduler_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count, int error)
+{
+	return error;
+}
+
+void
+metrics_now(struct timespec *now)
+{
+	memset(now, 0, sizeof(*now));
+}
+
+void
+metrics_fetch(struct rpki_uri *uri, struct timespec const *start, bool error)
+{
+	/* Empty */
+}
+
+/* The files rsync reported to the changeset */
+static char changes[8][64];
+static unsigned int changes_len;
+
+int
+changeset_add_file(char const *uri)
+{
+	ck_assert_uint_lt(changes_len, ARRAY_LEN(changes));
+	ck_assert_uint_lt(strlen(uri), sizeof(changes[0]));
+	strcpy(changes[changes_len++], uri);
+	return 0;
+}
+
+int
+changeset_add_tree(char const *uri, size_t len)
+{
+	return 0;
+}
+
+START_TEST(rsync_load_normal)
+{
 
-	ancestor = "rsync://a/b/c/";
-	assert_descendant(true, ancestor, "rsync://a/b/c");
-	assert_descendant(false, ancestor, "rsync://a/b/");
-	assert_descendant(true, ancestor, "rsync://a/b/c/c");
-	assert_descendant(false, ancestor, "rsync://a/b/cc");
-	assert_descendant(false, ancestor, "rsync://a/b/cc/");
 }
 END_TEST
 
 static void
-__mark_as_downloaded(char *uri_str, struct uri_list *visited_uris)
+__mark_as_downloaded(char *uri_str)
 {
 	struct rpki_uri *uri;
 	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str, strlen(uri_str)));
-	ck_assert_int_eq(mark_as_downloaded(uri, visited_uris), 0);
+	ck_assert_int_eq(mark_as_downloaded(uri), 0);
 	uri_refput(uri);
 }
 
 static void
-assert_downloaded(char *uri_str, struct uri_list *visited_uris, bool expected)
+assert_downloaded(char *uri_str, bool expected)
 {
 	struct rpki_uri *uri;
 	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str, strlen(uri_str)));
-	ck_assert_int_eq(is_already_downloaded(uri, visited_uris), expected);
+	ck_assert_int_eq(is_already_downloaded(uri), expected);
 	uri_refput(uri);
 }
 
-START_TEST(rsync_test_list)
+static void
+assert_descendant(bool expected, char *ancestor, char *descendant)
 {
-	struct uri_list *visited_uris;
+	reset_downloaded();
+	__mark_as_downloaded(ancestor);
+	assert_downloaded(descendant, expected);
+}
 
-	ck_assert_int_eq(rsync_create(&visited_uris), 0);
+START_TEST(rsync_test_prefix_equals)
+{
+	char *ancestor;
 
-	__mark_as_downloaded("rsync://example.foo/repository/", visited_uris);
-	__mark_as_downloaded("rsync://example.foo/member_repository/",
-	    visited_uris);
-	__mark_as_downloaded("rsync://example.foz/repository/", visited_uris);
-	__mark_as_downloaded("rsync://example.boo/repo/", visited_uris);
-	__mark_as_downloaded("rsync://example.potato/rpki/", visited_uris);
+	ck_assert_int_eq(rsync_init(), 0);
 
-	assert_downloaded("rsync://example.foo/repository/", visited_uris,
-	    true);
-	assert_downloaded("rsync://example.foo/repository/abc/cdfg",
-	    visited_uris, true);
-	assert_downloaded("rsync://example.foo/member_repository/bca",
-	    visited_uris, true);
-	assert_downloaded("rsync://example.boo/repository/", visited_uris,
-	    false);
-	assert_downloaded("rsync://example.potato/repository/", visited_uris,
-	    false);
-	assert_downloaded("rsync://example.potato/rpki/abc/", visited_uris,
-	    true);
+	ancestor = "rsync://a/b/c";
+	assert_descendant(true, ancestor, "rsync://a/b/c");
+	assert_descendant(false, ancestor, "rsync://a/b/");
+	assert_descendant(true, ancestor, "rsync://a/b/c/c");
+	assert_descendant(false, ancestor, "rsync://a/b/cc");
+	assert_descendant(false, ancestor, "rsync://a/b/cc/");
 
-	rsync_destroy(visited_uris);
+	ancestor = "rsync://a/b/c/";
+	assert_descendant(true, ancestor, "rsync://a/b/c");
+	assert_descendant(false, ancestor, "rsync://a/b/");
+	assert_descendant(true, ancestor, "rsync://a/b/c/c");
+	assert_descendant(false, ancestor, "rsync://a/b/cc");
+	assert_descendant(false, ancestor, "rsync://a/b/cc/");
+
+	rsync_destroy();
+}
+END_TEST
+
+START_TEST(rsync_test_list)
+{
+	ck_assert_int_eq(rsync_init(), 0);
+
+	__mark_as_downloaded("rsync://example.foo/repository/");
+	__mark_as_downloaded("rsync://example.foo/member_repository/");
+	__mark_as_downloaded("rsync://example.foz/repository/");
+	__mark_as_downloaded("rsync://example.boo/repo/");
+	__mark_as_downloaded("rsync://example.potato/rpki/");
+
+	assert_downloaded("rsync://example.foo/repository/", true);
+	assert_downloaded("rsync://example.foo/repository/abc/cdfg", true);
+	assert_downloaded("rsync://example.foo/member_repository/bca", true);
+	assert_downloaded("rsync://example.boo/repository/", false);
+	assert_downloaded("rsync://example.potato/repository/", false);
+	assert_downloaded("rsync://example.potato/rpki/abc/", true);
+	assert_downloaded("rsync://example.potato/", false);
+
+	reset_downloaded();
+	assert_downloaded("rsync://example.foo/repository/", false);
+	assert_downloaded("rsync://example.potato/rpki/abc/", false);
+
+	rsync_destroy();
 }
 END_TEST
 
@@ -137,10 +221,98 @@ START_TEST(rsync_test_get_prefix)
 }
 END_TEST
 
+START_TEST(rsync_test_itemize)
+{
+	struct rsync_report report;
+	struct line_buffer pending;
+	struct rpki_uri *uri;
+	char const *output;
+
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri,
+	    "rsync://example.com/module/a", strlen("rsync://example.com/module/a")));
+
+	memset(&report, 0, sizeof(report));
+	report.uri = uri;
+	changes_len = 0;
+	ck_assert(parse_itemized(">f+++++++++ a/b.cer", &report));
+	ck_assert(parse_itemized(">f.st...... a/c.mft", &report));
+	ck_assert(parse_itemized("*deleting   a/d.roa", &report));
+	ck_assert(parse_itemized("cd+++++++++ a/", &report));
+	ck_assert(parse_itemized(".f..t...... a/e.crl", &report));
+	ck_assert(!parse_itemized("receiving file list ... done", &report));
+	ck_assert(!parse_itemized("", &report));
+	ck_assert_uint_eq(1, report.added);
+	ck_assert_uint_eq(1, report.modified);
+	ck_assert_uint_eq(1, report.removed);
+
+	/* Whether the destination contains "a/" or not, both are recorded */
+	ck_assert_uint_eq(6, changes_len);
+	ck_assert_str_eq("rsync://example.com/module/a/a/b.cer", changes[0]);
+	ck_assert_str_eq("rsync://example.com/module/a/b.cer", changes[1]);
+	ck_assert_str_eq("rsync://example.com/module/a/a/c.mft", changes[2]);
+	ck_assert_str_eq("rsync://example.com/module/a/c.mft", changes[3]);
+	ck_assert_str_eq("rsync://example.com/module/a/a/d.roa", changes[4]);
+	ck_assert_str_eq("rsync://example.com/module/a/d.roa", changes[5]);
+
+	/* Lines split across reads */
+	memset(&report, 0, sizeof(report));
+	report.uri = uri;
+	changes_len = 0;
+	pending.len = 0;
+	output = ">f+++++++++ x.cer\n>f+++";
+	handle_output(&pending, output, strlen(output), false, 1, &report);
+	ck_assert_uint_eq(1, report.added);
+	output = "++++++ y.cer\n*deleting   z.cer";
+	handle_output(&pending, output, strlen(output), false, 1, &report);
+	ck_assert_uint_eq(2, report.added);
+	ck_assert_uint_eq(0, report.removed);
+	handle_output(&pending, "", 0, true, 1, &report);
+	ck_assert_uint_eq(1, report.removed);
+
+	uri_refput(uri);
+}
+END_TEST
+
+static bool
+itemizes(char const *args)
+{
+	struct string_array array;
+	char *copy, *token;
+	char *tokens[8];
+	bool result;
+
+	copy = strdup(args);
+	ck_assert_ptr_ne(NULL, copy);
+	array.array = tokens;
+	array.length = 0;
+	for (token = strtok(copy, " "); token != NULL; token = strtok(NULL, " "))
+		tokens[array.length++] = token;
+
+	result = has_itemize(&array);
+	free(copy);
+	return result;
+}
+
+START_TEST(rsync_test_has_itemize)
+{
+	ck_assert(itemizes("--recursive --itemize-changes"));
+	ck_assert(itemizes("-rti"));
+	ck_assert(itemizes("-vi --times"));
+	ck_assert(itemizes("-T tmp -i"));
+
+	ck_assert(!itemizes("--recursive --times"));
+	ck_assert(!itemizes("--ignore-times --info=progress2"));
+	ck_assert(!itemizes("--include=*.cer"));
+	ck_assert(!itemizes("-rt -Tdir/with/i"));
+	ck_assert(!itemizes("-e ssh-i"));
+	ck_assert(!itemizes("-f -i"));
+}
+END_TEST
+
 Suite *rsync_load_suite(void)
 {
 	Suite *suite;
-	TCase *core, *prefix_equals, *uri_list, *test_get_prefix;
+	TCase *core, *prefix_equals, *uri_list, *test_get_prefix, *itemize;
 
 	core = tcase_create("Core");
 	tcase_add_test(core, rsync_load_normal);
@@ -154,11 +326,16 @@ Suite *rsync_load_suite(void)
 	test_get_prefix = tcase_create("test_get_prefix");
 	tcase_add_test(test_get_prefix, rsync_test_get_prefix);
 
+	itemize = tcase_create("itemize");
+	tcase_add_test(itemize, rsync_test_itemize);
+	tcase_add_test(itemize, rsync_test_has_itemize);
+
 	suite = suite_create("rsync_test()");
 	suite_add_tcase(suite, core);
 	suite_add_tcase(suite, prefix_equals);
 	suite_add_tcase(suite, uri_list);
 	suite_add_tcase(suite, test_get_prefix);
+	suite_add_tcase(suite, itemize);
 
 	return suite;
 }
@@ -256,6 +256,50 @@ START_TEST(test_merge)
 }
 END_TEST
 
+static bool
+filter_asn_10(struct vrp const *vrp, void *arg)
+{
+	return vrp->asn == 10;
+}
+
+static bool
+filter_all_keys(struct router_key const *key, void *arg)
+{
+	return true;
+}
+
+START_TEST(test_merge_filtered)
+{
+	unsigned char ski[RK_SKI_LEN] = { 1 };
+	unsigned char spk[RK_SPKI_LEN] = { 2 };
+	struct ipv4_prefix prefix4;
+	struct db_table *src, *dst;
+
+	src = db_table_create();
+	ck_assert_ptr_ne(NULL, src);
+	dst = db_table_create();
+	ck_assert_ptr_ne(NULL, dst);
+
+	prefix4.addr.s_addr = ADDR1;
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(src, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(src, 11, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(src, ski, 10, spk));
+
+	ck_assert_int_eq(0, db_table_merge_filtered(dst, src, filter_asn_10,
+	    filter_all_keys, NULL));
+	ck_assert_uint_eq(1, db_table_roa_count(dst));
+	ck_assert_uint_eq(0, db_table_router_key_count(dst));
+
+	/* The source is left alone */
+	ck_assert_uint_eq(2, db_table_roa_count(src));
+	ck_assert_uint_eq(1, db_table_router_key_count(src));
+
+	db_table_destroy(src);
+	db_table_destroy(dst);
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -266,6 +310,7 @@ Suite *pdu_suite(void)
 
 	merge = tcase_create("Merge");
 	tcase_add_test(core, test_merge);
+	tcase_add_test(merge, test_merge_filtered);
 
 	suite = suite_create("DB Table");
 	suite_add_tcase(suite, core);
@@ -1,5 +1,6 @@
 #include <check.h>
 #include "object/tal.h"
+#include "metrics.h"
 
 #include "address.c"
 
@@ -20,6 +21,10 @@ static unsigned char db_imp_spk[] = {
     0x04 };
 
 static int iteration = 0;
+/* Iteration during which the TAL fails, if any */
+static int failing_iteration = -1;
+/* Read by vrps_init() */
+static unsigned int deltas_lifetime = 64;
 
 static void
 add_v4(struct validation_handler *handler, uint32_t as)
@@ -70,9 +75,14 @@ __handle_router_key(unsigned char const *ski, uint32_t as,
 }
 
 int
-perform_standalone_validation(struct db_table *table)
+perform_standalone_validation(struct string_array const *tals, tal_table_cb cb,
+    void *arg)
 {
 	struct validation_handler handler;
+	struct db_table *table;
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
 
 	handler.handle_roa_v4 = __handle_roa_v4;
 	handler.handle_roa_v6 = __handle_roa_v6;
@@ -108,7 +118,29 @@ perform_standalone_validation(struct db_table *table)
 		    iteration);
 	}
 
-	iteration++;
+	if (iteration++ == failing_iteration) {
+		db_table_destroy(table);
+		return -EINVAL;
+	}
+
+	return cb("impersonator.tal", table, arg);
+}
+
+unsigned int
+config_get_deltas_lifetime(void)
+{
+	return deltas_lifetime;
+}
+
+unsigned int
+config_get_deltas_max_memory(void)
+{
+	return 128;
+}
+
+int
+notify_clients(void)
+{
 	return 0;
 }
 
@@ -117,3 +149,33 @@ terminate_standalone_validation(void)
 {
 	/* Nothing, no threads to join */
 }
+
+void
+metrics_now(struct timespec *now)
+{
+	memset(now, 0, sizeof(*now));
+}
+
+void
+metrics_cycle(struct timespec const *start, bool error)
+{
+	/* Empty */
+}
+
+void
+metrics_phase(enum metrics_phase phase, struct timespec const *start)
+{
+	/* Empty */
+}
+
+void
+metrics_phase_totals(double *result)
+{
+	memset(result, 0, METRICS_PHASE_COUNT * sizeof(double));
+}
+
+void
+metrics_delta(size_t entries)
+{
+	/* Empty */
+}
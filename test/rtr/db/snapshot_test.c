@@ -0,0 +1,234 @@
+#include <check.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "address.c"
+#include "common.c"
+#include "file.c"
+#include "log.c"
+#include "impersonator.c"
+#include "object/router_key.c"
+#include "rtr/db/delta.c"
+#include "rtr/db/db_table.c"
+#include "rtr/db/snapshot.c"
+
+static unsigned char ski[RK_SKI_LEN] = { 0x0e, 0xe9, 0x6a, 0x8e };
+static unsigned char spk[RK_SPKI_LEN] = { 0x30, 0x59, 0x30, 0x13 };
+
+static struct db_table *
+create_table(void)
+{
+	struct db_table *table;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+
+	db_table_set_ta(table, db_table_intern_ta("ripe"));
+	prefix4.addr.s_addr = htonl(0xC0000200);
+	prefix4.len = 24;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 10, &prefix4, 32));
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 11, &prefix4, 24));
+
+	db_table_set_ta(table, db_table_intern_ta("arin"));
+	in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, 1);
+	prefix6.len = 120;
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 10, &prefix6, 128));
+
+	db_table_set_ta(table, NULL);
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(table, ski, 12, spk));
+
+	return table;
+}
+
+static int
+find_roa(struct vrp const *vrp, char const *ta, void *arg)
+{
+	struct db_table *table = arg;
+	struct hashable_roa *found;
+
+	HASH_FIND(hh, table->roas, vrp, sizeof(*vrp), found);
+	ck_assert_ptr_ne(NULL, found);
+	ck_assert_ptr_eq(found->ta, ta);
+	return 0;
+}
+
+static int
+find_router_key(struct router_key const *key, char const *ta, void *arg)
+{
+	struct db_table *table = arg;
+	struct hashable_key *found;
+
+	HASH_FIND(hh, table->router_keys, key, sizeof(*key), found);
+	ck_assert_ptr_ne(NULL, found);
+	ck_assert_ptr_eq(found->ta, ta);
+	return 0;
+}
+
+static void
+create_path(char *path)
+{
+	int fd;
+
+	fd = mkstemp(path);
+	ck_assert_int_ge(fd, 0);
+	close(fd);
+}
+
+START_TEST(test_roundtrip)
+{
+	char path[] = "/tmp/fort_snapshot_XXXXXX";
+	struct snapshot_header hdr, loaded_hdr;
+	struct db_table *table, *loaded;
+
+	create_path(path);
+	table = create_table();
+
+	hdr.serial = 1234;
+	hdr.v0_session_id = 50;
+	hdr.v1_session_id = 49;
+	hdr.time = 0x123456789;
+	ck_assert_int_eq(0, snapshot_write(path, &hdr, table));
+	ck_assert_int_eq(0, snapshot_load(path, &loaded_hdr, &loaded));
+
+	ck_assert_uint_eq(1234, loaded_hdr.serial);
+	ck_assert_uint_eq(50, loaded_hdr.v0_session_id);
+	ck_assert_uint_eq(49, loaded_hdr.v1_session_id);
+	ck_assert(loaded_hdr.time == 0x123456789);
+
+	ck_assert_uint_eq(3, db_table_roa_count(loaded));
+	ck_assert_uint_eq(1, db_table_router_key_count(loaded));
+	/* Including the Trust Anchors */
+	ck_assert_int_eq(0, db_table_foreach_roa_ta(loaded, find_roa, table));
+	ck_assert_int_eq(0, db_table_foreach_router_key_ta(loaded,
+	    find_router_key, table));
+
+	db_table_destroy(loaded);
+	db_table_destroy(table);
+	remove(path);
+}
+END_TEST
+
+START_TEST(test_map)
+{
+	char path[] = "/tmp/fort_snapshot_XXXXXX";
+	struct snapshot_header hdr;
+	struct mapped_snapshot snapshot;
+	struct db_table *table;
+
+	create_path(path);
+	table = create_table();
+
+	hdr.serial = 5;
+	hdr.v0_session_id = 1;
+	hdr.v1_session_id = 0;
+	hdr.time = 0;
+	ck_assert_int_eq(0, snapshot_write(path, &hdr, table));
+	db_table_destroy(table);
+
+	ck_assert_int_eq(0, snapshot_map(path, &snapshot));
+	ck_assert_uint_eq(5, snapshot.hdr.serial);
+
+	/* Sorted by prefix, lengths, then ASN */
+	ck_assert_uint_eq(2, snapshot.v4_count);
+	ck_assert_uint_eq(24, snapshot.v4[0].max_length);
+	ck_assert_uint_eq(11, ntohl(snapshot.v4[0].asn));
+	ck_assert_uint_eq(32, snapshot.v4[1].max_length);
+	ck_assert_uint_eq(10, ntohl(snapshot.v4[1].asn));
+	ck_assert_uint_eq(0xC0, snapshot.v4[1].prefix[0]);
+	ck_assert_uint_eq(0x02, snapshot.v4[1].prefix[2]);
+	ck_assert_uint_eq(1, ntohs(snapshot.v4[0].ta));
+	ck_assert_uint_eq(1, ntohs(snapshot.v4[1].ta));
+
+	ck_assert_uint_eq(1, snapshot.v6_count);
+	ck_assert_uint_eq(120, snapshot.v6[0].prefix_length);
+	ck_assert_uint_eq(0x20, snapshot.v6[0].prefix[0]);
+	ck_assert_uint_eq(0x01, snapshot.v6[0].prefix[15]);
+	ck_assert_uint_eq(2, ntohs(snapshot.v6[0].ta));
+
+	ck_assert_uint_eq(1, snapshot.rk_count);
+	ck_assert_uint_eq(12, ntohl(snapshot.rks[0].asn));
+	ck_assert_int_eq(0, memcmp(ski, snapshot.rks[0].ski, RK_SKI_LEN));
+	ck_assert_uint_eq(0, ntohs(snapshot.rks[0].ta));
+
+	ck_assert_uint_eq(2, snapshot.ta_count);
+	ck_assert_str_eq("ripe", snapshot.tas[0].name);
+	ck_assert_str_eq("arin", snapshot.tas[1].name);
+
+	snapshot_unmap(&snapshot);
+	remove(path);
+}
+END_TEST
+
+START_TEST(test_bad_files)
+{
+	char path[] = "/tmp/fort_snapshot_XXXXXX";
+	struct snapshot_header hdr;
+	struct db_table *table;
+	FILE *file;
+
+	create_path(path);
+	table = create_table();
+
+	/* Empty */
+	ck_assert_int_eq(-EINVAL, snapshot_load(path, &hdr, &table));
+
+	hdr.serial = 1;
+	hdr.v0_session_id = 1;
+	hdr.v1_session_id = 0;
+	hdr.time = 0;
+	ck_assert_int_eq(0, snapshot_write(path, &hdr, table));
+	db_table_destroy(table);
+
+	/* Corrupted */
+	file = fopen(path, "r+b");
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_int_eq(0, fseek(file, sizeof(struct snapshot_file_header),
+	    SEEK_SET));
+	ck_assert_int_eq(0xC0, fgetc(file));
+	ck_assert_int_eq(0, fseek(file, -1, SEEK_CUR));
+	ck_assert_int_eq(0xC1, fputc(0xC1, file));
+	fclose(file);
+	ck_assert_int_eq(-EINVAL, snapshot_load(path, &hdr, &table));
+
+	/* Truncated */
+	ck_assert_int_eq(0, truncate(path, 40));
+	ck_assert_int_eq(-EINVAL, snapshot_load(path, &hdr, &table));
+
+	/* Missing */
+	remove(path);
+	ck_assert_int_eq(-ENOENT, snapshot_load(path, &hdr, &table));
+}
+END_TEST
+
+Suite *snapshot_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_roundtrip);
+	tcase_add_test(core, test_map);
+	tcase_add_test(core, test_bad_files);
+
+	suite = suite_create("VRP snapshot");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = snapshot_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
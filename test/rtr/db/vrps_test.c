@@ -14,6 +14,7 @@
 #include "rtr/db/delta.c"
 #include "rtr/db/db_table.c"
 #include "rtr/db/rtr_db_impersonator.c"
+#include "rtr/db/snapshot.c"
 #include "rtr/db/vrps.c"
 #include "slurm/db_slurm.c"
 #include "slurm/slurm_loader.c"
@@ -68,13 +69,14 @@ static const bool deltas_3to3_clean[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
 
 /* Impersonator functions */
 
-serial_t current_min_serial = 0;
+/* Serial some router is at, if @router_connected */
+static serial_t router_serial;
+static bool router_connected;
 
-int
-clients_get_min_serial(serial_t *result)
+unsigned int
+clients_count_serial(serial_t serial)
 {
-	*result = current_min_serial;
-	return 0;
+	return (router_connected && serial == router_serial) ? 1 : 0;
 }
 
 /* Test functions */
@@ -352,8 +354,6 @@ static void
 create_deltas_0to1(struct deltas_db *deltas, serial_t *serial, bool *changed,
     bool *iterated_entries)
 {
-	current_min_serial = 0;
-
 	deltas_db_init(deltas);
 
 	ck_assert_int_eq(0, vrps_init());
@@ -365,13 +365,13 @@ create_deltas_0to1(struct deltas_db *deltas, serial_t *serial, bool *changed,
 	ck_assert_int_eq(-EAGAIN, vrps_get_deltas_from(0, serial, deltas));
 
 	/* First validation: One tree, no deltas */
-	ck_assert_int_eq(0, vrps_update(changed));
+	ck_assert_int_eq(0, vrps_update(NULL, changed));
 	check_serial(0);
 	check_base(0, iteration0_base);
 	check_deltas(0, 0, deltas_0to0, false);
 
 	/* Second validation: One tree, added deltas */
-	ck_assert_int_eq(0, vrps_update(changed));
+	ck_assert_int_eq(0, vrps_update(NULL, changed));
 	check_serial(1);
 	check_base(1, iteration1_base);
 	check_deltas(0, 1, deltas_0to1, false);
@@ -388,7 +388,7 @@ START_TEST(test_basic)
 	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
 
 	/* Third validation: One tree, removed deltas */
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	check_serial(2);
 	check_base(2, iteration2_base);
 	check_deltas(0, 2, deltas_0to2, false);
@@ -406,26 +406,63 @@ START_TEST(test_delta_forget)
 	bool changed;
 	bool iterated_entries[12];
 
+	/* Only one group of deltas; older ones become a checkpoint */
+	deltas_lifetime = 1;
 	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
 
-	/*
-	 * Assume that the client(s) already have serial 1 (serial 2 will be
-	 * created) so serial 0 isn't needed anymore.
-	 */
-	current_min_serial = 1;
-
-	/* Third validation: One tree, removed deltas and delta 0 removed */
-	ck_assert_int_eq(0, vrps_update(&changed));
+	/* Third validation: 0->1 and 1->2 are merged, so 1 is forgotten */
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	check_serial(2);
 	check_base(2, iteration2_base);
-	check_no_deltas(0, 2);
-	check_deltas(1, 2, deltas_1to2, false);
+	check_deltas(0, 2, deltas_0to2, false);
+	check_no_deltas(1, 2);
 	check_deltas(2, 2, deltas_2to2, false);
 
+	/* Fourth validation: 0->2 and 2->3 cancel each other out */
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
+	check_serial(3);
+	check_base(3, iteration3_base);
+	check_deltas(0, 3, deltas_0to3_clean, false);
+	check_no_deltas(2, 3);
+	check_deltas(3, 3, deltas_3to3_clean, false);
+
 	vrps_destroy();
 
 	/* Return to its initial value */
-	current_min_serial = 0;
+	deltas_lifetime = 64;
+}
+END_TEST
+
+START_TEST(test_delta_checkpoint_choice)
+{
+	struct deltas_db deltas;
+	serial_t serial;
+	bool changed;
+	bool iterated_entries[12];
+
+	deltas_lifetime = 2;
+	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
+
+	/* A router is at serial 1, so 1 shouldn't be merged away */
+	router_serial = 1;
+	router_connected = true;
+
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
+	check_serial(2);
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
+	check_serial(3);
+
+	/* 1->2 and 2->3 were merged instead of 0->1 and 1->2 */
+	check_deltas(0, 3, deltas_0to3_clean, true);
+	check_deltas(1, 3, deltas_1to3_clean, false);
+	check_no_deltas(2, 3);
+	check_deltas(3, 3, deltas_3to3_clean, false);
+
+	vrps_destroy();
+
+	/* Return to their initial values */
+	router_connected = false;
+	deltas_lifetime = 64;
 }
 END_TEST
 
@@ -439,7 +476,7 @@ START_TEST(test_delta_ovrd)
 	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
 
 	/* Third validation: One tree, removed deltas */
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	check_serial(2);
 	check_base(2, iteration2_base);
 	check_deltas(0, 2, deltas_0to2, false);
@@ -447,7 +484,7 @@ START_TEST(test_delta_ovrd)
 	check_deltas(2, 2, deltas_2to2, false);
 
 	/* Fourth validation with deltas that override each other */
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	check_serial(3);
 	check_base(3, iteration3_base);
 	check_deltas(0, 3, deltas_0to3_ovrd, false);
@@ -462,9 +499,130 @@ START_TEST(test_delta_ovrd)
 	check_deltas(3, 3, deltas_3to3_clean, true);
 
 	vrps_destroy();
+}
+END_TEST
 
-	/* Return to its initial value */
-	current_min_serial = 0;
+START_TEST(test_tal_failure)
+{
+	struct deltas_db deltas;
+	serial_t serial;
+	bool changed;
+	bool iterated_entries[12];
+
+	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
+
+	/* Third validation: The TAL fails, so its previous VRPs remain */
+	failing_iteration = 2;
+	ck_assert_int_eq(-EINVAL, vrps_update(NULL, &changed));
+	ck_assert_uint_eq(false, changed);
+	check_serial(1);
+	check_base(1, iteration1_base);
+	check_deltas(0, 1, deltas_0to1, false);
+
+	/* Fourth validation: The TAL recovers */
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
+	ck_assert_uint_eq(true, changed);
+	check_serial(2);
+	check_base(2, iteration3_base);
+
+	vrps_destroy();
+	failing_iteration = -1;
+}
+END_TEST
+
+static struct db_table *
+create_table(unsigned int roas)
+{
+	struct db_table *table;
+	struct ipv4_prefix prefix;
+	unsigned int i;
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+
+	for (i = 0; i < roas; i++) {
+		prefix.addr.s_addr = htonl(0x0A000000u + (i << 8));
+		prefix.len = 24;
+		ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 1, &prefix,
+		    24));
+	}
+
+	return table;
+}
+
+static void
+follow(unsigned int roas, serial_t serial, uint16_t session_id)
+{
+	struct snapshot_header hdr;
+
+	hdr.serial = serial;
+	hdr.v0_session_id = session_id;
+	hdr.v1_session_id = session_id - 1;
+	hdr.time = 0;
+	ck_assert_int_eq(0, vrps_follow(create_table(roas), &hdr));
+}
+
+static int
+vrp_count(struct vrp const *vrp, void *arg)
+{
+	(*((unsigned int *) arg))++;
+	return 0;
+}
+
+static void
+check_follower(serial_t serial, unsigned int roas)
+{
+	unsigned int count;
+
+	count = 0;
+	check_serial(serial);
+	ck_assert_int_eq(0, vrps_foreach_base(vrp_count, rk_fail, &count));
+	ck_assert_uint_eq(roas, count);
+}
+
+static void
+check_follower_deltas(serial_t from, serial_t to, unsigned int groups)
+{
+	struct deltas_db deltas;
+	serial_t actual;
+
+	deltas_db_init(&deltas);
+	ck_assert_int_eq(0, vrps_get_deltas_from(from, &actual, &deltas));
+	ck_assert_uint_eq(to, actual);
+	ck_assert_uint_eq(groups, deltas.len);
+}
+
+START_TEST(test_follow)
+{
+	ck_assert_int_eq(0, vrps_init());
+
+	follow(2, 5, 100);
+	check_follower(5, 2);
+	check_follower_deltas(5, 5, 0);
+
+	/* Same serial (the file was only touched) */
+	follow(3, 5, 100);
+	check_follower(5, 2);
+
+	/* Serial 6 was missed; 5 leads to 7 directly */
+	follow(3, 7, 100);
+	check_follower(7, 3);
+	check_follower_deltas(5, 7, 1);
+	check_no_deltas(6, 7);
+
+	/* Older serials are ignored */
+	follow(1, 6, 100);
+	check_follower(7, 3);
+
+	/* Another validator */
+	follow(1, 2, 200);
+	check_follower(2, 1);
+	check_follower_deltas(2, 2, 0);
+	check_no_deltas(7, 2);
+	ck_assert_uint_eq(200, get_current_session_id(0));
+	ck_assert_uint_eq(199, get_current_session_id(1));
+
+	vrps_destroy();
 }
 END_TEST
 
@@ -476,7 +634,10 @@ Suite *pdu_suite(void)
 	core = tcase_create("Core");
 	tcase_add_test(core, test_basic);
 	tcase_add_test(core, test_delta_forget);
+	tcase_add_test(core, test_delta_checkpoint_choice);
 	tcase_add_test(core, test_delta_ovrd);
+	tcase_add_test(core, test_tal_failure);
+	tcase_add_test(core, test_follow);
 
 	suite = suite_create("VRP Database");
 	suite_add_tcase(suite, core);
@@ -21,6 +21,7 @@
 #include "rtr/db/delta.c"
 #include "rtr/db/db_table.c"
 #include "rtr/db/rtr_db_impersonator.c"
+#include "rtr/db/snapshot.c"
 #include "rtr/db/vrps.c"
 #include "slurm/db_slurm.c"
 #include "slurm/slurm_loader.c"
@@ -73,11 +74,11 @@ init_db_full(void)
 {
 	bool changed;
 	ck_assert_int_eq(0, vrps_init());
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	ck_assert_uint_eq(true, changed);
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	ck_assert_uint_eq(true, changed);
-	ck_assert_int_eq(0, vrps_update(&changed));
+	ck_assert_int_eq(0, vrps_update(NULL, &changed));
 	ck_assert_uint_eq(true, changed);
 }
 
@@ -107,10 +108,9 @@ init_serial_query(struct rtr_request *request, struct serial_query_pdu *query,
 
 /* Impersonator functions */
 
-int
-clients_get_min_serial(serial_t *result)
+unsigned int
+clients_count_serial(serial_t serial)
 {
-	*result = 0;
 	return 0;
 }
 
@@ -426,6 +426,7 @@ START_TEST(test_bad_length)
 	struct rtr_request request;
 	struct serial_query_pdu client_pdu;
 	struct pdu_metadata const *meta;
+	struct pdu_stream stream;
 	unsigned char buf[BUF_SIZE];
 	int fd;
 
@@ -447,7 +448,8 @@ START_TEST(test_bad_length)
 	expected_pdu_add(PDU_TYPE_ERROR_REPORT);
 
 	/* Run and validate, before handling */
-	ck_assert_int_eq(-EINVAL, pdu_load(fd, NULL, &request, &meta));
+	pdu_stream_init(&stream, fd);
+	ck_assert_int_eq(-EINVAL, pdu_load(&stream, NULL, &request, &meta));
 	ck_assert_uint_eq(false, has_expected_pdus());
 
 	/* Clean up */
@@ -457,6 +459,47 @@ START_TEST(test_bad_length)
 }
 END_TEST
 
+START_TEST(test_pipelined)
+{
+#define BUF_SIZE 24 /* Two Serial Queries */
+	struct rtr_request request;
+	struct serial_query_pdu client_pdu;
+	struct serial_query_pdu *loaded;
+	struct pdu_metadata const *meta;
+	struct pdu_stream stream;
+	unsigned char buf[BUF_SIZE];
+	int fd;
+
+	pr_info("-- Pipelined --");
+
+	/* Both PDUs arrive in a single read() */
+	init_serial_query(&request, &client_pdu, 1);
+	ck_assert_int_eq(12, serialize_serial_query_pdu(&client_pdu, buf));
+	init_serial_query(&request, &client_pdu, 2);
+	ck_assert_int_eq(12, serialize_serial_query_pdu(&client_pdu, buf + 12));
+	fd = buffer2fd(buf, BUF_SIZE);
+	ck_assert_int_ge(fd, 0);
+	pdu_stream_init(&stream, fd);
+
+	ck_assert_int_eq(0, pdu_load(&stream, NULL, &request, &meta));
+	loaded = request.pdu;
+	ck_assert_uint_eq(PDU_TYPE_SERIAL_QUERY, loaded->header.pdu_type);
+	ck_assert_uint_eq(1, loaded->serial_number);
+	ck_assert_uint_eq(12, request.bytes_len);
+	ck_assert_uint_eq(true, pdu_stream_has_pdu(&stream));
+
+	ck_assert_int_eq(0, pdu_load(&stream, NULL, &request, &meta));
+	loaded = request.pdu;
+	ck_assert_uint_eq(2, loaded->serial_number);
+	ck_assert_uint_eq(false, pdu_stream_has_pdu(&stream));
+
+	ck_assert_int_eq(-EPIPE, pdu_load(&stream, NULL, &request, &meta));
+
+	close(fd);
+#undef BUF_SIZE
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -471,6 +514,7 @@ Suite *pdu_suite(void)
 	error = tcase_create("Unhappy path cases");
 	tcase_add_test(error, test_bad_session_id);
 	tcase_add_test(error, test_bad_length);
+	tcase_add_test(error, test_pipelined);
 
 	suite = suite_create("PDU Handler");
 	suite_add_tcase(suite, core);
@@ -78,6 +78,18 @@ send_error_report_pdu(int fd, uint8_t version, uint16_t code,
 	return 0;
 }
 
+struct db_table *
+db_table_create(void)
+{
+	return NULL;
+}
+
+void
+db_table_destroy(struct db_table *table)
+{
+	/* Nothing to destroy */
+}
+
 int
 rtrhandler_handle_roa_v4(struct db_table *table, uint32_t asn,
     struct ipv4_prefix const *prefix4, uint8_t max_length)
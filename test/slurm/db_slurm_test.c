@@ -0,0 +1,245 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "address.c"
+#include "common.c"
+#include "log.c"
+#include "impersonator.c"
+#include "crypto/base64.c"
+#include "slurm/db_slurm.c"
+
+static int
+add_filter4(struct db_slurm *db, bool has_asn, uint32_t asn, uint32_t addr,
+    uint8_t len)
+{
+	struct slurm_prefix filter;
+
+	memset(&filter, 0, sizeof(filter));
+	if (has_asn) {
+		filter.data_flag |= SLURM_COM_FLAG_ASN;
+		filter.vrp.asn = asn;
+	}
+	if (len != 255) {
+		filter.data_flag |= SLURM_PFX_FLAG_PREFIX;
+		filter.vrp.addr_fam = AF_INET;
+		filter.vrp.prefix.v4.s_addr = htonl(addr);
+		filter.vrp.prefix_length = len;
+	}
+
+	return db_slurm_add_prefix_filter(db, &filter, 1);
+}
+
+static void
+init_vrp4(struct vrp *vrp, uint32_t asn, uint32_t addr, uint8_t len)
+{
+	memset(vrp, 0, sizeof(*vrp));
+	vrp->asn = asn;
+	vrp->addr_fam = AF_INET;
+	vrp->prefix.v4.s_addr = htonl(addr);
+	vrp->prefix_length = len;
+	vrp->max_prefix_length = len;
+}
+
+/* The filters, the slow way. */
+static bool
+vrp_is_filtered_linear(struct db_slurm *db, struct vrp const *vrp)
+{
+	struct slurm_prefix slurm_prefix;
+
+	slurm_prefix.data_flag = SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX
+	    | SLURM_PFX_FLAG_MAX_LENGTH;
+	slurm_prefix.vrp = *vrp;
+
+	return prefix_filter_exists(db, &slurm_prefix, true, -1);
+}
+
+START_TEST(test_prefix_filters)
+{
+	struct db_slurm *db;
+	struct vrp vrp;
+
+	ck_assert_int_eq(0, db_slurm_create(&db));
+
+	/* 192.0.2.0/24 */
+	ck_assert_int_eq(0, add_filter4(db, false, 0, 0xC0000200, 24));
+	/* AS10, 203.0.113.0/24 */
+	ck_assert_int_eq(0, add_filter4(db, true, 10, 0xCB007100, 24));
+	/* AS11 */
+	ck_assert_int_eq(0, add_filter4(db, true, 11, 0, 255));
+
+	/* Covered by the prefix; any ASN */
+	init_vrp4(&vrp, 1, 0xC0000200, 24);
+	ck_assert(db_slurm_vrp_is_filtered(db, &vrp));
+	init_vrp4(&vrp, 1, 0xC0000280, 25);
+	ck_assert(db_slurm_vrp_is_filtered(db, &vrp));
+	/* Covers the prefix; not filtered */
+	init_vrp4(&vrp, 1, 0xC0000000, 16);
+	ck_assert(!db_slurm_vrp_is_filtered(db, &vrp));
+
+	/* ASN and prefix */
+	init_vrp4(&vrp, 10, 0xCB007180, 25);
+	ck_assert(db_slurm_vrp_is_filtered(db, &vrp));
+	init_vrp4(&vrp, 12, 0xCB007180, 25);
+	ck_assert(!db_slurm_vrp_is_filtered(db, &vrp));
+
+	/* ASN only */
+	init_vrp4(&vrp, 11, 0x0A000000, 8);
+	ck_assert(db_slurm_vrp_is_filtered(db, &vrp));
+
+	db_slurm_destroy(db);
+}
+END_TEST
+
+START_TEST(test_prefix_filters_random)
+{
+	struct db_slurm *db;
+	struct vrp vrp;
+	unsigned int i;
+	uint8_t len;
+	int error;
+
+	ck_assert_int_eq(0, db_slurm_create(&db));
+
+	/* A small space, so there are plenty of collisions */
+	srandom(1);
+	for (i = 0; i < 200; i++) {
+		len = 8 + random() % 17;
+		error = add_filter4(db, random() % 2, random() % 50,
+		    (0xC0000000 | (random() & 0xFFFF00)) &
+		    ~((1u << (32 - len)) - 1), len);
+		/* Duplicates are rejected */
+		ck_assert(error == 0 || error == -EEXIST);
+	}
+
+	for (i = 0; i < 100000; i++) {
+		len = 8 + random() % 25;
+		init_vrp4(&vrp, random() % 50,
+		    (0xC0000000 | (random() & 0xFFFFFF)) &
+		    ~(len == 32 ? 0 : ((1u << (32 - len)) - 1)), len);
+		ck_assert_int_eq(vrp_is_filtered_linear(db, &vrp),
+		    db_slurm_vrp_is_filtered(db, &vrp));
+	}
+
+	db_slurm_destroy(db);
+}
+END_TEST
+
+START_TEST(test_prefix_filters_v6)
+{
+	struct slurm_prefix filter;
+	struct db_slurm *db;
+	struct vrp vrp;
+
+	ck_assert_int_eq(0, db_slurm_create(&db));
+
+	memset(&filter, 0, sizeof(filter));
+	filter.data_flag = SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX;
+	filter.vrp.asn = 10;
+	filter.vrp.addr_fam = AF_INET6;
+	in6_addr_init(&filter.vrp.prefix.v6, 0x20010DB8u, 0, 0, 0);
+	filter.vrp.prefix_length = 32;
+	ck_assert_int_eq(0, db_slurm_add_prefix_filter(db, &filter, 1));
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = 10;
+	vrp.addr_fam = AF_INET6;
+	in6_addr_init(&vrp.prefix.v6, 0x20010DB8u, 0x12340000u, 0, 0);
+	vrp.prefix_length = 48;
+	vrp.max_prefix_length = 48;
+	ck_assert(db_slurm_vrp_is_filtered(db, &vrp));
+
+	/* Same address, other family */
+	vrp.addr_fam = AF_INET;
+	vrp.prefix.v4.s_addr = htonl(0x20010DB8u);
+	vrp.prefix_length = 32;
+	vrp.max_prefix_length = 32;
+	ck_assert(!db_slurm_vrp_is_filtered(db, &vrp));
+
+	db_slurm_destroy(db);
+}
+END_TEST
+
+static void
+add_bgpsec_filter(struct db_slurm *db, uint8_t data_flag, uint32_t asn,
+    unsigned char ski_byte)
+{
+	struct slurm_bgpsec filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.data_flag = data_flag;
+	filter.asn = asn;
+	if (data_flag & SLURM_BGPS_FLAG_SKI) {
+		filter.ski = malloc(RK_SKI_LEN);
+		ck_assert_ptr_ne(NULL, filter.ski);
+		memset(filter.ski, ski_byte, RK_SKI_LEN);
+	}
+
+	ck_assert_int_eq(0, db_slurm_add_bgpsec_filter(db, &filter, 1));
+}
+
+static bool
+key_is_filtered(struct db_slurm *db, uint32_t asn, unsigned char ski_byte)
+{
+	struct router_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.as = asn;
+	memset(key.ski, ski_byte, RK_SKI_LEN);
+	return db_slurm_bgpsec_is_filtered(db, &key);
+}
+
+START_TEST(test_bgpsec_filters)
+{
+	struct db_slurm *db;
+
+	ck_assert_int_eq(0, db_slurm_create(&db));
+
+	add_bgpsec_filter(db, SLURM_COM_FLAG_ASN, 10, 0);
+	add_bgpsec_filter(db, SLURM_BGPS_FLAG_SKI, 0, 0xAA);
+	add_bgpsec_filter(db, SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI, 20,
+	    0xBB);
+
+	ck_assert(key_is_filtered(db, 10, 0x01));
+	ck_assert(key_is_filtered(db, 30, 0xAA));
+	ck_assert(key_is_filtered(db, 20, 0xBB));
+	ck_assert(!key_is_filtered(db, 21, 0xBB));
+	ck_assert(!key_is_filtered(db, 20, 0xBC));
+
+	db_slurm_destroy(db);
+}
+END_TEST
+
+Suite *db_slurm_suite(void)
+{
+	Suite *suite;
+	TCase *prefix, *bgpsec;
+
+	prefix = tcase_create("Prefix filters");
+	tcase_add_test(prefix, test_prefix_filters);
+	tcase_add_test(prefix, test_prefix_filters_random);
+	tcase_add_test(prefix, test_prefix_filters_v6);
+
+	bgpsec = tcase_create("BGPsec filters");
+	tcase_add_test(bgpsec, test_bgpsec_filters);
+
+	suite = suite_create("SLURM DB");
+	suite_add_tcase(suite, prefix);
+	suite_add_tcase(suite, bgpsec);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = db_slurm_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
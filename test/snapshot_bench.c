@@ -0,0 +1,149 @@
+/*
+ * Compares the cost of exporting the VRPs as CSV (output.roa) against the
+ * binary snapshot (server.state-file), and of reading the snapshot back,
+ * through mmap() alone and into a table.
+ *
+ * Usage: ./snapshot.bench [VRPs [directory]]
+ * Default: 500000 VRPs (one in five of them IPv6), in /tmp.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "address.c"
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "output_printer.c"
+#include "object/router_key.c"
+#include "rtr/db/delta.c"
+#include "rtr/db/db_table.c"
+#include "rtr/db/snapshot.c"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct db_table *
+create_table(unsigned long count)
+{
+	struct db_table *table;
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	unsigned long i;
+	int error;
+
+	table = db_table_create();
+	if (table == NULL)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < count; i++) {
+		if (i % 5 != 4) {
+			prefix4.addr.s_addr = htonl(0x0A000000u + (i << 8));
+			prefix4.len = 24;
+			error = rtrhandler_handle_roa_v4(table, 64496 + i % 1024,
+			    &prefix4, 24 + i % 9);
+		} else {
+			in6_addr_init(&prefix6.addr, 0x20010DB8u, i, 0, 0);
+			prefix6.len = 48;
+			error = rtrhandler_handle_roa_v6(table, 64496 + i % 1024,
+			    &prefix6, 48 + i % 17);
+		}
+		if (error)
+			exit(EXIT_FAILURE);
+	}
+
+	return table;
+}
+
+static long
+file_size(char const *path)
+{
+	struct stat st;
+	return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+static void
+print_result(char const *what, double start, char const *path)
+{
+	printf("%-24s %10.1f", what, (now() - start) * 1e3);
+	if (path != NULL)
+		printf(" %12ld", file_size(path));
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct snapshot_header hdr;
+	struct mapped_snapshot snapshot;
+	struct output_job job;
+	struct db_table *table;
+	struct db_table *loaded;
+	char csv_path[4096];
+	char json_path[4096];
+	char bin_path[4096];
+	char const *dir;
+	unsigned long count;
+	double start;
+
+	count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 500000;
+	dir = (argc > 2) ? argv[2] : "/tmp";
+	snprintf(csv_path, sizeof(csv_path), "%s/fort_bench.csv", dir);
+	snprintf(json_path, sizeof(json_path), "%s/fort_bench.json", dir);
+	snprintf(bin_path, sizeof(bin_path), "%s/fort_bench.bin", dir);
+
+	table = create_table(count);
+	printf("%u VRPs\n", db_table_roa_count(table));
+	printf("%-24s %10s %12s\n", "", "Time (ms)", "Size (bytes)");
+
+	hdr.serial = 1;
+	hdr.v0_session_id = 1;
+	hdr.v1_session_id = 0;
+	hdr.time = time(NULL);
+
+	start = now();
+	job.hdr = hdr;
+	if (snapshot_records_init(&job.records, table) != 0)
+		return EXIT_FAILURE;
+	print_file(csv_path, print_roas, &job);
+	snapshot_records_cleanup(&job.records);
+	print_result("CSV write", start, csv_path);
+
+	start = now();
+	if (snapshot_records_init(&job.records, table) != 0)
+		return EXIT_FAILURE;
+	print_file(json_path, print_json, &job);
+	snapshot_records_cleanup(&job.records);
+	print_result("JSON write", start, json_path);
+
+	start = now();
+	if (snapshot_write(bin_path, &hdr, table) != 0)
+		return EXIT_FAILURE;
+	print_result("Binary write (+fsync)", start, bin_path);
+
+	start = now();
+	if (snapshot_map(bin_path, &snapshot) != 0)
+		return EXIT_FAILURE;
+	print_result("Binary map (+checksum)", start, NULL);
+	snapshot_unmap(&snapshot);
+
+	start = now();
+	if (snapshot_load(bin_path, &hdr, &loaded) != 0)
+		return EXIT_FAILURE;
+	print_result("Binary load into table", start, NULL);
+
+	db_table_destroy(loaded);
+	db_table_destroy(table);
+	remove(csv_path);
+	remove(json_path);
+	remove(bin_path);
+	return EXIT_SUCCESS;
+}
@@ -98,6 +98,146 @@ db_rrdp_rem_nonvisited_tals(void)
 	/* Empty */
 }
 
+int
+object_store_purge(void)
+{
+	return 0;
+}
+
+int
+rrdp_generation_cleanup(void)
+{
+	return 0;
+}
+
+/* Is the host of the TA backing off? */
+static bool host_down;
+
+/* Same as the real ones; they need a validation state to postpone */
+static int
+postpone(void)
+{
+	return (state_retrieve() != NULL) ? -EAGAIN : -EINVAL;
+}
+
+int
+fetch_scheduler_request(struct rpki_uri *uri, unsigned int retry_count)
+{
+	return host_down ? postpone() : 0;
+}
+
+void
+fetch_scheduler_success(struct rpki_uri *uri)
+{
+	host_down = false;
+}
+
+time_t
+fetch_scheduler_record_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count)
+{
+	host_down = true;
+	return time(NULL) + interval;
+}
+
+int
+fetch_scheduler_failure(struct rpki_uri *uri, unsigned int interval,
+    unsigned int retry_count, int error)
+{
+	fetch_scheduler_record_failure(uri, interval, retry_count);
+	return postpone();
+}
+
+bool
+fetch_scheduler_is_down(struct rpki_uri *uri)
+{
+	return host_down;
+}
+
+int
+create_dir_recursive(char const *path)
+{
+	return 0;
+}
+
+int
+rsync_pool_init(void)
+{
+	return 0;
+}
+
+void
+rsync_pool_destroy(void)
+{
+	/* Empty */
+}
+
+bool
+rsync_pool_enabled(void)
+{
+	return false;
+}
+
+int
+rsync_pool_submit(struct rpki_uri *uri, rsync_pool_cb cb, void *arg)
+{
+	return -EINVAL;
+}
+
+void
+rsync_pool_wait(void)
+{
+	/* Empty */
+}
+
+time_t
+validation_pop_retry(struct validation *state)
+{
+	return 0;
+}
+
+int
+changeset_add_file(char const *uri)
+{
+	return 0;
+}
+
+int
+changeset_add_tree(char const *uri, size_t len)
+{
+	return 0;
+}
+
+void
+rpp_cache_new_cycle(void)
+{
+	/* Empty */
+}
+
+void
+rpp_cache_purge(void)
+{
+	/* Empty */
+}
+
+int
+http_download_file(struct rpki_uri *uri, http_write_cb cb)
+{
+	return -EINVAL;
+}
+
+void
+metrics_now(struct timespec *now)
+{
+	memset(now, 0, sizeof(*now));
+}
+
+void
+metrics_fetch(struct rpki_uri *uri, struct timespec const *start, bool error)
+{
+	/* Empty */
+}
+
 START_TEST(tal_load_normal)
 {
 	struct tal *tal;
@@ -149,16 +289,36 @@ START_TEST(tal_load_normal)
 }
 END_TEST
 
+/* The change checks poll from a thread that has no validation state */
+START_TEST(tal_poll_ta_backing_off)
+{
+	static char const *TA = "rsync://potato/ta.cer";
+	struct rpki_uri *uri;
+
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, TA, strlen(TA)));
+	ck_assert_ptr_eq(NULL, state_retrieve());
+
+	host_down = true;
+	ck_assert_int_eq(-EAGAIN, download_ta(uri));
+
+	uri_refput(uri);
+}
+END_TEST
+
 Suite *tal_load_suite(void)
 {
 	Suite *suite;
-	TCase *core;
+	TCase *core, *poll;
 
 	core = tcase_create("Core");
 	tcase_add_test(core, tal_load_normal);
 
+	poll = tcase_create("Poll");
+	tcase_add_test(poll, tal_poll_ta_backing_off);
+
 	suite = suite_create("lfile_read()");
 	suite_add_tcase(suite, core);
+	suite_add_tcase(suite, poll);
 	return suite;
 }
 
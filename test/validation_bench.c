@@ -0,0 +1,384 @@
+/*
+ * Runs full validations (standalone mode, work-offline) against a captured
+ * local repository and TAL directory, and reports what they cost: wall time,
+ * CPU time, peak RSS, objects per second, and the time of each phase (see
+ * metrics.h). The medians (maximum, for the RSS) are then compared against a
+ * baseline file, if there's one; any of them growing more than the tolerance
+ * is reported as a regression, and the exit status is 2.
+ *
+ * Since no repository is contacted, the runs only differ by the code being
+ * measured: certificate_traverse(), hashing, table construction and so on.
+ *
+ * Usage: ./validation.bench [-n runs] [-b baseline] [-t tolerance%] [-s]
+ *            <fort> <TAL directory> <repository> [fort arguments...]
+ * Default: 5 runs, no baseline, 10% tolerance. -s writes the results into the
+ * baseline file, rather than comparing.
+ *
+ * `make bench` runs it; see test/Makefile.am.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS 100
+#define MAX_ARGS 64
+
+enum result_field {
+	WALL,
+	CPU,
+	RSS,
+	VALIDATION,
+	PUBLISH,
+	EXPORT,
+	FIELD_COUNT,
+};
+
+/* As written in the baseline file */
+static char const *const field_names[] = {
+	[WALL] = "wall",
+	[CPU] = "cpu",
+	[RSS] = "rss",
+	[VALIDATION] = "validation",
+	[PUBLISH] = "publish",
+	[EXPORT] = "export",
+};
+
+struct run {
+	double fields[FIELD_COUNT];
+	unsigned long vrps;
+	unsigned long router_keys;
+};
+
+static unsigned long objects;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+tv2double(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static int
+count_object(char const *path, struct stat const *st, int type,
+    struct FTW *ftw)
+{
+	static char const *const extensions[] = {
+	    ".cer", ".crl", ".mft", ".roa", ".gbr", ".asa", NULL
+	};
+	char const *dot;
+	unsigned int i;
+
+	if (type != FTW_F)
+		return 0;
+
+	dot = strrchr(path, '.');
+	if (dot == NULL)
+		return 0;
+	for (i = 0; extensions[i] != NULL; i++)
+		if (strcmp(dot, extensions[i]) == 0)
+			objects++;
+	return 0;
+}
+
+/* Picks the numbers up from the summary of vrps_update(). */
+static void
+parse_line(char const *line, struct run *run)
+{
+	char const *found;
+
+	found = strstr(line, "- Valid Prefixes: ");
+	if (found != NULL)
+		sscanf(found, "- Valid Prefixes: %lu", &run->vrps);
+	found = strstr(line, "- Valid Router Keys: ");
+	if (found != NULL)
+		sscanf(found, "- Valid Router Keys: %lu", &run->router_keys);
+	found = strstr(line, "- Phase times: ");
+	if (found != NULL)
+		sscanf(found, "- Phase times: validation %lf, publish %lf, export %lf",
+		    &run->fields[VALIDATION], &run->fields[PUBLISH],
+		    &run->fields[EXPORT]);
+}
+
+static int
+run_fort(char **args, struct run *run)
+{
+	struct rusage usage;
+	char line[4096];
+	double start;
+	FILE *output;
+	pid_t pid;
+	int fds[2];
+	int status;
+
+	memset(run, 0, sizeof(*run));
+
+	if (pipe(fds) == -1)
+		return errno;
+
+	start = now();
+	pid = fork();
+	if (pid == -1) {
+		close(fds[0]);
+		close(fds[1]);
+		return errno;
+	}
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execv(args[0], args);
+		fprintf(stderr, "Could not run '%s': %s\n", args[0],
+		    strerror(errno));
+		_exit(127);
+	}
+
+	close(fds[1]);
+	output = fdopen(fds[0], "r");
+	if (output == NULL) {
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+		return errno;
+	}
+	while (fgets(line, sizeof(line), output) != NULL)
+		parse_line(line, run);
+	fclose(output);
+
+	if (wait4(pid, &status, 0, &usage) == -1)
+		return errno;
+	run->fields[WALL] = now() - start;
+	run->fields[CPU] = tv2double(&usage.ru_utime) +
+	    tv2double(&usage.ru_stime);
+	/* Kilobytes on Linux and the BSDs */
+	run->fields[RSS] = usage.ru_maxrss;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Fort failed (status %d); run it by hand to see why.\n",
+		    status);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static int
+cmp_double(void const *a, void const *b)
+{
+	double x = *(double const *) a;
+	double y = *(double const *) b;
+	return (x > y) - (x < y);
+}
+
+/* The median of each field; the maximum of the RSS. */
+static void
+summarize(struct run *runs, unsigned int count, double *result)
+{
+	double values[MAX_RUNS];
+	unsigned int f, i;
+
+	for (f = 0; f < FIELD_COUNT; f++) {
+		for (i = 0; i < count; i++)
+			values[i] = runs[i].fields[f];
+		qsort(values, count, sizeof(double), cmp_double);
+		if (f == RSS)
+			result[f] = values[count - 1];
+		else if (count % 2 == 1)
+			result[f] = values[count / 2];
+		else
+			result[f] = (values[count / 2 - 1] +
+			    values[count / 2]) / 2;
+	}
+}
+
+static int
+save_baseline(char const *path, double *summary)
+{
+	FILE *file;
+	unsigned int f;
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not write '%s': %s\n", path,
+		    strerror(errno));
+		return 1;
+	}
+	for (f = 0; f < FIELD_COUNT; f++)
+		fprintf(file, "%s %f\n", field_names[f], summary[f]);
+	fclose(file);
+
+	printf("Baseline saved to '%s'.\n", path);
+	return 0;
+}
+
+static int
+compare_baseline(char const *path, double *summary, double tolerance)
+{
+	double baseline[FIELD_COUNT];
+	bool found[FIELD_COUNT] = { false };
+	char name[32];
+	double value;
+	double change;
+	FILE *file;
+	unsigned int f;
+	int regressions;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		printf("No baseline at '%s'; run with -s (BENCH_SAVE=1) to create it.\n",
+		    path);
+		return 0;
+	}
+	while (fscanf(file, "%31s %lf", name, &value) == 2) {
+		for (f = 0; f < FIELD_COUNT; f++) {
+			if (strcmp(name, field_names[f]) == 0) {
+				baseline[f] = value;
+				found[f] = true;
+			}
+		}
+	}
+	fclose(file);
+
+	printf("\nAgainst '%s' (tolerance %.0f%%):\n", path, tolerance * 100);
+	regressions = 0;
+	for (f = 0; f < FIELD_COUNT; f++) {
+		if (!found[f] || baseline[f] <= 0)
+			continue;
+		change = summary[f] / baseline[f] - 1;
+		/* Sub-10ms phases are mostly noise */
+		if (f != RSS && summary[f] < 0.01 && baseline[f] < 0.01)
+			change = 0;
+		printf("  %-10s %12.3f -> %12.3f  %+6.1f%%%s\n", field_names[f],
+		    baseline[f], summary[f], change * 100,
+		    (change > tolerance) ? "  REGRESSION" : "");
+		if (change > tolerance)
+			regressions++;
+	}
+
+	return regressions > 0 ? 2 : 0;
+}
+
+static void
+usage(char const *program)
+{
+	fprintf(stderr, "Usage: %s [-n runs] [-b baseline] [-t tolerance%%] [-s] <fort> <TAL directory> <repository> [fort arguments...]\n",
+	    program);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct run runs[MAX_RUNS];
+	char *args[MAX_ARGS];
+	char tal_arg[4096];
+	char repo_arg[4096];
+	char const *baseline;
+	double summary[FIELD_COUNT];
+	double tolerance;
+	unsigned int count, i;
+	unsigned int nargs;
+	bool save;
+	int opt;
+	int error;
+
+	count = 5;
+	baseline = NULL;
+	tolerance = 0.10;
+	save = false;
+
+	while ((opt = getopt(argc, argv, "n:b:t:s")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = strtod(optarg, NULL) / 100;
+			break;
+		case 's':
+			save = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind < 3 || count < 1 || count > MAX_RUNS ||
+	    (save && baseline == NULL)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (argc - optind - 3 > MAX_ARGS - 8) {
+		fprintf(stderr, "Too many Fort arguments.\n");
+		return 1;
+	}
+
+	if (nftw(argv[optind + 2], count_object, 64, FTW_PHYS) != 0) {
+		fprintf(stderr, "Could not walk '%s': %s\n", argv[optind + 2],
+		    strerror(errno));
+		return 1;
+	}
+
+	snprintf(tal_arg, sizeof(tal_arg), "--tal=%s", argv[optind + 1]);
+	snprintf(repo_arg, sizeof(repo_arg), "--local-repository=%s",
+	    argv[optind + 2]);
+	nargs = 0;
+	args[nargs++] = argv[optind];
+	args[nargs++] = "--mode=standalone";
+	args[nargs++] = "--work-offline";
+	args[nargs++] = "--log.level=info";
+	args[nargs++] = "--log.output=console";
+	args[nargs++] = tal_arg;
+	args[nargs++] = repo_arg;
+	for (i = optind + 3; i < argc; i++)
+		args[nargs++] = argv[i];
+	args[nargs] = NULL;
+
+	printf("%lu objects in '%s'.\n\n", objects, argv[optind + 2]);
+	printf("Run     Wall(s)    CPU(s)   RSS(MiB)   Objects/s   Validation(s) Publish(s) Export(s)   VRPs\n");
+	for (i = 0; i < count; i++) {
+		error = run_fort(args, &runs[i]);
+		if (error) {
+			fprintf(stderr, "Run %u failed: %s\n", i + 1,
+			    strerror(error));
+			return 1;
+		}
+		printf("%3u %11.3f %9.3f %10.1f %11.0f %15.3f %10.3f %9.3f %6lu\n",
+		    i + 1, runs[i].fields[WALL], runs[i].fields[CPU],
+		    runs[i].fields[RSS] / 1024,
+		    objects / runs[i].fields[WALL],
+		    runs[i].fields[VALIDATION], runs[i].fields[PUBLISH],
+		    runs[i].fields[EXPORT], runs[i].vrps);
+	}
+
+	summarize(runs, count, summary);
+	printf("Med %11.3f %9.3f %10.1f %11.0f %15.3f %10.3f %9.3f\n",
+	    summary[WALL], summary[CPU], summary[RSS] / 1024,
+	    objects / summary[WALL], summary[VALIDATION], summary[PUBLISH],
+	    summary[EXPORT]);
+	printf("(The RSS is the maximum.)\n");
+
+	if (baseline == NULL)
+		return 0;
+	return save
+	    ? save_baseline(baseline, summary)
+	    : compare_baseline(baseline, summary, tolerance);
+}
@@ -1,11 +1,13 @@
 #include <check.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <libxml/xmlreader.h>
 #include "impersonator.c"
 #include "log.c"
 #include "xml/relax_ng.c"
+#include "xml/rrdp_structure.c"
 
 struct reader_ctx {
 	unsigned int delta_count;
@@ -74,16 +76,229 @@ START_TEST(relax_ng_valid)
 }
 END_TEST
 
+static int
+count_cb(xmlTextReaderPtr reader, void *arg)
+{
+	unsigned int *count = arg;
+
+	if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT)
+		(*count)++;
+
+	return 0;
+}
+
+/*
+ * Parses @path with both validators, and checks they agree (Relax NG is the
+ * reference). Returns the result of the Relax NG parse.
+ */
+static int
+differential_parse(char const *path)
+{
+	unsigned int rng_count, structural_count;
+	int rng_error, structural_error;
+
+	rng_count = 0;
+	structural_count = 0;
+	rng_error = relax_ng_parse(path, count_cb, &rng_count);
+	structural_error = rrdp_structure_parse(path, count_cb,
+	    &structural_count);
+
+	ck_assert_msg((rng_error == 0) == (structural_error == 0),
+	    "Validators disagree on '%s': relax-ng=%d, structural=%d", path,
+	    rng_error, structural_error);
+	if (rng_error == 0)
+		ck_assert_uint_eq(rng_count, structural_count);
+
+	return rng_error;
+}
+
+/* Writes @content to a new temporal file, whose name is set at @path */
+static void
+write_tmp_file(char *path, char const *content)
+{
+	size_t len;
+	int fd;
+
+	strcpy(path, "/tmp/fort_xml_test_XXXXXX");
+	fd = mkstemp(path);
+	ck_assert_int_ne(fd, -1);
+	len = strlen(content);
+	ck_assert_int_eq(write(fd, content, len), len);
+	close(fd);
+}
+
+static int
+differential_parse_str(char const *content)
+{
+	char path[32];
+	int error;
+
+	write_tmp_file(path, content);
+	error = differential_parse(path);
+	unlink(path);
+
+	return error;
+}
+
+START_TEST(structural_corpus)
+{
+	relax_ng_init();
+	ck_assert_int_eq(differential_parse("xml/notification.xml"), 0);
+	ck_assert_int_eq(differential_parse("xml/snapshot.xml"), 0);
+	ck_assert_int_eq(differential_parse("xml/delta.xml"), 0);
+	relax_ng_cleanup();
+}
+END_TEST
+
+#define NS "xmlns=\"http://www.ripe.net/rpki/rrdp\""
+#define GLOBAL "version=\"1\" session_id=\"9df4b597\" serial=\"3\" " NS
+#define HASH "hash=\"0123456789abcdefABCDEF\""
+#define SNAPSHOT_REF "<snapshot uri=\"https://a/s.xml\" " HASH "/>"
+#define DELTA_REF "<delta serial=\"3\" uri=\"https://a/d.xml\" " HASH "/>"
+#define PUBLISH(content) "<publish uri=\"rsync://a/b.cer\">" content \
+	"</publish>"
+#define WITHDRAW "<withdraw uri=\"rsync://a/c.cer\" " HASH "/>"
+
+static char const *generated_valid[] = {
+	"<notification " GLOBAL ">" SNAPSHOT_REF "</notification>",
+	"<notification " GLOBAL ">\n " SNAPSHOT_REF "\n " DELTA_REF
+	    DELTA_REF "<!-- comment -->\n</notification>",
+	"<snapshot " GLOBAL "/>",
+	"<snapshot " GLOBAL ">" PUBLISH("QUJD") PUBLISH("\n QUI=\n ")
+	    PUBLISH("QQ==") PUBLISH("") "</snapshot>",
+	"<delta " GLOBAL ">" WITHDRAW "</delta>",
+	"<delta " GLOBAL ">" PUBLISH("QUJD") WITHDRAW
+	    "<publish uri=\"rsync://a/b.cer\" " HASH ">QUJD</publish>"
+	    "</delta>",
+	"<delta version=\"1\" session_id=\"-\" serial=\"+0012\" " NS ">"
+	    WITHDRAW "</delta>",
+	NULL,
+};
+
+static char const *generated_invalid[] = {
+	/* Unknown root */
+	"<notifications " GLOBAL ">" SNAPSHOT_REF "</notifications>",
+	"<publish uri=\"rsync://a/b.cer\" " NS ">QUJD</publish>",
+	/* Namespace */
+	"<snapshot version=\"1\" session_id=\"9df4b597\" serial=\"3\"/>",
+	"<snapshot " GLOBAL "><publish xmlns=\"urn:x\" uri=\"rsync://a\">"
+	    "QUJD</publish></snapshot>",
+	/* Element order */
+	"<notification " GLOBAL "/>",
+	"<notification " GLOBAL ">" DELTA_REF "</notification>",
+	"<notification " GLOBAL ">" DELTA_REF SNAPSHOT_REF "</notification>",
+	"<notification " GLOBAL ">" SNAPSHOT_REF SNAPSHOT_REF
+	    "</notification>",
+	"<notification " GLOBAL ">" SNAPSHOT_REF PUBLISH("QUJD")
+	    "</notification>",
+	"<snapshot " GLOBAL ">" WITHDRAW "</snapshot>",
+	"<delta " GLOBAL "/>",
+	"<delta " GLOBAL "></delta>",
+	"<delta " GLOBAL ">" DELTA_REF "</delta>",
+	"<snapshot " GLOBAL "><publish uri=\"rsync://a/b.cer\">"
+	    PUBLISH("QUJD") "</publish></snapshot>",
+	"<delta " GLOBAL "><withdraw uri=\"rsync://a/c.cer\" " HASH ">"
+	    "QUJD</withdraw></delta>",
+	/* Attributes */
+	"<snapshot version=\"2\" session_id=\"9df4b597\" serial=\"3\" "
+	    NS "/>",
+	"<snapshot version=\"0\" session_id=\"9df4b597\" serial=\"3\" "
+	    NS "/>",
+	"<snapshot session_id=\"9df4b597\" serial=\"3\" " NS "/>",
+	"<snapshot version=\"1\" serial=\"3\" " NS "/>",
+	"<snapshot version=\"1\" session_id=\"9df4b597\" " NS "/>",
+	"<snapshot version=\"1\" session_id=\"xyz\" serial=\"3\" " NS
+	    "/>",
+	"<snapshot version=\"1\" session_id=\"\" serial=\"3\" " NS "/>",
+	"<snapshot version=\"1\" session_id=\"9df4b597\" serial=\"0\" "
+	    NS "/>",
+	"<snapshot version=\"1\" session_id=\"9df4b597\" serial=\"-3\" "
+	    NS "/>",
+	"<snapshot version=\"1\" session_id=\"9df4b597\" serial=\"3a\" "
+	    NS "/>",
+	"<snapshot " GLOBAL " potato=\"1\"/>",
+	"<notification " GLOBAL "><snapshot uri=\"https://a/s.xml\"/>"
+	    "</notification>",
+	"<notification " GLOBAL "><snapshot uri=\"https://a/s.xml\" "
+	    "hash=\"xyz\"/></notification>",
+	"<notification " GLOBAL "><snapshot uri=\"https://a/s.xml\" "
+	    "hash=\"\"/></notification>",
+	"<notification " GLOBAL ">" SNAPSHOT_REF "<delta uri=\"https://a/d\" "
+	    HASH "/></notification>",
+	"<snapshot " GLOBAL "><publish>QUJD</publish></snapshot>",
+	"<snapshot " GLOBAL "><publish uri=\"rsync://a/b.cer\" " HASH ">"
+	    "QUJD</publish></snapshot>",
+	"<delta " GLOBAL "><withdraw uri=\"rsync://a/c.cer\"/></delta>",
+	"<delta " GLOBAL "><withdraw " HASH "/></delta>",
+	/* Content */
+	"<notification " GLOBAL ">potato" SNAPSHOT_REF "</notification>",
+	"<snapshot " GLOBAL ">" PUBLISH("QUJ") "</snapshot>",
+	"<snapshot " GLOBAL ">" PUBLISH("QU=D") "</snapshot>",
+	"<snapshot " GLOBAL ">" PUBLISH("Q===") "</snapshot>",
+	"<snapshot " GLOBAL ">" PUBLISH("QUJDRA=") "</snapshot>",
+	NULL,
+};
+
+/*
+ * libxml2 silently skips characters outside of the base64 alphabet, so these
+ * are only rejected by the structural validator.
+ */
+static char const *generated_stricter[] = {
+	"<snapshot " GLOBAL ">" PUBLISH("QU$JD") "</snapshot>",
+	"<delta " GLOBAL ">" PUBLISH("QUJD-") "</delta>",
+	NULL,
+};
+
+START_TEST(structural_generated)
+{
+	char const **doc;
+
+	relax_ng_init();
+	for (doc = generated_valid; *doc != NULL; doc++)
+		ck_assert_msg(differential_parse_str(*doc) == 0,
+		    "Rejected valid document: %s", *doc);
+	for (doc = generated_invalid; *doc != NULL; doc++)
+		ck_assert_msg(differential_parse_str(*doc) != 0,
+		    "Accepted invalid document: %s", *doc);
+	relax_ng_cleanup();
+}
+END_TEST
+
+START_TEST(structural_stricter)
+{
+	char const **doc;
+	char path[32];
+	unsigned int count;
+
+	relax_ng_init();
+	for (doc = generated_stricter; *doc != NULL; doc++) {
+		write_tmp_file(path, *doc);
+		count = 0;
+		ck_assert_int_eq(relax_ng_parse(path, count_cb, &count), 0);
+		ck_assert_int_ne(rrdp_structure_parse(path, count_cb, &count),
+		    0);
+		unlink(path);
+	}
+	relax_ng_cleanup();
+}
+END_TEST
+
 Suite *xml_load_suite(void)
 {
 	Suite *suite;
-	TCase *validate;
+	TCase *validate, *structural;
 
 	validate = tcase_create("Validate");
 	tcase_add_test(validate, relax_ng_valid);
 
+	structural = tcase_create("Structural");
+	tcase_add_test(structural, structural_corpus);
+	tcase_add_test(structural, structural_generated);
+	tcase_add_test(structural, structural_stricter);
+
 	suite = suite_create("xml_test()");
 	suite_add_tcase(suite, validate);
+	suite_add_tcase(suite, structural);
 
 	return suite;
 }